@@ -17,6 +17,10 @@ COMPONENT_SRCDIRS := \
 	flatbuffers/src \
 	src
 
+# Host (server) only TLS backends
+COMPONENT_OBJEXCLUDE := \
+	src/openssl_tls_connection.o
+
 CXXFLAGS += \
 	-DFLATBUFFERS_NO_ABSOLUTE_PATH_RESOLUTION \
 	-DPICOJSON_USE_INT64=1
@@ -0,0 +1,1012 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "flatbuffers_json_builder.h"
+
+#include "esp_log.h"
+
+#include <cstdlib>
+#include <string>
+#include <type_traits>
+
+constexpr char FlatbuffersJsonBuilder::TAG[];
+
+template<typename T>
+T
+default_value(const reflection::Field* field, T)
+{
+  return std::is_floating_point<T>::value?
+    static_cast<T>(field->default_real()) :
+    static_cast<T>(field->default_integer());
+}
+
+FlatbuffersJsonBuilder::FlatbuffersJsonBuilder(const reflection::Schema* _schema)
+: schema(_schema)
+{
+}
+
+bool
+FlatbuffersJsonBuilder::set_schema(
+  const reflection::Schema* _schema,
+  const FlatbuffersTableIndex* _table_index
+)
+{
+  schema = _schema;
+  table_index = _table_index;
+
+  clear();
+
+  return (schema != nullptr);
+}
+
+bool
+FlatbuffersJsonBuilder::start(const reflection::Object* root_table)
+{
+  clear();
+  root = root_table;
+
+  if (schema == nullptr || root == nullptr || root->is_struct())
+  {
+    return fail("Invalid root table");
+  }
+
+  return true;
+}
+
+bool
+FlatbuffersJsonBuilder::start(
+  const reflection::Object* root_table,
+  std::experimental::string_view key
+)
+{
+  if (start(root_table))
+  {
+    if (is_keyed(root))
+    {
+      return start_keyed_element(root, key);
+    }
+    else {
+      return (push_table(root, true) && this->key(key));
+    }
+  }
+
+  return false;
+}
+
+void
+FlatbuffersJsonBuilder::clear()
+{
+  // Retains allocated capacity for the next buffer
+  fbb.Clear();
+
+  frames.clear();
+  values.clear();
+  struct_bytes.clear();
+
+  complete = false;
+  error = false;
+}
+
+bool
+FlatbuffersJsonBuilder::set_null()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  // Leave the field unset (i.e. use the default), but still count the value
+  if (!frames.empty() && frames.back().kind == TableFrame)
+  {
+    return add_value(Value());
+  }
+  else if (!frames.empty() && frames.back().kind == SkipFrame)
+  {
+    return true;
+  }
+
+  return fail("Unexpected null");
+}
+
+bool
+FlatbuffersJsonBuilder::set_bool(bool b)
+{
+  Value value;
+  value.kind = ScalarValue;
+  value.scalar = FlatbuffersScalar::integer(b? 1 : 0);
+
+  return add_scalar(value);
+}
+
+bool
+FlatbuffersJsonBuilder::set_int64(int64_t i)
+{
+  Value value;
+  value.kind = ScalarValue;
+  value.scalar = FlatbuffersScalar::integer(i);
+
+  return add_scalar(value);
+}
+
+bool
+FlatbuffersJsonBuilder::set_number(double d)
+{
+  Value value;
+  value.kind = ScalarValue;
+  value.scalar = FlatbuffersScalar::real(d);
+
+  return add_scalar(value);
+}
+
+bool
+FlatbuffersJsonBuilder::set_string(std::experimental::string_view s)
+{
+  if (error)
+  {
+    return false;
+  }
+
+  auto type = get_pending_type();
+  if (type == nullptr)
+  {
+    return add_scalar(Value());
+  }
+
+  auto base_type = type->base_type();
+  if (frames.back().kind == VectorFrame)
+  {
+    base_type = type->element();
+  }
+
+  if (base_type == reflection::String)
+  {
+    Value value;
+    value.kind = OffsetValue;
+    value.o = fbb.CreateString(s.data(), s.size()).o;
+
+    return add_value(value);
+  }
+  else if (flatbuffers::IsScalar(base_type))
+  {
+    // Accept enum identifiers, and numbers given as strings
+    Value value;
+    value.kind = ScalarValue;
+    value.scalar = FlatbuffersScalar::integer(0);
+
+    if (!lookup_enum_value(type, s, value.scalar.i))
+    {
+      if (!value.scalar.parse(s, flatbuffers::IsFloat(base_type)))
+      {
+        return fail("Invalid string value for scalar field");
+      }
+    }
+
+    return add_scalar(value);
+  }
+
+  return fail("Unexpected string");
+}
+
+bool
+FlatbuffersJsonBuilder::start_object()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (frames.empty())
+  {
+    if (complete || root == nullptr)
+    {
+      return fail("Unexpected object");
+    }
+
+    return push_table(root);
+  }
+
+  // Copy, since the frames may be reallocated below
+  auto frame = frames.back();
+  switch (frame.kind)
+  {
+    case SkipFrame:
+      frames.back().depth++;
+      return true;
+
+    case TableFrame:
+    case StructFrame:
+    {
+      if (frame.field == nullptr)
+      {
+        return push_skip();
+      }
+
+      auto type = frame.field->type();
+      if (type->base_type() == reflection::Obj)
+      {
+        auto table = get_table(type->index());
+        if (table != nullptr && table->is_struct())
+        {
+          // Nested structs are written in-place, in their parent's bytes
+          auto offset = struct_bytes.size();
+          if (frame.kind == StructFrame)
+          {
+            offset = frame.values_mark + frame.field->offset();
+          }
+          else {
+            struct_bytes.resize(offset + table->bytesize(), 0);
+          }
+
+          return push_struct(table, offset);
+        }
+        else if (frame.kind == TableFrame)
+        {
+          return push_table(table);
+        }
+      }
+      else if (frame.kind == TableFrame)
+      {
+        if (type->base_type() == reflection::Union)
+        {
+          return push_table(get_union_table(frame, frame.field));
+        }
+        else if (type->base_type() == reflection::Vector &&
+                 type->element() == reflection::Obj &&
+                 is_keyed(get_table(type->index())))
+        {
+          // A JSON object given for an array of id/val tables
+          return push_vector(frame.field, true);
+        }
+      }
+      break;
+    }
+
+    case VectorFrame:
+    {
+      auto type = frame.field->type();
+      if (!frame.keyed && type->element() == reflection::Obj)
+      {
+        if (frame.table->is_struct())
+        {
+          auto offset = struct_bytes.size();
+          struct_bytes.resize(offset + frame.table->bytesize(), 0);
+
+          return push_struct(frame.table, offset);
+        }
+        else {
+          return push_table(frame.table);
+        }
+      }
+      break;
+    }
+  }
+
+  return fail("Unexpected object");
+}
+
+bool
+FlatbuffersJsonBuilder::key(std::experimental::string_view k)
+{
+  return key(k,
+    (table_index != nullptr)?
+      table_index->get_field_names().find(k) :
+      JsonKeyInterner::unknown
+  );
+}
+
+bool
+FlatbuffersJsonBuilder::key(
+  std::experimental::string_view k,
+  JsonKeyInterner::Id key_id
+)
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (!frames.empty())
+  {
+    auto& frame = frames.back();
+    switch (frame.kind)
+    {
+      case SkipFrame:
+        return true;
+
+      case TableFrame:
+      case StructFrame:
+      {
+        // Unknown keys leave the field empty, and their value is skipped
+        frame.field = lookup_field(frame, k, key_id);
+        return true;
+      }
+
+      case VectorFrame:
+        if (frame.keyed)
+        {
+          return start_keyed_element(frame.table, k);
+        }
+        break;
+    }
+  }
+
+  return fail("Unexpected key");
+}
+
+bool
+FlatbuffersJsonBuilder::end_object()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (!frames.empty())
+  {
+    auto& frame = frames.back();
+    switch (frame.kind)
+    {
+      case SkipFrame:
+        if (--frame.depth == 0)
+        {
+          frames.pop_back();
+          return add_value(Value());
+        }
+        return true;
+
+      case TableFrame:
+        return end_table();
+
+      case StructFrame:
+        return end_struct();
+
+      case VectorFrame:
+        if (frame.keyed)
+        {
+          return end_vector();
+        }
+        break;
+    }
+  }
+
+  return fail("Unexpected end of object");
+}
+
+bool
+FlatbuffersJsonBuilder::start_array()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (!frames.empty())
+  {
+    auto frame = frames.back();
+    switch (frame.kind)
+    {
+      case SkipFrame:
+        frames.back().depth++;
+        return true;
+
+      case TableFrame:
+        if (frame.field == nullptr)
+        {
+          return push_skip();
+        }
+        else if (frame.field->type()->base_type() == reflection::Vector)
+        {
+          return push_vector(frame.field, false);
+        }
+        break;
+
+      case StructFrame:
+        if (frame.field == nullptr)
+        {
+          return push_skip();
+        }
+        break;
+
+      case VectorFrame:
+        break;
+    }
+  }
+
+  return fail("Unexpected array");
+}
+
+bool
+FlatbuffersJsonBuilder::end_array()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (!frames.empty())
+  {
+    auto& frame = frames.back();
+    if (frame.kind == SkipFrame)
+    {
+      if (--frame.depth == 0)
+      {
+        frames.pop_back();
+        return add_value(Value());
+      }
+      return true;
+    }
+    else if (frame.kind == VectorFrame && !frame.keyed)
+    {
+      return end_vector();
+    }
+  }
+
+  return fail("Unexpected end of array");
+}
+
+bool
+FlatbuffersJsonBuilder::is_complete() const
+{
+  return (complete && !error);
+}
+
+bool
+FlatbuffersJsonBuilder::has_error() const
+{
+  return error;
+}
+
+std::experimental::string_view
+FlatbuffersJsonBuilder::get_buffer() const
+{
+  if (is_complete())
+  {
+    return std::experimental::string_view(
+      reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+      fbb.GetSize()
+    );
+  }
+
+  return std::experimental::string_view();
+}
+
+bool
+FlatbuffersJsonBuilder::is_keyed_table(const reflection::Object* table)
+{
+  return FlatbuffersTableIndex::is_keyed_table(table);
+}
+
+const reflection::Object*
+FlatbuffersJsonBuilder::get_table(int32_t index) const
+{
+  if (schema != nullptr && index >= 0 &&
+      static_cast<flatbuffers::uoffset_t>(index) < schema->objects()->size())
+  {
+    return schema->objects()->Get(index);
+  }
+
+  return nullptr;
+}
+
+const reflection::Object*
+FlatbuffersJsonBuilder::get_union_table(
+  const Frame& frame,
+  const reflection::Field* union_field
+) const
+{
+  // The union type field must have already been parsed, e.g. "x_type": "T"
+  auto type_field_name = union_field->name()->str() + "_type";
+
+  for (size_t v = frame.values_mark; v < values.size(); ++v)
+  {
+    const auto& value = values[v];
+    if (value.field != nullptr &&
+        value.field->name()->str() == type_field_name)
+    {
+      auto enum_def = schema->enums()->Get(union_field->type()->index());
+      for (auto enum_val : *enum_def->values())
+      {
+        if (enum_val->value() == value.scalar.as<int64_t>())
+        {
+          if (enum_val->union_type() != nullptr)
+          {
+            return get_table(enum_val->union_type()->index());
+          }
+          else if (enum_val->object() != nullptr)
+          {
+            return enum_val->object();
+          }
+        }
+      }
+    }
+  }
+
+  ESP_LOGW(TAG, "Union '%s' needs its type field first", union_field->name()->c_str());
+  return nullptr;
+}
+
+const reflection::Type*
+FlatbuffersJsonBuilder::get_pending_type() const
+{
+  if (!frames.empty())
+  {
+    const auto& frame = frames.back();
+    if (frame.field != nullptr && frame.kind != SkipFrame)
+    {
+      return frame.field->type();
+    }
+  }
+
+  return nullptr;
+}
+
+bool
+FlatbuffersJsonBuilder::lookup_enum_value(
+  const reflection::Type* type,
+  std::experimental::string_view name,
+  int64_t& value
+) const
+{
+  if (type->index() >= 0 &&
+      static_cast<flatbuffers::uoffset_t>(type->index()) < schema->enums()->size())
+  {
+    auto enum_def = schema->enums()->Get(type->index());
+    for (auto enum_val : *enum_def->values())
+    {
+      if (name == enum_val->name()->c_str())
+      {
+        value = enum_val->value();
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+const FlatbuffersJsonBuilder::TableInfo*
+FlatbuffersJsonBuilder::get_table_info(const reflection::Object* table) const
+{
+  return (table_index != nullptr)? table_index->get_table_info(table) : nullptr;
+}
+
+bool
+FlatbuffersJsonBuilder::is_keyed(const reflection::Object* table) const
+{
+  auto info = get_table_info(table);
+  return (info != nullptr)? info->keyed : is_keyed_table(table);
+}
+
+const reflection::Field*
+FlatbuffersJsonBuilder::lookup_field(
+  const Frame& frame,
+  std::experimental::string_view k,
+  JsonKeyInterner::Id key_id
+) const
+{
+  if (frame.info != nullptr)
+  {
+    // Every field name is interned, so other keys can't be fields
+    const auto& fields = frame.info->fields_by_key;
+    if ((key_id >= 0) && (static_cast<size_t>(key_id) < fields.size()))
+    {
+      return fields[key_id];
+    }
+    return nullptr;
+  }
+
+  std::string name(k.data(), k.size());
+  return frame.table->fields()->LookupByKey(name.c_str());
+}
+
+bool
+FlatbuffersJsonBuilder::push_table(
+  const reflection::Object* table,
+  bool single_value
+)
+{
+  if (table == nullptr)
+  {
+    return fail("Unknown table");
+  }
+
+  Frame frame;
+  frame.kind = TableFrame;
+  frame.table = table;
+  frame.info = get_table_info(table);
+  frame.values_mark = values.size();
+  frame.struct_bytes_mark = struct_bytes.size();
+  frame.single_value = single_value;
+  frames.push_back(frame);
+
+  return true;
+}
+
+bool
+FlatbuffersJsonBuilder::push_struct(const reflection::Object* table, size_t offset)
+{
+  Frame frame;
+  frame.kind = StructFrame;
+  frame.table = table;
+  frame.info = get_table_info(table);
+  // For structs, this is the offset of the struct in struct_bytes
+  frame.values_mark = offset;
+  frames.push_back(frame);
+
+  return true;
+}
+
+bool
+FlatbuffersJsonBuilder::push_vector(
+  const reflection::Field* vector_field,
+  bool keyed
+)
+{
+  auto type = vector_field->type();
+
+  Frame frame;
+  frame.kind = VectorFrame;
+  frame.field = vector_field;
+  frame.values_mark = values.size();
+  frame.struct_bytes_mark = struct_bytes.size();
+  frame.keyed = keyed;
+
+  if (type->element() == reflection::Obj)
+  {
+    frame.table = get_table(type->index());
+    if (frame.table == nullptr)
+    {
+      return fail("Unknown vector element table");
+    }
+  }
+  else if (type->element() == reflection::Union ||
+           type->element() == reflection::Vector)
+  {
+    return fail("Unsupported vector element type");
+  }
+
+  frames.push_back(frame);
+
+  return true;
+}
+
+bool
+FlatbuffersJsonBuilder::push_skip()
+{
+  Frame frame;
+  frame.kind = SkipFrame;
+  frame.depth = 1;
+  frames.push_back(frame);
+
+  return true;
+}
+
+bool
+FlatbuffersJsonBuilder::start_keyed_element(
+  const reflection::Object* table,
+  std::experimental::string_view key
+)
+{
+  const reflection::Field* id_field = nullptr;
+  const reflection::Field* val_field = nullptr;
+
+  auto info = get_table_info(table);
+  if (info != nullptr)
+  {
+    id_field = info->id_field;
+    val_field = info->val_field;
+  }
+  else {
+    id_field = table->fields()->LookupByKey("id");
+    val_field = table->fields()->LookupByKey("val");
+  }
+
+  // The id must be created before the element table is started
+  Value id;
+  id.field = id_field;
+
+  auto id_type = id_field->type()->base_type();
+  if (id_type == reflection::String)
+  {
+    id.kind = OffsetValue;
+    id.o = fbb.CreateString(key.data(), key.size()).o;
+  }
+  else if (flatbuffers::IsInteger(id_type))
+  {
+    // The key is the decimal id, which must fit the id field
+    bool fits = false;
+    id.kind = ScalarValue;
+    if (id.scalar.parse(key, false, 10))
+    {
+      with_scalar_type(id_type, [&](auto tag)
+      {
+        fits = id.scalar.fits<decltype(tag)>();
+      });
+    }
+
+    if (!fits)
+    {
+      return fail("Invalid id");
+    }
+  }
+  else {
+    return fail("Unsupported id field type");
+  }
+
+  if (push_table(table, true))
+  {
+    values.push_back(id);
+    frames.back().field = val_field;
+    return true;
+  }
+
+  return false;
+}
+
+bool
+FlatbuffersJsonBuilder::add_scalar(const Value& value)
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (frames.empty())
+  {
+    return fail("Unexpected scalar");
+  }
+
+  auto& frame = frames.back();
+  if (frame.kind == SkipFrame)
+  {
+    return true;
+  }
+
+  auto type = get_pending_type();
+  if (type == nullptr || value.kind == NoValue)
+  {
+    // Value for an unknown key
+    return add_value(Value());
+  }
+
+  auto base_type = type->base_type();
+  if (frame.kind == VectorFrame)
+  {
+    base_type = type->element();
+  }
+
+  if (!flatbuffers::IsScalar(base_type))
+  {
+    return fail("Unexpected scalar");
+  }
+
+  // Numbers are not truncated to fit the field
+  bool fits = true;
+  with_scalar_type(base_type, [&](auto tag)
+  {
+    fits = value.scalar.fits<decltype(tag)>();
+  });
+
+  if (!fits)
+  {
+    return fail("Number out of range for field");
+  }
+
+  if (frame.kind == StructFrame)
+  {
+    // Write the value in-place
+    auto data = &struct_bytes[frame.values_mark + frame.field->offset()];
+    with_scalar_type(base_type, [&](auto tag)
+    {
+      flatbuffers::WriteScalar(data, value.scalar.as<decltype(tag)>());
+    });
+
+    frame.field = nullptr;
+    return true;
+  }
+
+  return add_value(value);
+}
+
+bool
+FlatbuffersJsonBuilder::add_value(const Value& value)
+{
+  if (frames.empty())
+  {
+    // This must be the root table
+    if (value.kind == OffsetValue)
+    {
+      fbb.Finish(flatbuffers::Offset<void>(value.o));
+      complete = true;
+      return true;
+    }
+
+    return fail("Root value is not a table");
+  }
+
+  auto& frame = frames.back();
+  switch (frame.kind)
+  {
+    case TableFrame:
+      if (frame.field != nullptr && value.kind != NoValue)
+      {
+        // A table can only hold one value per field
+        for (size_t v = frame.values_mark; v < values.size(); ++v)
+        {
+          if (values[v].field == frame.field)
+          {
+            return fail("Field set more than once");
+          }
+        }
+
+        values.push_back(value);
+        values.back().field = frame.field;
+      }
+      frame.field = nullptr;
+
+      if (frame.single_value)
+      {
+        return end_table();
+      }
+      return true;
+
+    case VectorFrame:
+      if (value.kind == NoValue)
+      {
+        return fail("Unexpected null in vector");
+      }
+      values.push_back(value);
+      return true;
+
+    case StructFrame:
+      frame.field = nullptr;
+      return true;
+
+    case SkipFrame:
+      return true;
+  }
+
+  return false;
+}
+
+bool
+FlatbuffersJsonBuilder::end_table()
+{
+  auto frame = frames.back();
+  frames.pop_back();
+
+  // All strings, vectors and sub-tables have already been created
+  auto start = fbb.StartTable();
+  for (size_t v = frame.values_mark; v < values.size(); ++v)
+  {
+    const auto& value = values[v];
+    auto field = value.field;
+    auto voffset = field->offset();
+
+    switch (value.kind)
+    {
+      case ScalarValue:
+        with_scalar_type(field->type()->base_type(), [&](auto tag)
+        {
+          fbb.AddElement(voffset, value.scalar.as<decltype(tag)>(), default_value(field, tag));
+        });
+        break;
+
+      case OffsetValue:
+        fbb.AddOffset(voffset, flatbuffers::Offset<void>(value.o));
+        break;
+
+      case StructValue:
+      {
+        auto table = get_table(field->type()->index());
+        fbb.Align(table->minalign());
+        fbb.PushBytes(&struct_bytes[value.struct_offset], table->bytesize());
+        fbb.TrackField(voffset, fbb.GetSize());
+        break;
+      }
+
+      case NoValue:
+        break;
+    }
+  }
+  auto end = fbb.EndTable(start);
+
+  values.resize(frame.values_mark);
+  struct_bytes.resize(frame.struct_bytes_mark);
+
+  Value table_value;
+  table_value.kind = OffsetValue;
+  table_value.o = end;
+
+  return add_value(table_value);
+}
+
+bool
+FlatbuffersJsonBuilder::end_struct()
+{
+  auto frame = frames.back();
+  frames.pop_back();
+
+  if (!frames.empty() && frames.back().kind == StructFrame)
+  {
+    // Nested struct, already written in-place in the parent
+    frames.back().field = nullptr;
+    return true;
+  }
+
+  Value struct_value;
+  struct_value.kind = StructValue;
+  struct_value.struct_offset = frame.values_mark;
+
+  return add_value(struct_value);
+}
+
+bool
+FlatbuffersJsonBuilder::end_vector()
+{
+  auto frame = frames.back();
+  frames.pop_back();
+
+  auto element_type = frame.field->type()->element();
+  auto len = values.size() - frame.values_mark;
+
+  // Elements are pushed in reverse, as the buffer is built back to front
+  if (element_type == reflection::Obj && frame.table->is_struct())
+  {
+    auto bytesize = frame.table->bytesize();
+    auto minalign = frame.table->minalign();
+
+    fbb.StartVector(len * bytesize / minalign, minalign);
+    for (auto v = values.size(); v > frame.values_mark; --v)
+    {
+      fbb.PushBytes(&struct_bytes[values[v - 1].struct_offset], bytesize);
+    }
+  }
+  else if (element_type == reflection::Obj || element_type == reflection::String)
+  {
+    fbb.StartVector(len, sizeof(flatbuffers::uoffset_t));
+    for (auto v = values.size(); v > frame.values_mark; --v)
+    {
+      fbb.PushElement(flatbuffers::Offset<void>(values[v - 1].o));
+    }
+  }
+  else {
+    fbb.StartVector(len, flatbuffers::GetTypeSize(element_type));
+    for (auto v = values.size(); v > frame.values_mark; --v)
+    {
+      const auto& value = values[v - 1];
+      with_scalar_type(element_type, [&](auto tag)
+      {
+        fbb.PushElement(value.scalar.as<decltype(tag)>());
+      });
+    }
+  }
+  auto end = fbb.EndVector(len);
+
+  values.resize(frame.values_mark);
+  struct_bytes.resize(frame.struct_bytes_mark);
+
+  Value vector_value;
+  vector_value.kind = OffsetValue;
+  vector_value.o = end;
+
+  return add_value(vector_value);
+}
+
+bool
+FlatbuffersJsonBuilder::fail(const char* reason)
+{
+  if (!error)
+  {
+    ESP_LOGE(TAG, "%s", reason);
+    error = true;
+  }
+
+  return false;
+}
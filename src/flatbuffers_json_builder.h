@@ -0,0 +1,195 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_scalar.h"
+#include "flatbuffers_table_index.h"
+#include "json_key_interner.h"
+
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/reflection.h"
+
+#include <experimental/string_view>
+
+#include <cstdint>
+#include <vector>
+
+// Builds a flatbuffer directly from a stream of JSON (SAX-style) events,
+// using the reflection schema to map keys to fields and their types.
+// Keys not present in the schema are skipped, along with their values.
+// Numbers which do not fit their field's type, and fields given more than
+// once in the same object, are errors.
+// JSON objects given for a vector of id/val tables are rewritten as
+// [{"id": key, "val": value}, ...] (i.e. a keyed vector).
+class FlatbuffersJsonBuilder
+{
+public:
+  explicit FlatbuffersJsonBuilder(const reflection::Schema* _schema=nullptr);
+
+  static constexpr char TAG[] = "FlatbuffersJsonBuilder";
+
+  // With an index of this schema (e.g. from FlatbuffersSchema), keys are
+  // looked up by id, otherwise by name. The index must outlive the builder.
+  bool set_schema(
+    const reflection::Schema* _schema,
+    const FlatbuffersTableIndex* _table_index=nullptr
+  );
+
+  // Start a new buffer, with the next JSON object as the root table
+  bool start(const reflection::Object* root_table);
+
+  // Start a new buffer, with a root table containing only this key,
+  // or {"id": key, "val": value} if the root table is an id/val table
+  bool start(
+    const reflection::Object* root_table,
+    std::experimental::string_view key
+  );
+
+  void clear();
+
+  bool set_null();
+  bool set_bool(bool b);
+  bool set_int64(int64_t i);
+  bool set_number(double d);
+  bool set_string(std::experimental::string_view s);
+
+  bool start_object();
+  bool key(std::experimental::string_view k);
+
+  // key_id is the result of find(k), on the index's field names, or on an
+  // interner layered on them
+  bool key(std::experimental::string_view k, JsonKeyInterner::Id key_id);
+  bool end_object();
+
+  bool start_array();
+  bool end_array();
+
+  // Whether the root table has been finished successfully
+  bool is_complete() const;
+  bool has_error() const;
+
+  // Only valid once complete
+  std::experimental::string_view get_buffer() const;
+
+  // Whether this table should be written as an id/val keyed vector element
+  static bool is_keyed_table(const reflection::Object* table);
+
+private:
+  enum ValueKind : uint8_t
+  {
+    NoValue,
+    ScalarValue,
+    OffsetValue,
+    StructValue,
+  };
+
+  struct Value
+  {
+    const reflection::Field* field = nullptr;
+    ValueKind kind = NoValue;
+    union
+    {
+      FlatbuffersScalar scalar;
+      flatbuffers::uoffset_t o;
+      size_t struct_offset;
+    };
+  };
+
+  typedef FlatbuffersTableIndex::TableInfo TableInfo;
+
+  enum FrameKind : uint8_t
+  {
+    TableFrame,
+    StructFrame,
+    VectorFrame,
+    SkipFrame,
+  };
+
+  struct Frame
+  {
+    FrameKind kind;
+
+    // Table or struct being built, or the element table of a vector
+    const reflection::Object* table = nullptr;
+
+    // Table/struct: field for the next value, vector: the vector field
+    const reflection::Field* field = nullptr;
+
+    // Table/struct: lookup metadata for table
+    const TableInfo* info = nullptr;
+
+    // First value (or struct byte) belonging to this frame
+    size_t values_mark = 0;
+    size_t struct_bytes_mark = 0;
+
+    // Skip: nesting depth of ignored objects/arrays
+    int depth = 0;
+
+    // Vector: JSON object being rewritten into id/val tables
+    bool keyed = false;
+
+    // Table: close after the first value (used for keyed elements)
+    bool single_value = false;
+  };
+
+  const reflection::Object* get_table(int32_t index) const;
+  const reflection::Object* get_union_table(
+    const Frame& frame,
+    const reflection::Field* union_field
+  ) const;
+  const reflection::Type* get_pending_type() const;
+
+  const TableInfo* get_table_info(const reflection::Object* table) const;
+  bool is_keyed(const reflection::Object* table) const;
+  const reflection::Field* lookup_field(
+    const Frame& frame,
+    std::experimental::string_view k,
+    JsonKeyInterner::Id key_id
+  ) const;
+
+  bool lookup_enum_value(
+    const reflection::Type* type,
+    std::experimental::string_view name,
+    int64_t& value
+  ) const;
+
+  bool push_table(const reflection::Object* table, bool single_value=false);
+  bool push_struct(const reflection::Object* table, size_t offset);
+  bool push_vector(const reflection::Field* vector_field, bool keyed);
+  bool push_skip();
+
+  bool start_keyed_element(
+    const reflection::Object* table,
+    std::experimental::string_view key
+  );
+
+  bool add_scalar(const Value& value);
+  bool add_value(const Value& value);
+
+  bool end_table();
+  bool end_struct();
+  bool end_vector();
+
+  bool fail(const char* reason);
+
+  const reflection::Schema* schema = nullptr;
+  const reflection::Object* root = nullptr;
+
+  const FlatbuffersTableIndex* table_index = nullptr;
+
+  flatbuffers::FlatBufferBuilder fbb;
+
+  std::vector<Frame> frames;
+  std::vector<Value> values;
+  std::vector<uint8_t> struct_bytes;
+
+  bool complete = false;
+  bool error = false;
+};
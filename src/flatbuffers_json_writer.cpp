@@ -0,0 +1,533 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "flatbuffers_json_writer.h"
+
+#include "json_scan.h"
+
+#include "flatbuffers/minireflect.h"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+constexpr char FlatbuffersJsonWriter::TAG[];
+
+// Parsed as the same type, to check that text round-trips
+inline double
+parse_real(const char* str, double)
+{
+  return std::strtod(str, nullptr);
+}
+
+inline float
+parse_real(const char* str, float)
+{
+  return std::strtof(str, nullptr);
+}
+
+// snprintf and strtod use the decimal point of the C locale (e.g. ',' for
+// de_DE), JSON always uses '.'. Returns the new length of str.
+inline int
+use_json_decimal_point(char* str, int len)
+{
+  const char* point = std::localeconv()->decimal_point;
+  auto point_len = std::strlen(point);
+  if ((point_len == 0) || ((point_len == 1) && (point[0] == '.')))
+  {
+    return len;
+  }
+
+  char* p = std::strstr(str, point);
+  if (p == nullptr)
+  {
+    return len;
+  }
+
+  // The locale's decimal point may be more than one byte
+  *p = '.';
+  std::memmove(p + 1, p + point_len, (str + len + 1) - (p + point_len));
+  return len - static_cast<int>(point_len - 1);
+}
+
+bool
+FlatbuffersJsonWriter::write(
+  std::string& out,
+  const uint8_t* buffer,
+  const flatbuffers::TypeTable* type_table
+)
+{
+  return write_table_at(
+    out,
+    flatbuffers::GetRoot<uint8_t>(buffer),
+    type_table
+  );
+}
+
+bool
+FlatbuffersJsonWriter::write_table_at(
+  std::string& out,
+  const uint8_t* table,
+  const flatbuffers::TypeTable* type_table
+)
+{
+  if ((table == nullptr) ||
+      (type_table == nullptr) ||
+      (type_table->st != flatbuffers::ST_TABLE))
+  {
+    ESP_LOGE(TAG, "Invalid table");
+    return false;
+  }
+
+  return write_sequence(out, table, type_table);
+}
+
+void
+FlatbuffersJsonWriter::write_string(
+  std::string& out,
+  std::experimental::string_view s
+)
+{
+  static constexpr char hex[] = "0123456789abcdef";
+
+  out.push_back('"');
+
+  const char* p = s.data();
+  const char* end = p + s.size();
+  while (p < end)
+  {
+    // Copy the run of plain characters at once
+    const char* run = p;
+    p = json_scan::find_string_special(p, end);
+    out.append(run, p - run);
+
+    if (p == end)
+    {
+      break;
+    }
+
+    char c = *p++;
+    switch (c)
+    {
+      case '"': out.append("\\\"", 2); break;
+      case '\\': out.append("\\\\", 2); break;
+      case '\b': out.append("\\b", 2); break;
+      case '\f': out.append("\\f", 2); break;
+      case '\n': out.append("\\n", 2); break;
+      case '\r': out.append("\\r", 2); break;
+      case '\t': out.append("\\t", 2); break;
+      default:
+      {
+        char escape[6] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf]};
+        out.append(escape, sizeof(escape));
+        break;
+      }
+    }
+  }
+
+  out.push_back('"');
+}
+
+bool
+FlatbuffersJsonWriter::write_sequence(
+  std::string& out,
+  const uint8_t* obj,
+  const flatbuffers::TypeTable* type_table
+)
+{
+  if (type_table->names == nullptr)
+  {
+    ESP_LOGE(TAG, "Field names are required (generate with --reflect-names)");
+    return false;
+  }
+
+  bool is_table = (type_table->st == flatbuffers::ST_TABLE);
+  bool first = true;
+  const uint8_t* prev_val = nullptr;
+
+  out.push_back('{');
+  for (size_t i = 0; i < type_table->num_elems; ++i)
+  {
+    auto type_code = type_table->type_codes[i];
+    auto type = static_cast<flatbuffers::ElementaryType>(type_code.base_type);
+
+    const flatbuffers::TypeTable* ref = nullptr;
+    if (type_code.sequence_ref >= 0)
+    {
+      ref = type_table->type_refs[type_code.sequence_ref]();
+    }
+
+    const uint8_t* val = nullptr;
+    if (is_table)
+    {
+      val = reinterpret_cast<const flatbuffers::Table*>(obj)->GetAddressOf(
+        flatbuffers::FieldIndexToOffset(static_cast<flatbuffers::voffset_t>(i))
+      );
+    }
+    else {
+      val = obj + type_table->values[i];
+    }
+
+    // A union value follows its type field
+    auto union_type = prev_val;
+    prev_val = val;
+
+    if (val == nullptr)
+    {
+      continue;
+    }
+
+    if (!first)
+    {
+      out.push_back(',');
+    }
+    first = false;
+
+    write_string(out, type_table->names[i]);
+    out.push_back(':');
+
+    if (type_code.is_vector)
+    {
+      auto vec = reinterpret_cast<const flatbuffers::Vector<uint8_t>*>(
+        val + flatbuffers::ReadScalar<flatbuffers::uoffset_t>(val)
+      );
+
+      // A vector of unions follows its vector of types
+      const uint8_t* union_types = nullptr;
+      if ((ref != nullptr) && (ref->st == flatbuffers::ST_UNION) && (union_type != nullptr))
+      {
+        union_types = reinterpret_cast<const flatbuffers::Vector<uint8_t>*>(
+          union_type + flatbuffers::ReadScalar<flatbuffers::uoffset_t>(union_type)
+        )->Data();
+      }
+
+      out.push_back('[');
+      auto elem = vec->Data();
+      auto elem_size = flatbuffers::InlineSize(type, ref);
+      for (flatbuffers::uoffset_t j = 0; j < vec->size(); ++j)
+      {
+        if (j > 0)
+        {
+          out.push_back(',');
+        }
+
+        auto elem_union_type = (union_types != nullptr)? (union_types + j) : nullptr;
+        if (!write_value(out, type, elem, ref, elem_union_type))
+        {
+          return false;
+        }
+        elem += elem_size;
+      }
+      out.push_back(']');
+    }
+    else if (!write_value(out, type, val, ref, union_type))
+    {
+      return false;
+    }
+  }
+  out.push_back('}');
+
+  return true;
+}
+
+bool
+FlatbuffersJsonWriter::write_value(
+  std::string& out,
+  flatbuffers::ElementaryType type,
+  const uint8_t* val,
+  const flatbuffers::TypeTable* type_table,
+  const uint8_t* union_type
+)
+{
+  using flatbuffers::ReadScalar;
+
+  switch (type)
+  {
+    case flatbuffers::ET_BOOL:
+      if (ReadScalar<uint8_t>(val) != 0)
+      {
+        out.append("true", 4);
+      }
+      else {
+        out.append("false", 5);
+      }
+      return true;
+
+    case flatbuffers::ET_UTYPE:
+    case flatbuffers::ET_UCHAR:
+      write_integer(out, ReadScalar<uint8_t>(val), type_table);
+      return true;
+    case flatbuffers::ET_CHAR:
+      write_integer(out, ReadScalar<int8_t>(val), type_table);
+      return true;
+    case flatbuffers::ET_SHORT:
+      write_integer(out, ReadScalar<int16_t>(val), type_table);
+      return true;
+    case flatbuffers::ET_USHORT:
+      write_integer(out, ReadScalar<uint16_t>(val), type_table);
+      return true;
+    case flatbuffers::ET_INT:
+      write_integer(out, ReadScalar<int32_t>(val), type_table);
+      return true;
+    case flatbuffers::ET_UINT:
+      write_integer(out, ReadScalar<uint32_t>(val), type_table);
+      return true;
+    case flatbuffers::ET_LONG:
+      write_number(out, static_cast<int64_t>(ReadScalar<int64_t>(val)));
+      return true;
+    case flatbuffers::ET_ULONG:
+      write_number(out, static_cast<uint64_t>(ReadScalar<uint64_t>(val)));
+      return true;
+
+    case flatbuffers::ET_FLOAT:
+      write_number(out, ReadScalar<float>(val));
+      return true;
+    case flatbuffers::ET_DOUBLE:
+      write_number(out, ReadScalar<double>(val));
+      return true;
+
+    case flatbuffers::ET_STRING:
+    {
+      auto str = reinterpret_cast<const flatbuffers::String*>(
+        val + ReadScalar<flatbuffers::uoffset_t>(val)
+      );
+      write_string(out, {str->c_str(), str->size()});
+      return true;
+    }
+
+    case flatbuffers::ET_SEQUENCE:
+      switch (type_table->st)
+      {
+        case flatbuffers::ST_TABLE:
+          return write_sequence(out, val + ReadScalar<flatbuffers::uoffset_t>(val), type_table);
+
+        case flatbuffers::ST_STRUCT:
+          return write_sequence(out, val, type_table);
+
+        case flatbuffers::ST_UNION:
+        {
+          if (union_type == nullptr)
+          {
+            break;
+          }
+
+          auto index = flatbuffers::LookupEnum(
+            *union_type, type_table->values, type_table->num_elems
+          );
+          if ((index < 0) || (static_cast<size_t>(index) >= type_table->num_elems))
+          {
+            break;
+          }
+
+          auto type_code = type_table->type_codes[index];
+          if (type_code.base_type == flatbuffers::ET_SEQUENCE)
+          {
+            auto ref = type_table->type_refs[type_code.sequence_ref]();
+            return write_sequence(out, val + ReadScalar<flatbuffers::uoffset_t>(val), ref);
+          }
+          else if (type_code.base_type == flatbuffers::ET_STRING)
+          {
+            return write_value(out, flatbuffers::ET_STRING, val, nullptr, nullptr);
+          }
+          break;
+        }
+
+        case flatbuffers::ST_ENUM:
+          break;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  ESP_LOGE(TAG, "Unsupported value type %d", static_cast<int>(type));
+  return false;
+}
+
+template<typename T>
+void
+FlatbuffersJsonWriter::write_integer(
+  std::string& out,
+  T val,
+  const flatbuffers::TypeTable* type_table
+)
+{
+  // Enums are written by name, when the value is known
+  auto name = flatbuffers::EnumName(val, type_table);
+  if (name != nullptr)
+  {
+    write_string(out, name);
+  }
+  else if (std::is_signed<T>::value)
+  {
+    write_number(out, static_cast<int64_t>(val));
+  }
+  else {
+    write_number(out, static_cast<uint64_t>(val));
+  }
+}
+
+void
+FlatbuffersJsonWriter::write_number(std::string& out, int64_t val)
+{
+  if (val < 0)
+  {
+    out.push_back('-');
+    // Negate as unsigned, which is well-defined for the minimum value
+    write_number(out, 0 - static_cast<uint64_t>(val));
+  }
+  else {
+    write_number(out, static_cast<uint64_t>(val));
+  }
+}
+
+void
+FlatbuffersJsonWriter::write_number(std::string& out, uint64_t val)
+{
+  char digits[20];
+  char* p = digits + sizeof(digits);
+  do
+  {
+    *--p = static_cast<char>('0' + (val % 10));
+    val /= 10;
+  }
+  while (val > 0);
+
+  out.append(p, digits + sizeof(digits) - p);
+}
+
+void
+FlatbuffersJsonWriter::write_number(std::string& out, double val)
+{
+  write_real(out, val, 15, 17);
+}
+
+void
+FlatbuffersJsonWriter::write_number(std::string& out, float val)
+{
+  write_real(out, val, 6, 9);
+}
+
+template<typename T>
+void
+FlatbuffersJsonWriter::write_real(
+  std::string& out,
+  T val,
+  int min_digits,
+  int max_digits
+)
+{
+  if (!std::isfinite(val))
+  {
+    // No JSON representation
+    out.append("null", 4);
+    return;
+  }
+
+  if (write_fixed(out, val, std::min(max_digits, 15)))
+  {
+    return;
+  }
+
+  // Otherwise the fewest significant digits which round-trip, starting
+  // from the most that any shorter representation would be printed with
+  // (subnormals have fewer significant bits, so may need fewer digits)
+  if (std::fpclassify(val) == FP_SUBNORMAL)
+  {
+    min_digits = 1;
+  }
+
+  // Printed and parsed back in the same locale, only then made JSON
+  char digits[32];
+  int len = 0;
+  for (int precision = min_digits; precision <= max_digits; ++precision)
+  {
+    len = snprintf(digits, sizeof(digits), "%.*g", precision, static_cast<double>(val));
+    if (parse_real(digits, val) == val)
+    {
+      break;
+    }
+  }
+
+  len = use_json_decimal_point(digits, len);
+  out.append(digits, len);
+}
+
+// Common values (e.g. 21.5, -122.4194) without any text conversion:
+// the fewest fractional digits f such that round(val * 10^f) / 10^f is
+// exactly val. Both operands of the division are exact, so the result
+// is correctly rounded, as if the decimal text had been parsed.
+template<typename T>
+bool
+FlatbuffersJsonWriter::write_fixed(std::string& out, T val, int max_digits)
+{
+  static constexpr double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+  };
+
+  // Leave very small and very large values to exponent notation, which
+  // is also shorter once not every integer digit is significant
+  T magnitude = std::abs(val);
+  double d = magnitude;
+  if (!((d >= 1e-3) &&
+        (d < powers_of_ten[max_digits]) &&
+        (d < std::ldexp(1.0, std::numeric_limits<T>::digits))))
+  {
+    return false;
+  }
+
+  int int_digits = 1;
+  while (d >= powers_of_ten[int_digits])
+  {
+    int_digits++;
+  }
+
+  for (int frac_digits = 0; (int_digits + frac_digits) <= max_digits; ++frac_digits)
+  {
+    double scaled = std::round(d * powers_of_ten[frac_digits]);
+    if (static_cast<T>(scaled / powers_of_ten[frac_digits]) != magnitude)
+    {
+      continue;
+    }
+
+    // Fewer than 2^53, so exact
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    auto n = static_cast<uint64_t>(scaled);
+    for (int i = 0; (n > 0) || (i <= frac_digits); ++i)
+    {
+      if ((i == frac_digits) && (i > 0))
+      {
+        *--p = '.';
+      }
+      *--p = static_cast<char>('0' + (n % 10));
+      n /= 10;
+    }
+
+    if (val < 0)
+    {
+      *--p = '-';
+    }
+
+    out.append(p, end - p);
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers/flatbuffers.h"
+
+#include <experimental/string_view>
+
+#include <cstdint>
+#include <string>
+
+// Writes flatbuffer tables as strict JSON, appending to a caller's buffer.
+// Fields are found with the generated mini-reflection TypeTable (e.g.
+// OIDC::TokenTypeTable()), which must include names. Absent fields are
+// omitted, enums are written by name when known, and non-finite floats as
+// null. Strings are escaped as JSON requires, other UTF-8 is copied as-is.
+class FlatbuffersJsonWriter
+{
+public:
+  static constexpr char TAG[] = "FlatbuffersJsonWriter";
+
+  // The root table of a finished buffer
+  bool write(
+    std::string& out,
+    const uint8_t* buffer,
+    const flatbuffers::TypeTable* type_table
+  );
+
+  // Any table within a buffer, e.g. a table view from a callback
+  template<typename TableT>
+  bool write_table(
+    std::string& out,
+    const TableT* table,
+    const flatbuffers::TypeTable* type_table
+  )
+  {
+    return write_table_at(out, reinterpret_cast<const uint8_t*>(table), type_table);
+  }
+
+  // An object API struct (e.g. OIDC::TokenT), packed with a reused builder
+  template<typename ObjT>
+  bool write_object(
+    std::string& out,
+    const ObjT& obj,
+    const flatbuffers::TypeTable* type_table
+  )
+  {
+    fbb.Clear();
+    fbb.Finish(ObjT::TableType::Pack(fbb, &obj));
+    return write(out, fbb.GetBufferPointer(), type_table);
+  }
+
+  static void write_string(std::string& out, std::experimental::string_view s);
+
+private:
+  bool write_table_at(
+    std::string& out,
+    const uint8_t* table,
+    const flatbuffers::TypeTable* type_table
+  );
+
+  bool write_sequence(
+    std::string& out,
+    const uint8_t* obj,
+    const flatbuffers::TypeTable* type_table
+  );
+
+  bool write_value(
+    std::string& out,
+    flatbuffers::ElementaryType type,
+    const uint8_t* val,
+    const flatbuffers::TypeTable* type_table,
+    const uint8_t* union_type
+  );
+
+  template<typename T>
+  void write_integer(std::string& out, T val, const flatbuffers::TypeTable* type_table);
+
+  static void write_number(std::string& out, int64_t val);
+  static void write_number(std::string& out, uint64_t val);
+
+  // Shortest text which parses back to exactly the same value
+  static void write_number(std::string& out, double val);
+  static void write_number(std::string& out, float val);
+
+  template<typename T>
+  static void write_real(std::string& out, T val, int min_digits, int max_digits);
+
+  template<typename T>
+  static bool write_fixed(std::string& out, T val, int max_digits);
+
+  flatbuffers::FlatBufferBuilder fbb;
+};
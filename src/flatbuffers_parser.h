@@ -14,44 +14,89 @@
 
 #include "esp_log.h"
 
+#include <cassert>
+
 namespace FlatbuffersParser {
 
 constexpr char TAG[] = "FlatbuffersParser";
 
-template <typename ObjT>
-std::experimental::optional<ObjT>
-parse(std::experimental::string_view buf)
+template <typename TableT>
+bool
+verify(std::experimental::string_view buf)
 {
-  // Verify the buffer data before doing anything
   flatbuffers::Verifier verifier(
     reinterpret_cast<const uint8_t*>(buf.data()),
     buf.size()
   );
 
-  // Perform the check if the buffer is valid
-  if (verifier.VerifyBuffer<typename ObjT::TableType>())
-  {
-    // Parse it into a flatbuffer
-    const auto* flatbuf = flatbuffers::GetRoot<typename ObjT::TableType>(
-      buf.data()
-    );
+  return verifier.VerifyBuffer<TableT>();
+}
 
-    // Verify (again) that the flatbuffers parsing was successful
-    if (flatbuf != nullptr)
-    {
-      ObjT obj;
-      // Deserialize from buffer into object
-      flatbuf->UnPackTo(&obj);
-      return obj;
-    }
+template <typename TableT>
+const TableT*
+get_root(std::experimental::string_view buf)
+{
+  // Verify the buffer data before doing anything
+  if (verify<TableT>(buf))
+  {
+    // Read-only view into the buffer, no copies are made
+    return flatbuffers::GetRoot<TableT>(buf.data());
   }
   else {
     ESP_LOGE(TAG,
       "Couldn't verify flatbuffer of type '%s'",
-      ObjT::TableType::GetFullyQualifiedName()
+      TableT::GetFullyQualifiedName()
     );
   }
 
+  return nullptr;
+};
+
+template <typename ObjT>
+std::experimental::optional<ObjT>
+parse(std::experimental::string_view buf)
+{
+  // Parse it into a flatbuffer, if it can be verified
+  const auto* flatbuf = get_root<typename ObjT::TableType>(buf);
+  if (flatbuf != nullptr)
+  {
+    ObjT obj;
+    // Deserialize from buffer into object
+    flatbuf->UnPackTo(&obj);
+    return obj;
+  }
+
+  return std::experimental::nullopt;
+};
+
+// For buffers built in this process (e.g. by FlatbuffersJsonBuilder), which
+// are valid by construction: the verifier only runs in debug builds
+template <typename TableT>
+const TableT*
+get_trusted_root(std::experimental::string_view buf)
+{
+  assert(verify<TableT>(buf));
+
+  if (buf.size() < sizeof(flatbuffers::uoffset_t))
+  {
+    return nullptr;
+  }
+
+  return flatbuffers::GetRoot<TableT>(buf.data());
+};
+
+template <typename ObjT>
+std::experimental::optional<ObjT>
+parse_trusted(std::experimental::string_view buf)
+{
+  const auto* flatbuf = get_trusted_root<typename ObjT::TableType>(buf);
+  if (flatbuf != nullptr)
+  {
+    ObjT obj;
+    flatbuf->UnPackTo(&obj);
+    return obj;
+  }
+
   return std::experimental::nullopt;
 };
 
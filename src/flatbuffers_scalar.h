@@ -0,0 +1,154 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/reflection.h"
+
+#include <experimental/string_view>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// A JSON number (or bool, or enum value) for a flatbuffer scalar field,
+// as read by FlatbuffersJsonBuilder and FlatbuffersTableDecoder.
+// Both convert and range check numbers through here, so they agree on
+// which numbers are accepted for which field types.
+struct FlatbuffersScalar
+{
+  bool is_real;
+  union
+  {
+    int64_t i;
+    double d;
+  };
+
+  static FlatbuffersScalar integer(int64_t i)
+  {
+    FlatbuffersScalar scalar;
+    scalar.is_real = false;
+    scalar.i = i;
+    return scalar;
+  }
+
+  static FlatbuffersScalar real(double d)
+  {
+    FlatbuffersScalar scalar;
+    scalar.is_real = true;
+    scalar.d = d;
+    return scalar;
+  }
+
+  // A number given as a string, read as a real for floating point fields
+  // Integers are read in the given base (0 also accepts hex and octal)
+  bool parse(std::experimental::string_view s, bool as_real, int base=0)
+  {
+    std::string str(s.data(), s.size());
+    char* end = nullptr;
+
+    is_real = as_real;
+    if (is_real)
+    {
+      d = std::strtod(str.c_str(), &end);
+    }
+    else {
+      i = std::strtoll(str.c_str(), &end, base);
+    }
+
+    return (!str.empty() && end == (str.c_str() + str.size()));
+  }
+
+  template<typename T>
+  T as() const
+  {
+    return is_real? static_cast<T>(d) : static_cast<T>(i);
+  }
+
+  // Whether as<T>() is exact, i.e. not truncated or out of range
+  template<typename T>
+  bool fits() const
+  {
+    if (std::is_floating_point<T>::value)
+    {
+      return true;
+    }
+
+    if (is_real)
+    {
+      auto limit = std::ldexp(1.0, std::numeric_limits<T>::digits);
+      return (
+        (d == std::trunc(d)) &&
+        (d >= (std::is_signed<T>::value? -limit : 0.0)) &&
+        (d < limit)
+      );
+    }
+
+    if (std::is_signed<T>::value)
+    {
+      return (
+        (i >= static_cast<int64_t>(std::numeric_limits<T>::lowest())) &&
+        (i <= static_cast<int64_t>(std::numeric_limits<T>::max()))
+      );
+    }
+
+    return (
+      (i >= 0) &&
+      (static_cast<uint64_t>(i) <= static_cast<uint64_t>(std::numeric_limits<T>::max()))
+    );
+  }
+};
+
+// Calls fn with a default-constructed value of the C++ type for a scalar
+template<typename Fn>
+bool
+with_scalar_type(flatbuffers::ElementaryType type, Fn&& fn)
+{
+  switch (type)
+  {
+    case flatbuffers::ET_UTYPE:
+    case flatbuffers::ET_BOOL:
+    case flatbuffers::ET_UCHAR:   fn(uint8_t());  return true;
+    case flatbuffers::ET_CHAR:    fn(int8_t());   return true;
+    case flatbuffers::ET_SHORT:   fn(int16_t());  return true;
+    case flatbuffers::ET_USHORT:  fn(uint16_t()); return true;
+    case flatbuffers::ET_INT:     fn(int32_t());  return true;
+    case flatbuffers::ET_UINT:    fn(uint32_t()); return true;
+    case flatbuffers::ET_LONG:    fn(int64_t());  return true;
+    case flatbuffers::ET_ULONG:   fn(uint64_t()); return true;
+    case flatbuffers::ET_FLOAT:   fn(float());    return true;
+    case flatbuffers::ET_DOUBLE:  fn(double());   return true;
+    default:                                      return false;
+  }
+}
+
+// The reflection base types are the elementary types, after None
+static_assert(
+  (reflection::Double - reflection::UType) == flatbuffers::ET_DOUBLE,
+  "reflection::BaseType and flatbuffers::ElementaryType differ"
+);
+
+template<typename Fn>
+bool
+with_scalar_type(reflection::BaseType base_type, Fn&& fn)
+{
+  if (!flatbuffers::IsScalar(base_type))
+  {
+    return false;
+  }
+
+  return with_scalar_type(
+    static_cast<flatbuffers::ElementaryType>(base_type - reflection::UType),
+    std::forward<Fn>(fn)
+  );
+}
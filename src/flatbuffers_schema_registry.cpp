@@ -0,0 +1,148 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "flatbuffers_schema_registry.h"
+
+#include "flatbuffers/hash.h"
+#include "flatbuffers/reflection_generated.h"
+
+#include "esp_log.h"
+
+constexpr char FlatbuffersSchemaRegistry::TAG[];
+
+FlatbuffersSchemaRegistry&
+FlatbuffersSchemaRegistry::get_instance()
+{
+  static FlatbuffersSchemaRegistry registry;
+  return registry;
+}
+
+const FlatbuffersSchema*
+FlatbuffersSchemaRegistry::get_schema(
+  std::experimental::string_view binary_schema,
+  std::experimental::string_view text_schema
+)
+{
+  return register_schema(binary_schema, text_schema, false);
+}
+
+const FlatbuffersSchema*
+FlatbuffersSchemaRegistry::get_static_schema(
+  std::experimental::string_view binary_schema,
+  std::experimental::string_view text_schema
+)
+{
+  return register_schema(binary_schema, text_schema, true);
+}
+
+const FlatbuffersSchema*
+FlatbuffersSchemaRegistry::register_schema(
+  std::experimental::string_view binary_schema,
+  std::experimental::string_view text_schema,
+  bool is_static
+)
+{
+  // Text schemas may include their null terminator, which is not needed here
+  bool is_text_terminated = false;
+  if (!text_schema.empty() && (text_schema.back() == '\0'))
+  {
+    text_schema.remove_suffix(1);
+    is_text_terminated = true;
+  }
+
+  // Include the binary length, so the split between the two is unambiguous
+  auto key = hash(text_schema, hash(binary_schema, 0) ^ binary_schema.size());
+
+  std::lock_guard<std::mutex> lock(schemas_mutex);
+
+  auto found = schemas.equal_range(key);
+  for (auto it = found.first; it != found.second; ++it)
+  {
+    const auto& shared = *it->second;
+    if ((shared.binary_schema == binary_schema) &&
+        (shared.text_schema == text_schema))
+    {
+      return &shared;
+    }
+  }
+
+  if (found.first != found.second)
+  {
+    ESP_LOGW(TAG, "Hash collision for schema %016llx", (unsigned long long)key);
+  }
+
+  std::unique_ptr<FlatbuffersSchema> shared(new FlatbuffersSchema);
+  shared->hash = key;
+
+  if (is_static)
+  {
+    shared->binary_schema = binary_schema;
+  }
+  else {
+    shared->binary_schema_copy.assign(binary_schema.data(), binary_schema.size());
+    shared->binary_schema = shared->binary_schema_copy;
+  }
+
+  // flatbuffers::Parser needs the text schema to be null-terminated
+  if (is_static && (is_text_terminated || text_schema.empty()))
+  {
+    shared->text_schema = text_schema;
+  }
+  else {
+    shared->text_schema_copy.assign(text_schema.data(), text_schema.size());
+    shared->text_schema = shared->text_schema_copy;
+  }
+
+  // Verify the buffer which will be used
+  flatbuffers::Verifier verifier(
+    reinterpret_cast<const uint8_t*>(shared->binary_schema.data()),
+    shared->binary_schema.size()
+  );
+  if (!reflection::VerifySchemaBuffer(verifier))
+  {
+    ESP_LOGE(TAG, "Invalid binary flatbuffer schema buffer");
+    return nullptr;
+  }
+
+  shared->schema = reflection::GetSchema(shared->binary_schema.data());
+  shared->table_index.build(shared->schema);
+
+  ESP_LOGI(TAG, "Registered schema %016llx", (unsigned long long)key);
+
+  auto* ret = shared.get();
+  schemas.emplace(key, std::move(shared));
+  return ret;
+}
+
+size_t
+FlatbuffersSchemaRegistry::size() const
+{
+  std::lock_guard<std::mutex> lock(schemas_mutex);
+  return schemas.size();
+}
+
+uint64_t
+FlatbuffersSchemaRegistry::hash(std::experimental::string_view buf, uint64_t seed)
+{
+  // FNV-1a, continuing from seed (if non-zero)
+  typedef flatbuffers::FnvTraits<uint64_t> Fnv;
+
+  uint64_t h = Fnv::kOffsetBasis;
+  if (seed != 0)
+  {
+    h = seed;
+  }
+
+  for (auto c : buf)
+  {
+    h ^= static_cast<unsigned char>(c);
+    h *= Fnv::kFnvPrime;
+  }
+  return h;
+}
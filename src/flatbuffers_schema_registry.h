@@ -0,0 +1,82 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_table_index.h"
+
+#include "flatbuffers/reflection.h"
+
+#include <experimental/string_view>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A binary (.bfbs) schema, verified once and then shared read-only
+struct FlatbuffersSchema
+{
+  uint64_t hash = 0;
+
+  // Static buffers (e.g. embedded files) are used in place, others are
+  // copied so the caller's buffers need not outlive the registry
+  // The text schema is always followed by a null terminator
+  std::experimental::string_view binary_schema;
+  std::experimental::string_view text_schema;
+
+  std::string binary_schema_copy;
+  std::string text_schema_copy;
+
+  const reflection::Schema* schema = nullptr;
+
+  // Shared by every builder using this schema
+  FlatbuffersTableIndex table_index;
+};
+
+// Process-wide registry of schemas, keyed by a hash of their contents
+// Schemas with the same hash are told apart by comparing their contents
+// Registered schemas are never removed, so their pointers remain valid
+class FlatbuffersSchemaRegistry
+{
+public:
+  static constexpr char TAG[] = "FlatbuffersSchemaRegistry";
+
+  static FlatbuffersSchemaRegistry& get_instance();
+
+  // The shared schema for this binary schema (and optional text schema),
+  // verifying and registering it if needed; nullptr if it is invalid
+  const FlatbuffersSchema* get_schema(
+    std::experimental::string_view binary_schema,
+    std::experimental::string_view text_schema={}
+  );
+
+  // As get_schema, but buffers which outlive the registry are not copied
+  const FlatbuffersSchema* get_static_schema(
+    std::experimental::string_view binary_schema,
+    std::experimental::string_view text_schema={}
+  );
+
+  size_t size() const;
+
+  static uint64_t hash(std::experimental::string_view buf, uint64_t seed);
+
+private:
+  FlatbuffersSchemaRegistry() = default;
+
+  const FlatbuffersSchema* register_schema(
+    std::experimental::string_view binary_schema,
+    std::experimental::string_view text_schema,
+    bool is_static
+  );
+
+  mutable std::mutex schemas_mutex;
+  std::unordered_multimap<uint64_t, std::unique_ptr<FlatbuffersSchema>> schemas;
+};
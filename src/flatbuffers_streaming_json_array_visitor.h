@@ -0,0 +1,318 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_streaming_ndjson_visitor.h"
+#include "json_scan.h"
+
+#include <experimental/string_view>
+
+#include "delegate.hpp"
+
+#include "esp_log.h"
+
+#include <istream>
+#include <string>
+#include <vector>
+
+// A response which is one large top-level JSON array: feed() only finds
+// the boundaries of each element (by brackets and strings, nothing is
+// decoded), and the elements are converted on a pool of worker threads,
+// as for FlatbuffersStreamingNdjsonVisitor, which also bounds the number of
+// queued elements. Each element is a separate document, matched against
+// root/error paths relative to the element. Callbacks are delivered
+// strictly in input order, and stop once a callback returns false.
+template<typename MessageT, typename ErrorT>
+class FlatbuffersStreamingJsonArrayVisitor
+{
+private:
+  FlatbuffersStreamingJsonArrayVisitor(const FlatbuffersStreamingJsonArrayVisitor &);
+  FlatbuffersStreamingJsonArrayVisitor &operator=(const FlatbuffersStreamingJsonArrayVisitor &);
+
+  // do include space for null terminating byte
+  const char TAG[37] = "FlatbuffersStreamingJsonArrayVisitor";
+
+  enum Expect
+  {
+    ExpectArrayStart,
+    ExpectElement,
+    ExpectNothing,
+  };
+
+  FlatbuffersStreamingNdjsonVisitor<MessageT, ErrorT> records;
+
+  // Splitter state, kept across calls to feed()
+  Expect expect = ExpectArrayStart;
+  std::string partial_element;
+  bool in_element = false;
+  bool is_element_closed = false;
+  bool is_after_comma = false;
+  int depth = 0;
+  bool in_string = false;
+  bool escape = false;
+  bool is_split_error = false;
+
+  // A callback returned false, the rest of the input is ignored
+  bool is_cancelled = false;
+
+  // parse_stream reads into this buffer
+  static constexpr size_t read_buffer_size = 4096;
+  std::string read_buffer;
+
+public:
+  FlatbuffersStreamingJsonArrayVisitor(
+    FlatbuffersStreamingJsonParser& _flatbuffers_parser,
+    size_t worker_count=2,
+    size_t max_queued=64
+  )
+  : records(_flatbuffers_parser, worker_count, max_queued)
+  {
+  }
+
+  // Must not be called while a previous stream is still being delivered
+  void begin_stream(
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageT&)> _callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
+  {
+    records.begin_stream(_root_path, _callback, _error_path, _errback);
+
+    expect = ExpectArrayStart;
+    partial_element.clear();
+    in_element = false;
+    is_element_closed = false;
+    is_after_comma = false;
+    depth = 0;
+    in_string = false;
+    escape = false;
+    is_split_error = false;
+    is_cancelled = false;
+  }
+
+  // Queues each complete element, waiting only for room in the queue
+  bool feed(std::experimental::string_view buf)
+  {
+    if (!is_split_error && !is_cancelled && !split(buf.data(), buf.data() + buf.size()))
+    {
+      ESP_LOGE(TAG, "Unable to split JSON array");
+      is_split_error = true;
+    }
+
+    // Conversion errors are reported once the records are delivered
+    return (!is_split_error && !is_cancelled);
+  }
+
+  // Waits for all callbacks, items before an error are still delivered
+  bool finish()
+  {
+    if (!is_split_error && !is_cancelled && (expect != ExpectNothing))
+    {
+      ESP_LOGE(TAG, "Unexpected end of JSON array");
+      is_split_error = true;
+    }
+
+    auto ok = records.finish();
+    return (ok && !is_split_error);
+  }
+
+  bool parse_stream(
+    std::istream& resp,
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageT&)> _callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
+  {
+    begin_stream(_root_path, _callback, _error_path, _errback);
+
+    read_buffer.resize(read_buffer_size);
+    while (!is_split_error && !is_cancelled && (expect != ExpectNothing))
+    {
+      auto len = resp.rdbuf()->sgetn(&read_buffer[0], read_buffer.size());
+      if (len <= 0)
+      {
+        break;
+      }
+      feed({read_buffer.data(), static_cast<size_t>(len)});
+    }
+
+    return finish();
+  }
+
+private:
+  // Elements end at a comma or bracket outside of any string or container
+  bool split(const char* p, const char* end)
+  {
+    // Start of the current element within this buffer
+    const char* element_start = in_element? p : nullptr;
+
+    while (p < end)
+    {
+      if (in_string)
+      {
+        if (escape)
+        {
+          // Any escaped character, including a quote
+          escape = false;
+          p++;
+          continue;
+        }
+
+        // Control characters are reported by the element's parser
+        p = json_scan::find_string_special(p, end);
+        if (p == end)
+        {
+          break;
+        }
+
+        if (*p == '"')
+        {
+          in_string = false;
+          is_element_closed = (depth == 0);
+        }
+        else if (*p == '\\')
+        {
+          escape = true;
+        }
+        p++;
+        continue;
+      }
+
+      if (depth > 0)
+      {
+        // Mismatched brackets are reported by the element's parser
+        p = json_scan::find_structural(p, end);
+        if (p == end)
+        {
+          break;
+        }
+
+        if (*p == '"')
+        {
+          in_string = true;
+        }
+        else if ((*p == '{') || (*p == '['))
+        {
+          depth++;
+        }
+        else if ((*p == '}') || (*p == ']'))
+        {
+          depth--;
+          is_element_closed = (depth == 0);
+        }
+        p++;
+        continue;
+      }
+
+      char c = *p;
+      if (expect == ExpectArrayStart)
+      {
+        if (json_scan::is_whitespace(c))
+        {
+          p++;
+          continue;
+        }
+        else if (c != '[')
+        {
+          return false;
+        }
+
+        expect = ExpectElement;
+        p++;
+        continue;
+      }
+      else if (expect == ExpectNothing)
+      {
+        // As with picojson, input after the root value is ignored
+        return true;
+      }
+
+      if ((c == ',') || (c == ']'))
+      {
+        if (in_element)
+        {
+          end_element(element_start, p);
+          element_start = nullptr;
+
+          if (is_cancelled)
+          {
+            return true;
+          }
+        }
+        else if ((c == ',') || is_after_comma)
+        {
+          // Missing element, or a trailing comma
+          return false;
+        }
+
+        is_after_comma = (c == ',');
+        if (c == ']')
+        {
+          expect = ExpectNothing;
+          return true;
+        }
+        p++;
+        continue;
+      }
+
+      if (json_scan::is_whitespace(c))
+      {
+        // Also ends a scalar
+        is_element_closed = in_element;
+        p++;
+        continue;
+      }
+
+      if (is_element_closed || (c == '}'))
+      {
+        // e.g. [1 2]
+        return false;
+      }
+
+      if (!in_element)
+      {
+        in_element = true;
+        element_start = p;
+      }
+
+      if (c == '"')
+      {
+        in_string = true;
+      }
+      else if ((c == '{') || (c == '['))
+      {
+        depth++;
+      }
+      p++;
+    }
+
+    if (element_start != nullptr)
+    {
+      partial_element.append(element_start, end - element_start);
+    }
+
+    return true;
+  }
+
+  void end_element(const char* element_start, const char* element_end)
+  {
+    if (element_start != nullptr)
+    {
+      partial_element.append(element_start, element_end - element_start);
+    }
+
+    is_cancelled = !records.feed_document(partial_element);
+
+    in_element = false;
+    is_element_closed = false;
+  }
+};
@@ -0,0 +1,366 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_json_builder.h"
+#include "flatbuffers_parser.h"
+#include "flatbuffers_streaming_json_parser.h"
+#include "flatbuffers_streaming_json_visitor_base.h"
+#include "json_path_matcher.h"
+
+#include <experimental/string_view>
+
+#include "delegate.hpp"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// As FlatbuffersStreamingJsonVisitor, for any number of object API types:
+// each bound path routes the values it matches to its own callback, as one
+// of ObjTs, in a single pass over the input. Paths are matched as root_path
+// is, and if several paths match the same value, the first one bound wins.
+// A path which could match inside of another path's values (or contain
+// them) is not bound, since each value is converted by one route only.
+// e.g.
+//   FlatbuffersStreamingJsonMultiVisitor<UserT, GroupT> visitor(parser);
+//   visitor.bind<UserT>({"users", "*", "name"}, on_user);
+//   visitor.bind<GroupT>({"groups", "*", "id"}, on_group);
+//   visitor.parse_stream(resp);
+template<typename... ObjTs>
+class FlatbuffersStreamingJsonMultiVisitor
+: public FlatbuffersStreamingJsonVisitorBase<
+    FlatbuffersStreamingJsonMultiVisitor<ObjTs...>
+  >
+{
+public:
+  static constexpr size_t type_count = sizeof...(ObjTs);
+
+private:
+  typedef FlatbuffersStreamingJsonVisitorBase<
+    FlatbuffersStreamingJsonMultiVisitor<ObjTs...>
+  > Base;
+  friend Base;
+
+  using Base::TAG;
+  using Base::flatbuffers_parser;
+  using Base::paths_changed;
+  using Base::path_states;
+  using Base::begin;
+  using Base::parse;
+  using Base::convert_flatbuffer;
+
+  FlatbuffersStreamingJsonMultiVisitor(const FlatbuffersStreamingJsonMultiVisitor &);
+  FlatbuffersStreamingJsonMultiVisitor &operator=(const FlatbuffersStreamingJsonMultiVisitor &);
+
+  // Position of T in Ts
+  template<typename T, typename... Ts>
+  struct TypeIndex;
+
+  template<typename T, typename... Ts>
+  struct TypeIndex<T, T, Ts...>
+  : std::integral_constant<size_t, 0>
+  {
+  };
+
+  template<typename T, typename U, typename... Ts>
+  struct TypeIndex<T, U, Ts...>
+  : std::integral_constant<size_t, 1 + TypeIndex<T, Ts...>::value>
+  {
+  };
+
+  // Callbacks and output state for one of ObjTs
+  template<typename ObjT>
+  struct Binding
+  {
+    typedef ObjT ObjectT;
+    typedef typename ObjT::TableType TableT;
+
+    // Per route, only one of each pair is set
+    std::vector<delegate<bool(const ObjT&)>> callbacks;
+    std::vector<delegate<bool(const TableT&)>> table_callbacks;
+
+    const reflection::Object* table = nullptr;
+    FlatbuffersJsonBuilder builder;
+  };
+
+  // A bound path, the selector value is its index in routes
+  struct Route
+  {
+    std::vector<std::string> path;
+    size_t type_index;
+    size_t callback_index;
+  };
+
+  std::tuple<Binding<ObjTs>...> bindings;
+  std::vector<Route> routes;
+
+  // Output state, the route of the current item or -1
+  int item_route = -1;
+
+public:
+  FlatbuffersStreamingJsonMultiVisitor(
+    FlatbuffersStreamingJsonParser& _flatbuffers_parser
+  )
+  : Base(_flatbuffers_parser, "FlatbuffersStreamingJsonMultiVisitor")
+  {
+  }
+
+  // Values matching path are converted to ObjT, and passed to callback.
+  // Returns false, without binding it, if path is nested with another route
+  template<typename ObjT>
+  bool bind(
+    const std::vector<std::string>& path,
+    delegate<bool(const ObjT&)> callback
+  )
+  {
+    auto& binding = std::get<Binding<ObjT>>(bindings);
+    if (!add_route(path, TypeIndex<ObjT, ObjTs...>::value, binding.callbacks.size()))
+    {
+      return false;
+    }
+
+    binding.callbacks.push_back(callback);
+    binding.table_callbacks.push_back(nullptr);
+    return true;
+  }
+
+  // As bind, but the callback receives a view into the flatbuffer
+  // (no object API copies), which is only valid during the callback
+  template<typename ObjT>
+  bool bind_views(
+    const std::vector<std::string>& path,
+    delegate<bool(const typename ObjT::TableType&)> table_callback
+  )
+  {
+    auto& binding = std::get<Binding<ObjT>>(bindings);
+    if (!add_route(path, TypeIndex<ObjT, ObjTs...>::value, binding.callbacks.size()))
+    {
+      return false;
+    }
+
+    binding.callbacks.push_back(nullptr);
+    binding.table_callbacks.push_back(table_callback);
+    return true;
+  }
+
+  void clear_bindings()
+  {
+    routes.clear();
+    for_each_binding([](auto& binding)
+    {
+      binding.callbacks.clear();
+      binding.table_callbacks.clear();
+    });
+    paths_changed = true;
+  }
+
+  void clear()
+  {
+    Base::clear_input();
+
+    // Output state
+    item_route = -1;
+
+    // Reflection state, shared with the builders as is its field name interner
+    auto schema = flatbuffers_parser.get_flatbuffers_schema();
+    auto table_index = this->get_table_index();
+    for_each_binding([this, schema, table_index](auto& binding)
+    {
+      typedef typename std::decay<decltype(binding)>::type::TableT TableT;
+
+      binding.table = flatbuffers_parser.get_flatbuffers_table_by_name(
+        TableT::GetFullyQualifiedName()
+      );
+      binding.builder.set_schema(schema, table_index);
+    });
+  }
+
+  bool parse_stream(std::istream& resp)
+  {
+    // Reset existing state
+    clear();
+
+    return parse(resp);
+  }
+
+  // Push-mode alternative to parse_stream, as for
+  // FlatbuffersStreamingJsonVisitor::begin_stream
+  void begin_stream()
+  {
+    // Reset existing state
+    clear();
+
+    begin();
+  }
+
+private:
+  // Whether one path can match inside of the values of the other
+  static bool
+  is_nested_path(
+    const std::vector<std::string>& a,
+    const std::vector<std::string>& b
+  )
+  {
+    if (a.size() == b.size())
+    {
+      return false;
+    }
+
+    const auto& shorter = (a.size() < b.size())? a : b;
+    const auto& longer = (a.size() < b.size())? b : a;
+    return std::equal(
+      shorter.begin(),
+      shorter.end(),
+      longer.begin(),
+      [](const std::string& x, const std::string& y)
+      {
+        return (equality_or_wildcard(x, y) || equality_or_wildcard(y, x));
+      }
+    );
+  }
+
+  bool
+  add_route(
+    const std::vector<std::string>& path,
+    size_t type_index,
+    size_t callback_index
+  )
+  {
+    for (const auto& route : routes)
+    {
+      if (is_nested_path(path, route.path))
+      {
+        ESP_LOGE(TAG, "Path is nested with a bound path, not binding it");
+        return false;
+      }
+    }
+
+    routes.push_back({path, type_index, callback_index});
+    paths_changed = true;
+    return true;
+  }
+
+  void
+  add_selectors(JsonPathMatcher& matcher)
+  {
+    for (size_t i = 0; i < routes.size(); ++i)
+    {
+      matcher.add_selector(routes[i].path, i);
+    }
+  }
+
+  template<typename Fn>
+  void
+  for_each_binding(Fn&& fn)
+  {
+    int expand[] = {0, (fn(std::get<Binding<ObjTs>>(bindings)), 0)...};
+    (void)expand;
+  }
+
+  // Calls fn with the binding at a runtime index
+  template<typename Fn>
+  void
+  with_binding(size_t index, Fn&& fn)
+  {
+    with_binding(index, fn, std::integral_constant<size_t, 0>());
+  }
+
+  template<typename Fn, size_t I>
+  void
+  with_binding(size_t index, Fn& fn, std::integral_constant<size_t, I>)
+  {
+    if (index == I)
+    {
+      fn(std::get<I>(bindings));
+    }
+    else {
+      with_binding(index, fn, std::integral_constant<size_t, I + 1>());
+    }
+  }
+
+  template<typename Fn>
+  void
+  with_binding(size_t, Fn&, std::integral_constant<size_t, type_count>)
+  {
+  }
+
+  template<typename Fn>
+  void
+  build(Fn&& fn)
+  {
+    if (item_route < 0)
+    {
+      return;
+    }
+
+    with_binding(routes[item_route].type_index, [&fn](auto& binding)
+    {
+      fn(binding.builder);
+    });
+  }
+
+  void
+  start_item(int route, const std::string& key)
+  {
+    item_route = route;
+
+    bool is_root = (path_states.size() <= 1);
+    with_binding(routes[route].type_index, [is_root, &key](auto& binding)
+    {
+      if (is_root)
+      {
+        binding.builder.start(binding.table);
+      }
+      else {
+        // Wrap the value as {key: value}, or {"id": key, "val": value}
+        binding.builder.start(binding.table, key);
+      }
+    });
+  }
+
+  void
+  match_in_item(int)
+  {
+    // Routes are never nested, see add_route
+  }
+
+  bool
+  process_item()
+  {
+    bool ok = false;
+
+    const auto& route = routes[item_route];
+    with_binding(route.type_index, [this, &ok, &route](auto& binding)
+    {
+      ok = convert_flatbuffer(
+        binding.builder,
+        binding.callbacks[route.callback_index],
+        binding.table_callbacks[route.callback_index]
+      );
+    });
+
+    // Reset the item state
+    item_route = -1;
+
+    return ok;
+  }
+
+  bool
+  end_of_input()
+  {
+    return true;
+  }
+};
@@ -9,7 +9,7 @@
  */
 #include "flatbuffers_streaming_json_parser.h"
 
-#include "flatbuffers/reflection_generated.h"
+#include "json_push_parser.h"
 
 #include <stdint.h>
 
@@ -17,23 +17,15 @@ constexpr char FlatbuffersStreamingJsonParser::TAG[];
 
 FlatbuffersStreamingJsonParser::FlatbuffersStreamingJsonParser(
   std::experimental::string_view text_schema,
-  std::experimental::string_view binary_schema
+  std::experimental::string_view binary_schema,
+  SchemaStorage storage
 )
 {
-  // Allow trailing commas, and optional quotes around identifiers/values
-  flatbuffers_parser.opts.strict_json = false;
-
-  // Support additional (ignored) fields present in JSON but not in the schema
-  flatbuffers_parser.opts.skip_unexpected_fields_in_json = true;
-
-  did_parse_text_schema = parse_flatbuffers_text_schema(text_schema);
-  if (did_parse_text_schema)
-  {
-    // Success
-    ESP_LOGI(TAG, "Successfully parsed text flatbuffer schema buffer");
-  }
-
-  did_parse_binary_schema = parse_flatbuffers_binary_schema(binary_schema);
+  did_parse_binary_schema = parse_flatbuffers_binary_schema(
+    binary_schema,
+    text_schema,
+    storage
+  );
   if (did_parse_binary_schema)
   {
     // Success
@@ -44,16 +36,60 @@ FlatbuffersStreamingJsonParser::FlatbuffersStreamingJsonParser(
   }
 }
 
+FlatbuffersStreamingJsonParser::FlatbuffersStreamingJsonParser(
+  std::experimental::string_view binary_schema,
+  SchemaStorage storage
+)
+: FlatbuffersStreamingJsonParser({}, binary_schema, storage)
+{
+}
+
+FlatbuffersStreamingJsonParser::FlatbuffersStreamingJsonParser(
+  const FlatbuffersSchema& _shared_schema
+)
+: did_parse_binary_schema(_shared_schema.schema != nullptr)
+, shared_schema(&_shared_schema)
+, schema(_shared_schema.schema)
+{
+  json_builder.set_schema(schema, &_shared_schema.table_index);
+}
+
+std::unique_ptr<FlatbuffersStreamingJsonParser>
+FlatbuffersStreamingJsonParser::clone() const
+{
+  if (shared_schema == nullptr)
+  {
+    ESP_LOGE(TAG, "Parser not ready");
+    return nullptr;
+  }
+
+  return std::unique_ptr<FlatbuffersStreamingJsonParser>(
+    new FlatbuffersStreamingJsonParser(*shared_schema)
+  );
+}
+
 bool
 FlatbuffersStreamingJsonParser::is_ready() const
 {
-  return (did_parse_text_schema & did_parse_binary_schema);
+  return did_parse_binary_schema;
+}
+
+const flatbuffers::Parser*
+FlatbuffersStreamingJsonParser::get_flatbuffers_parser()
+{
+  return parse_flatbuffers_text_schema()? flatbuffers_parser.get() : nullptr;
+}
+
+const reflection::Schema*
+FlatbuffersStreamingJsonParser::get_flatbuffers_schema() const
+{
+  return schema;
 }
 
-const flatbuffers::Parser&
-FlatbuffersStreamingJsonParser::get_flatbuffers_parser() const
+const FlatbuffersSchema*
+FlatbuffersStreamingJsonParser::get_shared_schema() const
 {
-  return flatbuffers_parser;
+  return shared_schema;
 }
 
 const reflection::Object*
@@ -64,36 +100,77 @@ FlatbuffersStreamingJsonParser::get_flatbuffers_table(
   return schema? schema->objects()->Get(index) : (reflection::Object*)nullptr;
 }
 
+const reflection::Object*
+FlatbuffersStreamingJsonParser::get_flatbuffers_table_by_name(
+  const char* name
+) const
+{
+  // Objects are sorted by their fully qualified name
+  return schema? schema->objects()->LookupByKey(name) : nullptr;
+}
+
 const reflection::Object*
 FlatbuffersStreamingJsonParser::get_flatbuffers_root_table() const
 {
   return schema? schema->root_table() : nullptr;
 }
 
-bool
-FlatbuffersStreamingJsonParser::parse_flatbuffers_text_schema(
-  std::experimental::string_view buf
+std::experimental::string_view
+FlatbuffersStreamingJsonParser::build_from_json(
+  const char* root_type,
+  std::experimental::string_view json
 )
 {
-  // Load flatbuffers text schema file from buffer
+  auto root_table = get_flatbuffers_table_by_name(root_type);
+  if (root_table == nullptr)
+  {
+    return {};
+  }
+
+  JsonPushParser<FlatbuffersJsonBuilder> json_parser(json_builder);
+  json_builder.start(root_table);
+
+  if (json_parser.feed(json) && json_parser.finish() && json_builder.is_complete())
+  {
+    return json_builder.get_buffer();
+  }
+
+  return {};
+}
+
+bool
+FlatbuffersStreamingJsonParser::parse_flatbuffers_text_schema()
+{
+  if (did_parse_text_schema)
+  {
+    return true;
+  }
+
+  // Load flatbuffers text schema from the shared copy
   // Check for a non-zero buffer length
-  if (!buf.empty())
+  if ((shared_schema != nullptr) && !shared_schema->text_schema.empty())
   {
-    // Check for a nullptr terminated buffer
-    char eof = buf[buf.size() - 1];
-    if (eof == 0x00)
+    flatbuffers_parser.reset(new flatbuffers::Parser);
+
+    // Allow trailing commas, and optional quotes around identifiers/values
+    flatbuffers_parser->opts.strict_json = false;
+
+    // Support additional (ignored) fields present in JSON but not in the schema
+    flatbuffers_parser->opts.skip_unexpected_fields_in_json = true;
+
+    bool ok = flatbuffers_parser->Parse(
+      shared_schema->text_schema.data(),
+      nullptr
+    );
+    if (ok)
     {
-      bool ok = flatbuffers_parser.Parse(buf.data(), nullptr);
-      if (ok)
-      {
-        return true;
-      }
-      else {
-        ESP_LOGE(TAG, "Invalid text flatbuffer schema buffer");
-      }
+      ESP_LOGI(TAG, "Successfully parsed text flatbuffer schema buffer");
+      did_parse_text_schema = true;
+      return true;
     }
     else {
-      ESP_LOGE(TAG, "nullptr byte missing from text flatbuffer schema buffer");
+      ESP_LOGE(TAG, "Invalid text flatbuffer schema buffer");
+      flatbuffers_parser.reset();
     }
   }
   else {
@@ -105,10 +182,12 @@ FlatbuffersStreamingJsonParser::parse_flatbuffers_text_schema(
 
 bool
 FlatbuffersStreamingJsonParser::parse_flatbuffers_binary_schema(
-  std::experimental::string_view buf
+  std::experimental::string_view buf,
+  std::experimental::string_view text_schema,
+  SchemaStorage storage
 )
 {
-  // Load flatbuffers text schema file from buffer
+  // Load flatbuffers binary schema file from buffer
   // Check for a non-zero buffer length
   if (!buf.empty())
   {
@@ -116,24 +195,23 @@ FlatbuffersStreamingJsonParser::parse_flatbuffers_binary_schema(
     char eof = buf[buf.size() - 1];
     if (eof == 0x00)
     {
-      // Verify the buffer as valid flatbuffer
-      flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(buf.data()), buf.size());
-      if (reflection::VerifySchemaBuffer(verifier))
+      // Verified once, and then shared by all parsers using this schema
+      auto& registry = FlatbuffersSchemaRegistry::get_instance();
+      shared_schema = (storage == StaticSchema)?
+        registry.get_static_schema(buf, text_schema) :
+        registry.get_schema(buf, text_schema);
+      if (shared_schema != nullptr)
       {
-        // Parse a buffer containing the binary schema
-        schema = reflection::GetSchema(buf.data());
-        if (schema != nullptr)
-        {
-          return true;
-        }
+        schema = shared_schema->schema;
+        json_builder.set_schema(schema, &shared_schema->table_index);
+        return true;
       }
       else {
         ESP_LOGE(TAG, "Invalid binary flatbuffer schema buffer");
       }
     }
     else {
-      ESP_LOGE(TAG, "nullptr byte missing from text flatbuffer schema buffer");
+      ESP_LOGE(TAG, "nullptr byte missing from binary flatbuffer schema buffer");
     }
   }
   else {
@@ -13,7 +13,9 @@
 #include "flatbuffers/base.h"
 #include "flatbuffers/flatbuffers.h"
 
+#include "flatbuffers_json_builder.h"
 #include "flatbuffers_parser.h"
+#include "flatbuffers_schema_registry.h"
 
 #undef STRUCT_END
 
@@ -22,53 +24,99 @@
 
 #include "esp_log.h"
 
+#include <memory>
 #include <string>
 
+// Reflection tables come from the binary schema, shared by all instances
+// through FlatbuffersSchemaRegistry. The text schema is only needed as a
+// fallback by parse(json), and is not parsed until then.
+// An instance must only be used by one thread at a time, use clone() to
+// get another instance for a different thread (sharing the schema).
 class FlatbuffersStreamingJsonParser
 {
 public:
+  // Schema buffers which outlive the registry (e.g. embedded files) are
+  // used in place, others are copied
+  enum SchemaStorage
+  {
+    CopySchema,
+    StaticSchema,
+  };
+
   FlatbuffersStreamingJsonParser(
     std::experimental::string_view text_schema,
-    std::experimental::string_view binary_schema
+    std::experimental::string_view binary_schema,
+    SchemaStorage storage=CopySchema
+  );
+
+  explicit FlatbuffersStreamingJsonParser(
+    std::experimental::string_view binary_schema,
+    SchemaStorage storage=CopySchema
   );
 
+  explicit FlatbuffersStreamingJsonParser(const FlatbuffersSchema& _shared_schema);
+
+  // Shares the schema, without verifying it again
+  std::unique_ptr<FlatbuffersStreamingJsonParser> clone() const;
+
   // do include space for null terminating byte
   static constexpr char TAG[] = "FlatbuffersStreamingJsonParser";
 
   bool is_ready() const;
 
-  const flatbuffers::Parser& get_flatbuffers_parser() const;
+  // Parses the text schema on first use, nullptr if unavailable
+  const flatbuffers::Parser* get_flatbuffers_parser();
+
+  const reflection::Schema* get_flatbuffers_schema() const;
+  const FlatbuffersSchema* get_shared_schema() const;
 
   const reflection::Object* get_flatbuffers_table(flatbuffers::uoffset_t index) const;
+  const reflection::Object* get_flatbuffers_table_by_name(const char* name) const;
   const reflection::Object* get_flatbuffers_root_table() const;
 
   template<typename ObjT>
   std::experimental::optional<ObjT>
   parse(const std::string& json)
   {
-    bool ok = is_ready();
+    if (!is_ready())
+    {
+      ESP_LOGE(TAG, "Parser not ready");
+      return std::experimental::nullopt;
+    }
+
+    auto root_type = ObjT::TableType::GetFullyQualifiedName();
+
+    // Build directly from the reflection schema, re-using the builder capacity
+    auto buf = build_from_json(root_type, json);
+    if (!buf.empty())
+    {
+      // Built here, so it doesn't need to be verified again
+      return FlatbuffersParser::parse_trusted<ObjT>(buf);
+    }
+
+    // Fall back to the text schema parser, which accepts non-strict JSON
+    bool ok = parse_flatbuffers_text_schema();
     // Attempt to parse the JSON stream into a flatbuffer of template type
     if (ok)
     {
-      auto root_type = ObjT::TableType::GetFullyQualifiedName();
       // Determine whether to expect to parse an Error type or a Message type
-      ok = flatbuffers_parser.SetRootType(root_type);
+      ok = flatbuffers_parser->SetRootType(root_type);
 
       // We are set up for the root type of flatbuffer now
       if (ok)
       {
         // Parse JSON output stream into flatbuffer
-        ok = flatbuffers_parser.Parse(json.c_str(), nullptr);
+        ok = flatbuffers_parser->Parse(json.c_str(), nullptr);
 
         if (ok)
         {
           // Parse if possible, return whether it was successful
-          return FlatbuffersParser::parse<ObjT>(
+          return FlatbuffersParser::parse_trusted<ObjT>(
             std::experimental::string_view(
               reinterpret_cast<const char*>(
-                flatbuffers_parser.builder_.GetBufferPointer()
+                flatbuffers_parser->builder_.GetBufferPointer()
               ),
-              flatbuffers_parser.builder_.GetSize()
+              flatbuffers_parser->builder_.GetSize()
             )
           );
         }
@@ -88,19 +136,39 @@ public:
       }
     }
     else {
-      ESP_LOGE(TAG, "Parser not ready");
+      ESP_LOGE(TAG,
+        "Couldn't parse JSON string '%s' into valid flatbuffer of type '%s'",
+        json.c_str(),
+        root_type
+      );
     }
 
     return std::experimental::nullopt;
   }
 
 private:
-  bool parse_flatbuffers_text_schema(std::experimental::string_view buf);
-  bool parse_flatbuffers_binary_schema(std::experimental::string_view buf);
+  // Empty if the JSON is invalid for this type
+  std::experimental::string_view build_from_json(
+    const char* root_type,
+    std::experimental::string_view json
+  );
+
+  bool parse_flatbuffers_text_schema();
+  bool parse_flatbuffers_binary_schema(
+    std::experimental::string_view buf,
+    std::experimental::string_view text_schema,
+    SchemaStorage storage
+  );
 
   bool did_parse_text_schema = false;
   bool did_parse_binary_schema = false;
 
-  const reflection::Schema* schema;
-  flatbuffers::Parser flatbuffers_parser;
+  const FlatbuffersSchema* shared_schema = nullptr;
+  const reflection::Schema* schema = nullptr;
+
+  // Used by parse(json), retaining its capacity between calls
+  FlatbuffersJsonBuilder json_builder;
+
+  // Only created if parse(json) needs to fall back to the text schema
+  std::unique_ptr<flatbuffers::Parser> flatbuffers_parser;
 };
@@ -9,15 +9,14 @@
  */
 #pragma once
 
+#include "flatbuffers_json_builder.h"
 #include "flatbuffers_streaming_json_parser.h"
-
-#include "picojson.h"
+#include "flatbuffers_streaming_json_visitor_base.h"
+#include "flatbuffers_table_decoder.h"
 
 #include "flatbuffers/idl.h"
-// read streaming JSON into dynamically built flatbuffer:
+// build flatbuffers directly from streaming JSON:
 #include "flatbuffers/reflection.h"
-// simple output to JSON string:
-#include "flatbuffers/minireflect.h"
 
 #include <experimental/string_view>
 
@@ -25,94 +24,163 @@
 
 #include "esp_log.h"
 
-#include <sstream>
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
-inline bool
-equality_or_wildcard(
-  std::experimental::string_view root,
-  std::experimental::string_view current
-);
-
-inline bool
-is_a_subpath(
-  const std::vector<std::string>& current_path,
-  const std::vector<std::string>& root_path
-);
-
 template<typename MessageT, typename ErrorT>
 class FlatbuffersStreamingJsonVisitor
+: public FlatbuffersStreamingJsonVisitorBase<
+    FlatbuffersStreamingJsonVisitor<MessageT, ErrorT>
+  >
 {
+public:
+  typedef typename MessageT::TableType MessageTableT;
+  typedef typename ErrorT::TableType ErrorTableT;
+
 private:
+  typedef FlatbuffersStreamingJsonVisitorBase<
+    FlatbuffersStreamingJsonVisitor<MessageT, ErrorT>
+  > Base;
+  friend Base;
+
+  using Base::TAG;
+  using Base::flatbuffers_parser;
+  using Base::is_parse_error;
+  using Base::paths_changed;
+  using Base::path_states;
+  using Base::in_item;
+  using Base::begin;
+  using Base::parse;
+  using Base::convert_flatbuffer;
+
   FlatbuffersStreamingJsonVisitor(const FlatbuffersStreamingJsonVisitor &);
   FlatbuffersStreamingJsonVisitor &operator=(const FlatbuffersStreamingJsonVisitor &);
 
-  // do include space for null terminating byte
-  const char TAG[32] = "FlatbuffersStreamingJsonVisitor";
-
   std::vector<std::string> root_path;
   delegate<bool(const MessageT&)> callback;
 
   std::vector<std::string> error_path;
   delegate<bool(const ErrorT&)> errback;
 
-  FlatbuffersStreamingJsonParser& flatbuffers_parser;
+  // Zero-copy alternatives, used instead of the above if set
+  delegate<bool(const MessageTableT&)> table_callback;
+  delegate<bool(const ErrorTableT&)> table_errback;
 
-  bool is_parse_error = false;
+  // Batch alternative: messages are unpacked into batch, and passed on
+  // batch_size at a time (and the remainder at the end of the input)
+  delegate<bool(const std::vector<MessageT>&)> batch_callback;
+  size_t batch_size = 0;
+  std::vector<MessageT> batch;
 
   // Trigger errback instead of callback when error path matches
   bool is_error_path = false;
 
-  // Input parsing state
-  int object_depth = 0;
-  int array_depth = 0;
-  int object_idx = 0;
-  int array_idx = 0;
-  std::vector<std::string> current_path;
-  std::string current_key;
+  // Error path can match inside of a message, so build both types
+  bool is_error_path_nested = false;
+
+  // Additional paths, matched in the same pass as root_path/error_path
+  std::vector<std::vector<std::string>> extra_root_paths;
+  std::vector<std::vector<std::string>> extra_error_paths;
+
+  // Values of the paths, in the matcher
+  enum PathSelector
+  {
+    message_selector,
+    error_selector,
+  };
+
+  // Body of an application/x-flatbuffers response, kept for its capacity
+  static constexpr size_t flatbuffer_read_size = 1024;
+  std::string flatbuffer_body;
 
   // Output state
-  std::ostringstream ss;
-  bool emit_json = false;
-  bool needs_close_array = false;
-  bool needs_close_object = false;
+  bool build_message = false;
+  bool build_error = false;
+  FlatbuffersJsonBuilder message_builder;
+  FlatbuffersJsonBuilder error_builder;
+
+  // Used instead of the builders, only once enabled by use_table_decoders
+  std::unique_ptr<FlatbuffersTableDecoder> message_decoder;
+  std::unique_ptr<FlatbuffersTableDecoder> error_decoder;
 
   // Reflection state
-  const reflection::Object* reflection_table = nullptr;
+  const reflection::Object* message_table = nullptr;
+  const reflection::Object* error_table = nullptr;
 
 public:
   FlatbuffersStreamingJsonVisitor(
     FlatbuffersStreamingJsonParser& _flatbuffers_parser
   )
-  : flatbuffers_parser(_flatbuffers_parser)
+  : Base(_flatbuffers_parser, "FlatbuffersStreamingJsonVisitor")
   {
   }
 
   void clear()
   {
-    // Reset error state
-    is_parse_error = false;
+    Base::clear_input();
 
     // Trigger errback instead of callback when error path matches
     is_error_path = false;
 
-    // Input parsing state
-    object_depth = 0;
-    array_depth = 0;
-    object_idx = 0;
-    array_idx = 0;
-    current_path.clear();
-    current_key.clear();
-
     // Output state
-    ss.str("");
-    emit_json = false;
-    needs_close_array = false;
-    needs_close_object = false;
+    build_message = false;
+    build_error = false;
+
+    // Callbacks
+    callback.reset();
+    errback.reset();
+    table_callback.reset();
+    table_errback.reset();
+    batch_callback.reset();
+
+    // Retains allocated capacity for the next batch
+    batch.clear();
 
     // Reflection state
-    reflection_table = flatbuffers_parser.get_flatbuffers_root_table();;
+    message_table = flatbuffers_parser.get_flatbuffers_table_by_name(
+      MessageT::TableType::GetFullyQualifiedName()
+    );
+    error_table = flatbuffers_parser.get_flatbuffers_table_by_name(
+      ErrorT::TableType::GetFullyQualifiedName()
+    );
+
+    // Shared with the builders, as is its field name interner
+    auto table_index = this->get_table_index();
+    message_builder.set_schema(
+      flatbuffers_parser.get_flatbuffers_schema(),
+      table_index
+    );
+    error_builder.set_schema(
+      flatbuffers_parser.get_flatbuffers_schema(),
+      table_index
+    );
+  }
+
+  // Decode flat messages/errors (scalar, enum and string fields only) with
+  // FlatbuffersTableDecoder, from the generated TypeTable for MessageTableT
+  // (e.g. OIDC::TokenTypeTable()) and ErrorTableT, instead of the reflection
+  // schema. Either may be nullptr. Unsupported tables, and TypeTables which
+  // don't match the schema of their table, use the builder and return false.
+  // Applies to subsequent calls to parse_stream.
+  bool use_table_decoders(
+    const flatbuffers::TypeTable* message_type_table,
+    const flatbuffers::TypeTable* error_type_table=nullptr
+  )
+  {
+    return (
+      set_decoder(
+        message_decoder,
+        message_type_table,
+        MessageTableT::GetFullyQualifiedName()
+      ) &&
+      set_decoder(
+        error_decoder,
+        error_type_table,
+        ErrorTableT::GetFullyQualifiedName()
+      )
+    );
   }
 
   bool parse_stream(
@@ -123,400 +191,531 @@ public:
     delegate<bool(const ErrorT&)> _errback=nullptr
   )
   {
-    std::string err;
+    // Reset existing state
+    clear();
+
+    set_paths(_root_path, _error_path);
+    callback = _callback;
+    errback = _errback;
+
+    return parse(resp);
+  }
 
+  // As parse_stream, but each callback receives a view into the flatbuffer
+  // (no object API copies), which is only valid during the callback
+  bool parse_stream_views(
+    std::istream& resp,
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageTableT&)> _table_callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorTableT&)> _table_errback=nullptr
+  )
+  {
     // Reset existing state
     clear();
 
-    root_path = _root_path;
+    set_paths(_root_path, _error_path);
+    table_callback = _table_callback;
+    table_errback = _table_errback;
+
+    return parse(resp);
+  }
+
+  // As parse_stream, but messages are delivered in batches of up to
+  // _batch_size, to spread the per-item costs (errors are not batched)
+  bool parse_stream_batches(
+    std::istream& resp,
+    const std::vector<std::string>& _root_path,
+    delegate<bool(const std::vector<MessageT>&)> _batch_callback,
+    size_t _batch_size=256,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
+  {
+    // Reset existing state
+    clear();
+
+    set_paths(_root_path, _error_path);
+    batch_callback = _batch_callback;
+    batch_size = std::max<size_t>(_batch_size, 1);
+    errback = _errback;
+
+    return parse(resp);
+  }
+
+  // Push-mode alternative to parse_stream, for non-blocking input:
+  // call begin_stream, then feed() with each buffer as it arrives
+  // (split anywhere), then finish() at the end of the response
+  void begin_stream(
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageT&)> _callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
+  {
+    // Reset existing state
+    clear();
+
+    set_paths(_root_path, _error_path);
     callback = _callback;
-    error_path = _error_path;
     errback = _errback;
 
-    picojson::_parse(
-      *this,
-      std::istreambuf_iterator<char>(resp.rdbuf()),
-      std::istreambuf_iterator<char>(),
-      &err);
+    begin();
+  }
 
-    if (!err.empty())
-    {
-      ESP_LOGE(TAG, "Unable to parse JSON response, err = %s", err.c_str());
-    }
+  void begin_stream_views(
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageTableT&)> _table_callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorTableT&)> _table_errback=nullptr
+  )
+  {
+    // Reset existing state
+    clear();
 
-    return (
-      (err.empty() == true) &&
-      (is_parse_error == false)
-    );
+    set_paths(_root_path, _error_path);
+    table_callback = _table_callback;
+    table_errback = _table_errback;
+
+    begin();
   }
 
-  bool
-  set_null()
+  void begin_stream_batches(
+    const std::vector<std::string>& _root_path,
+    delegate<bool(const std::vector<MessageT>&)> _batch_callback,
+    size_t _batch_size=256,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
   {
-    if (emit_json)
-    {
-      ss << "null";
-    }
-    return true;
+    // Reset existing state
+    clear();
+
+    set_paths(_root_path, _error_path);
+    batch_callback = _batch_callback;
+    batch_size = std::max<size_t>(_batch_size, 1);
+    errback = _errback;
+
+    begin();
   }
 
-  bool
-  set_bool(bool b)
+  // For a response which is already a flatbuffer (application/x-flatbuffers)
+  // instead of JSON: nothing is tokenized or converted, the body is only
+  // verified, then its root is passed to the callback, or to the errback
+  // if is_error (e.g. for an HTTP error status). Paths do not apply.
+  bool parse_flatbuffer(
+    std::istream& resp,
+    bool is_error,
+    delegate<bool(const MessageT&)> _callback=nullptr,
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
   {
-    if (emit_json)
+    if (!read_flatbuffer(resp))
     {
-      ss << (b? "true" : "false");
+      return false;
     }
-    return true;
+
+    return is_error?
+      convert_response_flatbuffer<ErrorT>(_errback, nullptr) :
+      convert_response_flatbuffer<MessageT>(_callback, nullptr);
   }
 
-  bool
-  set_int64(int64_t i)
+  // As parse_flatbuffer, with views into the received buffer
+  bool parse_flatbuffer_views(
+    std::istream& resp,
+    bool is_error,
+    delegate<bool(const MessageTableT&)> _table_callback=nullptr,
+    delegate<bool(const ErrorTableT&)> _table_errback=nullptr
+  )
   {
-    if (emit_json)
+    if (!read_flatbuffer(resp))
     {
-      ss << i;
+      return false;
     }
-    return true;
+
+    return is_error?
+      convert_response_flatbuffer<ErrorT>(nullptr, _table_errback) :
+      convert_response_flatbuffer<MessageT>(nullptr, _table_callback);
   }
 
-  bool
-  set_number(double d)
+  // Also match these paths, in subsequent calls to parse_stream
+  void add_root_path(const std::vector<std::string>& path)
   {
-    if (emit_json)
+    extra_root_paths.push_back(path);
+    paths_changed = true;
+  }
+
+  void add_error_path(const std::vector<std::string>& path)
+  {
+    extra_error_paths.push_back(path);
+    paths_changed = true;
+  }
+
+  void clear_paths()
+  {
+    extra_root_paths.clear();
+    extra_error_paths.clear();
+    paths_changed = true;
+  }
+
+private:
+  template<typename Fn>
+  void
+  build(Fn&& fn)
+  {
+    if (build_message)
     {
-      //ss << d;
-      ss << (int)(d);
+      if (message_decoder)
+      {
+        fn(*message_decoder);
+      }
+      else {
+        fn(message_builder);
+      }
+    }
+
+    if (build_error)
+    {
+      if (error_decoder)
+      {
+        fn(*error_decoder);
+      }
+      else {
+        fn(error_builder);
+      }
     }
-    return true;
   }
 
-  template <typename Iter> bool
-  parse_string(picojson::input<Iter> &in)
+  void
+  set_paths(
+    const std::vector<std::string>& _root_path,
+    const std::vector<std::string>& _error_path
+  )
   {
-    std::string s;
-    auto ok = _parse_string(s, in);
-    if (emit_json)
+    if ((root_path != _root_path) || (error_path != _error_path))
     {
-      ss << "\"" << s << "\"";
+      root_path = _root_path;
+      error_path = _error_path;
+      paths_changed = true;
     }
-    return ok;
   }
 
-  bool
-  parse_array_start()
+  void
+  add_selectors(JsonPathMatcher& matcher)
   {
-    array_depth++;
-    array_idx = 0;
+    std::vector<std::vector<std::string>> root_paths(extra_root_paths);
+    root_paths.insert(root_paths.begin(), root_path);
+
+    std::vector<std::vector<std::string>> error_paths(extra_error_paths);
+    error_paths.insert(error_paths.begin(), error_path);
+
+    is_error_path_nested = false;
 
-    if (emit_json)
+    // Error paths are added first, so they take precedence
+    for (const auto& path : error_paths)
     {
-      ss << "[";
+      if (!path.empty())
+      {
+        matcher.add_selector(path, error_selector);
+
+        // An error path below a root path can only be recognized mid-message
+        for (const auto& root : root_paths)
+        {
+          if ((path.size() > root.size()) && (is_a_subpath(path, root)))
+          {
+            is_error_path_nested = true;
+          }
+        }
+      }
+    }
+
+    // An empty root path matches the entire document
+    for (const auto& path : root_paths)
+    {
+      matcher.add_selector(path, message_selector);
     }
-    return true;
   }
 
-  template <typename Iter> bool 
-  parse_array_item(picojson::input<Iter> &in, size_t i)
+  void
+  start_item(int selector, const std::string& key)
   {
-    // print leading comma (it should have followed last parsed item)
-    if (emit_json)
+    is_error_path = (selector == error_selector);
+
+    // Build an error in parallel until the item can be classified
+    build_message = !is_error_path;
+    build_error = (is_error_path || is_error_path_nested);
+
+    if (build_message)
     {
-      if (array_idx > 0)
+      if (message_decoder)
       {
-        ss << ",";
+        start_decoder(*message_decoder, key);
+      }
+      else {
+        start_builder(message_builder, message_table, key);
       }
     }
 
-    array_idx++;
-    return _parse(*this, in);
+    if (build_error)
+    {
+      if (error_decoder)
+      {
+        start_decoder(*error_decoder, key);
+      }
+      else {
+        start_builder(error_builder, error_table, key);
+      }
+    }
   }
 
-  bool
-  parse_array_stop(size_t)
+  void
+  match_in_item(int selector)
   {
-    array_depth--;
-    array_idx = -1;
-
-    if (emit_json)
+    if (is_error_path_nested && !is_error_path && selector == error_selector)
     {
-      ss << "]";
+      // This item is an error, not a message
+      is_error_path = true;
     }
-    return true;
   }
 
   bool
-  parse_object_start()
+  set_decoder(
+    std::unique_ptr<FlatbuffersTableDecoder>& decoder,
+    const flatbuffers::TypeTable* type_table,
+    const char* table_name
+  )
   {
-    object_depth++;
-    object_idx = 0;
-
-    // We can lookahead to the fields first in parse_object_item
-    // If needed, an object '{' will be opened there
-    return true;
-  }
+    if (type_table == nullptr)
+    {
+      decoder.reset();
+      return true;
+    }
 
-  template <typename Iter> bool
-  parse_object_item(
-    picojson::input<Iter> &in,
-    const std::string &key)
-  {
-    // Store the previous reflection table,
-    // In case we recurse into a reflection sub-table
-    auto reflection_table_prev = reflection_table;
+    // Decoded buffers are trusted (not verified) as this table
+    auto table = flatbuffers_parser.get_flatbuffers_table_by_name(table_name);
+    if (!describes_table(type_table, table))
+    {
+      ESP_LOGE(TAG, "TypeTable does not match the schema of '%s'", table_name);
+      decoder.reset();
+      return false;
+    }
 
-    // Check whether we used a workaround to reformat the JSON
-    // To be more flatbuffers friendly
-    bool keyed_vector_table_found = check_for_keyed_vector_table(key);
+    if (!decoder)
+    {
+      decoder.reset(new FlatbuffersTableDecoder);
+    }
 
-    // Capture and push the current object key onto the current path
-    current_key = key;
-    current_path.push_back(current_key);
+    if (!decoder->set_type_table(type_table))
+    {
+      ESP_LOGW(TAG, "Unsupported table for FlatbuffersTableDecoder");
+      decoder.reset();
+      return false;
+    }
 
-    // Check for error path first
-    is_error_path = is_a_subpath(current_path, error_path);
+    return true;
+  }
 
-    auto emit_json_prev = emit_json;
-    // Start outputting JSON if either with error or message path
-    emit_json = (is_error_path || is_a_subpath(current_path, root_path));
+  // Each field of the TypeTable is the schema field with the same name, id
+  // and type, so decoded buffers are valid for the table
+  static bool
+  describes_table(
+    const flatbuffers::TypeTable* type_table,
+    const reflection::Object* table
+  )
+  {
+    if ((table == nullptr) || (type_table->st != flatbuffers::ST_TABLE))
+    {
+      return false;
+    }
 
-    if (emit_json)
+    for (size_t i = 0; i < type_table->num_elems; ++i)
     {
-      if (keyed_vector_table_found)
+      auto type_code = type_table->type_codes[i];
+      auto field = table->fields()->LookupByKey(type_table->names[i]);
+      if ((field == nullptr) ||
+          (field->id() != i) ||
+          type_code.is_vector ||
+          (field->type()->base_type() != (reflection::UType + type_code.base_type)))
       {
-        if (!emit_json_prev)
-        {
-          // Start (or ignore starting) an anonymous array here.
-        }
-        else if (!needs_close_array)
-        {
-          ss << "[";
-          needs_close_array = true;
-        }
-        else {
-          ss << ",";
-        }
-
-        // Print key with array/object indirection
-        ss << "{\"id\":\"" << key << "\",\"val\":";
-        needs_close_object = true;
-      }
-      else {
-        if (!needs_close_object)
-        {
-          ss << "{";
-          needs_close_object = true;
-        }
-        else {
-          ss << ",";
-        }
-
-        // Print key
-        ss << "\"" << key << "\":";
+        return false;
       }
     }
 
-    auto needs_close_array_prev = needs_close_array;
-    auto needs_close_object_prev = needs_close_object;
-    needs_close_array = false;
-    needs_close_object = false;
+    return true;
+  }
 
-    auto ok = _parse(*this, in);
+  void
+  start_decoder(
+    FlatbuffersTableDecoder& decoder,
+    const std::string& key
+  )
+  {
+    if (path_states.size() <= 1)
+    {
+      decoder.start();
+    }
+    else {
+      // Wrap the value as {key: value}
+      decoder.start(key);
+    }
+  }
 
-    needs_close_array = needs_close_array_prev;
-    needs_close_object = needs_close_object_prev;
-    reflection_table = reflection_table_prev;
+  void
+  start_builder(
+    FlatbuffersJsonBuilder& builder,
+    const reflection::Object* table,
+    const std::string& key
+  )
+  {
+    if (path_states.size() <= 1)
+    {
+      builder.start(table);
+    }
+    else {
+      // Wrap the value as {key: value}, or {"id": key, "val": value}
+      builder.start(table, key);
+    }
+  }
 
-    object_idx++;
+  bool
+  process_item()
+  {
+    bool ok = false;
 
-    // pop the key, it has now been parsed
-    current_path.pop_back();
+    if (is_error_path)
+    {
+      // Keep messages and errors in order
+      if (!flush_batch())
+      {
+        is_parse_error = true;
+      }
 
-    if (is_a_subpath(current_path, root_path))
+      ok = error_decoder?
+        convert_flatbuffer(*error_decoder, errback, table_errback) :
+        convert_flatbuffer(error_builder, errback, table_errback);
+    }
+    else if (batch_callback)
     {
+      ok = message_decoder?
+        add_to_batch(*message_decoder) :
+        add_to_batch(message_builder);
     }
     else {
-      if (emit_json) // check if we were emitting
-      {
-        if (keyed_vector_table_found == false)
-        {
-          // We will be missing one of these at this point in regular parsing
-          ss << "}";
-        }
-
-        if (process_item() == false)
-        {
-          is_parse_error = true;
-        }
-      }
-      emit_json = false;
+      ok = message_decoder?
+        convert_flatbuffer(*message_decoder, callback, table_callback) :
+        convert_flatbuffer(message_builder, callback, table_callback);
     }
 
+    // Reset the item state
+    is_error_path = false;
+    build_message = false;
+    build_error = false;
+
     return ok;
   }
 
   bool
-  parse_object_stop()
+  end_of_input()
   {
-    current_key.clear();
-
-    object_depth--;
-    object_idx = -1;
+    return flush_batch();
+  }
 
-    if (emit_json)
+  bool
+  read_flatbuffer(std::istream& resp)
+  {
+    // The stream is copied once, into flatbuffer_body (reusing its capacity),
+    // which is then verified and read in place
+    size_t len = 0;
+    while (true)
     {
-      if (needs_close_array)
-      {
-        ss << "]";
-        needs_close_array = false;
-      }
-      else if (needs_close_object)
+      flatbuffer_body.resize(len + flatbuffer_read_size);
+      auto count = resp.rdbuf()->sgetn(&flatbuffer_body[len], flatbuffer_read_size);
+      if (count <= 0)
       {
-        // We did expect at least one of these
-        ss << "}";
-
-        if (!root_path.empty())
-        {
-          // We will be missing one of these at this point in regular parsing
-          ss << "}";
-        }
-        needs_close_object = false;
-      }
-      else {
-        ss << "}";
+        break;
       }
+      len += count;
+    }
+    flatbuffer_body.resize(len);
 
-      if (object_depth == 0)
-      {
-        process_item();
-      }
+    if (flatbuffer_body.empty())
+    {
+      ESP_LOGE(TAG, "Empty flatbuffers response");
+      return false;
     }
 
     return true;
   }
 
+  template<typename ObjT>
   bool
-  process_item()
+  convert_response_flatbuffer(
+    const delegate<bool(const ObjT&)>& item_callback,
+    const delegate<bool(const typename ObjT::TableType&)>& item_table_callback
+  )
   {
-    bool ok = convert_json_stream_to_flatbuffer();
+    // Received from the network, so it must be verified
+    auto table = FlatbuffersParser::get_root<typename ObjT::TableType>(
+      flatbuffer_body
+    );
+    if (table == nullptr)
+    {
+      return false;
+    }
 
-    // reset the JSON output stream
-    ss.str("");
+    if (item_table_callback)
+    {
+      return item_table_callback(*table);
+    }
+    else if (item_callback)
+    {
+      ObjT obj;
+      table->UnPackTo(&obj);
+      return item_callback(obj);
+    }
 
-    return ok;
+    return true;
   }
 
+  template<typename BuilderT>
   bool
-  check_for_keyed_vector_table(const std::string& key)
+  add_to_batch(const BuilderT& builder)
   {
-    if (reflection_table != nullptr)
+    if (!builder.is_complete())
     {
-      auto fields = reflection_table->fields();
-      if (fields != nullptr)
-      {
-        auto id_field = fields->LookupByKey("id");
-        auto val_field = fields->LookupByKey("val");
+      ESP_LOGE(TAG,
+        "Couldn't build valid flatbuffer of type '%s'",
+        MessageTableT::GetFullyQualifiedName()
+      );
+      return false;
+    }
 
-        if ((id_field != nullptr) &&
-            (val_field != nullptr))
-        {
-          if (val_field->type()->base_type() == reflection::Obj)
-          {
-            reflection_table = flatbuffers_parser.get_flatbuffers_table(
-              val_field->type()->index()
-            );
-
-            if (reflection_table != nullptr)
-            {
-              // We found a reflection structure that can be re-written
-              return true;
-            }
-          }
-        }
-        else {
-          auto field = fields->LookupByKey(key.c_str());
-          if (field != nullptr)
-          {
-            if (field->type()->base_type() == reflection::Obj)
-            {
-              //TODO(@paulreimer): could be a union/struct? what then?
-              reflection_table = flatbuffers_parser.get_flatbuffers_table(
-                field->type()->index()
-              );
-            }
-
-            if (field->type()->base_type() == reflection::Vector)
-            {
-              if (field->type()->element() == reflection::Obj)
-              {
-                reflection_table = flatbuffers_parser.get_flatbuffers_table(
-                  field->type()->index()
-                );
-
-                if (reflection_table != nullptr)
-                {
-                  //TODO(@paulreimer): good state, but should this be logged somehow?
-                }
-              }
-            }
-          }
-        }
-      }
+    auto table = FlatbuffersParser::get_trusted_root<MessageTableT>(
+      builder.get_buffer()
+    );
+    if (table == nullptr)
+    {
+      return false;
     }
 
-    return false;
+    // Unpack in place, without an intermediate copy
+    batch.emplace_back();
+    table->UnPackTo(&batch.back());
+
+    return ((batch.size() < batch_size) || flush_batch());
   }
 
   bool
-  convert_json_stream_to_flatbuffer()
+  flush_batch()
   {
-    bool ok = false;
-
-    if (is_error_path)
+    if (batch.empty())
     {
-      auto error = flatbuffers_parser.parse<ErrorT>(ss.str());
-      if (error)
-      {
-        // Trigger the errback
-        ok = errback(*error);
-      }
-    }
-    else {
-      auto message = flatbuffers_parser.parse<MessageT>(ss.str());;
-      if (message)
-      {
-        // Trigger the callback
-        ok = callback(*message);
-      }
+      return true;
     }
 
+    auto ok = batch_callback(batch);
+    batch.clear();
+
     return ok;
   }
 };
-
-inline bool
-equality_or_wildcard(
-  std::experimental::string_view root,
-  std::experimental::string_view current)
-{
-  constexpr char wildcard_sym[] = "*";
-  return ((root == wildcard_sym) || (root == current));
-}
-
-inline bool
-is_a_subpath(
-  const std::vector<std::string>& current_path,
-  const std::vector<std::string>& root_path
-)
-{
-  return (
-    (root_path.empty()) || (
-    (current_path.size() >= root_path.size()) &&
-    (std::equal(
-      root_path.begin(),
-      root_path.end(),
-      current_path.begin(),
-      equality_or_wildcard
-    ))
-  ));
-}
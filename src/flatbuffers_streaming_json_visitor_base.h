@@ -0,0 +1,635 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_parser.h"
+#include "flatbuffers_streaming_json_parser.h"
+#include "flatbuffers_table_index.h"
+#include "json_key_interner.h"
+#include "json_path_matcher.h"
+#include "json_push_parser.h"
+
+#include "picojson.h"
+
+#include <experimental/string_view>
+
+#include "delegate.hpp"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <vector>
+
+inline bool
+equality_or_wildcard(
+  std::experimental::string_view root,
+  std::experimental::string_view current)
+{
+  constexpr char wildcard_sym[] = "*";
+  return ((root == wildcard_sym) || (root == current));
+}
+
+inline bool
+is_a_subpath(
+  const std::vector<std::string>& current_path,
+  const std::vector<std::string>& root_path
+)
+{
+  return (
+    (root_path.empty()) || (
+    (current_path.size() >= root_path.size()) &&
+    (std::equal(
+      root_path.begin(),
+      root_path.end(),
+      current_path.begin(),
+      equality_or_wildcard
+    ))
+  ));
+}
+
+// Input side of the streaming JSON visitors: tokenizes the response (pulled
+// from an istream, or pushed with feed), follows each key through the
+// compiled paths, skips values outside of all paths, and forwards the events
+// of each matched value (an item) to DerivedT, which must provide:
+//   void add_selectors(JsonPathMatcher&)  - paths, with their values
+//   void start_item(int value, const std::string& key)
+//   void match_in_item(int value)         - a path matched inside an item
+//   template<typename Fn> void build(Fn&& fn) - fn(builder) for the item
+//   bool process_item()                   - the item is complete
+//   bool end_of_input()
+template<typename DerivedT>
+class FlatbuffersStreamingJsonVisitorBase
+{
+private:
+  FlatbuffersStreamingJsonVisitorBase(const FlatbuffersStreamingJsonVisitorBase &);
+  FlatbuffersStreamingJsonVisitorBase &operator=(const FlatbuffersStreamingJsonVisitorBase &);
+
+protected:
+  const char* TAG;
+
+  FlatbuffersStreamingJsonParser& flatbuffers_parser;
+
+  bool is_parse_error = false;
+
+  // All paths, compiled into a single matcher
+  JsonPathMatcher path_matcher;
+  bool paths_changed = true;
+
+  // Schema field names and path keys, so each input key is hashed once
+  JsonKeyInterner key_interner;
+
+  // Input parsing state
+  int object_depth = 0;
+  int array_depth = 0;
+  std::vector<JsonPathMatcher::State> path_states;
+  std::string current_str;
+
+  // Brackets of a skipped value, for the picojson parser
+  std::vector<char> skip_containers;
+
+  // Push-mode tokenizer, calling the events below
+  JsonPushParser<FlatbuffersStreamingJsonVisitorBase> push_parser{*this};
+
+#if defined(HTTPS_ENDPOINT_USE_SIMD_JSON)
+  // parse reads into this buffer, instead of through picojson
+  static constexpr size_t read_buffer_size = 1024;
+  std::string read_buffer;
+#endif // HTTPS_ENDPOINT_USE_SIMD_JSON
+
+  // Whether the events are part of an item, which started at item_depth
+  bool in_item = false;
+  int item_depth = 0;
+
+  FlatbuffersStreamingJsonVisitorBase(
+    FlatbuffersStreamingJsonParser& _flatbuffers_parser,
+    const char* _tag
+  )
+  : TAG(_tag)
+  , flatbuffers_parser(_flatbuffers_parser)
+  {
+  }
+
+public:
+  // Returns false once the input is known to be invalid
+  bool feed(std::experimental::string_view buf)
+  {
+    if (push_parser.has_error())
+    {
+      return false;
+    }
+
+    if (!push_parser.feed(buf))
+    {
+      ESP_LOGE(TAG, "Unable to parse JSON response, err = %s",
+        push_parser.get_error().c_str());
+      return false;
+    }
+
+    return !is_parse_error;
+  }
+
+  // Same result as parse_stream for the complete input
+  bool finish()
+  {
+    if (push_parser.has_error())
+    {
+      return false;
+    }
+
+    // Items found before an error are still delivered
+    auto ok = push_parser.finish();
+    if (!derived().end_of_input())
+    {
+      is_parse_error = true;
+    }
+
+    if (!ok)
+    {
+      ESP_LOGE(TAG, "Unable to parse JSON response, err = %s",
+        push_parser.get_error().c_str());
+      return false;
+    }
+
+    return !is_parse_error;
+  }
+
+  bool
+  set_null()
+  {
+    derived().build([](auto& builder)
+    {
+      builder.set_null();
+    });
+    return check_for_item_end();
+  }
+
+  bool
+  set_bool(bool b)
+  {
+    derived().build([b](auto& builder)
+    {
+      builder.set_bool(b);
+    });
+    return check_for_item_end();
+  }
+
+  bool
+  set_int64(int64_t i)
+  {
+    derived().build([i](auto& builder)
+    {
+      builder.set_int64(i);
+    });
+    return check_for_item_end();
+  }
+
+  bool
+  set_number(double d)
+  {
+    derived().build([d](auto& builder)
+    {
+      builder.set_number(d);
+    });
+    return check_for_item_end();
+  }
+
+  bool
+  set_string(std::experimental::string_view s)
+  {
+    derived().build([s](auto& builder)
+    {
+      builder.set_string(s);
+    });
+    return check_for_item_end();
+  }
+
+  bool
+  start_array()
+  {
+    array_depth++;
+
+    derived().build([](auto& builder)
+    {
+      builder.start_array();
+    });
+    return true;
+  }
+
+  bool
+  end_array()
+  {
+    array_depth--;
+
+    derived().build([](auto& builder)
+    {
+      builder.end_array();
+    });
+    return check_for_item_end();
+  }
+
+  bool
+  start_object()
+  {
+    object_depth++;
+
+    // Placeholder for the path of the current key
+    path_states.push_back(JsonPathMatcher::no_match);
+
+    derived().build([](auto& builder)
+    {
+      builder.start_object();
+    });
+    return true;
+  }
+
+  bool
+  key(const std::string& k)
+  {
+    auto key_id = key_interner.find(k);
+
+    // Follow the current object key from the parent path
+    auto path_state = path_matcher.next(
+      path_states[path_states.size() - 2],
+      key_id
+    );
+    path_states.back() = path_state;
+
+    if (is_skippable())
+    {
+      // Nothing below this key can match, don't decode its value
+      push_parser.skip_value();
+      return true;
+    }
+
+    auto value = path_matcher.get_value(path_state);
+    if (!in_item)
+    {
+      if (value >= 0)
+      {
+        enter_item(value, k);
+      }
+    }
+    else {
+      if (value >= 0)
+      {
+        derived().match_in_item(value);
+      }
+
+      derived().build([&k, key_id](auto& builder)
+      {
+        builder.key(k, key_id);
+      });
+    }
+
+    return true;
+  }
+
+  bool
+  end_object()
+  {
+    object_depth--;
+    path_states.pop_back();
+
+    derived().build([](auto& builder)
+    {
+      builder.end_object();
+    });
+    return check_for_item_end();
+  }
+
+  // picojson parse context, forwarding to the events above
+  template <typename Iter> bool
+  parse_string(picojson::input<Iter> &in)
+  {
+    // Re-use the string capacity between values
+    current_str.clear();
+    auto ok = _parse_string(current_str, in);
+    if (ok)
+    {
+      set_string(current_str);
+    }
+    return ok;
+  }
+
+  bool
+  parse_array_start()
+  {
+    return start_array();
+  }
+
+  template <typename Iter> bool
+  parse_array_item(picojson::input<Iter> &in, size_t)
+  {
+    return _parse(*this, in);
+  }
+
+  bool
+  parse_array_stop(size_t)
+  {
+    return end_array();
+  }
+
+  bool
+  parse_object_start()
+  {
+    return start_object();
+  }
+
+  template <typename Iter> bool
+  parse_object_item(
+    picojson::input<Iter> &in,
+    const std::string &k)
+  {
+    if (!key(k))
+    {
+      return false;
+    }
+
+    return is_skippable()? skip_value(in) : _parse(*this, in);
+  }
+
+  bool
+  parse_object_stop()
+  {
+    return end_object();
+  }
+
+protected:
+  DerivedT&
+  derived()
+  {
+    return static_cast<DerivedT&>(*this);
+  }
+
+  // Reset the input state, with key ids following the schema's field names
+  void clear_input()
+  {
+    // Reset error state
+    is_parse_error = false;
+
+    // Input parsing state
+    object_depth = 0;
+    array_depth = 0;
+    path_states.clear();
+    current_str.clear();
+    push_parser.clear();
+
+    in_item = false;
+    item_depth = 0;
+
+    auto table_index = get_table_index();
+    auto field_names = table_index? &table_index->get_field_names() : nullptr;
+    if (key_interner.get_base() != field_names)
+    {
+      // Path keys are interned again, after the field names
+      key_interner.set_base(field_names);
+      paths_changed = true;
+    }
+  }
+
+  // Shared by the builders, nullptr without a shared schema
+  const FlatbuffersTableIndex* get_table_index() const
+  {
+    auto shared_schema = flatbuffers_parser.get_shared_schema();
+    return shared_schema? &shared_schema->table_index : nullptr;
+  }
+
+  void begin()
+  {
+    compile_paths();
+
+    path_states.push_back(path_matcher.get_root_state());
+    auto value = path_matcher.get_value(path_states.back());
+    if (value >= 0)
+    {
+      // The entire document is one item
+      enter_item(value, "");
+    }
+  }
+
+  bool parse(std::istream& resp)
+  {
+    std::string err;
+
+    begin();
+
+#if defined(HTTPS_ENDPOINT_USE_SIMD_JSON)
+    // Block-scanning tokenizer, fed with whatever the stream has buffered
+    auto* buf = resp.rdbuf();
+    read_buffer.resize(read_buffer_size);
+    while (!push_parser.is_done() &&
+           !push_parser.has_error() &&
+           (buf->sgetc() != std::char_traits<char>::eof()))
+    {
+      auto avail = std::max<std::streamsize>(
+        std::min<std::streamsize>(buf->in_avail(), read_buffer.size()), 1
+      );
+      auto len = buf->sgetn(&read_buffer[0], avail);
+      push_parser.feed({read_buffer.data(), static_cast<size_t>(len)});
+    }
+    push_parser.finish();
+    err = push_parser.get_error();
+#else
+    picojson::_parse(
+      *this,
+      std::istreambuf_iterator<char>(resp.rdbuf()),
+      std::istreambuf_iterator<char>(),
+      &err);
+#endif // HTTPS_ENDPOINT_USE_SIMD_JSON
+
+    if (!derived().end_of_input())
+    {
+      is_parse_error = true;
+    }
+
+    if (!err.empty())
+    {
+      ESP_LOGE(TAG, "Unable to parse JSON response, err = %s", err.c_str());
+    }
+
+    return (
+      (err.empty() == true) &&
+      (is_parse_error == false)
+    );
+  }
+
+  // Passes the builder's output to whichever callback is set
+  template<typename BuilderT, typename ObjT>
+  bool
+  convert_flatbuffer(
+    const BuilderT& builder,
+    const delegate<bool(const ObjT&)>& item_callback,
+    const delegate<bool(const typename ObjT::TableType&)>& item_table_callback
+  )
+  {
+    if (!builder.is_complete())
+    {
+      ESP_LOGE(TAG,
+        "Couldn't build valid flatbuffer of type '%s'",
+        ObjT::TableType::GetFullyQualifiedName()
+      );
+      return false;
+    }
+
+    // Builder output is valid by construction, and not verified again
+    if (item_table_callback)
+    {
+      auto table = FlatbuffersParser::get_trusted_root<typename ObjT::TableType>(
+        builder.get_buffer()
+      );
+
+      // Trigger the callback (or errback) with the buffer contents
+      return ((table != nullptr) && item_table_callback(*table));
+    }
+    else if (item_callback)
+    {
+      auto obj = FlatbuffersParser::parse_trusted<ObjT>(builder.get_buffer());
+
+      // Trigger the callback (or errback)
+      return (obj && item_callback(*obj));
+    }
+
+    return true;
+  }
+
+private:
+  void
+  compile_paths()
+  {
+    if (!paths_changed)
+    {
+      return;
+    }
+
+    path_matcher.clear();
+    derived().add_selectors(path_matcher);
+
+    path_matcher.compile(key_interner);
+    paths_changed = false;
+  }
+
+  void
+  enter_item(int value, const std::string& key)
+  {
+    in_item = true;
+    item_depth = object_depth + array_depth;
+
+    derived().start_item(value, key);
+  }
+
+  bool
+  check_for_item_end()
+  {
+    // The value which started the item has been fully parsed
+    if (in_item && (object_depth + array_depth) == item_depth)
+    {
+      in_item = false;
+
+      if (derived().process_item() == false)
+      {
+        is_parse_error = true;
+      }
+    }
+
+    return true;
+  }
+
+  bool
+  is_skippable() const
+  {
+    return (!in_item && (path_states.back() == JsonPathMatcher::no_match));
+  }
+
+  // As JsonPushParser::skip_value, for the picojson parser
+  template <typename Iter> bool
+  skip_value(picojson::input<Iter> &in)
+  {
+    in.skip_ws();
+
+    int ch = in.getc();
+    if ((ch != '"') && (ch != '{') && (ch != '['))
+    {
+      // Scalars are short, parse them as usual
+      in.ungetc();
+      return _parse(*this, in);
+    }
+
+    skip_containers.clear();
+    bool in_string = (ch == '"');
+    if (!in_string)
+    {
+      skip_containers.push_back(ch);
+    }
+
+    while (true)
+    {
+      if (in_string)
+      {
+        ch = in.getc();
+        if (ch == '"')
+        {
+          in_string = false;
+          if (skip_containers.empty())
+          {
+            return true;
+          }
+        }
+        else if (ch == '\\')
+        {
+          // Any escaped character, including a quote
+          if (in.getc() == -1)
+          {
+            return false;
+          }
+        }
+        else if ((ch >= 0) && (ch < ' '))
+        {
+          in.ungetc();
+          return false;
+        }
+        else if (ch == -1)
+        {
+          return false;
+        }
+        continue;
+      }
+
+      ch = in.getc();
+      if (ch == -1)
+      {
+        return false;
+      }
+      else if (ch == '"')
+      {
+        in_string = true;
+      }
+      else if ((ch == '{') || (ch == '['))
+      {
+        skip_containers.push_back(ch);
+      }
+      else if ((ch == '}') || (ch == ']'))
+      {
+        if (skip_containers.back() != ((ch == '}')? '{' : '['))
+        {
+          in.ungetc();
+          return false;
+        }
+
+        skip_containers.pop_back();
+        if (skip_containers.empty())
+        {
+          return true;
+        }
+      }
+    }
+  }
+};
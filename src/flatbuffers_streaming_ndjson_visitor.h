@@ -0,0 +1,393 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_streaming_json_visitor.h"
+
+#include <experimental/string_view>
+
+#include "delegate.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Newline-delimited JSON (JSON lines): each line is a separate document,
+// matched against the root/error paths as in FlatbuffersStreamingJsonVisitor.
+// feed() only splits the input into records, which are converted on a pool
+// of worker threads, each with its own clone of the parser. feed() waits
+// only while max_queued records are pending. Callbacks are delivered strictly
+// in input order, one at a time, but from the worker threads. Once a
+// callback returns false, nothing more is converted or delivered.
+template<typename MessageT, typename ErrorT>
+class FlatbuffersStreamingNdjsonVisitor
+{
+public:
+  typedef FlatbuffersStreamingJsonVisitor<MessageT, ErrorT> VisitorT;
+
+private:
+  FlatbuffersStreamingNdjsonVisitor(const FlatbuffersStreamingNdjsonVisitor &);
+  FlatbuffersStreamingNdjsonVisitor &operator=(const FlatbuffersStreamingNdjsonVisitor &);
+
+  // One converted item, in the order it was found in its record
+  struct Item
+  {
+    std::unique_ptr<MessageT> message;
+    std::unique_ptr<ErrorT> error;
+  };
+
+  struct Record
+  {
+    std::string json;
+    bool is_converted = false;
+    bool ok = false;
+    std::vector<Item> items;
+  };
+
+  struct Worker
+  {
+    std::unique_ptr<FlatbuffersStreamingJsonParser> parser;
+    std::unique_ptr<VisitorT> visitor;
+    std::thread thread;
+  };
+
+  std::vector<std::string> root_path;
+  delegate<bool(const MessageT&)> callback;
+
+  std::vector<std::string> error_path;
+  delegate<bool(const ErrorT&)> errback;
+
+  // Input state, only used by the reader
+  std::string partial_record;
+
+  // Records not yet delivered, in input order
+  std::mutex records_mutex;
+  std::condition_variable records_queued;
+  std::condition_variable records_delivered;
+  std::deque<std::unique_ptr<Record>> records;
+  size_t max_queued = 0;
+
+  // Sequence number of records.front(), and of the next to convert
+  size_t first_record = 0;
+  size_t next_record = 0;
+
+  bool is_delivering = false;
+  bool is_parse_error = false;
+  bool is_cancelled = false;
+  bool is_stopping = false;
+
+  std::vector<Worker> workers;
+
+public:
+  // feed() blocks while max_queued records are converting or waiting to be
+  // delivered: backpressure on the reader, which bounds the memory used
+  FlatbuffersStreamingNdjsonVisitor(
+    FlatbuffersStreamingJsonParser& _flatbuffers_parser,
+    size_t worker_count=2,
+    size_t _max_queued=64
+  )
+  : max_queued(std::max<size_t>(_max_queued, 1))
+  {
+    workers.resize(std::max<size_t>(worker_count, 1));
+    for (auto& worker : workers)
+    {
+      // Parsers are not thread-safe, but clones share the schema
+      worker.parser = _flatbuffers_parser.clone();
+      worker.visitor.reset(new VisitorT(
+        worker.parser? *worker.parser : _flatbuffers_parser
+      ));
+      worker.thread = std::thread(
+        &FlatbuffersStreamingNdjsonVisitor::run_worker,
+        this,
+        worker.visitor.get()
+      );
+    }
+  }
+
+  ~FlatbuffersStreamingNdjsonVisitor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(records_mutex);
+      is_stopping = true;
+    }
+    records_queued.notify_all();
+    records_delivered.notify_all();
+
+    for (auto& worker : workers)
+    {
+      worker.thread.join();
+    }
+  }
+
+  // Must not be called while a previous stream is still being delivered
+  void begin_stream(
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageT&)> _callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
+  {
+    std::lock_guard<std::mutex> lock(records_mutex);
+
+    root_path = _root_path;
+    callback = _callback;
+    error_path = _error_path;
+    errback = _errback;
+
+    partial_record.clear();
+    records.clear();
+    first_record = 0;
+    next_record = 0;
+    is_parse_error = false;
+    is_cancelled = false;
+  }
+
+  // Queues each complete line, waiting only for room in the queue
+  bool feed(std::experimental::string_view buf)
+  {
+    const char* p = buf.data();
+    const char* end = p + buf.size();
+
+    while (p < end)
+    {
+      auto newline = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (newline == nullptr)
+      {
+        partial_record.append(p, end - p);
+        break;
+      }
+
+      partial_record.append(p, newline - p);
+      if (!queue_record(partial_record))
+      {
+        return false;
+      }
+      p = newline + 1;
+    }
+
+    std::lock_guard<std::mutex> lock(records_mutex);
+    return !is_parse_error;
+  }
+
+  // Queues one complete document, split from the input by the caller
+  // (instead of feed), leaves json empty
+  // Returns false once a callback has returned false, the document is dropped
+  bool feed_document(std::string& json)
+  {
+    return queue_record(json);
+  }
+
+  // Queues a final unterminated line, then waits for all callbacks
+  bool finish()
+  {
+    queue_record(partial_record);
+
+    std::unique_lock<std::mutex> lock(records_mutex);
+    records_delivered.wait(lock, [this]
+    {
+      return (records.empty() && !is_delivering);
+    });
+
+    return !is_parse_error;
+  }
+
+  bool parse_stream(
+    std::istream& resp,
+    const std::vector<std::string>& _root_path={},
+    delegate<bool(const MessageT&)> _callback=nullptr,
+    const std::vector<std::string>& _error_path={},
+    delegate<bool(const ErrorT&)> _errback=nullptr
+  )
+  {
+    begin_stream(_root_path, _callback, _error_path, _errback);
+
+    std::string line;
+    while (std::getline(resp, line))
+    {
+      if (!queue_record(line))
+      {
+        break;
+      }
+    }
+
+    return finish();
+  }
+
+private:
+  // Returns false once a callback has returned false, the record is dropped
+  bool queue_record(std::string& json)
+  {
+    // Skip blank lines (and a trailing \r)
+    auto non_blank = json.find_first_not_of(" \t\r");
+    if (non_blank == std::string::npos)
+    {
+      json.clear();
+      return true;
+    }
+
+    std::unique_ptr<Record> record(new Record);
+    record->json.swap(json);
+
+    {
+      // Bound the memory used when the input outpaces conversion
+      std::unique_lock<std::mutex> lock(records_mutex);
+      records_delivered.wait(lock, [this]
+      {
+        return (is_stopping || is_cancelled || (records.size() < max_queued));
+      });
+
+      if (is_cancelled)
+      {
+        return false;
+      }
+
+      records.push_back(std::move(record));
+    }
+    records_queued.notify_one();
+
+    return true;
+  }
+
+  void run_worker(VisitorT* visitor)
+  {
+    std::unique_lock<std::mutex> lock(records_mutex);
+
+    while (true)
+    {
+      records_queued.wait(lock, [this]
+      {
+        return (is_stopping || (next_record < first_record + records.size()));
+      });
+
+      if (is_stopping)
+      {
+        break;
+      }
+
+      // Record pointers are stable until delivered, which needs this result
+      auto* record = records[next_record - first_record].get();
+      next_record++;
+
+      // Records still queued once delivery stops are dropped unconverted
+      if (!is_cancelled)
+      {
+        lock.unlock();
+        convert_record(*visitor, *record);
+        lock.lock();
+      }
+
+      record->is_converted = true;
+
+      deliver_records(lock);
+    }
+  }
+
+  // Paths and callbacks are only changed by begin_stream, while idle
+  void convert_record(VisitorT& visitor, Record& record)
+  {
+    // Unpacked straight into the item, instead of copying a temporary
+    visitor.begin_stream_views(
+      root_path,
+      [&record](const typename VisitorT::MessageTableT& table) -> bool
+      {
+        Item item;
+        item.message.reset(new MessageT);
+        table.UnPackTo(item.message.get());
+        record.items.push_back(std::move(item));
+        return true;
+      },
+      error_path,
+      [&record](const typename VisitorT::ErrorTableT& table) -> bool
+      {
+        Item item;
+        item.error.reset(new ErrorT);
+        table.UnPackTo(item.error.get());
+        record.items.push_back(std::move(item));
+        return true;
+      }
+    );
+
+    record.ok = (visitor.feed(record.json) && visitor.finish());
+  }
+
+  // Delivers converted records from the front, one thread at a time
+  void deliver_records(std::unique_lock<std::mutex>& lock)
+  {
+    if (is_delivering)
+    {
+      return;
+    }
+
+    is_delivering = true;
+    while (!records.empty() && records.front()->is_converted)
+    {
+      auto record = std::move(records.front());
+      records.pop_front();
+      first_record++;
+
+      // There is room for the reader to queue another record
+      records_delivered.notify_all();
+
+      if (is_cancelled)
+      {
+        continue;
+      }
+
+      // Callbacks may be slow, don't block the reader meanwhile
+      lock.unlock();
+      auto is_accepted = deliver_record(*record);
+      lock.lock();
+
+      if (!record->ok || !is_accepted)
+      {
+        is_parse_error = true;
+      }
+
+      if (!is_accepted)
+      {
+        is_cancelled = true;
+      }
+    }
+    is_delivering = false;
+
+    records_delivered.notify_all();
+  }
+
+  // Returns false as soon as a callback does
+  bool deliver_record(const Record& record)
+  {
+    // Items found before a parse error are still delivered
+    for (const auto& item : record.items)
+    {
+      if (item.message && callback)
+      {
+        if (!callback(*item.message))
+        {
+          return false;
+        }
+      }
+      else if (item.error && errback)
+      {
+        if (!errback(*item.error))
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+};
@@ -0,0 +1,549 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "flatbuffers_table_decoder.h"
+
+#include "esp_log.h"
+
+#include <cstring>
+
+constexpr char FlatbuffersTableDecoder::TAG[];
+
+FlatbuffersTableDecoder::FlatbuffersTableDecoder()
+{
+  // There are no default values in a TypeTable, so write every value
+  fbb.ForceDefaults(true);
+}
+
+bool
+FlatbuffersTableDecoder::set_type_table(const flatbuffers::TypeTable* _type_table)
+{
+  if (_type_table != type_table)
+  {
+    type_table = _type_table;
+    ready = build_hash();
+  }
+
+  clear();
+  return ready;
+}
+
+bool
+FlatbuffersTableDecoder::is_ready() const
+{
+  return ready;
+}
+
+bool
+FlatbuffersTableDecoder::start()
+{
+  clear();
+
+  if (!ready)
+  {
+    return fail("Unsupported table");
+  }
+
+  return true;
+}
+
+bool
+FlatbuffersTableDecoder::start(std::experimental::string_view key)
+{
+  if (start())
+  {
+    in_table = true;
+    single_value = true;
+    return this->key(key);
+  }
+
+  return false;
+}
+
+void
+FlatbuffersTableDecoder::clear()
+{
+  // Retains allocated capacity for the next buffer
+  fbb.Clear();
+  values.clear();
+
+  field = -1;
+  in_table = false;
+  single_value = false;
+  skip_depth = 0;
+
+  complete = false;
+  error = false;
+}
+
+bool
+FlatbuffersTableDecoder::set_null()
+{
+  if (error || (skip_depth > 0))
+  {
+    return !error;
+  }
+
+  if (!in_table)
+  {
+    return fail("Unexpected null");
+  }
+
+  // Leave the field unset (i.e. use the default)
+  field = -1;
+  return add_value({-1, ScalarValue, {}});
+}
+
+bool
+FlatbuffersTableDecoder::set_bool(bool b)
+{
+  return set_int64(b? 1 : 0);
+}
+
+bool
+FlatbuffersTableDecoder::set_int64(int64_t i)
+{
+  Value value;
+  value.field = field;
+  value.kind = ScalarValue;
+  value.scalar = FlatbuffersScalar::integer(i);
+
+  return add_value(value);
+}
+
+bool
+FlatbuffersTableDecoder::set_number(double d)
+{
+  Value value;
+  value.field = field;
+  value.kind = ScalarValue;
+  value.scalar = FlatbuffersScalar::real(d);
+
+  return add_value(value);
+}
+
+bool
+FlatbuffersTableDecoder::set_string(std::experimental::string_view s)
+{
+  if (error || (skip_depth > 0) || !in_table || (field < 0))
+  {
+    // Unknown key, or an error below
+    return add_value({-1, ScalarValue, {}});
+  }
+
+  Value value;
+  value.field = field;
+
+  auto type = type_table->type_codes[field].base_type;
+  if (type == flatbuffers::ET_STRING)
+  {
+    value.kind = OffsetValue;
+    value.o = fbb.CreateString(s.data(), s.size()).o;
+
+    return add_value(value);
+  }
+
+  // Accept enum identifiers, and numbers given as strings
+  value.kind = ScalarValue;
+  value.scalar = FlatbuffersScalar::integer(0);
+  if (!lookup_enum_value(s, value.scalar.i))
+  {
+    auto is_real = ((type == flatbuffers::ET_FLOAT) || (type == flatbuffers::ET_DOUBLE));
+    if (!value.scalar.parse(s, is_real))
+    {
+      return fail("Invalid string value for scalar field");
+    }
+  }
+
+  return add_value(value);
+}
+
+bool
+FlatbuffersTableDecoder::start_object()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (skip_depth > 0)
+  {
+    skip_depth++;
+    return true;
+  }
+
+  if (!in_table)
+  {
+    if (complete || !ready)
+    {
+      return fail("Unexpected object");
+    }
+
+    in_table = true;
+    return true;
+  }
+
+  if (field < 0)
+  {
+    // Value for an unknown key
+    skip_depth = 1;
+    return true;
+  }
+
+  return fail("Unexpected object");
+}
+
+bool
+FlatbuffersTableDecoder::key(std::experimental::string_view k)
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (skip_depth > 0)
+  {
+    return true;
+  }
+
+  if (in_table)
+  {
+    // Unknown keys leave the field empty, and their value is skipped
+    field = find_field(k);
+    return true;
+  }
+
+  return fail("Unexpected key");
+}
+
+bool
+FlatbuffersTableDecoder::key(
+  std::experimental::string_view k,
+  JsonKeyInterner::Id
+)
+{
+  return key(k);
+}
+
+bool
+FlatbuffersTableDecoder::end_object()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (skip_depth > 0)
+  {
+    if (--skip_depth == 0)
+    {
+      return add_value({-1, ScalarValue, {}});
+    }
+    return true;
+  }
+
+  if (in_table)
+  {
+    return end_table();
+  }
+
+  return fail("Unexpected end of object");
+}
+
+bool
+FlatbuffersTableDecoder::start_array()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (skip_depth > 0)
+  {
+    skip_depth++;
+    return true;
+  }
+
+  if (in_table && (field < 0))
+  {
+    skip_depth = 1;
+    return true;
+  }
+
+  return fail("Unexpected array");
+}
+
+bool
+FlatbuffersTableDecoder::end_array()
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (skip_depth > 0)
+  {
+    if (--skip_depth == 0)
+    {
+      return add_value({-1, ScalarValue, {}});
+    }
+    return true;
+  }
+
+  return fail("Unexpected end of array");
+}
+
+bool
+FlatbuffersTableDecoder::is_complete() const
+{
+  return complete;
+}
+
+bool
+FlatbuffersTableDecoder::has_error() const
+{
+  return error;
+}
+
+std::experimental::string_view
+FlatbuffersTableDecoder::get_buffer() const
+{
+  if (!complete)
+  {
+    return {};
+  }
+
+  return {
+    reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+    fbb.GetSize()
+  };
+}
+
+int
+FlatbuffersTableDecoder::find_field(std::experimental::string_view k) const
+{
+  if (hash_slots.empty())
+  {
+    return -1;
+  }
+
+  auto slot = hash_slots[hash(k, hash_seed) & (hash_slots.size() - 1)];
+  if ((slot >= 0) && (k == type_table->names[slot]))
+  {
+    return slot;
+  }
+
+  return -1;
+}
+
+uint32_t
+FlatbuffersTableDecoder::hash(std::experimental::string_view k, uint32_t seed)
+{
+  // FNV-1a
+  uint32_t h = 2166136261u ^ seed;
+  for (auto c : k)
+  {
+    h ^= static_cast<uint8_t>(c);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+bool
+FlatbuffersTableDecoder::build_hash()
+{
+  hash_slots.clear();
+
+  if ((type_table == nullptr) ||
+      (type_table->st != flatbuffers::ST_TABLE) ||
+      (type_table->names == nullptr))
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < type_table->num_elems; ++i)
+  {
+    auto type_code = type_table->type_codes[i];
+    auto type = static_cast<flatbuffers::ElementaryType>(type_code.base_type);
+
+    // Only scalars (including enums) and strings
+    if (type_code.is_vector ||
+        (type == flatbuffers::ET_UTYPE) ||
+        (type == flatbuffers::ET_SEQUENCE))
+    {
+      return false;
+    }
+  }
+
+  // Find a seed without collisions, growing the table if needed
+  size_t slot_count = 4;
+  while (slot_count < type_table->num_elems)
+  {
+    slot_count *= 2;
+  }
+
+  for (; slot_count <= 4096; slot_count *= 2)
+  {
+    for (uint32_t seed = 0; seed < 256; ++seed)
+    {
+      hash_slots.assign(slot_count, -1);
+
+      bool collision = false;
+      for (size_t i = 0; (i < type_table->num_elems) && !collision; ++i)
+      {
+        auto& slot = hash_slots[hash(type_table->names[i], seed) & (slot_count - 1)];
+        collision = (slot >= 0);
+        slot = i;
+      }
+
+      if (!collision)
+      {
+        hash_seed = seed;
+        return true;
+      }
+    }
+  }
+
+  hash_slots.clear();
+  return false;
+}
+
+bool
+FlatbuffersTableDecoder::add_value(const Value& value)
+{
+  if (error)
+  {
+    return false;
+  }
+
+  if (skip_depth > 0)
+  {
+    return true;
+  }
+
+  if (!in_table)
+  {
+    return fail("Root value is not a table");
+  }
+
+  if (value.field >= 0)
+  {
+    auto type = static_cast<flatbuffers::ElementaryType>(
+      type_table->type_codes[value.field].base_type
+    );
+    if ((type == flatbuffers::ET_STRING) != (value.kind == OffsetValue))
+    {
+      return fail("Unexpected scalar");
+    }
+
+    bool fits = true;
+    with_scalar_type(type, [&](auto tag)
+    {
+      fits = value.scalar.fits<decltype(tag)>();
+    });
+
+    if (!fits)
+    {
+      return fail("Number out of range for field");
+    }
+
+    // A table can only hold one value per field
+    for (const auto& other : values)
+    {
+      if (other.field == value.field)
+      {
+        return fail("Field set more than once");
+      }
+    }
+
+    values.push_back(value);
+  }
+  field = -1;
+
+  if (single_value)
+  {
+    return end_table();
+  }
+  return true;
+}
+
+bool
+FlatbuffersTableDecoder::lookup_enum_value(
+  std::experimental::string_view name,
+  int64_t& value
+) const
+{
+  auto type_code = type_table->type_codes[field];
+  if (type_code.sequence_ref < 0)
+  {
+    return false;
+  }
+
+  auto enum_table = type_table->type_refs[type_code.sequence_ref]();
+  if ((enum_table->st != flatbuffers::ST_ENUM) || (enum_table->names == nullptr))
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < enum_table->num_elems; ++i)
+  {
+    if (name == enum_table->names[i])
+    {
+      value = (enum_table->values != nullptr)? enum_table->values[i] : i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+FlatbuffersTableDecoder::end_table()
+{
+  // All strings have already been created
+  auto start = fbb.StartTable();
+  for (const auto& value : values)
+  {
+    auto voffset = flatbuffers::FieldIndexToOffset(value.field);
+    auto type = static_cast<flatbuffers::ElementaryType>(
+      type_table->type_codes[value.field].base_type
+    );
+
+    if (type == flatbuffers::ET_STRING)
+    {
+      fbb.AddOffset(voffset, flatbuffers::Offset<void>(value.o));
+      continue;
+    }
+
+    // Values were range checked as they were added
+    with_scalar_type(type, [&](auto tag)
+    {
+      fbb.AddElement(voffset, value.scalar.as<decltype(tag)>(), decltype(tag)(0));
+    });
+  }
+  fbb.Finish(flatbuffers::Offset<void>(fbb.EndTable(start)));
+
+  values.clear();
+  in_table = false;
+  complete = true;
+
+  return true;
+}
+
+bool
+FlatbuffersTableDecoder::fail(const char* reason)
+{
+  if (!error)
+  {
+    ESP_LOGE(TAG, "%s", reason);
+    error = true;
+  }
+
+  return false;
+}
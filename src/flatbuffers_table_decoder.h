@@ -0,0 +1,116 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers_scalar.h"
+#include "json_key_interner.h"
+
+#include "flatbuffers/flatbuffers.h"
+
+#include <experimental/string_view>
+
+#include <cstdint>
+#include <vector>
+
+// Builds a flat table (scalar, enum and string fields) straight from JSON
+// events, with the same event interface and conversions as
+// FlatbuffersJsonBuilder, but no reflection schema. Field names are matched
+// with a perfect hash, computed from the mini-reflection TypeTable once.
+// Tables with any other kind of field are not supported (is_ready is false).
+class FlatbuffersTableDecoder
+{
+public:
+  FlatbuffersTableDecoder();
+
+  static constexpr char TAG[] = "FlatbuffersTableDecoder";
+
+  bool set_type_table(const flatbuffers::TypeTable* _type_table);
+  bool is_ready() const;
+
+  bool start();
+
+  // Start a new buffer, with a root table containing only this key
+  bool start(std::experimental::string_view key);
+
+  void clear();
+
+  bool set_null();
+  bool set_bool(bool b);
+  bool set_int64(int64_t i);
+  bool set_number(double d);
+  bool set_string(std::experimental::string_view s);
+
+  bool start_object();
+  bool key(std::experimental::string_view k);
+
+  // Same as key(k), the id is not needed
+  bool key(std::experimental::string_view k, JsonKeyInterner::Id key_id);
+  bool end_object();
+
+  bool start_array();
+  bool end_array();
+
+  bool is_complete() const;
+  bool has_error() const;
+
+  // Only valid once complete
+  std::experimental::string_view get_buffer() const;
+
+  // Index of the field named k, or -1
+  int find_field(std::experimental::string_view k) const;
+
+private:
+  enum ValueKind : uint8_t
+  {
+    ScalarValue,
+    OffsetValue,
+  };
+
+  struct Value
+  {
+    int field;
+    ValueKind kind;
+    union
+    {
+      FlatbuffersScalar scalar;
+      flatbuffers::uoffset_t o;
+    };
+  };
+
+  static uint32_t hash(std::experimental::string_view k, uint32_t seed);
+  bool build_hash();
+
+  bool add_value(const Value& value);
+  bool lookup_enum_value(std::experimental::string_view name, int64_t& value) const;
+  bool end_table();
+
+  bool fail(const char* reason);
+
+  const flatbuffers::TypeTable* type_table = nullptr;
+  bool ready = false;
+
+  // Perfect hash of the field names, slots hold a field index or -1
+  uint32_t hash_seed = 0;
+  std::vector<int> hash_slots;
+
+  flatbuffers::FlatBufferBuilder fbb;
+  std::vector<Value> values;
+
+  // Field for the next value, or -1 for an unknown key
+  int field = -1;
+  bool in_table = false;
+  bool single_value = false;
+
+  // Nesting depth of an ignored object/array
+  int skip_depth = 0;
+
+  bool complete = false;
+  bool error = false;
+};
@@ -0,0 +1,86 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "flatbuffers_table_index.h"
+
+FlatbuffersTableIndex::FlatbuffersTableIndex(const reflection::Schema* schema)
+{
+  build(schema);
+}
+
+void
+FlatbuffersTableIndex::build(const reflection::Schema* schema)
+{
+  field_names.clear();
+  table_infos.clear();
+
+  if (schema == nullptr)
+  {
+    return;
+  }
+
+  for (auto table : *schema->objects())
+  {
+    auto& info = table_infos[table];
+    for (auto field : *table->fields())
+    {
+      size_t key_id = field_names.intern({
+        field->name()->c_str(),
+        field->name()->size()
+      });
+      if (key_id >= info.fields_by_key.size())
+      {
+        info.fields_by_key.resize(key_id + 1, nullptr);
+      }
+      info.fields_by_key[key_id] = field;
+    }
+
+    info.keyed = is_keyed_table(table);
+    if (info.keyed)
+    {
+      info.id_field = table->fields()->LookupByKey("id");
+      info.val_field = table->fields()->LookupByKey("val");
+    }
+  }
+}
+
+const FlatbuffersTableIndex::TableInfo*
+FlatbuffersTableIndex::get_table_info(const reflection::Object* table) const
+{
+  auto found = table_infos.find(table);
+  return (found != table_infos.end())? &found->second : nullptr;
+}
+
+const JsonKeyInterner&
+FlatbuffersTableIndex::get_field_names() const
+{
+  return field_names;
+}
+
+bool
+FlatbuffersTableIndex::is_keyed_table(const reflection::Object* table)
+{
+  if (table != nullptr && !table->is_struct())
+  {
+    auto fields = table->fields();
+    if (fields != nullptr)
+    {
+      auto id_field = fields->LookupByKey("id");
+      auto val_field = fields->LookupByKey("val");
+
+      return (
+        (id_field != nullptr) &&
+        (val_field != nullptr) &&
+        (val_field->type()->base_type() == reflection::Obj)
+      );
+    }
+  }
+
+  return false;
+}
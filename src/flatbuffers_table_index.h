@@ -0,0 +1,52 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "json_key_interner.h"
+
+#include "flatbuffers/reflection.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Lookup metadata for each table/struct of a schema, with every field name
+// interned so keys are matched by id. Built once per schema (it is stored
+// in the shared FlatbuffersSchema), then only read, from any thread.
+class FlatbuffersTableIndex
+{
+public:
+  struct TableInfo
+  {
+    // Fields indexed by key id, from get_field_names()
+    std::vector<const reflection::Field*> fields_by_key;
+
+    // id/val keyed vector element
+    bool keyed = false;
+    const reflection::Field* id_field = nullptr;
+    const reflection::Field* val_field = nullptr;
+  };
+
+  explicit FlatbuffersTableIndex(const reflection::Schema* schema=nullptr);
+
+  void build(const reflection::Schema* schema);
+
+  // nullptr for tables of another schema
+  const TableInfo* get_table_info(const reflection::Object* table) const;
+
+  // Use as the base of another interner, to look up keys by the same ids
+  const JsonKeyInterner& get_field_names() const;
+
+  // Whether this table should be written as an id/val keyed vector element
+  static bool is_keyed_table(const reflection::Object* table);
+
+private:
+  JsonKeyInterner field_names;
+  std::unordered_map<const reflection::Object*, TableInfo> table_infos;
+};
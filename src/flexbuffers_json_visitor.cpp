@@ -0,0 +1,265 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "flexbuffers_json_visitor.h"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <cstring>
+
+constexpr char FlexbuffersJsonVisitor::TAG[];
+
+FlexbuffersJsonVisitor::FlexbuffersJsonVisitor(flexbuffers::BuilderFlag flags)
+: fbb(256, flags)
+{
+}
+
+bool
+FlexbuffersJsonVisitor::parse_stream(std::istream& resp)
+{
+  std::string err;
+
+  clear();
+
+#if defined(HTTPS_ENDPOINT_USE_SIMD_JSON)
+  begin_stream();
+
+  // Block-scanning tokenizer, fed with whatever the stream has buffered
+  auto* buf = resp.rdbuf();
+  char read_buffer[256];
+  while (!push_parser.is_done() &&
+         !push_parser.has_error() &&
+         (buf->sgetc() != std::char_traits<char>::eof()))
+  {
+    auto avail = std::max<std::streamsize>(
+      std::min<std::streamsize>(buf->in_avail(), sizeof(read_buffer)), 1
+    );
+    auto len = buf->sgetn(read_buffer, avail);
+    push_parser.feed({read_buffer, static_cast<size_t>(len)});
+  }
+  push_parser.finish();
+  err = push_parser.get_error();
+#else
+  picojson::_parse(
+    *this,
+    std::istreambuf_iterator<char>(resp.rdbuf()),
+    std::istreambuf_iterator<char>(),
+    &err);
+#endif // HTTPS_ENDPOINT_USE_SIMD_JSON
+
+  if (!err.empty())
+  {
+    ESP_LOGE(TAG, "Unable to parse JSON response, err = %s", err.c_str());
+  }
+
+  return (err.empty() && complete);
+}
+
+void
+FlexbuffersJsonVisitor::begin_stream()
+{
+  clear();
+  push_parser.clear();
+}
+
+bool
+FlexbuffersJsonVisitor::feed(std::experimental::string_view buf)
+{
+  if (push_parser.has_error())
+  {
+    return false;
+  }
+
+  if (!push_parser.feed(buf))
+  {
+    ESP_LOGE(TAG, "Unable to parse JSON response, err = %s",
+      push_parser.get_error().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool
+FlexbuffersJsonVisitor::finish()
+{
+  if (push_parser.has_error())
+  {
+    return false;
+  }
+
+  if (!push_parser.finish())
+  {
+    ESP_LOGE(TAG, "Unable to parse JSON response, err = %s",
+      push_parser.get_error().c_str());
+    return false;
+  }
+
+  return complete;
+}
+
+void
+FlexbuffersJsonVisitor::clear()
+{
+  // Retains allocated capacity for the next buffer
+  fbb.Clear();
+  starts.clear();
+  object_key_chars.clear();
+  object_keys.clear();
+  object_key_starts.clear();
+  complete = false;
+}
+
+bool
+FlexbuffersJsonVisitor::is_complete() const
+{
+  return complete;
+}
+
+std::experimental::string_view
+FlexbuffersJsonVisitor::get_buffer() const
+{
+  if (!complete)
+  {
+    return {};
+  }
+
+  const auto& buf = fbb.GetBuffer();
+  return {reinterpret_cast<const char*>(buf.data()), buf.size()};
+}
+
+flexbuffers::Reference
+FlexbuffersJsonVisitor::get_root() const
+{
+  auto buf = get_buffer();
+  if (buf.empty())
+  {
+    // A null reference
+    static const uint8_t empty[] = {0, 0, 1};
+    return flexbuffers::GetRoot(empty, sizeof(empty));
+  }
+
+  return flexbuffers::GetRoot(
+    reinterpret_cast<const uint8_t*>(buf.data()),
+    buf.size()
+  );
+}
+
+bool
+FlexbuffersJsonVisitor::set_null()
+{
+  fbb.Null();
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::set_bool(bool b)
+{
+  fbb.Bool(b);
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::set_int64(int64_t i)
+{
+  fbb.Int(i);
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::set_number(double d)
+{
+  fbb.Double(d);
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::set_string(const std::string& s)
+{
+  fbb.String(s);
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::start_object()
+{
+  starts.push_back(fbb.StartMap());
+  object_key_starts.push_back(object_keys.size());
+  return true;
+}
+
+bool
+FlexbuffersJsonVisitor::key(const std::string& k)
+{
+  fbb.Key(k);
+  object_keys.push_back(object_key_chars.size());
+  object_key_chars.append(k.c_str(), k.size() + 1);
+  return true;
+}
+
+bool
+FlexbuffersJsonVisitor::end_object()
+{
+  // EndMap() sorts the keys, and requires them to be unique C strings
+  auto first_key = object_keys.begin() + object_key_starts.back();
+  auto last_key = object_keys.end();
+  auto first_char = (first_key != last_key)? *first_key : object_key_chars.size();
+
+  const char* chars = object_key_chars.c_str();
+  std::sort(first_key, last_key, [chars](size_t a, size_t b)
+  {
+    return (strcmp(chars + a, chars + b) < 0);
+  });
+  auto duplicate = std::adjacent_find(first_key, last_key, [chars](size_t a, size_t b)
+  {
+    return (strcmp(chars + a, chars + b) == 0);
+  });
+  if (duplicate != last_key)
+  {
+    ESP_LOGE(TAG, "Duplicate key in JSON object");
+    return false;
+  }
+
+  object_key_chars.resize(first_char);
+  object_keys.erase(first_key, last_key);
+  object_key_starts.pop_back();
+
+  fbb.EndMap(starts.back());
+  starts.pop_back();
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::start_array()
+{
+  starts.push_back(fbb.StartVector());
+  return true;
+}
+
+bool
+FlexbuffersJsonVisitor::end_array()
+{
+  fbb.EndVector(starts.back(), false, false);
+  starts.pop_back();
+  return end_value();
+}
+
+bool
+FlexbuffersJsonVisitor::end_value()
+{
+  // The root value is complete
+  if (starts.empty())
+  {
+    fbb.Finish();
+    complete = true;
+  }
+
+  return true;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "json_push_parser.h"
+
+#include "picojson.h"
+
+#include "flatbuffers/flexbuffers.h"
+
+#include <experimental/string_view>
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Converts any JSON document into a single FlexBuffer, for responses with no
+// schema. Object keys are shared (stored once) by default, and values can be
+// read in place with flexbuffers::GetRoot(), without building a DOM.
+// Objects with duplicate keys are rejected, as FlexBuffer maps need
+// unique keys.
+class FlexbuffersJsonVisitor
+{
+public:
+  explicit FlexbuffersJsonVisitor(
+    flexbuffers::BuilderFlag flags=flexbuffers::BUILDER_FLAG_SHARE_KEYS
+  );
+
+  static constexpr char TAG[] = "FlexbuffersJsonVisitor";
+
+  bool parse_stream(std::istream& resp);
+
+  // Push-mode alternative to parse_stream, as in FlatbuffersStreamingJsonVisitor
+  void begin_stream();
+  bool feed(std::experimental::string_view buf);
+  bool finish();
+
+  void clear();
+
+  // Only valid after a successful parse, until the next one
+  bool is_complete() const;
+  std::experimental::string_view get_buffer() const;
+  flexbuffers::Reference get_root() const;
+
+  // JSON events
+  bool set_null();
+  bool set_bool(bool b);
+  bool set_int64(int64_t i);
+  bool set_number(double d);
+
+  // Must be null-terminated, which std::string guarantees
+  bool set_string(const std::string& s);
+
+  bool start_object();
+  bool key(const std::string& k);
+  bool end_object();
+
+  bool start_array();
+  bool end_array();
+
+  // picojson parse context, forwarding to the events above
+  template <typename Iter> bool
+  parse_string(picojson::input<Iter> &in)
+  {
+    // Re-use the string capacity between values
+    current_str.clear();
+    return _parse_string(current_str, in) && set_string(current_str);
+  }
+
+  bool
+  parse_array_start()
+  {
+    return start_array();
+  }
+
+  template <typename Iter> bool
+  parse_array_item(picojson::input<Iter> &in, size_t)
+  {
+    return _parse(*this, in);
+  }
+
+  bool
+  parse_array_stop(size_t)
+  {
+    return end_array();
+  }
+
+  bool
+  parse_object_start()
+  {
+    return start_object();
+  }
+
+  template <typename Iter> bool
+  parse_object_item(
+    picojson::input<Iter> &in,
+    const std::string &k)
+  {
+    return key(k) && _parse(*this, in);
+  }
+
+  bool
+  parse_object_stop()
+  {
+    return end_object();
+  }
+
+private:
+  FlexbuffersJsonVisitor(const FlexbuffersJsonVisitor &);
+  FlexbuffersJsonVisitor &operator=(const FlexbuffersJsonVisitor &);
+
+  bool end_value();
+
+  flexbuffers::Builder fbb;
+
+  // Builder stack position of each open map/vector
+  std::vector<size_t> starts;
+
+  // Keys of the open maps, null-terminated one after another (as EndMap()
+  // compares them), the offset of each key, and where each map's keys begin
+  std::string object_key_chars;
+  std::vector<size_t> object_keys;
+  std::vector<size_t> object_key_starts;
+
+  std::string current_str;
+  bool complete = false;
+
+  JsonPushParser<FlexbuffersJsonVisitor> push_parser{*this};
+};
@@ -0,0 +1,387 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "http_response_cache.h"
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+constexpr char HttpResponseCache::TAG[];
+
+struct CacheControl
+{
+  bool no_store = false;
+  bool no_cache = false;
+  long max_age = -1;
+};
+
+CacheControl
+parse_cache_control(const HttpResponseCache::HeaderMap& response_headers)
+{
+  CacheControl cache_control;
+
+  auto hdr = response_headers.find("cache-control");
+  if (hdr != response_headers.end())
+  {
+    std::string directives(hdr->second);
+    std::transform(
+      directives.begin(), directives.end(), directives.begin(), ::tolower
+    );
+
+    // Comma-separated list of directives, e.g. "public, max-age=60"
+    size_t pos = 0;
+    while (pos < directives.size())
+    {
+      auto end = directives.find(',', pos);
+      if (end == std::string::npos)
+      {
+        end = directives.size();
+      }
+
+      auto start = directives.find_first_not_of(" \t", pos);
+      if (start < end)
+      {
+        auto directive = directives.substr(start, end - start);
+        if (directive.compare(0, 8, "no-store") == 0)
+        {
+          cache_control.no_store = true;
+        }
+        else if (directive.compare(0, 8, "no-cache") == 0)
+        {
+          cache_control.no_cache = true;
+        }
+        else if (directive.compare(0, 8, "max-age=") == 0)
+        {
+          cache_control.max_age = std::strtol(directive.c_str() + 8, nullptr, 10);
+        }
+      }
+
+      pos = end + 1;
+    }
+  }
+
+  return cache_control;
+}
+
+// Lowercase header names from a Vary header, e.g. "Accept, Accept-Language"
+std::string
+parse_vary(const HttpResponseCache::HeaderMap& response_headers)
+{
+  std::string vary;
+
+  auto hdr = response_headers.find("vary");
+  if (hdr != response_headers.end())
+  {
+    for (auto c : hdr->second)
+    {
+      if (c != ' ' && c != '\t')
+      {
+        vary.push_back(::tolower(c));
+      }
+    }
+  }
+
+  return vary;
+}
+
+// The request values of each header named in vary, to compare requests
+std::string
+select_vary_values(
+  const std::string& vary,
+  const HttpResponseCache::HeaderMap& request_headers
+)
+{
+  std::string values;
+
+  size_t pos = 0;
+  while (pos < vary.size())
+  {
+    auto end = vary.find(',', pos);
+    if (end == std::string::npos)
+    {
+      end = vary.size();
+    }
+
+    auto hdr = request_headers.find(vary.substr(pos, end - pos));
+    if (hdr != request_headers.end())
+    {
+      values.append(hdr->second);
+    }
+    values.push_back('\n');
+
+    pos = end + 1;
+  }
+
+  return values;
+}
+
+HttpResponseCache::HttpResponseCache(size_t _max_bytes)
+: max_bytes(_max_bytes)
+{
+}
+
+std::string
+HttpResponseCache::make_key(
+  std::experimental::string_view method,
+  std::experimental::string_view host,
+  std::experimental::string_view path,
+  std::experimental::string_view query,
+  const HeaderMap& request_headers
+)
+{
+  std::string key;
+  key.reserve(method.size() + host.size() + path.size() + query.size() + 2);
+
+  key.append(method.data(), method.size());
+  key.push_back(' ');
+  key.append(host.data(), host.size());
+  key.append(path.data(), path.size());
+  key.append(query.data(), query.size());
+
+  for (const auto& name : {"authorization", "accept"})
+  {
+    auto hdr = request_headers.find(name);
+    if (hdr != request_headers.end())
+    {
+      key.append("\n").append(name).append(": ").append(hdr->second);
+    }
+  }
+
+  return key;
+}
+
+bool
+HttpResponseCache::is_cacheable(int code, const HeaderMap& response_headers)
+{
+  if (code != 200)
+  {
+    return false;
+  }
+
+  auto cache_control = parse_cache_control(response_headers);
+  if (cache_control.no_store)
+  {
+    return false;
+  }
+
+  // Varies on something other than request headers
+  if (parse_vary(response_headers) == "*")
+  {
+    return false;
+  }
+
+  // Without a lifetime, a validator is needed to make an entry useful
+  return (
+    (cache_control.max_age > 0) ||
+    (response_headers.find("etag") != response_headers.end()) ||
+    (response_headers.find("last-modified") != response_headers.end())
+  );
+}
+
+const HttpResponseCache::Entry*
+HttpResponseCache::find(
+  const std::string& key,
+  const HeaderMap& request_headers
+)
+{
+  auto found = index.find(key);
+  if (found != index.end())
+  {
+    const auto& entry = found->second->second;
+    if (!entry.vary.empty() &&
+        (select_vary_values(entry.vary, request_headers) != entry.vary_values))
+    {
+      return nullptr;
+    }
+
+    // Move to the front of the LRU list, iterators remain valid
+    entries.splice(entries.begin(), entries, found->second);
+    return &found->second->second;
+  }
+
+  return nullptr;
+}
+
+bool
+HttpResponseCache::is_fresh(const Entry& entry) const
+{
+  return (Clock::now() < entry.expires);
+}
+
+bool
+HttpResponseCache::store(
+  const std::string& key,
+  int code,
+  std::string body,
+  const HeaderMap& response_headers,
+  const HeaderMap& request_headers
+)
+{
+  erase(key);
+
+  Entry entry;
+  entry.code = code;
+  entry.body = std::move(body);
+  update_entry(entry, response_headers);
+
+  // Only requests with the same values for these headers may use the entry
+  entry.vary = parse_vary(response_headers);
+  if (!entry.vary.empty())
+  {
+    entry.vary_values = select_vary_values(entry.vary, request_headers);
+  }
+
+  // Callers may decode the body differently depending on its type
+  auto content_type = response_headers.find("content-type");
+  if (content_type != response_headers.end())
+  {
+    entry.content_type = content_type->second;
+  }
+
+  auto len = entry_size(key, entry);
+  if (len > max_bytes)
+  {
+    ESP_LOGW(TAG, "Response of %d bytes exceeds cache size", (int)len);
+    return false;
+  }
+
+  evict_to_fit(len);
+
+  entries.emplace_front(key, std::move(entry));
+  index[key] = entries.begin();
+  cur_bytes += len;
+
+  return true;
+}
+
+bool
+HttpResponseCache::refresh(const std::string& key, const HeaderMap& response_headers)
+{
+  auto found = index.find(key);
+  if (found != index.end())
+  {
+    // Revalidated, so also the most recently used
+    auto item = found->second;
+    entries.splice(entries.begin(), entries, item);
+
+    auto& entry = item->second;
+    cur_bytes -= entry_size(key, entry);
+    update_entry(entry, response_headers);
+
+    // New validators may have grown the entry
+    auto len = entry_size(key, entry);
+    if (len > max_bytes)
+    {
+      ESP_LOGW(TAG, "Response of %d bytes exceeds cache size", (int)len);
+      entries.erase(item);
+      index.erase(found);
+      return false;
+    }
+
+    // The entry is at the front, so it is evicted last
+    evict_to_fit(len);
+    cur_bytes += len;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool
+HttpResponseCache::erase(const std::string& key)
+{
+  auto found = index.find(key);
+  if (found != index.end())
+  {
+    cur_bytes -= entry_size(key, found->second->second);
+    entries.erase(found->second);
+    index.erase(found);
+
+    return true;
+  }
+
+  return false;
+}
+
+void
+HttpResponseCache::clear()
+{
+  entries.clear();
+  index.clear();
+  cur_bytes = 0;
+}
+
+size_t
+HttpResponseCache::size_bytes() const
+{
+  return cur_bytes;
+}
+
+size_t
+HttpResponseCache::max_size_bytes() const
+{
+  return max_bytes;
+}
+
+size_t
+HttpResponseCache::entry_size(const std::string& key, const Entry& entry)
+{
+  return (
+    key.size() +
+    entry.body.size() +
+    entry.content_type.size() +
+    entry.etag.size() +
+    entry.last_modified.size() +
+    entry.vary.size() +
+    entry.vary_values.size()
+  );
+}
+
+void
+HttpResponseCache::update_entry(Entry& entry, const HeaderMap& response_headers)
+{
+  auto etag = response_headers.find("etag");
+  if (etag != response_headers.end())
+  {
+    entry.etag = etag->second;
+  }
+
+  auto last_modified = response_headers.find("last-modified");
+  if (last_modified != response_headers.end())
+  {
+    entry.last_modified = last_modified->second;
+  }
+
+  // Entries without a usable max-age must be revalidated on every use
+  // A response without Cache-Control keeps the previous lifetime
+  if (response_headers.find("cache-control") != response_headers.end())
+  {
+    auto cache_control = parse_cache_control(response_headers);
+    auto max_age = (cache_control.no_cache? 0 : std::max(cache_control.max_age, 0L));
+    entry.lifetime = std::chrono::seconds(max_age);
+  }
+  entry.expires = Clock::now() + entry.lifetime;
+}
+
+void
+HttpResponseCache::evict_to_fit(size_t len)
+{
+  // Drop least recently used entries until there is room
+  while (!entries.empty() && (cur_bytes + len > max_bytes))
+  {
+    auto& lru = entries.back();
+    cur_bytes -= entry_size(lru.first, lru.second);
+    index.erase(lru.first);
+    entries.pop_back();
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <experimental/string_view>
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// In-memory LRU cache of HTTP response bodies, bounded by a byte budget.
+// Honors Cache-Control (max-age, no-cache, no-store) and Vary, and keeps the
+// ETag/Last-Modified validators so stale entries can be revalidated.
+// Request headers are passed with lowercase names.
+class HttpResponseCache
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::unordered_map<std::string, std::string> HeaderMap;
+
+  explicit HttpResponseCache(size_t _max_bytes=16384);
+
+  static constexpr char TAG[] = "HttpResponseCache";
+
+  struct Entry
+  {
+    int code = -1;
+    std::string body;
+    std::string content_type;
+    std::string etag;
+    std::string last_modified;
+    std::string vary;
+    std::string vary_values;
+    Clock::duration lifetime = Clock::duration::zero();
+    Clock::time_point expires;
+  };
+
+  // Responses differ by credentials and requested type, so the Authorization
+  // and Accept request headers are part of the key
+  static std::string make_key(
+    std::experimental::string_view method,
+    std::experimental::string_view host,
+    std::experimental::string_view path,
+    std::experimental::string_view query,
+    const HeaderMap& request_headers=HeaderMap()
+  );
+
+  // Whether a response with these (lowercase) headers may be stored
+  static bool is_cacheable(int code, const HeaderMap& response_headers);
+
+  // Lookup an entry and mark it as most recently used, or nullptr
+  // An entry is only found if the request matches its Vary headers
+  const Entry* find(
+    const std::string& key,
+    const HeaderMap& request_headers=HeaderMap()
+  );
+
+  // Whether the entry can be used without revalidating it first
+  bool is_fresh(const Entry& entry) const;
+
+  bool store(
+    const std::string& key,
+    int code,
+    std::string body,
+    const HeaderMap& response_headers,
+    const HeaderMap& request_headers=HeaderMap()
+  );
+
+  // Update expiry/validators from a 304 Not Modified response
+  // Without Cache-Control, the stored lifetime is renewed
+  bool refresh(const std::string& key, const HeaderMap& response_headers);
+
+  bool erase(const std::string& key);
+  void clear();
+
+  size_t size_bytes() const;
+  size_t max_size_bytes() const;
+
+private:
+  typedef std::list<std::pair<std::string, Entry>> EntryList;
+
+  static size_t entry_size(const std::string& key, const Entry& entry);
+
+  void update_entry(Entry& entry, const HeaderMap& response_headers);
+  void evict_to_fit(size_t len);
+
+  const size_t max_bytes;
+  size_t cur_bytes = 0;
+
+  // Most recently used at the front
+  EntryList entries;
+  std::unordered_map<std::string, EntryList::iterator> index;
+};
@@ -9,6 +9,7 @@
  */
 #pragma once
 
+#include "http_response_cache.h"
 #include "https_response_streambuf.h"
 
 #include "delegate.hpp"
@@ -71,6 +72,22 @@ public:
   bool add_header(std::experimental::string_view k, std::experimental::string_view v);
   bool has_header(std::experimental::string_view k);
 
+  // Advertise gzip/deflate support, and decode compressed response bodies
+  bool set_accept_encoding(bool enable=true);
+
+  // Advertise flatbuffers responses, preferred over JSON. Disabling it
+  // restores any Accept header which was set before
+  bool set_accept_flatbuffers(bool enable=true);
+
+  // Headers from the most recent response, with lowercase names
+  const HeaderMap& get_response_headers() const;
+
+  // Whether the most recent response body is a flatbuffer, not JSON
+  bool is_flatbuffers_response() const;
+
+  // Cache (and revalidate) GET responses, or nullptr to disable caching
+  bool set_response_cache(HttpResponseCache* _response_cache);
+
   // Main request call, others are shortcuts to this
   bool make_request(
     std::experimental::string_view method,
@@ -130,6 +147,20 @@ public:
   );
 
 protected:
+  std::string generate_query_string(
+    const QueryMapView& extra_query_params
+  );
+
+  // Request headers used to select a cached response
+  HeaderMap generate_cache_request_headers(
+    const HeaderMapView& extra_headers
+  );
+
+  bool replay_cached_response(
+    const HttpResponseCache::Entry& cached,
+    ResponseCallback process_resp_body
+  );
+
   std::string generate_request(
     std::experimental::string_view method,
     std::experimental::string_view path,
@@ -144,6 +175,14 @@ protected:
   std::unordered_map<std::string, std::string> headers;
   std::unordered_map<std::string, std::string> query_params;
 
+  HeaderMap response_headers;
+  bool accept_encoding = false;
+
+  // Caller's Accept header, while replaced by set_accept_flatbuffers
+  std::string replaced_accept;
+
+  HttpResponseCache* response_cache = nullptr;
+
   delegate<bool(HttpsResponseStreambuf<TLSConnectionImpl>&)> process_body;
 
 protected:
@@ -9,14 +9,21 @@
  */
 #include "https_endpoint.h"
 
+#include "inflating_streambuf.h"
+#include "recording_streambuf.h"
+
 #include "esp_log.h"
 
 #include "mbedtls/ssl.h"
 
 #include <string.h>
 
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 
+#include <experimental/optional>
+
 template <class ConnectionHelper, class TLSConnectionImpl>
 HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::HttpsEndpoint(
   TLSConnectionImpl& _conn,
@@ -106,19 +113,11 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::ensure_connected()
 
 template <class ConnectionHelper, class TLSConnectionImpl>
 std::string
-HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::generate_request(
-  std::experimental::string_view method,
-  std::experimental::string_view path,
-  const HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::QueryMapView& extra_query_params,
-  const HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::HeaderMapView& extra_headers,
-  std::experimental::string_view req_body
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::generate_query_string(
+  const HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::QueryMapView& extra_query_params
 )
 {
-  std::stringstream http_req;
-
-  // Request path
-  http_req
-  << method << " " << path;
+  std::stringstream query_str;
 
   // Query string (?x=1&y=2 ...)
   char sep = '?';
@@ -127,7 +126,7 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::generate_request(
     if (extra_query_params.find(param.first) == extra_query_params.end())
     {
       // Do not set an query param if it is overriden for this request
-      http_req
+      query_str
       << sep << param.first << "=" << param.second;
 
       sep = '&';
@@ -135,12 +134,35 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::generate_request(
   }
   for (const auto& param : extra_query_params)
   {
-    http_req
+    query_str
     << sep << param.first << "=" << param.second;
 
     sep = '&';
   }
 
+  return query_str.str();
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+std::string
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::generate_request(
+  std::experimental::string_view method,
+  std::experimental::string_view path,
+  const HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::QueryMapView& extra_query_params,
+  const HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::HeaderMapView& extra_headers,
+  std::experimental::string_view req_body
+)
+{
+  std::stringstream http_req;
+
+  // Request path
+  http_req
+  << method << " " << path;
+
+  // Query string (?x=1&y=2 ...)
+  http_req
+  << generate_query_string(extra_query_params);
+
   // Protocol
   http_req
   << " HTTP/1.0\r\n";
@@ -190,6 +212,48 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::make_request(
   ResponseCallback process_resp_body
 )
 {
+  // Check for a cached response before making the request
+  std::string cache_key;
+  HeaderMap cache_request_headers;
+  const HttpResponseCache::Entry* cached = nullptr;
+  const HeaderMapView* request_headers = &extra_headers;
+  HeaderMapView conditional_headers;
+
+  bool use_cache = ((response_cache != nullptr) && (method == "GET"));
+  if (use_cache)
+  {
+    cache_request_headers = generate_cache_request_headers(extra_headers);
+    cache_key = HttpResponseCache::make_key(
+      method, host, path, generate_query_string(extra_query_params),
+      cache_request_headers
+    );
+
+    cached = response_cache->find(cache_key, cache_request_headers);
+    if (cached != nullptr)
+    {
+      if (response_cache->is_fresh(*cached))
+      {
+        ESP_LOGI(TAG, "Using cached response for %.*s",
+          (int)path.size(), path.data()
+        );
+        response_headers.clear();
+        return replay_cached_response(*cached, process_resp_body);
+      }
+
+      // Revalidate the stale entry with a conditional request
+      conditional_headers = extra_headers;
+      if (!cached->etag.empty())
+      {
+        conditional_headers["If-None-Match"] = cached->etag;
+      }
+      if (!cached->last_modified.empty())
+      {
+        conditional_headers["If-Modified-Since"] = cached->last_modified;
+      }
+      request_headers = &conditional_headers;
+    }
+  }
+
   // Make sure we are connected, re-use an existing session if possible/required
   ensure_connected();
 
@@ -201,7 +265,7 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::make_request(
   //std::experimental::string_view req_str(http_req.str());
   std::string req_str(
     generate_request(
-      method, path, extra_query_params, extra_headers, req_body
+      method, path, extra_query_params, *request_headers, req_body
     )
   );
 
@@ -230,35 +294,116 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::make_request(
   // Extract status line for the response code
   std::string protocol, status;
   int code = -1;
-  resp >> protocol >> code >> status;
+  std::string line;
+  std::getline(resp, line);
+  std::istringstream status_line(line);
+  status_line >> protocol >> code >> status;
   ESP_LOGI(TAG, "Received %s response %d %s",
     protocol.c_str(), code, status.c_str()
   );
 
-  // Skip through the headers until delimiter marking end of HTTP headers
-  constexpr char delim[4] = { '\r', '\n', '\r', '\n' };
+  // Read the headers until the empty line marking end of HTTP headers
+  response_headers.clear();
   bool body_was_found = false;
-  size_t delim_pos = 0;
-  char c;
   int header_size = 0;
-  while (resp.get(c))
+  while (std::getline(resp, line))
   {
-    delim_pos = (c == delim[delim_pos])? (delim_pos+1) : 0;
-    if (delim_pos >= sizeof(delim))
+    header_size += line.size() + 1;
+
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.pop_back();
+    }
+
+    if (line.empty())
     {
       body_was_found = true;
       break;
     }
 
-    header_size++;
+    auto sep = line.find(':');
+    if (sep != std::string::npos)
+    {
+      // Header names are case-insensitive, store them in lowercase
+      std::string k(line, 0, sep);
+      std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+
+      auto v_start = line.find_first_not_of(" \t", sep + 1);
+      std::string v(
+        (v_start != std::string::npos)? line.substr(v_start) : ""
+      );
+
+      response_headers[k] = v;
+    }
   }
 
   bool ok = body_was_found;
   if (ok)
   {
-    if (process_resp_body)
+    if ((code == 304) && (cached != nullptr))
     {
-      ok = process_resp_body(code, resp);
+      // Not modified, use the cached body
+      if (response_cache->refresh(cache_key, response_headers))
+      {
+        ok = replay_cached_response(*cached, process_resp_body);
+      }
+      else {
+        ESP_LOGW(TAG, "Cached response is no longer available");
+        ok = false;
+      }
+    }
+    else {
+      std::streambuf* body_buf = &resp_buf;
+
+      // Content codings are case-insensitive
+      std::string content_coding;
+      auto content_encoding = response_headers.find("content-encoding");
+      if (content_encoding != response_headers.end())
+      {
+        content_coding = content_encoding->second;
+        std::transform(
+          content_coding.begin(), content_coding.end(),
+          content_coding.begin(), ::tolower
+        );
+      }
+
+      bool is_compressed = (
+        accept_encoding && (
+          (content_coding == "gzip") ||
+          (content_coding == "deflate")
+        )
+      );
+
+      // Decompress the body as it is read from the connection
+      std::experimental::optional<InflatingStreambuf> inflated_buf;
+      if (is_compressed)
+      {
+        inflated_buf.emplace(resp_buf, 512);
+        body_buf = &(*inflated_buf);
+      }
+
+      // Keep a copy of a cacheable body as it is read
+      std::experimental::optional<RecordingStreambuf> recorded_buf;
+      if (use_cache && HttpResponseCache::is_cacheable(code, response_headers))
+      {
+        recorded_buf.emplace(*body_buf, response_cache->max_size_bytes());
+        body_buf = &(*recorded_buf);
+      }
+
+      std::istream body(body_buf);
+      if (process_resp_body)
+      {
+        ok = process_resp_body(code, body);
+      }
+
+      // Do not cache a body which the callback rejected
+      if (ok && recorded_buf && recorded_buf->drain())
+      {
+        response_cache->store(
+          cache_key, code, std::move(recorded_buf->recorded()),
+          response_headers, cache_request_headers
+        );
+      }
     }
   }
   else {
@@ -380,3 +525,142 @@ HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::has_header(std::experimental
 {
   return headers.find(std::string(k)) != headers.end();
 }
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+bool
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::set_accept_encoding(bool enable)
+{
+  accept_encoding = enable;
+
+  if (accept_encoding)
+  {
+    add_header("Accept-Encoding", "gzip, deflate");
+  }
+  else {
+    headers.erase("Accept-Encoding");
+  }
+
+  return true;
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+bool
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::set_accept_flatbuffers(bool enable)
+{
+  constexpr char accept_flatbuffers[] = "application/x-flatbuffers, application/json";
+
+  auto accept = headers.find("Accept");
+  if (enable)
+  {
+    // Keep any Accept header set by the caller, to restore it after
+    if ((accept != headers.end()) && (accept->second != accept_flatbuffers))
+    {
+      replaced_accept = accept->second;
+    }
+
+    add_header("Accept", accept_flatbuffers);
+  }
+  else {
+    // Only remove the header added above, if it is still set
+    if ((accept != headers.end()) && (accept->second == accept_flatbuffers))
+    {
+      if (replaced_accept.empty())
+      {
+        headers.erase(accept);
+      }
+      else {
+        accept->second = replaced_accept;
+      }
+    }
+
+    replaced_accept.clear();
+  }
+
+  return true;
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+const typename HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::HeaderMap&
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::get_response_headers() const
+{
+  return response_headers;
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+bool
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::is_flatbuffers_response() const
+{
+  auto content_type = response_headers.find("content-type");
+  if (content_type == response_headers.end())
+  {
+    return false;
+  }
+
+  // Compare the media type only, ignoring case and any parameters
+  std::string media_type(
+    content_type->second, 0, content_type->second.find(';')
+  );
+  media_type.erase(media_type.find_last_not_of(" \t") + 1);
+  std::transform(
+    media_type.begin(), media_type.end(), media_type.begin(), ::tolower
+  );
+
+  return (media_type == "application/x-flatbuffers");
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+bool
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::set_response_cache(HttpResponseCache* _response_cache)
+{
+  response_cache = _response_cache;
+  return true;
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+typename HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::HeaderMap
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::generate_cache_request_headers(
+  const HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::HeaderMapView& extra_headers
+)
+{
+  // The headers as sent, with lowercase names
+  HeaderMap request_headers;
+  for (const auto& hdr : headers)
+  {
+    if (extra_headers.find(hdr.first) == extra_headers.end())
+    {
+      std::string k(hdr.first);
+      std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+      request_headers[k] = hdr.second;
+    }
+  }
+  for (const auto& hdr : extra_headers)
+  {
+    std::string k(hdr.first);
+    std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+    request_headers[k] = std::string(hdr.second);
+  }
+
+  return request_headers;
+}
+
+template <class ConnectionHelper, class TLSConnectionImpl>
+bool
+HttpsEndpoint<ConnectionHelper, TLSConnectionImpl>::replay_cached_response(
+  const HttpResponseCache::Entry& cached,
+  ResponseCallback process_resp_body
+)
+{
+  // Cached bodies are decoded as for the original response
+  if (!cached.content_type.empty())
+  {
+    response_headers["content-type"] = cached.content_type;
+  }
+
+  if (process_resp_body)
+  {
+    std::istringstream body(cached.body);
+    return process_resp_body(cached.code, body);
+  }
+
+  return true;
+}
@@ -52,8 +52,9 @@ HttpsResponseStreambuf<TLSConnectionImpl>::underflow()
   if (eback() == base) // true when this isn't the first fill
   {
     // Make arrangements for putback characters
-    std::memmove(base, egptr() - put_back_len, put_back_len);
-    start += put_back_len;
+    auto put_back = std::min(put_back_len, size_t(egptr() - base));
+    std::memmove(base, egptr() - put_back, put_back);
+    start += put_back;
   }
 
   // Start is now the start of the buffer, proper.
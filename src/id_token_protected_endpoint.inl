@@ -9,6 +9,7 @@
  */
 #include "id_token_protected_endpoint.h"
 
+#include "flatbuffers_json_writer.h"
 #include "flatbuffers_streaming_json_visitor.h"
 #include "oidc_embedded_files.h"
 
@@ -39,8 +40,12 @@ IdTokenProtectedEndpoint<TLSConnectionImpl>::IdTokenProtectedEndpoint(
     _id_token_cacert_pem
   )
 , refresh_token(_refresh_token)
-, oidc_parser(OIDC::embedded_files::oidc_fbs, OIDC::embedded_files::oidc_bfbs)
+, oidc_parser(
+    OIDC::embedded_files::oidc_bfbs,
+    FlatbuffersStreamingJsonParser::StaticSchema
+  )
 {
+  id_token_endpoint.set_accept_flatbuffers();
 }
 
 template <class TLSConnectionImpl>
@@ -127,44 +132,68 @@ IdTokenProtectedEndpoint<TLSConnectionImpl>::refresh_id_token(bool update_refres
         oidc_parser
       );
 
-      // prepare to read the response body as JSON
-      return visitor.parse_stream(resp,
-        {},
-        [update_refresh_token, this]
-        (const OIDC::TokenT& t) -> bool
+      // Token and Error are flat, so decode them without the reflection schema
+      visitor.use_table_decoders(OIDC::TokenTypeTable(), OIDC::ErrorTypeTable());
+
+      auto token_callback = [update_refresh_token, this]
+      (const OIDC::Token& t) -> bool
+      {
+        // Update the refresh token if possible
+        if ((update_refresh_token) &&
+            (t.refresh_token() != nullptr) &&
+            (t.refresh_token()->size() > 0))
         {
-          // Update the refresh token if possible
-          if ((update_refresh_token) && (!t.refresh_token.empty()))
-          {
-            refresh_token = t.refresh_token;
-          }
-
-          // Update the id_token, preferring id_token
-          // Then checking access_token as backup
-          if (!t.id_token.empty())
-          {
-            set_id_token(t.id_token);
-            return true;
-          }
-          else if (!t.access_token.empty())
-          {
-            set_id_token(t.access_token);
-            return true;
-          }
-          else {
-            ESP_LOGE(this->TAG, "Unable to obtain valid id_token");
-          }
-
-          return false;
-        },
+          refresh_token = t.refresh_token()->str();
+        }
 
-        {"code"},
-        [this]
-        (const OIDC::ErrorT& error) -> bool
+        // Update the id_token, preferring id_token
+        // Then checking access_token as backup
+        if ((t.id_token() != nullptr) && (t.id_token()->size() > 0))
+        {
+          set_id_token(std::experimental::string_view(
+            t.id_token()->c_str(), t.id_token()->size()
+          ));
+          return true;
+        }
+        else if ((t.access_token() != nullptr) && (t.access_token()->size() > 0))
         {
-          ESP_LOGW(this->TAG, "Encountered unexpected error in HTTP response '%s'", error.message.c_str());
-          return false;
+          set_id_token(std::experimental::string_view(
+            t.access_token()->c_str(), t.access_token()->size()
+          ));
+          return true;
         }
+        else {
+          ESP_LOGE(this->TAG, "Unable to obtain valid id_token");
+        }
+
+        return false;
+      };
+
+      auto error_callback = [this]
+      (const OIDC::Error& error) -> bool
+      {
+        ESP_LOGW(this->TAG, "Encountered unexpected error in HTTP response '%s'",
+          error.message()? error.message()->c_str() : "");
+        return false;
+      };
+
+      // A flatbuffers response is used as-is, skipping JSON entirely
+      if (id_token_endpoint.is_flatbuffers_response())
+      {
+        return visitor.parse_flatbuffer_views(resp,
+          (code >= 400),
+          token_callback,
+          error_callback
+        );
+      }
+
+      // prepare to read the response body as JSON
+      // Only the fields used are copied out of the flatbuffer
+      return visitor.parse_stream_views(resp,
+        {},
+        token_callback,
+        {"code"},
+        error_callback
       );
     }
   );
@@ -191,8 +220,10 @@ IdTokenProtectedEndpoint<TLSConnectionImpl>::generate_refresh_token_json()
   // Finalize the flatbuffer
   fbb.Finish(token_builder.Finish());
 
-  return flatbuffers::FlatBufferToString(
-    fbb.GetBufferPointer(),
-    OIDC::TokenTypeTable()
-  );
+  // Strict JSON, straight from the flatbuffer
+  std::string req_body;
+  FlatbuffersJsonWriter json_writer;
+  json_writer.write(req_body, fbb.GetBufferPointer(), OIDC::TokenTypeTable());
+
+  return req_body;
 }
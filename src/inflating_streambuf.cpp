@@ -0,0 +1,136 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "inflating_streambuf.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+using std::size_t;
+
+constexpr char InflatingStreambuf::TAG[];
+
+// Maximum window size, +32 to automatically detect a gzip or zlib header
+constexpr int inflate_window_bits = (MAX_WBITS + 32);
+
+InflatingStreambuf::InflatingStreambuf(
+  std::streambuf& _src,
+  size_t _len,
+  size_t _put_back_len)
+: src(_src)
+, put_back_len(std::max(_put_back_len, size_t(1)))
+, buffer(std::max(_len, put_back_len) + put_back_len)
+, in_buffer(std::max(_len, size_t(1)))
+{
+  char *end = &buffer.front() + buffer.size();
+  setg(end, end, end);
+
+  std::memset(&zs, 0, sizeof(zs));
+  auto ret = inflateInit2(&zs, inflate_window_bits);
+  zs_initialized = (ret == Z_OK);
+  if (!zs_initialized)
+  {
+    ESP_LOGE(TAG, "inflateInit2 returned %d", ret);
+  }
+}
+
+InflatingStreambuf::~InflatingStreambuf()
+{
+  if (zs_initialized)
+  {
+    inflateEnd(&zs);
+  }
+}
+
+bool
+InflatingStreambuf::fill_input()
+{
+  // Block for at least one byte, then take only what is already buffered
+  if (traits_type::eq_int_type(src.sgetc(), traits_type::eof()))
+  {
+    return false;
+  }
+
+  auto avail = std::max(src.in_avail(), std::streamsize(1));
+  auto len = src.sgetn(
+    &in_buffer.front(),
+    std::min(avail, std::streamsize(in_buffer.size()))
+  );
+
+  zs.next_in = reinterpret_cast<Bytef*>(&in_buffer.front());
+  zs.avail_in = len;
+
+  return (len > 0);
+}
+
+std::streambuf::int_type
+InflatingStreambuf::underflow()
+{
+  if (gptr() < egptr()) // buffer not exhausted
+  {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  if (!zs_initialized || zs_finished)
+  {
+    return traits_type::eof();
+  }
+
+  char *base = &buffer.front();
+  char *start = base;
+
+  if (eback() == base) // true when this isn't the first fill
+  {
+    // Make arrangements for putback characters
+    auto put_back = std::min(put_back_len, size_t(egptr() - base));
+    std::memmove(base, egptr() - put_back, put_back);
+    start += put_back;
+  }
+
+  zs.next_out = reinterpret_cast<Bytef*>(start);
+  zs.avail_out = buffer.size() - (start - base);
+
+  // Inflate until at least one output byte is available
+  while (zs.next_out == reinterpret_cast<Bytef*>(start))
+  {
+    if (zs.avail_in == 0)
+    {
+      if (!fill_input())
+      {
+        ESP_LOGW(TAG, "compressed stream ended unexpectedly");
+        return traits_type::eof();
+      }
+    }
+
+    auto ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+    {
+      zs_finished = true;
+      break;
+    }
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+      ESP_LOGE(TAG, "inflate returned %d", ret);
+      return traits_type::eof();
+    }
+  }
+
+  char *end = reinterpret_cast<char*>(zs.next_out);
+  if (end == start)
+  {
+    return traits_type::eof();
+  }
+
+  // Set buffer pointers
+  setg(base, start, end);
+
+  return traits_type::to_int_type(*gptr());
+}
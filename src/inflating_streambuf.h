@@ -0,0 +1,52 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <streambuf>
+#include <vector>
+
+#include <zlib.h>
+
+// Decompresses a gzip or deflate (zlib) encoded source streambuf on the fly
+class InflatingStreambuf
+: public std::streambuf
+{
+public:
+  explicit InflatingStreambuf(
+    std::streambuf& _src,
+    size_t _len=512,
+    size_t _put_back_len=8);
+
+  ~InflatingStreambuf();
+
+  static constexpr char TAG[] = "InflatingStreambuf";
+
+private:
+  // overrides base class underflow()
+  int_type underflow();
+
+  // Refill the compressed input buffer from the source streambuf
+  bool fill_input();
+
+  // copy ctor and assignment not implemented;
+  // copying not allowed
+  InflatingStreambuf(const InflatingStreambuf &);
+  InflatingStreambuf &operator= (const InflatingStreambuf &);
+
+private:
+  std::streambuf& src;
+  const std::size_t put_back_len;
+  std::vector<char> buffer;
+  std::vector<char> in_buffer;
+
+  z_stream zs;
+  bool zs_initialized = false;
+  bool zs_finished = false;
+};
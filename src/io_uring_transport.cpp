@@ -0,0 +1,649 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "io_uring_transport.h"
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+
+#include "esp_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr char IoUringTransport::TAG[];
+
+// Operation kind, stored in the low bits of the (aligned) Socket* user_data
+enum IoUringOp : uint64_t {
+  IO_URING_OP_SEND = 0,
+  IO_URING_OP_RECV = 1,
+  IO_URING_OP_CANCEL = 2,
+};
+constexpr uint64_t io_uring_op_mask = 0x3;
+
+inline uint64_t
+make_user_data(const IoUringTransport::Socket* sock, IoUringOp op)
+{
+  return (reinterpret_cast<uint64_t>(sock) | op);
+}
+
+IoUringTransport::~IoUringTransport()
+{
+  clear();
+}
+
+bool
+IoUringTransport::init(
+  unsigned _max_sockets,
+  size_t _buf_len
+)
+{
+  if (ready())
+  {
+    return true;
+  }
+
+  // Enough submission entries for a send, recv and cancel per socket
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd = syscall(__NR_io_uring_setup, _max_sockets * 3, &params);
+  if (ring_fd < 0)
+  {
+    ESP_LOGE(TAG, "io_uring_setup failed, errno %d", errno);
+    return false;
+  }
+
+  sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+  if (single_mmap)
+  {
+    sq_len = cq_len = std::max(sq_len, cq_len);
+  }
+
+  sq_ptr = mmap(
+    nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ring_fd, IORING_OFF_SQ_RING
+  );
+  cq_ptr = single_mmap? sq_ptr : mmap(
+    nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ring_fd, IORING_OFF_CQ_RING
+  );
+  sqes = static_cast<struct io_uring_sqe*>(mmap(
+    nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ring_fd, IORING_OFF_SQES
+  ));
+
+  if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+  {
+    ESP_LOGE(TAG, "Unable to map io_uring rings, errno %d", errno);
+    if (sq_ptr == MAP_FAILED) { sq_ptr = nullptr; }
+    if (cq_ptr == MAP_FAILED) { cq_ptr = nullptr; }
+    if (sqes == MAP_FAILED) { sqes = nullptr; }
+    clear();
+    return false;
+  }
+
+  auto sq = static_cast<uint8_t*>(sq_ptr);
+  sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_entries = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+  sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+  auto cq = static_cast<uint8_t*>(cq_ptr);
+  cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // A send and a recv buffer for each socket
+  buf_len = _buf_len;
+  buffers.assign(_max_sockets * 2 * buf_len, 0);
+  sockets.assign(_max_sockets, Socket());
+  sockets_in_use.assign(_max_sockets, false);
+  queued_recvs.reserve(_max_sockets);
+
+  // Registered file slots, indexed like sockets, assigned on attach
+  std::vector<int> fds(_max_sockets, -1);
+  auto ret = syscall(
+    __NR_io_uring_register, ring_fd, IORING_REGISTER_FILES,
+    fds.data(), fds.size()
+  );
+  if (ret < 0)
+  {
+    ESP_LOGE(TAG, "io_uring_register(FILES) failed, errno %d", errno);
+    clear();
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Initialized ring for %u sockets", _max_sockets);
+  return true;
+}
+
+bool
+IoUringTransport::clear()
+{
+  if (sqes != nullptr)
+  {
+    munmap(sqes, sqes_len);
+    sqes = nullptr;
+  }
+  if ((cq_ptr != nullptr) && (cq_ptr != sq_ptr))
+  {
+    munmap(cq_ptr, cq_len);
+  }
+  cq_ptr = nullptr;
+  if (sq_ptr != nullptr)
+  {
+    munmap(sq_ptr, sq_len);
+    sq_ptr = nullptr;
+  }
+  if (ring_fd >= 0)
+  {
+    // Closing the ring also unregisters the files
+    close(ring_fd);
+    ring_fd = -1;
+  }
+
+  to_submit = 0;
+  buffers.clear();
+  sockets.clear();
+  sockets_in_use.clear();
+  queued_recvs.clear();
+
+  return true;
+}
+
+bool
+IoUringTransport::ready() const
+{
+  return (ring_fd >= 0);
+}
+
+IoUringTransport::Socket*
+IoUringTransport::attach(int fd)
+{
+  if (ready())
+  {
+    for (size_t i=0; i<sockets.size(); i++)
+    {
+      if (!sockets_in_use[i])
+      {
+        sockets_in_use[i] = true;
+
+        auto& sock = sockets[i];
+        sock = Socket();
+        sock.transport = this;
+        sock.fd = fd;
+        sock.index = i;
+
+        if (!register_file(i, fd))
+        {
+          sockets_in_use[i] = false;
+          return nullptr;
+        }
+
+        // Let the kernel fill the recv buffer before it is first needed
+        queue_recv(&sock);
+        if (!flush())
+        {
+          detach(&sock);
+          return nullptr;
+        }
+
+        return &sock;
+      }
+    }
+
+    ESP_LOGW(TAG, "No free sockets, %d sockets attached", (int)sockets.size());
+  }
+
+  return nullptr;
+}
+
+int
+IoUringTransport::detach(Socket* sock)
+{
+  if (sock == nullptr || sock->transport != this)
+  {
+    return -EINVAL;
+  }
+
+  bool ok = true;
+
+  // Make sure queued sends (e.g. TLS close_notify) reach the socket
+  while (ok && sock->send_in_flight)
+  {
+    ok = flush(1);
+  }
+
+  // A read-ahead which was not submitted yet is simply dropped
+  auto queued = std::find(queued_recvs.begin(), queued_recvs.end(), sock);
+  if (queued != queued_recvs.end())
+  {
+    queued_recvs.erase(queued);
+    sock->recv_in_flight = false;
+  }
+
+  // A read-ahead may be blocked waiting for data which will never arrive
+  if (ok && sock->recv_in_flight)
+  {
+    ok = queue_cancel(sock);
+    while (ok && sock->recv_in_flight)
+    {
+      ok = flush(1);
+    }
+  }
+
+  auto err = ok? take_send_error(sock) : -EIO;
+  if (!ok)
+  {
+    // The ring is unusable, the slot is released with it on clear()
+    ESP_LOGE(TAG, "Unable to complete pending operations for fd %d", sock->fd);
+    return err;
+  }
+
+  // The ring would otherwise keep the socket open after it is closed
+  register_file(sock->index, -1);
+
+  sockets_in_use[sock->index] = false;
+  *sock = Socket();
+
+  return err;
+}
+
+bool
+IoUringTransport::register_file(unsigned index, int fd)
+{
+  struct io_uring_files_update update;
+  std::memset(&update, 0, sizeof(update));
+  update.offset = index;
+  update.fds = reinterpret_cast<uint64_t>(&fd);
+
+  auto ret = syscall(
+    __NR_io_uring_register, ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1
+  );
+  if (ret < 0)
+  {
+    ESP_LOGE(TAG, "io_uring_register(FILES_UPDATE) failed, errno %d", errno);
+    return false;
+  }
+
+  return true;
+}
+
+void
+IoUringTransport::begin_batch()
+{
+  batching = true;
+}
+
+bool
+IoUringTransport::flush(unsigned min_complete)
+{
+  batching = false;
+  prepare_recvs();
+
+  while ((to_submit > 0) || (min_complete > 0))
+  {
+    auto ret = syscall(
+      __NR_io_uring_enter, ring_fd, to_submit, min_complete,
+      (min_complete > 0)? IORING_ENTER_GETEVENTS : 0,
+      nullptr, 0
+    );
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      ESP_LOGE(TAG, "io_uring_enter failed, errno %d", errno);
+      return false;
+    }
+
+    to_submit -= std::min<unsigned>(ret, to_submit);
+    break;
+  }
+
+  reap();
+  return true;
+}
+
+void
+IoUringTransport::reap()
+{
+  // Every available completion, for any attached socket
+  unsigned head = *cq_head;
+  while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+  {
+    process_completion(&cqes[head & *cq_mask]);
+    head++;
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe*
+IoUringTransport::get_sqe()
+{
+  unsigned tail = *sq_tail;
+  if ((tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)) >= *sq_entries)
+  {
+    // Should not happen, there are 3 entries for each socket and each socket
+    // has at most one send, one recv and one cancel queued at a time
+    ESP_LOGE(TAG, "Submission queue is full");
+    return nullptr;
+  }
+
+  unsigned idx = (tail & *sq_mask);
+  auto sqe = &sqes[idx];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array[idx] = idx;
+
+  return sqe;
+}
+
+bool
+IoUringTransport::queue_send(Socket* sock)
+{
+  auto sqe = get_sqe();
+  if (sqe == nullptr)
+  {
+    return false;
+  }
+
+  // A peer which has gone away is reported as EPIPE, not with SIGPIPE
+  sqe->opcode = IORING_OP_SEND;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = sock->index;
+  sqe->addr = reinterpret_cast<uint64_t>(send_buffer(sock) + sock->send_off);
+  sqe->len = (sock->send_len - sock->send_off);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = make_user_data(sock, IO_URING_OP_SEND);
+
+  __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+  to_submit++;
+
+  sock->send_in_flight = true;
+  return true;
+}
+
+void
+IoUringTransport::queue_recv(Socket* sock)
+{
+  // The entry is only added on flush, after any sends queued until then,
+  // so a read-ahead submitted along with a send to the same host finds its
+  // data instead of having to wait for it
+  queued_recvs.push_back(sock);
+
+  sock->recv_in_flight = true;
+  sock->recv_len = 0;
+  sock->recv_off = 0;
+}
+
+void
+IoUringTransport::prepare_recvs()
+{
+  for (auto sock : queued_recvs)
+  {
+    auto sqe = get_sqe();
+    if (sqe == nullptr)
+    {
+      // recv() queues it again
+      sock->recv_in_flight = false;
+      continue;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = sock->index;
+    sqe->addr = reinterpret_cast<uint64_t>(recv_buffer(sock));
+    sqe->len = buf_len;
+    sqe->user_data = make_user_data(sock, IO_URING_OP_RECV);
+
+    __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+  }
+
+  queued_recvs.clear();
+}
+
+bool
+IoUringTransport::queue_cancel(Socket* sock)
+{
+  auto sqe = get_sqe();
+  if (sqe == nullptr)
+  {
+    return false;
+  }
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = make_user_data(sock, IO_URING_OP_RECV);
+  sqe->user_data = make_user_data(sock, IO_URING_OP_CANCEL);
+
+  __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+  to_submit++;
+
+  return true;
+}
+
+void
+IoUringTransport::process_completion(const struct io_uring_cqe* cqe)
+{
+  auto op = (cqe->user_data & io_uring_op_mask);
+  auto sock = reinterpret_cast<Socket*>(cqe->user_data & ~io_uring_op_mask);
+
+  switch (op)
+  {
+    case IO_URING_OP_SEND:
+      if (cqe->res < 0)
+      {
+        sock->send_err = cqe->res;
+        sock->send_in_flight = false;
+      }
+      else {
+        sock->send_off += cqe->res;
+        // Resubmit the remainder of a short write
+        sock->send_in_flight = false;
+        if ((sock->send_off < sock->send_len) && !queue_send(sock))
+        {
+          sock->send_err = -EIO;
+        }
+      }
+      break;
+
+    case IO_URING_OP_RECV:
+      sock->recv_in_flight = false;
+      if (cqe->res < 0)
+      {
+        sock->recv_err = cqe->res;
+      }
+      else if (cqe->res == 0)
+      {
+        sock->recv_eof = true;
+      }
+      else {
+        sock->recv_len = cqe->res;
+        sock->recv_off = 0;
+      }
+      break;
+
+    case IO_URING_OP_CANCEL:
+    default:
+      // Nothing to do, the cancelled recv reports its own completion
+      break;
+  }
+}
+
+uint8_t*
+IoUringTransport::send_buffer(const Socket* sock)
+{
+  return &buffers[(sock->index * 2) * buf_len];
+}
+
+uint8_t*
+IoUringTransport::recv_buffer(const Socket* sock)
+{
+  return &buffers[((sock->index * 2) + 1) * buf_len];
+}
+
+int
+IoUringTransport::take_send_error(Socket* sock)
+{
+  auto err = sock->send_err;
+  sock->send_err = 0;
+  return err;
+}
+
+int
+IoUringTransport::send(void* ctx, const unsigned char* buf, size_t len)
+{
+  auto sock = static_cast<Socket*>(ctx);
+  auto transport = sock->transport;
+
+  // The send buffer can only be re-used once the previous send completes
+  while (sock->send_in_flight)
+  {
+    if (!transport->flush(1))
+    {
+      return -EIO;
+    }
+  }
+
+  // Report an error from a previous send
+  if (sock->send_err != 0)
+  {
+    return take_send_error(sock);
+  }
+
+  // mbedtls will retry with the remainder of a partial write
+  len = std::min(len, transport->buf_len);
+  std::memcpy(transport->send_buffer(sock), buf, len);
+  sock->send_len = len;
+  sock->send_off = 0;
+
+  if (!transport->queue_send(sock))
+  {
+    return -EIO;
+  }
+
+  // Submitted on flush, along with the other sends of the batch
+  if (transport->batching)
+  {
+    return len;
+  }
+
+  // Submitted with any queued read-aheads, a socket send usually completes
+  // during the submission, and its errors are reported here
+  if (!transport->flush())
+  {
+    return -EIO;
+  }
+
+  if (!sock->send_in_flight && (sock->send_err != 0))
+  {
+    return take_send_error(sock);
+  }
+
+  return len;
+}
+
+int
+IoUringTransport::recv(void* ctx, unsigned char* buf, size_t len)
+{
+  auto sock = static_cast<Socket*>(ctx);
+  auto transport = sock->transport;
+
+  // The read-ahead may have completed already
+  transport->reap();
+
+  // e.g. the remainder of a short write, queued while reaping
+  if (sock->send_in_flight && !transport->flush())
+  {
+    return -EIO;
+  }
+
+  while (true)
+  {
+    // A request followed by a read must not lose its write error
+    if (sock->send_err != 0)
+    {
+      return take_send_error(sock);
+    }
+
+    // Serve from the read-ahead buffer
+    if (sock->recv_off < sock->recv_len)
+    {
+      auto n = std::min(len, (sock->recv_len - sock->recv_off));
+      std::memcpy(buf, transport->recv_buffer(sock) + sock->recv_off, n);
+      sock->recv_off += n;
+
+      // Start the next read-ahead as soon as this one is consumed, it is
+      // submitted with the next send or flush
+      if (sock->recv_off >= sock->recv_len)
+      {
+        transport->queue_recv(sock);
+      }
+
+      return n;
+    }
+
+    if ((sock->recv_err != 0) || sock->recv_eof)
+    {
+      // A peer which closed the connection has most likely failed the send
+      // too, its error is the one to report
+      while (sock->send_in_flight)
+      {
+        if (!transport->flush(1))
+        {
+          return -EIO;
+        }
+      }
+
+      if (sock->send_err != 0)
+      {
+        return take_send_error(sock);
+      }
+    }
+
+    if (sock->recv_err != 0)
+    {
+      auto err = sock->recv_err;
+      sock->recv_err = 0;
+      return err;
+    }
+
+    if (sock->recv_eof)
+    {
+      return 0;
+    }
+
+    if (!sock->recv_in_flight)
+    {
+      transport->queue_recv(sock);
+    }
+
+    // Submits any queued read-aheads along with this one, in one syscall
+    if (!transport->flush(1))
+    {
+      return -EIO;
+    }
+  }
+}
+
+#endif // HTTPS_ENDPOINT_USE_IO_URING
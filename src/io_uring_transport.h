@@ -0,0 +1,161 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+
+#include <linux/io_uring.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Linux io_uring socket transport, for use as an mbedtls BIO.
+//
+// One transport (ring) is shared by many connections on the same thread.
+// Each attached socket is a registered (fixed) file, and owns two buffers:
+// - sends are copied into the send buffer and submitted right away, along
+//   with any queued read-aheads, in a single io_uring_enter() call;
+//   between begin_batch() and flush(), sends on all sockets are only queued,
+//   and submitted together
+// - a read-ahead into the recv buffer is started on attach, and queued again
+//   as soon as the previous one has been consumed, so the kernel can fill it
+//   while TLS processing runs; it is submitted after the sends queued with
+//   it, so a reply which is already there is read without waiting
+// Completions are reaped without a syscall whenever they are already posted,
+// so a recv whose data has arrived is served from the read-ahead buffer.
+//
+// Sends on one socket never overlap: with a single send buffer, send() first
+// waits for the previous send on that socket to complete. Sends on different
+// sockets are in flight concurrently. A failed send is reported by the next
+// send(), recv() or detach() on that socket, whichever comes first.
+//
+// Errors are returned as negative errno values, which the caller maps to its
+// own error codes (e.g. TLSConnection maps them to mbedtls's).
+class IoUringTransport
+{
+public:
+  struct Socket;
+
+  IoUringTransport() = default;
+  ~IoUringTransport();
+
+  static constexpr char TAG[] = "IoUringTransport";
+
+  bool init(
+    unsigned _max_sockets=32,
+    size_t _buf_len=16384
+  );
+  bool clear();
+  bool ready() const;
+
+  // Assign ring resources to a connected socket
+  Socket* attach(int fd);
+
+  // Wait for in-flight sends, cancel any read-ahead, release resources
+  // Returns 0, or the negative errno of a send which failed and was not yet
+  // reported; the socket is released either way
+  int detach(Socket* sock);
+
+  // Submit all queued operations, and process any available completions
+  // Blocks until at least min_complete completions have been processed
+  bool flush(unsigned min_complete=0);
+
+  // Queue sends instead of submitting each one, until the next flush()
+  // e.g. to write requests on many connections with a single syscall
+  // A send() or recv() which has to wait flushes, and so ends the batch
+  void begin_batch();
+
+  // Same signatures as mbedtls_ssl_send_t / mbedtls_ssl_recv_t, with ctx a
+  // Socket* returned from attach(), but returning a negative errno on error
+  // send() blocks until the socket's previous send has completed, then
+  // submits at most buf_len bytes
+  // recv() returns 0 at the end of the stream
+  static int send(void* ctx, const unsigned char* buf, size_t len);
+  static int recv(void* ctx, unsigned char* buf, size_t len);
+
+  struct Socket
+  {
+    IoUringTransport* transport = nullptr;
+    int fd = -1;
+    unsigned index = 0;
+
+    // Send state
+    bool send_in_flight = false;
+    size_t send_len = 0;
+    size_t send_off = 0;
+    int send_err = 0;
+
+    // Recv (read-ahead) state
+    bool recv_in_flight = false;
+    size_t recv_len = 0;
+    size_t recv_off = 0;
+    int recv_err = 0;
+    bool recv_eof = false;
+  };
+
+private:
+  struct io_uring_sqe* get_sqe();
+
+  // Assign fd (or -1 to release it) to a registered file slot
+  bool register_file(unsigned index, int fd);
+
+  bool queue_send(Socket* sock);
+  void queue_recv(Socket* sock);
+  bool queue_cancel(Socket* sock);
+
+  // Add the queued read-aheads to the submission queue
+  void prepare_recvs();
+
+  // Process any posted completions, without a syscall
+  void reap();
+  void process_completion(const struct io_uring_cqe* cqe);
+
+  // Returns and resets the error of a failed send, or 0
+  static int take_send_error(Socket* sock);
+
+  uint8_t* send_buffer(const Socket* sock);
+  uint8_t* recv_buffer(const Socket* sock);
+
+  // Ring
+  int ring_fd = -1;
+  unsigned to_submit = 0;
+  bool batching = false;
+
+  void* sq_ptr = nullptr;
+  size_t sq_len = 0;
+  void* cq_ptr = nullptr;
+  size_t cq_len = 0;
+  struct io_uring_sqe* sqes = nullptr;
+  size_t sqes_len = 0;
+
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_mask = nullptr;
+  unsigned* sq_entries = nullptr;
+  unsigned* sq_array = nullptr;
+
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned* cq_mask = nullptr;
+  struct io_uring_cqe* cqes = nullptr;
+
+  // Buffers, 2 per socket (send, recv)
+  size_t buf_len = 0;
+  std::vector<uint8_t> buffers;
+  std::vector<Socket> sockets;
+  std::vector<bool> sockets_in_use;
+
+  // Read-aheads to submit on the next flush, after any sends
+  std::vector<Socket*> queued_recvs;
+};
+
+#endif // HTTPS_ENDPOINT_USE_IO_URING
@@ -0,0 +1,132 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "json_key_interner.h"
+
+#include <cstring>
+
+constexpr JsonKeyInterner::Id JsonKeyInterner::unknown;
+constexpr size_t JsonKeyInterner::block_size;
+
+void
+JsonKeyInterner::set_base(const JsonKeyInterner* _base)
+{
+  if (_base != base)
+  {
+    // Ids of the keys interned here depend on the size of the base
+    clear();
+    base = _base;
+    base_size = (base != nullptr)? base->size() : 0;
+  }
+}
+
+const JsonKeyInterner*
+JsonKeyInterner::get_base() const
+{
+  return base;
+}
+
+void
+JsonKeyInterner::clear()
+{
+  blocks.clear();
+  block_used = block_size;
+
+  keys.clear();
+  ids.clear();
+}
+
+JsonKeyInterner::Id
+JsonKeyInterner::intern(std::experimental::string_view key)
+{
+  if (base != nullptr)
+  {
+    auto id = base->find(key);
+    if (id != unknown)
+    {
+      return id;
+    }
+  }
+
+  auto found = ids.find(key);
+  if (found != ids.end())
+  {
+    return found->second;
+  }
+
+  Id id = base_size + keys.size();
+  std::experimental::string_view stored(store(key), key.size());
+  keys.push_back(stored);
+  ids.emplace(stored, id);
+
+  return id;
+}
+
+JsonKeyInterner::Id
+JsonKeyInterner::find(std::experimental::string_view key) const
+{
+  if (base != nullptr)
+  {
+    auto id = base->find(key);
+    if ((id != unknown) || ids.empty())
+    {
+      return id;
+    }
+  }
+
+  auto found = ids.find(key);
+  return (found != ids.end())? found->second : unknown;
+}
+
+std::experimental::string_view
+JsonKeyInterner::get_key(Id id) const
+{
+  if (id < base_size)
+  {
+    return (base != nullptr)? base->get_key(id) : std::experimental::string_view();
+  }
+
+  if (static_cast<size_t>(id - base_size) >= keys.size())
+  {
+    return {};
+  }
+
+  return keys[id - base_size];
+}
+
+size_t
+JsonKeyInterner::size() const
+{
+  return base_size + keys.size();
+}
+
+const char*
+JsonKeyInterner::store(std::experimental::string_view key)
+{
+  if (blocks.empty() || ((block_size - block_used) < key.size()))
+  {
+    if (key.size() > block_size)
+    {
+      // Oversized keys get a block of their own, which is then full
+      blocks.emplace_back(new char[key.size()]);
+      memcpy(blocks.back().get(), key.data(), key.size());
+      block_used = block_size;
+      return blocks.back().get();
+    }
+
+    blocks.emplace_back(new char[block_size]);
+    block_used = 0;
+  }
+
+  auto* p = blocks.back().get() + block_used;
+  memcpy(p, key.data(), key.size());
+  block_used += key.size();
+
+  return p;
+}
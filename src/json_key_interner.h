@@ -0,0 +1,60 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <experimental/string_view>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Assigns small integer ids to known object keys (schema field names and
+// path selector keys), so each key in the input is hashed once and then
+// matched by id. Interned keys are copied into an arena, and ids stay valid
+// until clear().
+// An interner can be layered on a shared base (e.g. the field names of a
+// schema): keys in the base keep its ids, others are numbered after them.
+class JsonKeyInterner
+{
+public:
+  typedef int Id;
+
+  // Returned by find() for keys which were never interned
+  static constexpr Id unknown = -1;
+
+  // Clears the keys interned here (but not the base), if the base changes
+  // The base must outlive this interner, and must not change itself
+  void set_base(const JsonKeyInterner* _base);
+  const JsonKeyInterner* get_base() const;
+
+  // Keys interned here, the base is unchanged
+  void clear();
+
+  Id intern(std::experimental::string_view key);
+  Id find(std::experimental::string_view key) const;
+
+  std::experimental::string_view get_key(Id id) const;
+  size_t size() const;
+
+private:
+  static constexpr size_t block_size = 1024;
+
+  const char* store(std::experimental::string_view key);
+
+  const JsonKeyInterner* base = nullptr;
+  Id base_size = 0;
+
+  // Key storage, never reallocated
+  std::vector<std::unique_ptr<char[]>> blocks;
+  size_t block_used = block_size;
+
+  std::vector<std::experimental::string_view> keys;
+  std::unordered_map<std::experimental::string_view, Id> ids;
+};
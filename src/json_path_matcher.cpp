@@ -0,0 +1,263 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "json_path_matcher.h"
+
+#include <algorithm>
+#include <map>
+
+constexpr JsonPathMatcher::State JsonPathMatcher::no_match;
+constexpr char JsonPathMatcher::wildcard[];
+
+void
+JsonPathMatcher::clear()
+{
+  nodes.clear();
+  selector_values.clear();
+  states.clear();
+}
+
+bool
+JsonPathMatcher::add_selector(const std::vector<std::string>& selector, int value)
+{
+  if (nodes.empty())
+  {
+    nodes.emplace_back();
+  }
+
+  // Walk (or extend) the trie along the selector
+  int node = 0;
+  for (const auto& key : selector)
+  {
+    int child = -1;
+    if (key == wildcard)
+    {
+      child = nodes[node].wildcard_child;
+    }
+    else {
+      auto found = nodes[node].children.find(key);
+      if (found != nodes[node].children.end())
+      {
+        child = found->second;
+      }
+    }
+
+    if (child < 0)
+    {
+      child = nodes.size();
+      nodes.emplace_back();
+
+      if (key == wildcard)
+      {
+        nodes[node].wildcard_child = child;
+      }
+      else {
+        nodes[node].children[key] = child;
+      }
+    }
+
+    node = child;
+  }
+
+  if (nodes[node].selector < 0)
+  {
+    nodes[node].selector = selector_values.size();
+  }
+  selector_values.push_back(value);
+
+  // Must be compiled again before use
+  states.clear();
+
+  return true;
+}
+
+bool
+JsonPathMatcher::compile()
+{
+  states.clear();
+
+  if (nodes.empty())
+  {
+    return false;
+  }
+
+  // Subset construction, each state is a sorted set of trie nodes
+  // Selectors have no cycles, so this always terminates
+  std::map<std::vector<int>, State> state_ids;
+  std::vector<std::vector<int>> pending;
+
+  auto get_state = [&](std::vector<int>& node_set) -> State
+  {
+    if (node_set.empty())
+    {
+      return no_match;
+    }
+
+    std::sort(node_set.begin(), node_set.end());
+    node_set.erase(std::unique(node_set.begin(), node_set.end()), node_set.end());
+
+    auto found = state_ids.find(node_set);
+    if (found != state_ids.end())
+    {
+      return found->second;
+    }
+
+    State state = states.size();
+    state_ids.emplace(node_set, state);
+    pending.push_back(node_set);
+
+    DeterministicState deterministic_state;
+    int selector = -1;
+    for (auto node : node_set)
+    {
+      if (nodes[node].selector >= 0 &&
+          (selector < 0 || nodes[node].selector < selector))
+      {
+        selector = nodes[node].selector;
+      }
+    }
+
+    if (selector >= 0)
+    {
+      deterministic_state.value = selector_values[selector];
+    }
+
+    states.push_back(std::move(deterministic_state));
+    return state;
+  };
+
+  std::vector<int> root_set = {0};
+  get_state(root_set);
+
+  for (size_t i = 0; i < pending.size(); ++i)
+  {
+    // Copy, pending may be reallocated by get_state
+    auto node_set = pending[i];
+
+    // Any key not listed explicitly can only follow wildcards
+    std::vector<int> other_set;
+    for (auto node : node_set)
+    {
+      if (nodes[node].wildcard_child >= 0)
+      {
+        other_set.push_back(nodes[node].wildcard_child);
+      }
+    }
+
+    auto other = get_state(other_set);
+    states[i].other = other;
+
+    for (auto node : node_set)
+    {
+      for (const auto& child : nodes[node].children)
+      {
+        const auto& key = child.first;
+        if (states[i].transitions.count(key))
+        {
+          continue;
+        }
+
+        std::vector<int> key_set(other_set);
+        for (auto key_node : node_set)
+        {
+          auto found = nodes[key_node].children.find(key);
+          if (found != nodes[key_node].children.end())
+          {
+            key_set.push_back(found->second);
+          }
+        }
+
+        auto state = get_state(key_set);
+        states[i].transitions[key] = state;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool
+JsonPathMatcher::compile(JsonKeyInterner& interner)
+{
+  if (!compile())
+  {
+    return false;
+  }
+
+  for (auto& state : states)
+  {
+    for (const auto& transition : state.transitions)
+    {
+      size_t key_id = interner.intern(transition.first);
+      if (key_id >= state.key_transitions.size())
+      {
+        state.key_transitions.resize(key_id + 1, state.other);
+      }
+      state.key_transitions[key_id] = transition.second;
+    }
+  }
+
+  return true;
+}
+
+bool
+JsonPathMatcher::is_compiled() const
+{
+  return !states.empty();
+}
+
+JsonPathMatcher::State
+JsonPathMatcher::get_root_state() const
+{
+  return is_compiled()? 0 : no_match;
+}
+
+JsonPathMatcher::State
+JsonPathMatcher::next(State state, const std::string& key) const
+{
+  if (state == no_match)
+  {
+    return no_match;
+  }
+
+  const auto& current = states[state];
+  if (!current.transitions.empty())
+  {
+    auto found = current.transitions.find(key);
+    if (found != current.transitions.end())
+    {
+      return found->second;
+    }
+  }
+
+  return current.other;
+}
+
+JsonPathMatcher::State
+JsonPathMatcher::next(State state, JsonKeyInterner::Id key_id) const
+{
+  if (state == no_match)
+  {
+    return no_match;
+  }
+
+  const auto& current = states[state];
+  if ((key_id >= 0) && (static_cast<size_t>(key_id) < current.key_transitions.size()))
+  {
+    return current.key_transitions[key_id];
+  }
+
+  return current.other;
+}
+
+int
+JsonPathMatcher::get_value(State state) const
+{
+  return (state == no_match)? -1 : states[state].value;
+}
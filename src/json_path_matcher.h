@@ -0,0 +1,78 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "json_key_interner.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Matches JSON object key paths against a set of selectors, e.g. {"items", "*"}
+// The selectors are compiled into a state machine, so following each key
+// costs one hash lookup regardless of the depth or the number of selectors.
+// "*" matches any single key, and an empty selector matches the root value.
+class JsonPathMatcher
+{
+public:
+  typedef int State;
+
+  // No selector can match below this state
+  static constexpr State no_match = -1;
+
+  static constexpr char wildcard[] = "*";
+
+  void clear();
+
+  // Value is returned by get_value() when the selector matches
+  // If several selectors match the same path, the first one added is used
+  bool add_selector(const std::vector<std::string>& selector, int value);
+
+  bool compile();
+
+  // Also interns each selector key, for next() by key id
+  bool compile(JsonKeyInterner& interner);
+
+  bool is_compiled() const;
+
+  State get_root_state() const;
+  State next(State state, const std::string& key) const;
+
+  // Only after compile(interner), with ids from the same interner
+  State next(State state, JsonKeyInterner::Id key_id) const;
+
+  // Value of the selector matching exactly at this state, or -1
+  int get_value(State state) const;
+
+private:
+  // Trie of all selectors
+  struct Node
+  {
+    std::unordered_map<std::string, int> children;
+    int wildcard_child = -1;
+    int selector = -1;
+  };
+
+  // Deterministic state, for a set of trie nodes
+  struct DeterministicState
+  {
+    std::unordered_map<std::string, State> transitions;
+    State other = no_match;
+
+    // Transitions indexed by key id, other for any key not listed
+    std::vector<State> key_transitions;
+    int value = -1;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<int> selector_values;
+
+  std::vector<DeterministicState> states;
+};
@@ -0,0 +1,141 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <experimental/string_view>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Resumable JSON tokenizer, fed with buffers split at arbitrary boundaries.
+// Emits the same events as picojson::_parse (including number handling and
+// string escapes), as calls on the handler:
+//   set_null(), set_bool(b), set_int64(i), set_number(d), set_string(s),
+//   start_object(), key(k), end_object(), start_array(), end_array()
+// Any handler call returning false stops parsing with an error.
+// As with picojson, input after the root value is ignored.
+// The handler may call skip_value() from key() to ignore the key's value.
+template<class Handler>
+class JsonPushParser
+{
+public:
+  explicit JsonPushParser(Handler& _handler);
+
+  static constexpr char TAG[] = "JsonPushParser";
+
+  void clear();
+
+  // Returns false on a syntax error (or a handler failure)
+  bool feed(std::experimental::string_view buf);
+
+  // End of input, completes a trailing root number
+  bool finish();
+
+  // A string, object or array value following this key produces no events:
+  // it is only checked for string boundaries and balanced brackets
+  void skip_value();
+
+  bool is_done() const;
+  bool has_error() const;
+  const std::string& get_error() const;
+
+private:
+  enum Expect : uint8_t
+  {
+    ExpectValue,
+    ExpectValueOrArrayEnd,
+    ExpectKeyOrObjectEnd,
+    ExpectKey,
+    ExpectColon,
+    ExpectCommaOrEnd,
+    ExpectNothing,
+  };
+
+  enum Token : uint8_t
+  {
+    NoToken,
+    StringToken,
+    NumberToken,
+    LiteralToken,
+    SkipToken,
+  };
+
+  // Position within a string escape sequence
+  enum Escape : uint8_t
+  {
+    NoEscape,
+    EscapeStart,
+    EscapeHex,
+    SurrogateBackslash,
+    SurrogateU,
+    SurrogateHex,
+  };
+
+  enum Container : uint8_t
+  {
+    ObjectContainer,
+    ArrayContainer,
+  };
+
+  const char* continue_string(const char* p, const char* end);
+  const char* continue_number(const char* p, const char* end);
+  const char* continue_literal(const char* p, const char* end);
+  const char* continue_skip(const char* p, const char* end);
+
+  bool start_value(char c);
+  bool start_skip(char c);
+  bool end_string();
+  bool end_number();
+  static bool parse_simple_number(
+    const std::string& s,
+    bool& is_integer,
+    int64_t& i,
+    double& d
+  );
+  bool end_literal();
+  bool end_container(Container container);
+  bool end_skip_container(Container container);
+  bool end_value();
+
+  bool escape_char(char c);
+  bool hex_digit(char c);
+  void append_code_point(int uni_ch);
+
+  bool fail(const char* reason);
+
+  Handler& handler;
+
+  Expect expect = ExpectValue;
+  std::vector<Container> containers;
+
+  // Partial token, kept across calls to feed()
+  Token token = NoToken;
+  std::string str;
+  bool is_key = false;
+  Escape escape = NoEscape;
+  int hex_count = 0;
+  int hex_value = 0;
+  int high_surrogate = 0;
+  const char* literal = nullptr;
+  size_t literal_pos = 0;
+
+  // Skipped value state
+  bool skip_next = false;
+  bool skip_in_string = false;
+  bool skip_escape = false;
+  std::vector<Container> skip_containers;
+
+  int line = 1;
+  bool error = false;
+  std::string error_str;
+};
+
+#include "json_push_parser.inl"
@@ -0,0 +1,887 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "json_push_parser.h"
+
+#include "json_scan.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+template<class Handler>
+constexpr char JsonPushParser<Handler>::TAG[];
+
+template<class Handler>
+JsonPushParser<Handler>::JsonPushParser(Handler& _handler)
+: handler(_handler)
+{
+}
+
+template<class Handler>
+void
+JsonPushParser<Handler>::clear()
+{
+  expect = ExpectValue;
+  containers.clear();
+
+  token = NoToken;
+  str.clear();
+  is_key = false;
+  escape = NoEscape;
+  hex_count = 0;
+  hex_value = 0;
+  high_surrogate = 0;
+  literal = nullptr;
+  literal_pos = 0;
+
+  skip_next = false;
+  skip_in_string = false;
+  skip_escape = false;
+  skip_containers.clear();
+
+  line = 1;
+  error = false;
+  error_str.clear();
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::feed(std::experimental::string_view buf)
+{
+  const char* p = buf.data();
+  const char* end = p + buf.size();
+
+  while ((p < end) && !error && (expect != ExpectNothing))
+  {
+    // Resume a token split by the previous buffer boundary
+    if (token != NoToken)
+    {
+      if (token == StringToken)
+      {
+        p = continue_string(p, end);
+      }
+      else if (token == NumberToken)
+      {
+        p = continue_number(p, end);
+      }
+      else if (token == SkipToken)
+      {
+        p = continue_skip(p, end);
+      }
+      else {
+        p = continue_literal(p, end);
+      }
+      continue;
+    }
+
+    if (json_scan::is_whitespace(*p))
+    {
+      const char* ws = p;
+      p = json_scan::skip_whitespace(p, end);
+      line += std::count(ws, p, '\n');
+      continue;
+    }
+
+    char c = *p;
+
+    switch (expect)
+    {
+      case ExpectValueOrArrayEnd:
+        if (c == ']')
+        {
+          p++;
+          end_container(ArrayContainer);
+          break;
+        }
+        // fall through
+
+      case ExpectValue:
+        if (skip_next && start_skip(c))
+        {
+          p++;
+          break;
+        }
+
+        // Numbers are consumed by continue_number, including the first char
+        if (start_value(c) && (token != NumberToken))
+        {
+          p++;
+        }
+        break;
+
+      case ExpectKeyOrObjectEnd:
+        if (c == '}')
+        {
+          p++;
+          end_container(ObjectContainer);
+          break;
+        }
+        // fall through
+
+      case ExpectKey:
+        if (c == '"')
+        {
+          p++;
+          token = StringToken;
+          is_key = true;
+          str.clear();
+        }
+        else {
+          fail("expected a key");
+        }
+        break;
+
+      case ExpectColon:
+        if (c == ':')
+        {
+          p++;
+          expect = ExpectValue;
+          skip_next = false;
+          if (!handler.key(str))
+          {
+            fail("key rejected");
+          }
+        }
+        else {
+          fail("expected ':'");
+        }
+        break;
+
+      case ExpectCommaOrEnd:
+        p++;
+        if (c == ',')
+        {
+          expect = (containers.back() == ObjectContainer)? ExpectKey : ExpectValue;
+        }
+        else if ((c == '}') && (containers.back() == ObjectContainer))
+        {
+          end_container(ObjectContainer);
+        }
+        else if ((c == ']') && (containers.back() == ArrayContainer))
+        {
+          end_container(ArrayContainer);
+        }
+        else {
+          fail("expected ',' or the end of a container");
+        }
+        break;
+
+      case ExpectNothing:
+        break;
+    }
+  }
+
+  return !error;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::finish()
+{
+  // A root number has no terminating character
+  if (!error && (token == NumberToken))
+  {
+    end_number();
+  }
+
+  if (!error && (expect != ExpectNothing))
+  {
+    fail("unexpected end of input");
+  }
+
+  return !error;
+}
+
+template<class Handler>
+void
+JsonPushParser<Handler>::skip_value()
+{
+  skip_next = true;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::is_done() const
+{
+  return (expect == ExpectNothing);
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::has_error() const
+{
+  return error;
+}
+
+template<class Handler>
+const std::string&
+JsonPushParser<Handler>::get_error() const
+{
+  return error_str;
+}
+
+template<class Handler>
+const char*
+JsonPushParser<Handler>::continue_string(const char* p, const char* end)
+{
+  while (p < end)
+  {
+    if (escape != NoEscape)
+    {
+      char c = *p++;
+      if (!escape_char(c))
+      {
+        return end;
+      }
+      continue;
+    }
+
+    // Copy the run of plain characters at once
+    const char* run = p;
+    p = json_scan::find_string_special(p, end);
+    str.append(run, p - run);
+
+    if (p == end)
+    {
+      break;
+    }
+
+    char c = *p++;
+    if (c == '"')
+    {
+      end_string();
+      break;
+    }
+    else if (c == '\\')
+    {
+      escape = EscapeStart;
+    }
+    else {
+      fail("control character in string");
+      return end;
+    }
+  }
+
+  return p;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::escape_char(char c)
+{
+  switch (escape)
+  {
+    case EscapeStart:
+      escape = NoEscape;
+      switch (c)
+      {
+        case '"': str.push_back('"'); break;
+        case '\\': str.push_back('\\'); break;
+        case '/': str.push_back('/'); break;
+        case 'b': str.push_back('\b'); break;
+        case 'f': str.push_back('\f'); break;
+        case 'n': str.push_back('\n'); break;
+        case 'r': str.push_back('\r'); break;
+        case 't': str.push_back('\t'); break;
+        case 'u':
+          escape = EscapeHex;
+          hex_count = 0;
+          hex_value = 0;
+          break;
+        default:
+          return fail("invalid escape");
+      }
+      return true;
+
+    case EscapeHex:
+    case SurrogateHex:
+      return hex_digit(c);
+
+    case SurrogateBackslash:
+      if (c != '\\')
+      {
+        return fail("expected a low surrogate");
+      }
+      escape = SurrogateU;
+      return true;
+
+    case SurrogateU:
+      if (c != 'u')
+      {
+        return fail("expected a low surrogate");
+      }
+      escape = SurrogateHex;
+      hex_count = 0;
+      hex_value = 0;
+      return true;
+
+    case NoEscape:
+      break;
+  }
+
+  return true;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::hex_digit(char c)
+{
+  int hex = 0;
+  if (('0' <= c) && (c <= '9'))
+  {
+    hex = c - '0';
+  }
+  else if (('A' <= c) && (c <= 'F'))
+  {
+    hex = c - 'A' + 0xa;
+  }
+  else if (('a' <= c) && (c <= 'f'))
+  {
+    hex = c - 'a' + 0xa;
+  }
+  else {
+    return fail("invalid \\u escape");
+  }
+
+  hex_value = (hex_value * 16) + hex;
+  if (++hex_count < 4)
+  {
+    return true;
+  }
+
+  if (escape == SurrogateHex)
+  {
+    if ((hex_value < 0xdc00) || (hex_value > 0xdfff))
+    {
+      return fail("invalid low surrogate");
+    }
+
+    escape = NoEscape;
+    append_code_point(
+      (((high_surrogate - 0xd800) << 10) | ((hex_value - 0xdc00) & 0x3ff))
+      + 0x10000
+    );
+    return true;
+  }
+
+  if ((0xd800 <= hex_value) && (hex_value <= 0xdfff))
+  {
+    if (hex_value >= 0xdc00)
+    {
+      return fail("unpaired low surrogate");
+    }
+
+    // The second half of the pair must follow immediately
+    high_surrogate = hex_value;
+    escape = SurrogateBackslash;
+    return true;
+  }
+
+  escape = NoEscape;
+  append_code_point(hex_value);
+  return true;
+}
+
+template<class Handler>
+void
+JsonPushParser<Handler>::append_code_point(int uni_ch)
+{
+  if (uni_ch < 0x80)
+  {
+    str.push_back(static_cast<char>(uni_ch));
+  }
+  else {
+    if (uni_ch < 0x800)
+    {
+      str.push_back(static_cast<char>(0xc0 | (uni_ch >> 6)));
+    }
+    else {
+      if (uni_ch < 0x10000)
+      {
+        str.push_back(static_cast<char>(0xe0 | (uni_ch >> 12)));
+      }
+      else {
+        str.push_back(static_cast<char>(0xf0 | (uni_ch >> 18)));
+        str.push_back(static_cast<char>(0x80 | ((uni_ch >> 12) & 0x3f)));
+      }
+      str.push_back(static_cast<char>(0x80 | ((uni_ch >> 6) & 0x3f)));
+    }
+    str.push_back(static_cast<char>(0x80 | (uni_ch & 0x3f)));
+  }
+}
+
+template<class Handler>
+const char*
+JsonPushParser<Handler>::continue_number(const char* p, const char* end)
+{
+  // Same (permissive) character set as picojson, validated by strtoll/strtod
+  const char* run = p;
+  while ((p < end) && (
+    (('0' <= *p) && (*p <= '9')) ||
+    (*p == '+') || (*p == '-') ||
+    (*p == 'e') || (*p == 'E') ||
+    (*p == '.')))
+  {
+    p++;
+  }
+  str.append(run, p - run);
+
+  if (p < end)
+  {
+    end_number();
+  }
+
+  return p;
+}
+
+template<class Handler>
+const char*
+JsonPushParser<Handler>::continue_literal(const char* p, const char* end)
+{
+  while ((p < end) && (literal[literal_pos] != '\0'))
+  {
+    if (*p++ != literal[literal_pos++])
+    {
+      fail("invalid literal");
+      return end;
+    }
+  }
+
+  if (literal[literal_pos] == '\0')
+  {
+    end_literal();
+  }
+
+  return p;
+}
+
+template<class Handler>
+const char*
+JsonPushParser<Handler>::continue_skip(const char* p, const char* end)
+{
+  while (p < end)
+  {
+    if (skip_in_string)
+    {
+      if (skip_escape)
+      {
+        // Any escaped character, including a quote
+        p++;
+        skip_escape = false;
+        continue;
+      }
+
+      p = json_scan::find_string_special(p, end);
+      if (p == end)
+      {
+        break;
+      }
+
+      char c = *p++;
+      if (c == '"')
+      {
+        skip_in_string = false;
+        if (skip_containers.empty())
+        {
+          // A skipped string value
+          token = NoToken;
+          end_value();
+          break;
+        }
+      }
+      else if (c == '\\')
+      {
+        skip_escape = true;
+      }
+      else {
+        fail("control character in string");
+        return end;
+      }
+      continue;
+    }
+
+    // Numbers, literals and separators are not checked
+    p = json_scan::find_structural(p, end);
+    if (p == end)
+    {
+      break;
+    }
+
+    char c = *p++;
+    switch (c)
+    {
+      case '"':
+        skip_in_string = true;
+        break;
+
+      case '{':
+        skip_containers.push_back(ObjectContainer);
+        break;
+
+      case '[':
+        skip_containers.push_back(ArrayContainer);
+        break;
+
+      case '}':
+        if (!end_skip_container(ObjectContainer))
+        {
+          return end;
+        }
+        break;
+
+      case ']':
+        if (!end_skip_container(ArrayContainer))
+        {
+          return end;
+        }
+        break;
+
+      case '\n':
+        line++;
+        break;
+
+      default:
+        fail("expected a value");
+        return end;
+    }
+
+    if (token != SkipToken)
+    {
+      break;
+    }
+  }
+
+  return p;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::start_skip(char c)
+{
+  skip_next = false;
+
+  switch (c)
+  {
+    case '"':
+      skip_in_string = true;
+      break;
+
+    case '{':
+      skip_containers.push_back(ObjectContainer);
+      break;
+
+    case '[':
+      skip_containers.push_back(ArrayContainer);
+      break;
+
+    default:
+      // Scalars are short, parse them as usual
+      return false;
+  }
+
+  token = SkipToken;
+  skip_escape = false;
+  return true;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::end_skip_container(Container container)
+{
+  if (skip_containers.empty() || (skip_containers.back() != container))
+  {
+    return fail("mismatched brackets");
+  }
+
+  skip_containers.pop_back();
+  if (skip_containers.empty())
+  {
+    token = NoToken;
+    end_value();
+  }
+  return true;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::start_value(char c)
+{
+  switch (c)
+  {
+    case '"':
+      token = StringToken;
+      is_key = false;
+      str.clear();
+      return true;
+
+    case '{':
+      containers.push_back(ObjectContainer);
+      expect = ExpectKeyOrObjectEnd;
+      return handler.start_object() || fail("object rejected");
+
+    case '[':
+      containers.push_back(ArrayContainer);
+      expect = ExpectValueOrArrayEnd;
+      return handler.start_array() || fail("array rejected");
+
+    case 'n':
+    case 't':
+    case 'f':
+      token = LiteralToken;
+      literal = (c == 'n')? "null" : (c == 't')? "true" : "false";
+      literal_pos = 1;
+      return true;
+
+    default:
+      if ((('0' <= c) && (c <= '9')) || (c == '-'))
+      {
+        token = NumberToken;
+        str.clear();
+        return true;
+      }
+      return fail("expected a value");
+  }
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::end_string()
+{
+  token = NoToken;
+
+  if (is_key)
+  {
+    // The key is passed on once its ':' is found, as picojson does
+    expect = ExpectColon;
+    return true;
+  }
+
+  if (!handler.set_string(str))
+  {
+    return fail("string rejected");
+  }
+  return end_value();
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::end_number()
+{
+  token = NoToken;
+
+  // Most numbers are converted here, without strtoll/strtod
+  bool is_integer = false;
+  int64_t ival = 0;
+  double f = 0;
+  if (parse_simple_number(str, is_integer, ival, f))
+  {
+#ifdef PICOJSON_USE_INT64
+    if (is_integer)
+    {
+      return handler.set_int64(ival)? end_value() : fail("number rejected");
+    }
+#endif // PICOJSON_USE_INT64
+
+    return handler.set_number(f)? end_value() : fail("number rejected");
+  }
+
+  const char* num_end = str.c_str() + str.size();
+  char* endp = nullptr;
+
+#ifdef PICOJSON_USE_INT64
+  errno = 0;
+  ival = strtoll(str.c_str(), &endp, 10);
+  if ((errno == 0) && (endp == num_end))
+  {
+    return handler.set_int64(ival)? end_value() : fail("number rejected");
+  }
+#endif // PICOJSON_USE_INT64
+
+  f = strtod(str.c_str(), &endp);
+  if (endp == num_end)
+  {
+    return handler.set_number(f)? end_value() : fail("number rejected");
+  }
+
+  return fail("invalid number");
+}
+
+// Up to 15 significant digits, with a power of ten up to 22: the digits
+// and the power of ten are both exact doubles, so a single multiply or
+// divide is correctly rounded, the same result as strtod (Clinger's fast
+// path). Anything else, including invalid numbers, is left to strtod.
+template<class Handler>
+bool
+JsonPushParser<Handler>::parse_simple_number(
+  const std::string& s,
+  bool& is_integer,
+  int64_t& i,
+  double& d
+)
+{
+  static constexpr double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  constexpr int max_digits = 15;
+  constexpr int max_exponent = 22;
+
+  const char* p = s.c_str();
+  const char* end = p + s.size();
+
+  bool negative = ((p < end) && (*p == '-'));
+  if (negative)
+  {
+    p++;
+  }
+
+  // Leading zeros are not significant
+  int64_t digits = 0;
+  int digit_count = 0;
+  int exponent = 0;
+
+  const char* int_start = p;
+  while ((p < end) && ('0' <= *p) && (*p <= '9'))
+  {
+    digits = (digits * 10) + (*p++ - '0');
+    digit_count += (digits != 0);
+    if (digit_count > max_digits)
+    {
+      return false;
+    }
+  }
+  if (p == int_start)
+  {
+    return false;
+  }
+
+  is_integer = true;
+  if ((p < end) && (*p == '.'))
+  {
+    const char* frac_start = ++p;
+    while ((p < end) && ('0' <= *p) && (*p <= '9'))
+    {
+      digits = (digits * 10) + (*p++ - '0');
+      digit_count += (digits != 0);
+      exponent--;
+      if (digit_count > max_digits)
+      {
+        return false;
+      }
+    }
+    if (p == frac_start)
+    {
+      return false;
+    }
+    is_integer = false;
+  }
+
+  if ((p < end) && ((*p == 'e') || (*p == 'E')))
+  {
+    p++;
+    bool negative_exponent = false;
+    if ((p < end) && ((*p == '+') || (*p == '-')))
+    {
+      negative_exponent = (*p++ == '-');
+    }
+
+    const char* exp_start = p;
+    int exp_value = 0;
+    while ((p < end) && ('0' <= *p) && (*p <= '9') && (exp_value <= max_exponent))
+    {
+      exp_value = (exp_value * 10) + (*p++ - '0');
+    }
+    if (p == exp_start)
+    {
+      return false;
+    }
+    exponent += (negative_exponent? -exp_value : exp_value);
+    is_integer = false;
+  }
+
+  if ((p != end) || (exponent < -max_exponent) || (exponent > max_exponent))
+  {
+    return false;
+  }
+
+  d = static_cast<double>(digits);
+  d = (exponent < 0)?
+    (d / powers_of_ten[-exponent]) :
+    (d * powers_of_ten[exponent]);
+  d = (negative? -d : d);
+
+  i = (negative? -digits : digits);
+
+  return true;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::end_literal()
+{
+  token = NoToken;
+
+  bool ok = false;
+  switch (literal[0])
+  {
+    case 'n':
+      ok = handler.set_null();
+      break;
+    case 't':
+      ok = handler.set_bool(true);
+      break;
+    default:
+      ok = handler.set_bool(false);
+      break;
+  }
+
+  if (!ok)
+  {
+    return fail("literal rejected");
+  }
+  return end_value();
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::end_container(Container container)
+{
+  containers.pop_back();
+
+  bool ok = (container == ObjectContainer)?
+    handler.end_object() : handler.end_array();
+
+  if (!ok)
+  {
+    return fail("container rejected");
+  }
+  return end_value();
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::end_value()
+{
+  expect = containers.empty()? ExpectNothing : ExpectCommaOrEnd;
+  return true;
+}
+
+template<class Handler>
+bool
+JsonPushParser<Handler>::fail(const char* reason)
+{
+  if (!error)
+  {
+    error = true;
+    error_str = "syntax error at line " + std::to_string(line) + ": " + reason;
+  }
+  return false;
+}
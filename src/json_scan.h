@@ -0,0 +1,428 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) && !defined(JSON_SCAN_NO_SIMD)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__) && !defined(JSON_SCAN_NO_SIMD)
+#include <immintrin.h>
+#endif
+
+// Block scanners for the JSON tokenizer hot loops: the plain run of a string
+// (up to a quote, backslash or control character) and runs of whitespace.
+// AVX2 (32 bytes) or SSE2 (16 bytes) is used when the compiler targets it,
+// otherwise 8 bytes at a time in a 64-bit word. Define JSON_SCAN_NO_SIMD to
+// use the word-at-a-time scanner everywhere.
+// find_structural is used to skip values: outside of strings, only quotes,
+// brackets and newlines (for line numbers) matter.
+namespace json_scan {
+
+inline bool
+is_string_special(char c)
+{
+  return (
+    (c == '"') ||
+    (c == '\\') ||
+    (static_cast<unsigned char>(c) < 0x20)
+  );
+}
+
+inline bool
+is_whitespace(char c)
+{
+  return ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'));
+}
+
+// Brackets are the bytes with (c & 0xd9) == 0x59, which is also true of
+// 'Y', 'y', '_' and DEL (never valid outside of a string)
+inline bool
+is_structural(char c)
+{
+  return (
+    (c == '"') ||
+    (c == '\n') ||
+    ((static_cast<unsigned char>(c) & 0xd9) == 0x59)
+  );
+}
+
+namespace scalar {
+
+// Byte-at-a-time, for the tail of a block scan
+inline const char*
+find_string_special(const char* p, const char* end)
+{
+  while ((p < end) && !is_string_special(*p))
+  {
+    p++;
+  }
+  return p;
+}
+
+inline const char*
+skip_whitespace(const char* p, const char* end)
+{
+  while ((p < end) && is_whitespace(*p))
+  {
+    p++;
+  }
+  return p;
+}
+
+inline const char*
+find_structural(const char* p, const char* end)
+{
+  while ((p < end) && !is_structural(*p))
+  {
+    p++;
+  }
+  return p;
+}
+
+} // namespace scalar
+
+namespace word {
+
+constexpr uint64_t ones = 0x0101010101010101ULL;
+constexpr uint64_t lows = 0x7f7f7f7f7f7f7f7fULL;
+constexpr uint64_t highs = 0x8080808080808080ULL;
+
+// High bit set in exactly the zero bytes (no borrows between bytes)
+inline uint64_t
+zero_bytes(uint64_t x)
+{
+  return ~(((x & lows) + lows) | x | lows);
+}
+
+inline uint64_t
+bytes_equal_to(uint64_t x, uint8_t c)
+{
+  return zero_bytes(x ^ (ones * c));
+}
+
+// Bytes below 0x20 are those with none of the top 3 bits set
+inline uint64_t
+control_bytes(uint64_t x)
+{
+  return zero_bytes(x & (ones * 0xe0));
+}
+
+inline const char*
+find_string_special(const char* p, const char* end)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  while ((end - p) >= 8)
+  {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+
+    auto mask = (
+      bytes_equal_to(x, '"') |
+      bytes_equal_to(x, '\\') |
+      control_bytes(x)
+    );
+    if (mask)
+    {
+      return p + (__builtin_ctzll(mask) / 8);
+    }
+    p += 8;
+  }
+#endif // __BYTE_ORDER__
+
+  return scalar::find_string_special(p, end);
+}
+
+inline const char*
+skip_whitespace(const char* p, const char* end)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  while ((end - p) >= 8)
+  {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+
+    auto ws = (
+      bytes_equal_to(x, ' ') |
+      bytes_equal_to(x, '\t') |
+      bytes_equal_to(x, '\n') |
+      bytes_equal_to(x, '\r')
+    );
+
+    auto mask = ~ws & highs;
+    if (mask)
+    {
+      return p + (__builtin_ctzll(mask) / 8);
+    }
+    p += 8;
+  }
+#endif // __BYTE_ORDER__
+
+  return scalar::skip_whitespace(p, end);
+}
+
+inline const char*
+find_structural(const char* p, const char* end)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  while ((end - p) >= 8)
+  {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+
+    auto mask = (
+      bytes_equal_to(x, '"') |
+      bytes_equal_to(x, '\n') |
+      bytes_equal_to(x & (ones * 0xd9), 0x59)
+    );
+    if (mask)
+    {
+      return p + (__builtin_ctzll(mask) / 8);
+    }
+    p += 8;
+  }
+#endif // __BYTE_ORDER__
+
+  return scalar::find_structural(p, end);
+}
+
+} // namespace word
+
+#if defined(__SSE2__) && !defined(JSON_SCAN_NO_SIMD)
+namespace sse2 {
+
+inline const char*
+find_string_special(const char* p, const char* end)
+{
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  const auto control = _mm_set1_epi8(0x1f);
+
+  while ((end - p) >= 16)
+  {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+    auto special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+      // Unsigned v <= 0x1f
+      _mm_cmpeq_epi8(_mm_min_epu8(v, control), v)
+    );
+
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special));
+    if (mask)
+    {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+
+  return scalar::find_string_special(p, end);
+}
+
+inline const char*
+skip_whitespace(const char* p, const char* end)
+{
+  const auto space = _mm_set1_epi8(' ');
+  const auto tab = _mm_set1_epi8('\t');
+  const auto newline = _mm_set1_epi8('\n');
+  const auto carriage_return = _mm_set1_epi8('\r');
+
+  while ((end - p) >= 16)
+  {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+    auto ws = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+      _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, carriage_return))
+    );
+
+    auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(ws)) & 0xffff;
+    if (mask)
+    {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+
+  return scalar::skip_whitespace(p, end);
+}
+
+inline const char*
+find_structural(const char* p, const char* end)
+{
+  const auto quote = _mm_set1_epi8('"');
+  const auto newline = _mm_set1_epi8('\n');
+  const auto bracket_bits = _mm_set1_epi8(static_cast<char>(0xd9));
+  const auto bracket = _mm_set1_epi8(0x59);
+
+  while ((end - p) >= 16)
+  {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+    auto structural = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, newline)),
+      _mm_cmpeq_epi8(_mm_and_si128(v, bracket_bits), bracket)
+    );
+
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(structural));
+    if (mask)
+    {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+
+  return scalar::find_structural(p, end);
+}
+
+} // namespace sse2
+#endif // __SSE2__
+
+#if defined(__AVX2__) && !defined(JSON_SCAN_NO_SIMD)
+namespace avx2 {
+
+inline const char*
+find_string_special(const char* p, const char* end)
+{
+  const auto quote = _mm256_set1_epi8('"');
+  const auto backslash = _mm256_set1_epi8('\\');
+  const auto control = _mm256_set1_epi8(0x1f);
+
+  while ((end - p) >= 32)
+  {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+    auto special = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, quote),
+        _mm256_cmpeq_epi8(v, backslash)
+      ),
+      // Unsigned v <= 0x1f
+      _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v)
+    );
+
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special));
+    if (mask)
+    {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+
+  return sse2::find_string_special(p, end);
+}
+
+inline const char*
+skip_whitespace(const char* p, const char* end)
+{
+  const auto space = _mm256_set1_epi8(' ');
+  const auto tab = _mm256_set1_epi8('\t');
+  const auto newline = _mm256_set1_epi8('\n');
+  const auto carriage_return = _mm256_set1_epi8('\r');
+
+  while ((end - p) >= 32)
+  {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+    auto ws = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, space),
+        _mm256_cmpeq_epi8(v, tab)
+      ),
+      _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, newline),
+        _mm256_cmpeq_epi8(v, carriage_return)
+      )
+    );
+
+    auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(ws));
+    if (mask)
+    {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+
+  return sse2::skip_whitespace(p, end);
+}
+
+inline const char*
+find_structural(const char* p, const char* end)
+{
+  const auto quote = _mm256_set1_epi8('"');
+  const auto newline = _mm256_set1_epi8('\n');
+  const auto bracket_bits = _mm256_set1_epi8(static_cast<char>(0xd9));
+  const auto bracket = _mm256_set1_epi8(0x59);
+
+  while ((end - p) >= 32)
+  {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+    auto structural = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, quote),
+        _mm256_cmpeq_epi8(v, newline)
+      ),
+      _mm256_cmpeq_epi8(_mm256_and_si256(v, bracket_bits), bracket)
+    );
+
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(structural));
+    if (mask)
+    {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+
+  return sse2::find_structural(p, end);
+}
+
+} // namespace avx2
+#endif // __AVX2__
+
+// The widest scanner available for this target
+#if defined(__AVX2__) && !defined(JSON_SCAN_NO_SIMD)
+namespace native = avx2;
+#elif defined(__SSE2__) && !defined(JSON_SCAN_NO_SIMD)
+namespace native = sse2;
+#else
+namespace native = word;
+#endif
+
+// First quote, backslash or control character in [p, end), or end
+inline const char*
+find_string_special(const char* p, const char* end)
+{
+  return native::find_string_special(p, end);
+}
+
+// First non-whitespace character in [p, end), or end
+inline const char*
+skip_whitespace(const char* p, const char* end)
+{
+  // Most runs are short (minified JSON, or a single space)
+  if ((p == end) || !is_whitespace(*p))
+  {
+    return p;
+  }
+  return native::skip_whitespace(p + 1, end);
+}
+
+// First quote, bracket or newline in [p, end) (see is_structural), or end
+inline const char*
+find_structural(const char* p, const char* end)
+{
+  return native::find_structural(p, end);
+}
+
+} // namespace json_scan
@@ -0,0 +1,608 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "openssl_tls_connection.h"
+
+#include <string>
+
+#include <cerrno>
+#include <cstring>
+
+#include "esp_log.h"
+
+// Error codes expected by HttpsEndpoint and HttpsResponseStreambuf
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+OpenSSLTLSConnection::OpenSSLTLSConnection(
+  std::experimental::string_view _host,
+  unsigned short _port,
+  std::experimental::string_view _cacert_pem
+)
+{
+  initialize(_host, _port, _cacert_pem);
+}
+
+OpenSSLTLSConnection::~OpenSSLTLSConnection()
+{
+  clear();
+}
+
+bool
+OpenSSLTLSConnection::initialize(
+  std::experimental::string_view _host,
+  unsigned short _port,
+  std::experimental::string_view _cacert_pem
+)
+{
+  // Update our cached state
+  bool host_changed = ((_host != host) || (_port != port));
+  if (host_changed)
+  {
+    // Disconnect if already connected and new connection parameters specified
+    if (connected())
+    {
+      disconnect();
+    }
+
+    // Mark the session (for the previous host) as invalid
+    clear_session();
+
+    // Update member variables for desired connection host/port/cacert
+    host.assign(_host.data(), _host.size());
+    port = _port;
+
+    // Update logging message prefix
+    TAG = host.data();
+  }
+
+  if (_cacert_pem.empty() == false)
+  {
+    set_cacert(_cacert_pem);
+  }
+
+  return host_changed;
+}
+
+bool
+OpenSSLTLSConnection::init()
+{
+  if (!_initialized)
+  {
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx != nullptr)
+    {
+      SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+      // Sessions are stored and re-used explicitly, as with mbedtls
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+    }
+    else {
+      ESP_LOGE(TAG, "SSL_CTX_new failed");
+      tls_print_error(0);
+    }
+
+    _initialized = (ctx != nullptr);
+  }
+
+  return _initialized;
+}
+
+bool
+OpenSSLTLSConnection::clear()
+{
+  if (_initialized)
+  {
+    _close();
+    clear_session();
+    SSL_CTX_free(ctx);
+    ctx = nullptr;
+
+    _initialized = false;
+    _connected = false;
+    _verified = false;
+    _has_valid_session = false;
+  }
+
+  return _initialized;
+}
+
+bool
+OpenSSLTLSConnection::ready()
+{
+  return _initialized && _cacert_set;
+}
+
+bool
+OpenSSLTLSConnection::connected()
+{
+  return _connected && _verified;
+}
+
+bool
+OpenSSLTLSConnection::store_session()
+{
+  if (connected())
+  {
+    ESP_LOGI(TAG, "(5/7) Storing established session ticket for reuse...");
+
+    clear_session();
+
+    saved_session = SSL_get1_session(ssl);
+    _has_valid_session = (saved_session != nullptr);
+    if (_has_valid_session == false)
+    {
+      ESP_LOGE(TAG, "SSL_get1_session returned no session");
+    }
+  }
+
+  return _has_valid_session;
+}
+
+bool
+OpenSSLTLSConnection::clear_session()
+{
+  if (saved_session != nullptr)
+  {
+    SSL_SESSION_free(saved_session);
+    saved_session = nullptr;
+  }
+
+  _has_valid_session = false;
+
+  return (_has_valid_session == false);
+}
+
+bool
+OpenSSLTLSConnection::has_valid_session()
+{
+  return _has_valid_session;
+}
+
+bool
+OpenSSLTLSConnection::set_verification_level(int level)
+{
+  // Only REQUIRE policy is supported
+  return (level == MBEDTLS_SSL_VERIFY_REQUIRED);
+}
+
+int
+OpenSSLTLSConnection::get_verification_level()
+{
+  // Only REQUIRE policy is supported
+  return MBEDTLS_SSL_VERIFY_REQUIRED;
+}
+
+bool
+OpenSSLTLSConnection::set_cacert(
+  std::experimental::string_view _cacert_pem,
+  bool force_disconnect
+)
+{
+  cacert_pem.assign(_cacert_pem.data(), _cacert_pem.size());
+
+  if (!_ensure_initialized())
+  {
+    return false;
+  }
+
+  ESP_LOGI(TAG, "(0/7) Setting up the SSL/TLS structure...");
+
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+
+  ESP_LOGI(TAG, "(1/7) Loading the CA root certificate...");
+
+  // Replace any previously loaded CA certificates
+  X509_STORE* store = X509_STORE_new();
+  BIO* bio = BIO_new_mem_buf(_cacert_pem.data(), _cacert_pem.size());
+
+  int count = 0;
+  X509* cert = nullptr;
+  while ((cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) != nullptr)
+  {
+    if (X509_STORE_add_cert(store, cert) == 1)
+    {
+      count++;
+    }
+    X509_free(cert);
+  }
+  BIO_free(bio);
+
+  // Reaching the end of the PEM data is expected, not an error
+  ERR_clear_error();
+
+  if (count == 0)
+  {
+    ESP_LOGE(TAG, "No CA root certificates found in PEM data");
+    X509_STORE_free(store);
+
+    return false;
+  }
+
+  SSL_CTX_set_cert_store(ctx, store);
+
+  if (force_disconnect)
+  {
+    disconnect();
+  }
+
+  _cacert_set = true;
+
+  return _cacert_set;
+}
+
+bool
+OpenSSLTLSConnection::clear_cacert()
+{
+  _cacert_set = false;
+  cacert_pem.clear();
+
+  return true;
+}
+
+bool
+OpenSSLTLSConnection::has_valid_cacert()
+{
+  return _cacert_set;
+}
+
+bool
+OpenSSLTLSConnection::_ensure_initialized()
+{
+  if (!_initialized)
+  {
+    _initialized = init();
+    if (_cacert_set)
+    {
+      set_cacert(cacert_pem);
+    }
+    if (!_initialized)
+    {
+      clear();
+    }
+  }
+
+  return _initialized;
+}
+
+bool
+OpenSSLTLSConnection::_ensure_connected(
+  std::experimental::string_view _host,
+  unsigned short _port
+)
+{
+  initialize(_host, _port);
+
+  if (!connected() && _has_valid_session)
+  {
+    if (reconnect() == false)
+    {
+      ESP_LOGW(TAG, "Invalid or missing SSL session, reconnecting fully");
+
+      clear_session();
+    }
+  }
+
+  return connected();
+}
+
+bool
+OpenSSLTLSConnection::connect(
+  std::experimental::string_view _host,
+  unsigned short _port
+)
+{
+  if (!_ensure_initialized())
+  {
+    return false;
+  }
+
+  if (!_cacert_set)
+  {
+    return false;
+  }
+
+  if (_ensure_connected(_host, _port))
+  {
+    return true;
+  }
+
+  // Our conditions are met, and we will need a full (re)connection cycle
+
+  // (Re)initialize saved session storage
+  clear_session();
+
+  // connecting for the first time
+  _connected = _connect();
+
+  if (_connected)
+  {
+    _verified = verify();
+    if (_verified)
+    {
+      store_session();
+    }
+  }
+
+  return connected();
+}
+
+bool
+OpenSSLTLSConnection::reconnect()
+{
+  if (!connected())
+  {
+    // We are (or were) already connected
+    if (has_valid_session())
+    {
+      // Reconnecting and hopefully re-using existing session ticket
+      ESP_LOGI(TAG, "Re-use previous session");
+      _connected = _connect();
+      if (_connected)
+      {
+        // Still verify, the server may have chosen a full handshake
+        _verified = verify();
+        if (_verified)
+        {
+          ESP_LOGI(TAG, "Session was %s",
+            SSL_session_reused(ssl)? "re-used" : "not re-used"
+          );
+          if (!SSL_session_reused(ssl))
+          {
+            store_session();
+          }
+        }
+      }
+    }
+    else if (
+      (host.empty() == false) &&
+      (port > 0) &&
+      (_cacert_set == true)
+    )
+    {
+      return connect(host, port);
+    }
+
+    if (_connected == false)
+    {
+      clear_session();
+    }
+  }
+
+  return connected();
+}
+
+bool
+OpenSSLTLSConnection::disconnect()
+{
+  if (_connected)
+  {
+    // TLS 1.3 session tickets arrive after the handshake, store them now
+    if (connected() && (SSL_version(ssl) >= TLS1_3_VERSION))
+    {
+      store_session();
+    }
+
+    SSL_shutdown(ssl);
+
+    _close();
+
+    _connected = false;
+    _verified = false;
+  }
+
+  return (_connected == false);
+}
+
+int
+OpenSSLTLSConnection::write(std::experimental::string_view buf)
+{
+  if (connected())
+  {
+    auto ret = SSL_write(ssl, buf.data(), buf.size());
+    return (ret > 0)? ret : _map_error(ret, MBEDTLS_ERR_NET_SEND_FAILED);
+  }
+
+  return -1;
+}
+
+int
+OpenSSLTLSConnection::read(std::experimental::string_view buf)
+{
+  if (connected())
+  {
+    auto ret = SSL_read(ssl, const_cast<char*>(buf.data()), buf.size());
+    return (ret > 0)? ret : _map_error(ret, MBEDTLS_ERR_NET_RECV_FAILED);
+  }
+
+  return -1;
+}
+
+int
+OpenSSLTLSConnection::_map_error(int ret, int socket_error)
+{
+  // Before anything else can overwrite errno
+  auto sys_err = errno;
+
+  auto err = SSL_get_error(ssl, ret);
+  switch (err)
+  {
+    case SSL_ERROR_WANT_READ:
+      return MBEDTLS_ERR_SSL_WANT_READ;
+
+    case SSL_ERROR_WANT_WRITE:
+      return MBEDTLS_ERR_SSL_WANT_WRITE;
+
+    case SSL_ERROR_ZERO_RETURN:
+      return MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+
+    case SSL_ERROR_SYSCALL:
+      if (ERR_peek_error() == 0)
+      {
+        // Connection closed without close_notify
+        if (ret == 0)
+        {
+          return 0;
+        }
+
+        // Otherwise the socket itself failed, as mbedtls_net_send/recv report it
+        ESP_LOGE(TAG, "Socket error, errno %d", sys_err);
+        return ((sys_err == ECONNRESET) || (sys_err == EPIPE))?
+          MBEDTLS_ERR_NET_CONN_RESET : socket_error;
+      }
+      // fall through
+
+    default:
+      ESP_LOGE(TAG, "SSL_get_error returned %d", err);
+      tls_print_error(ret);
+      return -1;
+  }
+}
+
+bool
+OpenSSLTLSConnection::tls_print_error(int ret)
+{
+  static char buf[256] = {0};
+  ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+  ESP_LOGE(TAG, "Last error was: %d - %s", ret, buf);
+
+  return true;
+}
+
+void
+OpenSSLTLSConnection::_close()
+{
+  if (ssl != nullptr)
+  {
+    SSL_free(ssl);
+    ssl = nullptr;
+  }
+
+  if (server_fd >= 0)
+  {
+    close(server_fd);
+    server_fd = -1;
+  }
+}
+
+bool
+OpenSSLTLSConnection::_connect()
+{
+  _close();
+
+  char port_str_c_str[6];
+  snprintf(port_str_c_str, sizeof(port_str_c_str), "%d", port);
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  struct addrinfo* addr_list = nullptr;
+  auto ret = getaddrinfo(host.c_str(), port_str_c_str, &hints, &addr_list);
+  if (ret != 0)
+  {
+    ESP_LOGE(TAG, "getaddrinfo returned %d", ret);
+    return false;
+  }
+
+  for (auto addr = addr_list; addr != nullptr; addr = addr->ai_next)
+  {
+    server_fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (server_fd < 0)
+    {
+      continue;
+    }
+
+    if (::connect(server_fd, addr->ai_addr, addr->ai_addrlen) == 0)
+    {
+      break;
+    }
+
+    close(server_fd);
+    server_fd = -1;
+  }
+  freeaddrinfo(addr_list);
+
+  if (server_fd < 0)
+  {
+    ESP_LOGE(TAG, "Unable to connect to %s:%d", host.c_str(), port);
+    return false;
+  }
+
+  ESP_LOGI(TAG, "(2/7) Setting hostname for TLS session...");
+
+  ssl = SSL_new(ctx);
+  SSL_set_fd(ssl, server_fd);
+
+  // Hostname set here should match CN in server certificate
+  SSL_set_tlsext_host_name(ssl, host.c_str());
+  SSL_set1_host(ssl, host.c_str());
+
+  ESP_LOGI(TAG, "(3/7) TCP/IP Connected.");
+
+  if (_has_valid_session)
+  {
+    SSL_set_session(ssl, saved_session);
+  }
+
+  ESP_LOGI(TAG, "(4/7) Performing the SSL/TLS handshake...");
+
+  ret = SSL_connect(ssl);
+  if (ret != 1)
+  {
+    ESP_LOGE(TAG, "SSL_connect returned %d", SSL_get_error(ssl, ret));
+    tls_print_error(ret);
+    _close();
+  }
+
+  return (ret == 1);
+}
+
+bool
+OpenSSLTLSConnection::verify()
+{
+  if (_connected)
+  {
+    ESP_LOGI(TAG, "(6/7) Verifying peer X.509 certificate...");
+
+    // The result is also X509_V_OK when no certificate was presented
+    X509* peer_cert = SSL_get_peer_certificate(ssl);
+    auto result = SSL_get_verify_result(ssl);
+    if ((result == X509_V_OK) && (peer_cert != nullptr))
+    {
+      ESP_LOGI(TAG, "(7/7) Certificate verified.");
+      _verified = true;
+    }
+    else {
+      ESP_LOGW(TAG, "Failed to verify peer certificate!");
+      ESP_LOGE(TAG, "Failed verification info: %s",
+        X509_verify_cert_error_string(result)
+      );
+    }
+
+    X509_free(peer_cert);
+  }
+
+  return _verified;
+}
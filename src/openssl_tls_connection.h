@@ -0,0 +1,109 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <experimental/string_view>
+#include <string>
+
+#include <openssl/ssl.h>
+
+// OpenSSL/BoringSSL implementation of the TLSConnection interface,
+// for use as the TLSConnectionImpl of HttpsEndpoint on servers.
+// read()/write() report errors with the same (mbedtls) codes as TLSConnection
+class OpenSSLTLSConnection
+{
+public:
+  OpenSSLTLSConnection() = default;
+
+  OpenSSLTLSConnection(
+    std::experimental::string_view _host,
+    unsigned short _port,
+    std::experimental::string_view _cacert_pem
+  );
+
+  ~OpenSSLTLSConnection();
+
+  bool initialize(
+    std::experimental::string_view _host,
+    unsigned short _port=443,
+    std::experimental::string_view _cacert_pem=""
+  );
+
+  bool init();
+  bool clear();
+
+  bool ready();
+  bool connected();
+
+  bool store_session();
+  bool clear_session();
+  bool has_valid_session();
+
+  bool set_verification_level(int level);
+  int get_verification_level();
+  bool verify();
+
+  bool set_cacert(
+    std::experimental::string_view _cacert_pem,
+    bool force_disconnect=true
+  );
+  bool clear_cacert();
+  bool has_valid_cacert();
+
+  bool connect(
+    std::experimental::string_view _host,
+    unsigned short _port
+  );
+
+  bool reconnect();
+  bool disconnect();
+
+  int write(std::experimental::string_view buf);
+  int read(std::experimental::string_view buf);
+
+protected:
+  std::string host;
+  unsigned short port = 443;
+  std::string cacert_pem;
+
+  const char* TAG = "";
+
+private:
+  bool _ensure_initialized();
+  bool _ensure_connected(
+    std::experimental::string_view _host,
+    unsigned short _port
+  );
+  bool _connect();
+  void _close();
+
+  // socket_error is returned for socket failures other than a reset
+  int _map_error(int ret, int socket_error);
+
+  // Endpoint specific
+  bool _initialized = false;
+  SSL_CTX* ctx = nullptr;
+  SSL* ssl = nullptr;
+
+  // Certificate/verification specific
+  bool _cacert_set = false;
+  bool _verified = false;
+
+  // Connection specific
+  bool _connected = false;
+  int server_fd = -1;
+  SSL_SESSION* saved_session = nullptr;
+
+  // Session specific
+  bool _has_valid_session = false;
+
+public:
+  bool tls_print_error(int ret);
+};
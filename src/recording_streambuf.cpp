@@ -0,0 +1,108 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "recording_streambuf.h"
+
+#include <algorithm>
+#include <cstring>
+
+using std::size_t;
+
+constexpr char RecordingStreambuf::TAG[];
+
+RecordingStreambuf::RecordingStreambuf(
+  std::streambuf& _src,
+  size_t _max_len,
+  size_t _len,
+  size_t _put_back_len)
+: src(_src)
+, max_len(_max_len)
+, put_back_len(std::max(_put_back_len, size_t(1)))
+, buffer(std::max(_len, put_back_len) + put_back_len)
+{
+  char *end = &buffer.front() + buffer.size();
+  setg(end, end, end);
+}
+
+bool
+RecordingStreambuf::drain()
+{
+  // Discard the unread part of the buffer, it has been recorded already
+  setg(eback(), egptr(), egptr());
+
+  while (!traits_type::eq_int_type(underflow(), traits_type::eof()))
+  {
+    setg(eback(), egptr(), egptr());
+  }
+
+  return complete();
+}
+
+bool
+RecordingStreambuf::complete() const
+{
+  return (reached_eof && !overflowed);
+}
+
+std::string&
+RecordingStreambuf::recorded()
+{
+  return record;
+}
+
+std::streambuf::int_type
+RecordingStreambuf::underflow()
+{
+  if (gptr() < egptr()) // buffer not exhausted
+  {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  char *base = &buffer.front();
+  char *start = base;
+
+  if (eback() == base) // true when this isn't the first fill
+  {
+    // Make arrangements for putback characters
+    auto put_back = std::min(put_back_len, size_t(egptr() - base));
+    std::memmove(base, egptr() - put_back, put_back);
+    start += put_back;
+  }
+
+  // Block for at least one byte, then take only what is already buffered
+  if (traits_type::eq_int_type(src.sgetc(), traits_type::eof()))
+  {
+    reached_eof = true;
+    return traits_type::eof();
+  }
+
+  auto avail = std::max(src.in_avail(), std::streamsize(1));
+  auto len = src.sgetn(
+    start,
+    std::min(avail, std::streamsize(buffer.size() - (start - base)))
+  );
+
+  if (!overflowed)
+  {
+    if (record.size() + len <= max_len)
+    {
+      record.append(start, len);
+    }
+    else {
+      // Too large to keep, stop recording
+      overflowed = true;
+      record.clear();
+    }
+  }
+
+  // Set buffer pointers
+  setg(base, start, start + len);
+
+  return traits_type::to_int_type(*gptr());
+}
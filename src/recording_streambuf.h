@@ -0,0 +1,55 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Passes a source streambuf through, keeping a copy of everything read
+class RecordingStreambuf
+: public std::streambuf
+{
+public:
+  explicit RecordingStreambuf(
+    std::streambuf& _src,
+    size_t _max_len,
+    size_t _len=512,
+    size_t _put_back_len=8);
+
+  static constexpr char TAG[] = "RecordingStreambuf";
+
+  // Read (and record) the remainder of the source
+  bool drain();
+
+  // Whether the source was read to the end without exceeding max_len
+  bool complete() const;
+
+  std::string& recorded();
+
+private:
+  // overrides base class underflow()
+  int_type underflow();
+
+  // copy ctor and assignment not implemented;
+  // copying not allowed
+  RecordingStreambuf(const RecordingStreambuf &);
+  RecordingStreambuf &operator= (const RecordingStreambuf &);
+
+private:
+  std::streambuf& src;
+  const std::size_t max_len;
+  const std::size_t put_back_len;
+  std::vector<char> buffer;
+
+  std::string record;
+  bool reached_eof = false;
+  bool overflowed = false;
+};
@@ -22,6 +22,50 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+#include "mbedtls/platform_util.h"
+
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+// TLS record content types
+constexpr unsigned char tls_record_type_alert = 21;
+constexpr unsigned char tls_record_type_application_data = 23;
+#endif
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+#include <cerrno>
+
+// IoUringTransport's negative errno values, as mbedtls_net_send/recv report them
+inline int
+map_transport_error(int err, int fallback)
+{
+  switch (err)
+  {
+    case -EAGAIN:
+      return (fallback == MBEDTLS_ERR_NET_SEND_FAILED)?
+        MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_SSL_WANT_READ;
+
+    case -EPIPE:
+    case -ECONNRESET:
+      return MBEDTLS_ERR_NET_CONN_RESET;
+
+    default:
+      return fallback;
+  }
+}
+#endif
+
 TLSConnection::TLSConnection(
   std::experimental::string_view _host,
   unsigned short _port,
@@ -112,6 +156,8 @@ TLSConnection::clear()
 
   if (_initialized)
   {
+    _detach_transport();
+    _clear_ktls_keys();
     mbedtls_net_free(&server_fd);
     mbedtls_x509_crt_free(&cacert);
     mbedtls_ssl_session_free(&saved_session);
@@ -230,6 +276,11 @@ TLSConnection::set_cacert(
   mbedtls_ssl_conf_authmode(&conf, get_verification_level());
   mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
 
+#if defined(HTTPS_ENDPOINT_KTLS_KEY_EXPORT)
+  // Capture the traffic keys, in case they are handed over to the kernel
+  mbedtls_ssl_conf_export_keys_cb(&conf, TLSConnection::_export_keys, this);
+#endif
+
   ESP_LOGI(TAG, "(1/7) Loading the CA root certificate...");
 
   ret = mbedtls_x509_crt_parse(
@@ -437,8 +488,14 @@ TLSConnection::disconnect()
 {
   if (_connected)
   {
-    mbedtls_ssl_close_notify(&ssl);
+    // With kTLS the kernel sends close_notify, mbedtls state is out of date
+    if (!_disable_ktls())
+    {
+      mbedtls_ssl_close_notify(&ssl);
+    }
 
+    _detach_transport();
+    _clear_ktls_keys();
     mbedtls_net_free(&server_fd);
 
     _connected = false;
@@ -453,6 +510,13 @@ TLSConnection::write(std::experimental::string_view buf)
 {
   if (connected())
   {
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+    if (_ktls_enabled)
+    {
+      return _ktls_write(buf);
+    }
+#endif
+
     return mbedtls_ssl_write(
       &ssl,
       reinterpret_cast<const uint8_t*>(buf.data()),
@@ -468,6 +532,13 @@ TLSConnection::read(std::experimental::string_view buf)
 {
   if (connected())
   {
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+    if (_ktls_enabled)
+    {
+      return _ktls_read(buf);
+    }
+#endif
+
     return mbedtls_ssl_read(
       &ssl,
       const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(buf.data())),
@@ -506,7 +577,7 @@ TLSConnection::_connect()
     ESP_LOGI(TAG, "(3/7) TCP/IP Connected.");
 
     // Callback functions (to set_bio) must be setup before the handshake
-    mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv, nullptr);
+    _attach_transport();
 
     ESP_LOGI(TAG, "(4/7) Performing the SSL/TLS handshake...");
 
@@ -518,6 +589,12 @@ TLSConnection::_connect()
         break;
       }
     }
+
+    if (ret == 0)
+    {
+      // Optionally move record encryption into the kernel from here on
+      ret = _enable_ktls();
+    }
   }
   else {
     ESP_LOGE(TAG, "mbedtls_net_connect returned -%x", -ret);
@@ -559,3 +636,436 @@ TLSConnection::verify()
   return _verified;
 }
 
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+bool
+TLSConnection::set_transport(IoUringTransport* _transport)
+{
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+  if ((_transport != nullptr) && _ktls_requested)
+  {
+    ESP_LOGE(TAG, "The io_uring transport cannot be used with kTLS");
+    return false;
+  }
+#endif
+
+  transport = _transport;
+  return true;
+}
+#endif
+
+void
+TLSConnection::_attach_transport()
+{
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+  _detach_transport();
+
+  if ((transport != nullptr) && transport->ready())
+  {
+    transport_socket = transport->attach(server_fd.fd);
+    if (transport_socket != nullptr)
+    {
+      mbedtls_ssl_set_bio(
+        &ssl,
+        transport_socket,
+        _transport_send,
+        _transport_recv,
+        nullptr
+      );
+      return;
+    }
+
+    ESP_LOGW(TAG, "Unable to attach to io_uring transport, using sockets");
+  }
+#endif
+
+  mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv, nullptr);
+}
+
+void
+TLSConnection::_detach_transport()
+{
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+  if (transport_socket != nullptr)
+  {
+    // e.g. close_notify could not be sent
+    auto err = transport->detach(transport_socket);
+    if (err != 0)
+    {
+      ESP_LOGW(TAG, "io_uring transport send failed, errno %d", -err);
+    }
+    transport_socket = nullptr;
+  }
+#endif
+}
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+int
+TLSConnection::_transport_send(void* ctx, const unsigned char* buf, size_t len)
+{
+  auto ret = IoUringTransport::send(ctx, buf, len);
+  return (ret < 0)? map_transport_error(ret, MBEDTLS_ERR_NET_SEND_FAILED) : ret;
+}
+
+int
+TLSConnection::_transport_recv(void* ctx, unsigned char* buf, size_t len)
+{
+  auto ret = IoUringTransport::recv(ctx, buf, len);
+  return (ret < 0)? map_transport_error(ret, MBEDTLS_ERR_NET_RECV_FAILED) : ret;
+}
+#endif
+
+// Returns 0 if the connection is usable, with or without kTLS
+int
+TLSConnection::_enable_ktls()
+{
+#if defined(HTTPS_ENDPOINT_KTLS_KEY_EXPORT)
+  _ktls_enabled = false;
+
+  auto ret = _install_ktls_keys();
+
+  // Keys are no longer needed in user-space, whether or not they were used
+  _clear_ktls_keys();
+
+  return ret;
+#else
+  return 0;
+#endif
+}
+
+void
+TLSConnection::_clear_ktls_keys()
+{
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+  mbedtls_platform_zeroize(_ktls_key_block, sizeof(_ktls_key_block));
+  _ktls_keylen = 0;
+  _ktls_ivlen = 0;
+#endif
+}
+
+bool
+TLSConnection::_disable_ktls()
+{
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+  if (_ktls_enabled)
+  {
+    // Send a (warning level) close_notify alert through the kernel
+    unsigned char alert[2] = { 1, 0 };
+    char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec iov = { alert, sizeof(alert) };
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = tls_record_type_alert;
+
+    sendmsg(server_fd.fd, &msg, MSG_NOSIGNAL);
+
+    _ktls_enabled = false;
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+bool
+TLSConnection::set_ktls(bool enable)
+{
+#if !defined(HTTPS_ENDPOINT_KTLS_KEY_EXPORT)
+  if (enable)
+  {
+    ESP_LOGE(TAG, "kTLS needs the mbedtls 2.x key export");
+    return false;
+  }
+#endif
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+  if (enable && (transport != nullptr))
+  {
+    ESP_LOGE(TAG, "kTLS cannot be used with the io_uring transport");
+    return false;
+  }
+#endif
+
+  _ktls_requested = enable;
+  return true;
+}
+
+bool
+TLSConnection::ktls_enabled()
+{
+  return _ktls_enabled;
+}
+
+#if defined(HTTPS_ENDPOINT_KTLS_KEY_EXPORT)
+int
+TLSConnection::_export_keys(
+  void* ctx,
+  const unsigned char* /*ms*/,
+  const unsigned char* kb,
+  size_t maclen,
+  size_t keylen,
+  size_t ivlen
+)
+{
+  auto self = static_cast<TLSConnection*>(ctx);
+
+  // Keys are only kept for as long as needed, and only if needed at all
+  if (!self->_ktls_requested)
+  {
+    return 0;
+  }
+
+  // Key block: client/server MAC keys (empty for AEAD), keys, then IVs
+  if ((maclen == 0) && ((2 * keylen) + (2 * ivlen) <= sizeof(self->_ktls_key_block)))
+  {
+    memcpy(self->_ktls_key_block, kb + (2 * maclen), (2 * keylen) + (2 * ivlen));
+    self->_ktls_keylen = keylen;
+    self->_ktls_ivlen = ivlen;
+  }
+  else {
+    self->_ktls_keylen = 0;
+    self->_ktls_ivlen = 0;
+  }
+
+  return 0;
+}
+
+// Returns an error only once the socket can no longer be used by mbedtls
+int
+TLSConnection::_install_ktls_keys()
+{
+  if (!_ktls_requested)
+  {
+    return 0;
+  }
+
+  // Only TLS 1.2 AES-GCM keys can be expressed to the kernel here
+  const char* ciphersuite = mbedtls_ssl_get_ciphersuite(&ssl);
+  bool is_tls12 = (strcmp(mbedtls_ssl_get_version(&ssl), "TLSv1.2") == 0);
+  bool is_aes_gcm = (
+    (ciphersuite != nullptr) &&
+    (strstr(ciphersuite, "-AES-") != nullptr) &&
+    (strstr(ciphersuite, "-GCM-") != nullptr)
+  );
+  if (!is_tls12 || !is_aes_gcm || (_ktls_ivlen != 4) || (
+      (_ktls_keylen != TLS_CIPHER_AES_GCM_128_KEY_SIZE) &&
+      (_ktls_keylen != TLS_CIPHER_AES_GCM_256_KEY_SIZE)))
+  {
+    ESP_LOGW(TAG, "kTLS not available for %s %s",
+      mbedtls_ssl_get_version(&ssl),
+      (ciphersuite != nullptr)? ciphersuite : "(unknown)"
+    );
+    return 0;
+  }
+
+  // Records already read (and decrypted) by mbedtls would be lost
+  if (mbedtls_ssl_check_pending(&ssl))
+  {
+    ESP_LOGW(TAG, "kTLS not enabled, mbedtls has pending data");
+    return 0;
+  }
+
+  int fd = server_fd.fd;
+  auto ret = setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+  if (ret != 0)
+  {
+    // Nothing has changed yet, so mbedtls can carry on
+    ESP_LOGW(TAG, "setsockopt(TCP_ULP) failed, errno %d, is the tls module loaded?", errno);
+    return 0;
+  }
+
+  const unsigned char* client_key = _ktls_key_block;
+  const unsigned char* server_key = client_key + _ktls_keylen;
+  const unsigned char* client_iv = server_key + _ktls_keylen;
+  const unsigned char* server_iv = client_iv + _ktls_ivlen;
+
+  // We are the client: TX uses the client keys, RX the server keys
+  // The next record sequence numbers are tracked by mbedtls (public in 2.x)
+  const struct {
+    int direction;
+    const unsigned char* key;
+    const unsigned char* salt;
+    const unsigned char* seq;
+  } directions[] = {
+    { TLS_TX, client_key, client_iv, ssl.out_ctr },
+    { TLS_RX, server_key, server_iv, ssl.in_ctr },
+  };
+
+  for (const auto& dir : directions)
+  {
+    if (_ktls_keylen == TLS_CIPHER_AES_GCM_128_KEY_SIZE)
+    {
+      struct tls12_crypto_info_aes_gcm_128 crypto_info;
+      memset(&crypto_info, 0, sizeof(crypto_info));
+      crypto_info.info.version = TLS_1_2_VERSION;
+      crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+      memcpy(crypto_info.key, dir.key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+      memcpy(crypto_info.salt, dir.salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+      // The explicit nonce is the sequence number, as mbedtls does it
+      memcpy(crypto_info.iv, dir.seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+      memcpy(crypto_info.rec_seq, dir.seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+
+      ret = setsockopt(fd, SOL_TLS, dir.direction, &crypto_info, sizeof(crypto_info));
+      mbedtls_platform_zeroize(&crypto_info, sizeof(crypto_info));
+    }
+    else {
+      struct tls12_crypto_info_aes_gcm_256 crypto_info;
+      memset(&crypto_info, 0, sizeof(crypto_info));
+      crypto_info.info.version = TLS_1_2_VERSION;
+      crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+      memcpy(crypto_info.key, dir.key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+      memcpy(crypto_info.salt, dir.salt, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+      memcpy(crypto_info.iv, dir.seq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+      memcpy(crypto_info.rec_seq, dir.seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+
+      ret = setsockopt(fd, SOL_TLS, dir.direction, &crypto_info, sizeof(crypto_info));
+      mbedtls_platform_zeroize(&crypto_info, sizeof(crypto_info));
+    }
+
+    if (ret != 0)
+    {
+      // The ULP cannot be detached again, so this connection is unusable
+      ESP_LOGE(TAG, "setsockopt(SOL_TLS, %s) failed, errno %d",
+        (dir.direction == TLS_TX)? "TLS_TX" : "TLS_RX", errno
+      );
+      return MBEDTLS_ERR_NET_SOCKET_FAILED;
+    }
+  }
+
+  ESP_LOGI(TAG, "Record encryption offloaded to kernel TLS (%s)", ciphersuite);
+  _ktls_enabled = true;
+
+  return 0;
+}
+#endif
+
+int
+TLSConnection::_ktls_write(std::experimental::string_view buf)
+{
+  auto ret = ::send(server_fd.fd, buf.data(), buf.size(), MSG_NOSIGNAL);
+  if (ret < 0)
+  {
+    if (errno == EAGAIN || errno == EINTR)
+    {
+      return MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+
+    ESP_LOGE(TAG, "kTLS send failed, errno %d", errno);
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+
+  return ret;
+}
+
+int
+TLSConnection::_ktls_read(std::experimental::string_view buf)
+{
+  char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+  struct iovec iov = { const_cast<char*>(buf.data()), buf.size() };
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  auto ret = recvmsg(server_fd.fd, &msg, 0);
+  if (ret < 0)
+  {
+    if (errno == EAGAIN || errno == EINTR)
+    {
+      return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+
+    ESP_LOGE(TAG, "kTLS recv failed, errno %d", errno);
+    return MBEDTLS_ERR_NET_RECV_FAILED;
+  }
+
+  // Non application data records are reported with their record type
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if ((cmsg != nullptr) &&
+      (cmsg->cmsg_level == SOL_TLS) &&
+      (cmsg->cmsg_type == TLS_GET_RECORD_TYPE))
+  {
+    auto record_type = *CMSG_DATA(cmsg);
+    if (record_type != tls_record_type_application_data)
+    {
+      auto alert = reinterpret_cast<const unsigned char*>(buf.data());
+      if ((record_type == tls_record_type_alert) && (ret >= 2) && (alert[1] == 0))
+      {
+        return MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+      }
+
+      ESP_LOGE(TAG, "Unexpected TLS record type %d with kTLS", record_type);
+      return MBEDTLS_ERR_SSL_UNEXPECTED_MESSAGE;
+    }
+  }
+
+  return ret;
+}
+
+ssize_t
+TLSConnection::sendfile(int in_fd, off_t* offset, size_t count)
+{
+  if (!connected())
+  {
+    return -1;
+  }
+
+  if (_ktls_enabled)
+  {
+    // File pages are encrypted by the kernel without a user-space copy
+    return ::sendfile(server_fd.fd, in_fd, offset, count);
+  }
+
+  // Fallback, read the file in chunks and encrypt with mbedtls
+  char chunk[1024];
+  ssize_t total = 0;
+  while (static_cast<size_t>(total) < count)
+  {
+    auto len = std::min(sizeof(chunk), count - total);
+    auto n = (offset != nullptr)?
+      pread(in_fd, chunk, len, *offset + total) :
+      ::read(in_fd, chunk, len);
+    if (n <= 0)
+    {
+      break;
+    }
+
+    ssize_t written = 0;
+    while (written < n)
+    {
+      auto ret = write(std::experimental::string_view(chunk + written, n - written));
+      if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+      {
+        continue;
+      }
+      if (ret <= 0)
+      {
+        return (total > 0)? total : -1;
+      }
+      written += ret;
+    }
+
+    total += n;
+  }
+
+  if (offset != nullptr)
+  {
+    *offset += total;
+  }
+
+  return total;
+}
+#endif
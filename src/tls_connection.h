@@ -18,6 +18,22 @@
 #include "mbedtls/ssl.h"
 #include "mbedtls/x509_crt.h"
 
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+#include "io_uring_transport.h"
+#endif
+
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+#include <sys/types.h>
+
+#include "mbedtls/version.h"
+
+// The key block export and record counters kTLS is set up from are mbedtls 2.x
+// API, mbedtls 3.x made them private
+#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
+#define HTTPS_ENDPOINT_KTLS_KEY_EXPORT
+#endif
+#endif
+
 class TLSConnection
 {
 public:
@@ -69,6 +85,23 @@ public:
   int write(std::experimental::string_view buf);
   int read(std::experimental::string_view buf);
 
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+  // Use a (shared) io_uring ring instead of mbedtls_net_send/recv
+  // Takes effect on the next connection, fails if kTLS is requested
+  bool set_transport(IoUringTransport* _transport);
+#endif
+
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+  // Hand AES-GCM record encryption to the Linux kernel after the handshake
+  // Takes effect on the next connection, fails with mbedtls 3.x or if an
+  // io_uring transport is set (the ring would bypass the kernel's TLS)
+  bool set_ktls(bool enable=true);
+  bool ktls_enabled();
+
+  // Zero-copy with kTLS, otherwise read from in_fd and encrypted here
+  ssize_t sendfile(int in_fd, off_t* offset, size_t count);
+#endif
+
 protected:
   std::string host;
   unsigned short port = 443;
@@ -84,6 +117,13 @@ private:
   );
   bool _connect();
 
+  void _attach_transport();
+  void _detach_transport();
+
+  int _enable_ktls();
+  bool _disable_ktls();
+  void _clear_ktls_keys();
+
   // Endpoint specific
   bool _initialized = false;
   mbedtls_entropy_context entropy;
@@ -104,6 +144,42 @@ private:
   // Session specific
   bool _has_valid_session = false;
 
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+  // Transport specific
+  IoUringTransport* transport = nullptr;
+  IoUringTransport::Socket* transport_socket = nullptr;
+
+  // mbedtls BIO callbacks, with the transport's errors as mbedtls errors
+  static int _transport_send(void* ctx, const unsigned char* buf, size_t len);
+  static int _transport_recv(void* ctx, unsigned char* buf, size_t len);
+#endif
+
+#if defined(HTTPS_ENDPOINT_USE_KTLS)
+  // Kernel TLS specific
+#if defined(HTTPS_ENDPOINT_KTLS_KEY_EXPORT)
+  static int _export_keys(
+    void* ctx,
+    const unsigned char* ms,
+    const unsigned char* kb,
+    size_t maclen,
+    size_t keylen,
+    size_t ivlen
+  );
+  int _install_ktls_keys();
+#endif
+  int _ktls_write(std::experimental::string_view buf);
+  int _ktls_read(std::experimental::string_view buf);
+
+  bool _ktls_requested = false;
+  bool _ktls_enabled = false;
+
+  // client_write_key, server_write_key, client_write_IV, server_write_IV
+  // Only captured when kTLS is requested, wiped once the handshake is done
+  unsigned char _ktls_key_block[(2 * 32) + (2 * 4)];
+  size_t _ktls_keylen = 0;
+  size_t _ktls_ivlen = 0;
+#endif
+
 public:
   bool tls_print_error(int ret);
 };
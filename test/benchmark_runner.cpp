@@ -0,0 +1,39 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "benchmark_runner.h"
+
+#include <cstring>
+
+std::vector<Benchmark>&
+get_benchmarks()
+{
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+// Runs all benchmarks, or only those containing the first argument
+int
+main(int argc, char** argv)
+{
+  const char* filter = (argc > 1)? argv[1] : nullptr;
+
+  for (const auto& benchmark : get_benchmarks())
+  {
+    if (filter && !strstr(benchmark.name, filter))
+    {
+      continue;
+    }
+
+    printf("%s\n", benchmark.name);
+    benchmark.fn();
+  }
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Minimal throughput benchmarks, each registered with BENCHMARK(name)
+struct Benchmark
+{
+  const char* name;
+  void (*fn)();
+};
+
+std::vector<Benchmark>& get_benchmarks();
+
+struct BenchmarkRegistration
+{
+  BenchmarkRegistration(const char* name, void (*fn)())
+  {
+    get_benchmarks().push_back({name, fn});
+  }
+};
+
+#define BENCHMARK(name) \
+  static void name(); \
+  static BenchmarkRegistration name##_registration(#name, name); \
+  static void name()
+
+// Calls fn repeatedly for at least min_seconds, then prints the throughput
+// fn processes bytes per call, and returns false to stop early (on failure)
+template<typename Fn>
+double
+measure_throughput(const char* label, size_t bytes, Fn&& fn, double min_seconds=0.5)
+{
+  using clock = std::chrono::steady_clock;
+
+  // Warm up caches and allocations
+  if (!fn())
+  {
+    printf("  %-40s FAILED\n", label);
+    return 0;
+  }
+
+  size_t iterations = 0;
+  auto start = clock::now();
+  std::chrono::duration<double> elapsed(0);
+  do
+  {
+    if (!fn())
+    {
+      printf("  %-40s FAILED\n", label);
+      return 0;
+    }
+    iterations++;
+    elapsed = clock::now() - start;
+  }
+  while (elapsed.count() < min_seconds);
+
+  auto mb_per_s = (bytes * iterations) / (elapsed.count() * 1e6);
+  printf("  %-40s %10.1f MB/s\n", label, mb_per_s);
+  return mb_per_s;
+}
@@ -0,0 +1,284 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/flatbuffers_json_builder.h"
+#include "../src/json_push_parser.h"
+
+#include "flatbuffers/idl.h"
+
+#include <cstdlib>
+#include <string>
+
+constexpr char keyed_fbs_text[] =
+  "table Item { n:int; name:string; }"
+  "table Entry { id:string; val:Item; }"
+  "table Slot { id:int; val:Item; }"
+  "table Root { entries:[Entry]; slots:[Slot]; items:[Item]; }"
+  "root_type Root;";
+
+TEST_CASE("JSON objects are rewritten as keyed vectors")
+{
+  flatbuffers::Parser fbs_parser;
+  REQUIRE(fbs_parser.Parse(keyed_fbs_text));
+  fbs_parser.Serialize();
+  auto schema = reflection::GetSchema(fbs_parser.builder_.GetBufferPointer());
+  auto root_table = schema->objects()->LookupByKey("Root");
+  auto entry_table = schema->objects()->LookupByKey("Entry");
+  REQUIRE(root_table != nullptr);
+  REQUIRE(entry_table != nullptr);
+
+  CHECK(FlatbuffersJsonBuilder::is_keyed_table(entry_table));
+  CHECK_FALSE(FlatbuffersJsonBuilder::is_keyed_table(root_table));
+
+  const std::string json(R"({
+    "entries":{"a":{"n":1},"b":{"n":2,"name":"two","unknown":[]}},
+    "slots":{"7":{"n":3}},
+    "items":[{"n":4}]
+  })");
+
+  // The same with keys looked up by name, and by interned id
+  FlatbuffersTableIndex table_index(schema);
+  for (auto index : {static_cast<FlatbuffersTableIndex*>(nullptr), &table_index})
+  {
+    FlatbuffersJsonBuilder builder;
+    REQUIRE(builder.set_schema(schema, index));
+
+    JsonPushParser<FlatbuffersJsonBuilder> push_parser(builder);
+    REQUIRE(builder.start(root_table));
+    REQUIRE(push_parser.feed(json));
+    REQUIRE(push_parser.finish());
+    REQUIRE(builder.is_complete());
+
+    auto buf = builder.get_buffer();
+    auto root = flatbuffers::GetAnyRoot(reinterpret_cast<const uint8_t*>(buf.data()));
+
+    auto fields = root_table->fields();
+    auto entries = flatbuffers::GetFieldAnyV(*root, *fields->LookupByKey("entries"));
+    auto slots = flatbuffers::GetFieldAnyV(*root, *fields->LookupByKey("slots"));
+    auto items = flatbuffers::GetFieldAnyV(*root, *fields->LookupByKey("items"));
+    REQUIRE(entries != nullptr);
+    REQUIRE(slots != nullptr);
+    REQUIRE(items != nullptr);
+    CHECK(entries->size() == 2);
+    CHECK(slots->size() == 1);
+    CHECK(items->size() == 1);
+
+    // Keyed vector elements are {"id": key, "val": value}
+    auto entry_fields = entry_table->fields();
+    auto item_fields = schema->objects()->LookupByKey("Item")->fields();
+
+    auto b = flatbuffers::GetAnyVectorElemPointer<const flatbuffers::Table>(entries, 1);
+    CHECK(flatbuffers::GetFieldS(*b, *entry_fields->LookupByKey("id"))->str() == "b");
+
+    auto b_val = flatbuffers::GetFieldT(*b, *entry_fields->LookupByKey("val"));
+    REQUIRE(b_val != nullptr);
+    CHECK(flatbuffers::GetFieldI<int32_t>(*b_val, *item_fields->LookupByKey("n")) == 2);
+    CHECK(flatbuffers::GetFieldS(*b_val, *item_fields->LookupByKey("name"))->str() == "two");
+
+    auto slot = flatbuffers::GetAnyVectorElemPointer<const flatbuffers::Table>(slots, 0);
+    auto slot_fields = schema->objects()->LookupByKey("Slot")->fields();
+    CHECK(flatbuffers::GetFieldI<int32_t>(*slot, *slot_fields->LookupByKey("id")) == 7);
+
+    // A single keyed root element
+    REQUIRE(builder.start(entry_table, "c"));
+    push_parser.clear();
+    REQUIRE(push_parser.feed(R"({"n":5})"));
+    REQUIRE(push_parser.finish());
+    REQUIRE(builder.is_complete());
+
+    buf = builder.get_buffer();
+    auto c = flatbuffers::GetAnyRoot(reinterpret_cast<const uint8_t*>(buf.data()));
+    CHECK(flatbuffers::GetFieldS(*c, *entry_fields->LookupByKey("id"))->str() == "c");
+
+    auto c_val = flatbuffers::GetFieldT(*c, *entry_fields->LookupByKey("val"));
+    REQUIRE(c_val != nullptr);
+    CHECK(flatbuffers::GetFieldI<int32_t>(*c_val, *item_fields->LookupByKey("n")) == 5);
+  }
+}
+
+TEST_CASE("Keys of keyed vectors with integer ids must be decimal ids that fit")
+{
+  flatbuffers::Parser fbs_parser;
+  REQUIRE(fbs_parser.Parse(keyed_fbs_text));
+  fbs_parser.Serialize();
+  auto schema = reflection::GetSchema(fbs_parser.builder_.GetBufferPointer());
+  auto root_table = schema->objects()->LookupByKey("Root");
+  REQUIRE(root_table != nullptr);
+
+  FlatbuffersJsonBuilder builder;
+  REQUIRE(builder.set_schema(schema));
+  JsonPushParser<FlatbuffersJsonBuilder> push_parser(builder);
+
+  auto build = [&](const std::string& key)
+  {
+    builder.start(root_table);
+    push_parser.clear();
+    return (
+      push_parser.feed(R"({"slots":{")" + key + R"(":{"n":1}}})") &&
+      push_parser.finish() &&
+      builder.is_complete()
+    );
+  };
+
+  CHECK(build("-2147483648"));
+  CHECK(build("010"));
+
+  for (const std::string key : {"", "seven", "7a", "0x10", "1.5", "2147483648"})
+  {
+    CAPTURE(key);
+    CHECK_FALSE(build(key));
+    CHECK(builder.has_error());
+  }
+}
+
+TEST_CASE("Real numbers are stored without conversion to text")
+{
+  flatbuffers::Parser fbs_parser;
+  REQUIRE(fbs_parser.Parse("table Reading { f:float; d:double; i:int; } root_type Reading;"));
+  fbs_parser.Serialize();
+  auto schema = reflection::GetSchema(fbs_parser.builder_.GetBufferPointer());
+  auto reading_table = schema->objects()->LookupByKey("Reading");
+  REQUIRE(reading_table != nullptr);
+
+  FlatbuffersJsonBuilder builder;
+  REQUIRE(builder.set_schema(schema));
+  JsonPushParser<FlatbuffersJsonBuilder> push_parser(builder);
+
+  REQUIRE(builder.start(reading_table));
+  REQUIRE(push_parser.feed(R"({"f":-122.4194155,"d":-122.4194155,"i":3.0})"));
+  REQUIRE(push_parser.finish());
+  REQUIRE(builder.is_complete());
+
+  auto buf = builder.get_buffer();
+  auto reading = flatbuffers::GetAnyRoot(reinterpret_cast<const uint8_t*>(buf.data()));
+  auto fields = reading_table->fields();
+
+  CHECK(flatbuffers::GetFieldF<float>(*reading, *fields->LookupByKey("f")) == -122.4194155f);
+  CHECK(flatbuffers::GetFieldF<double>(*reading, *fields->LookupByKey("d")) == -122.4194155);
+
+  // Integer fields accept integral reals
+  CHECK(flatbuffers::GetFieldI<int32_t>(*reading, *fields->LookupByKey("i")) == 3);
+
+  // Short and long forms, all the same value as strtod
+  for (const std::string number : {
+    "0", "-0.0", "21.53", "-122.4194155", "2.5E+3", "1e-22", "1e23",
+    "123456789012345", "12345678901234567890", "9007199254740993",
+    "0.1000000000000000055511151231257827", "5e-324", "1.7976931348623157e308",
+  })
+  {
+    REQUIRE(builder.start(reading_table));
+    push_parser.clear();
+    REQUIRE(push_parser.feed(R"({"d":)" + number + "}"));
+    REQUIRE(push_parser.finish());
+    REQUIRE(builder.is_complete());
+
+    buf = builder.get_buffer();
+    reading = flatbuffers::GetAnyRoot(reinterpret_cast<const uint8_t*>(buf.data()));
+
+    auto d = flatbuffers::GetFieldF<double>(*reading, *fields->LookupByKey("d"));
+    CHECK(d == std::strtod(number.c_str(), nullptr));
+  }
+}
+
+TEST_CASE("Numbers must fit their field, and fields are only set once")
+{
+  flatbuffers::Parser fbs_parser;
+  REQUIRE(fbs_parser.Parse(
+    "struct Pair { x:short; y:short; }"
+    "table Limits { b:byte; ub:ubyte; i:int; u:uint; l:long; ul:ulong; p:Pair; name:string; }"
+    "root_type Limits;"
+  ));
+  fbs_parser.Serialize();
+  auto schema = reflection::GetSchema(fbs_parser.builder_.GetBufferPointer());
+  auto limits_table = schema->objects()->LookupByKey("Limits");
+  REQUIRE(limits_table != nullptr);
+
+  FlatbuffersJsonBuilder builder;
+  REQUIRE(builder.set_schema(schema));
+  JsonPushParser<FlatbuffersJsonBuilder> push_parser(builder);
+
+  auto build = [&](const std::string& json)
+  {
+    builder.start(limits_table);
+    push_parser.clear();
+    return (push_parser.feed(json) && push_parser.finish() && builder.is_complete());
+  };
+
+  CHECK(build(R"({"b":-128,"ub":255,"i":-2147483648,"u":4294967295})"));
+  CHECK(build(R"({"l":-9223372036854775808,"ul":0,"i":2.0,"p":{"x":-32768,"y":32767}})"));
+  CHECK(build(R"({"i":null,"i":1})"));
+
+  for (const std::string json : {
+    R"({"i":3000000000})",
+    R"({"i":1.9})",
+    R"({"i":"3000000000"})",
+    R"({"b":128})",
+    R"({"ub":-1})",
+    R"({"u":-1})",
+    R"({"ul":-1})",
+    R"({"ul":1e30})",
+    R"({"p":{"x":40000,"y":0}})",
+    R"({"i":1,"i":2})",
+    R"({"name":"a","i":1,"name":"b"})",
+    R"({"p":{"x":1,"y":2},"p":{"x":3,"y":4}})",
+  })
+  {
+    CAPTURE(json);
+    CHECK_FALSE(build(json));
+    CHECK(builder.has_error());
+  }
+}
+
+namespace {
+
+// Rejects numbers, and counts the events that follow
+struct NumberRejectingHandler
+{
+  int events_after = 0;
+  bool rejected = false;
+
+  bool count() { events_after += rejected; return true; }
+  bool set_null() { return count(); }
+  bool set_bool(bool) { return count(); }
+  bool set_int64(int64_t) { rejected = true; return false; }
+  bool set_number(double) { rejected = true; return false; }
+  bool set_string(const std::string&) { return count(); }
+  bool start_object() { return count(); }
+  bool key(const std::string&) { return count(); }
+  bool end_object() { return count(); }
+  bool start_array() { return count(); }
+  bool end_array() { return count(); }
+};
+
+} // namespace
+
+TEST_CASE("A rejected number stops parsing, as any other rejected value")
+{
+  // Integers and reals, with and without the strtoll/strtod fallback
+  for (const std::string json : {"[1,2]", "[1.5,2]", "[12345678901234567890,2]", "[1e300,2]"})
+  {
+    CAPTURE(json);
+    NumberRejectingHandler handler;
+    JsonPushParser<NumberRejectingHandler> push_parser(handler);
+
+    CHECK_FALSE(push_parser.feed(json));
+    CHECK(push_parser.has_error());
+    CHECK(handler.events_after == 0);
+  }
+
+  // A trailing root number is completed by finish()
+  NumberRejectingHandler handler;
+  JsonPushParser<NumberRejectingHandler> push_parser(handler);
+  CHECK(push_parser.feed("42"));
+  CHECK_FALSE(push_parser.finish());
+  CHECK(push_parser.has_error());
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/flatbuffers_json_writer.h"
+#include "../src/oidc_generated.h"
+
+#include "picojson.h"
+
+#include <clocale>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+TEST_CASE("Tables are written as strict JSON")
+{
+  FlatbuffersJsonWriter writer;
+
+  OIDC::TokenT token;
+  token.grant_type = "refresh_token";
+  token.refresh_token = "r1";
+  token.expires_in = -3600;
+
+  std::string json("prefix:");
+  REQUIRE(writer.write_object(json, token, OIDC::TokenTypeTable()));
+  CHECK(json ==
+    R"(prefix:{"grant_type":"refresh_token","refresh_token":"r1","expires_in":-3600})"
+  );
+
+  // Escapes, control characters and UTF-8
+  token = OIDC::TokenT();
+  token.access_token = std::string("\"\\/\b\f\n\r\t\x01\x1f caf\xc3\xa9", 16);
+
+  json.clear();
+  REQUIRE(writer.write_object(json, token, OIDC::TokenTypeTable()));
+  CHECK(json ==
+    "{\"access_token\":\"\\\"\\\\/\\b\\f\\n\\r\\t\\u0001\\u001f caf\xc3\xa9\"}"
+  );
+
+  picojson::value parsed;
+  CHECK(picojson::parse(parsed, json).empty());
+  CHECK(parsed.get("access_token").get<std::string>() == token.access_token);
+
+  // Table views, e.g. from a parse callback
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(OIDC::CreateErrorDirect(fbb, 401, "Invalid token"));
+  auto error = flatbuffers::GetRoot<OIDC::Error>(fbb.GetBufferPointer());
+
+  json.clear();
+  REQUIRE(writer.write_table(json, error, OIDC::ErrorTypeTable()));
+  CHECK(json == R"({"code":401,"message":"Invalid token"})");
+}
+
+// Mini-reflection tables, as flatc --reflect-names would generate for:
+//   enum Color:byte { Red, Green }
+//   struct Vec2 { x:float; y:double; }
+//   union Any { Sample }
+//   table Sample { color:Color; pos:Vec2; ids:[long]; names:[string];
+//                  ok:bool; any_type:ubyte; any:Any; big:ulong; }
+flatbuffers::TypeTable* SampleTypeTable();
+
+flatbuffers::TypeTable*
+ColorTypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_CHAR, 0, 0 },
+    { flatbuffers::ET_CHAR, 0, 0 },
+  };
+  static const char* names[] = { "Red", "Green" };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_ENUM, 2, type_codes, nullptr, nullptr, names
+  };
+  return &tt;
+}
+
+flatbuffers::TypeTable*
+Vec2TypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_FLOAT, 0, -1 },
+    { flatbuffers::ET_DOUBLE, 0, -1 },
+  };
+  static const int32_t values[] = { 0, 8, 16 };
+  static const char* names[] = { "x", "y" };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_STRUCT, 2, type_codes, nullptr, values, names
+  };
+  return &tt;
+}
+
+flatbuffers::TypeTable*
+AnyTypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_SEQUENCE, 0, -1 },
+    { flatbuffers::ET_SEQUENCE, 0, 0 },
+  };
+  static flatbuffers::TypeFunction type_refs[] = { SampleTypeTable };
+  static const char* names[] = { "NONE", "Sample" };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_UNION, 2, type_codes, type_refs, nullptr, names
+  };
+  return &tt;
+}
+
+flatbuffers::TypeTable*
+SampleTypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_CHAR, 0, 0 },
+    { flatbuffers::ET_SEQUENCE, 0, 1 },
+    { flatbuffers::ET_LONG, 1, -1 },
+    { flatbuffers::ET_STRING, 1, -1 },
+    { flatbuffers::ET_BOOL, 0, -1 },
+    { flatbuffers::ET_UTYPE, 0, 2 },
+    { flatbuffers::ET_SEQUENCE, 0, 2 },
+    { flatbuffers::ET_ULONG, 0, -1 },
+  };
+  static flatbuffers::TypeFunction type_refs[] = {
+    ColorTypeTable, Vec2TypeTable, AnyTypeTable
+  };
+  static const char* names[] = {
+    "color", "pos", "ids", "names", "ok", "any_type", "any", "big"
+  };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_TABLE, 8, type_codes, type_refs, nullptr, names
+  };
+  return &tt;
+}
+
+struct Vec2
+{
+  float x;
+  float padding;
+  double y;
+};
+
+TEST_CASE("Structs, vectors, enums and unions")
+{
+  flatbuffers::FlatBufferBuilder fbb;
+
+  auto inner_start = fbb.StartTable();
+  fbb.AddElement<int8_t>(flatbuffers::FieldIndexToOffset(0), 5, 0);
+  flatbuffers::Offset<void> inner(fbb.EndTable(inner_start));
+
+  auto ids = fbb.CreateVector(std::vector<int64_t>({
+    std::numeric_limits<int64_t>::min(), 0, 42
+  }));
+  auto names = fbb.CreateVectorOfStrings({"a", "b\"c"});
+
+  Vec2 pos = { 0.1f, 0, std::nan("") };
+
+  auto start = fbb.StartTable();
+  fbb.AddElement<int8_t>(flatbuffers::FieldIndexToOffset(0), 1, 0);
+  fbb.AddStruct(flatbuffers::FieldIndexToOffset(1), &pos);
+  fbb.AddOffset(flatbuffers::FieldIndexToOffset(2), ids);
+  fbb.AddOffset(flatbuffers::FieldIndexToOffset(3), names);
+  fbb.AddElement<uint8_t>(flatbuffers::FieldIndexToOffset(4), 1, 0);
+  fbb.AddElement<uint8_t>(flatbuffers::FieldIndexToOffset(5), 1, 0);
+  fbb.AddOffset(flatbuffers::FieldIndexToOffset(6), inner);
+  fbb.AddElement<uint64_t>(flatbuffers::FieldIndexToOffset(7), 18446744073709551615ULL, 0);
+  fbb.Finish(flatbuffers::Offset<void>(fbb.EndTable(start)));
+
+  FlatbuffersJsonWriter writer;
+  std::string json;
+  REQUIRE(writer.write(json, fbb.GetBufferPointer(), SampleTypeTable()));
+
+  CHECK(json ==
+    R"({"color":"Green","pos":{"x":0.1,"y":null},)"
+    R"("ids":[-9223372036854775808,0,42],"names":["a","b\"c"],"ok":true,)"
+    R"("any_type":"Sample","any":{"color":5},"big":18446744073709551615})"
+  );
+
+  picojson::value parsed;
+  CHECK(picojson::parse(parsed, json).empty());
+}
+
+// As flatc --reflect-names would generate for:
+//   table Reading { f:float; d:double; }
+flatbuffers::TypeTable*
+ReadingTypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_FLOAT, 0, -1 },
+    { flatbuffers::ET_DOUBLE, 0, -1 },
+  };
+  static const char* names[] = { "f", "d" };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_TABLE, 2, type_codes, nullptr, nullptr, names
+  };
+  return &tt;
+}
+
+namespace {
+
+// Sets LC_NUMERIC to the first of these locales which is installed, if any,
+// and back to "C" afterwards
+struct NumericLocale
+{
+  explicit NumericLocale(std::initializer_list<const char*> names)
+  {
+    for (auto locale_name : names)
+    {
+      if (setlocale(LC_NUMERIC, locale_name) != nullptr)
+      {
+        name = locale_name;
+        break;
+      }
+    }
+  }
+
+  ~NumericLocale()
+  {
+    setlocale(LC_NUMERIC, "C");
+  }
+
+  const char* name = nullptr;
+};
+
+} // namespace
+
+TEST_CASE("Real numbers are written in their shortest exact form")
+{
+  FlatbuffersJsonWriter writer;
+  flatbuffers::FlatBufferBuilder fbb;
+
+  auto write_reading = [&](float f, double d) -> std::string
+  {
+    fbb.Clear();
+    auto start = fbb.StartTable();
+    fbb.AddElement<float>(flatbuffers::FieldIndexToOffset(0), f, 1);
+    fbb.AddElement<double>(flatbuffers::FieldIndexToOffset(1), d, 1);
+    fbb.Finish(flatbuffers::Offset<void>(fbb.EndTable(start)));
+
+    std::string json;
+    writer.write(json, fbb.GetBufferPointer(), ReadingTypeTable());
+    return json;
+  };
+
+  CHECK(write_reading(0.1f, 0.1) == R"({"f":0.1,"d":0.1})");
+  CHECK(write_reading(21.53f, -122.4194155) == R"({"f":21.53,"d":-122.4194155})");
+  CHECK(write_reading(3600, 2.0 / 3) == R"({"f":3600,"d":0.6666666666666666})");
+  CHECK(write_reading(-0.0f, 0.0) == R"({"f":-0,"d":0})");
+  CHECK(write_reading(1e-7f, 1e300) == R"({"f":1e-07,"d":1e+300})");
+  CHECK(write_reading(16777217.0f, 123456789012345.6) == R"({"f":16777216,"d":123456789012345.6})");
+  CHECK(write_reading(1e-45f, 5e-324) == R"({"f":1e-45,"d":5e-324})");
+  CHECK(write_reading(
+    std::numeric_limits<float>::max(), std::numeric_limits<double>::max()
+  ) == R"({"f":3.4028235e+38,"d":1.7976931348623157e+308})");
+
+  // Every value parses back exactly
+  double d = 1e-5;
+  for (int i = 0; i < 2000; ++i)
+  {
+    d *= -1.0173;
+    auto f = static_cast<float>(d);
+
+    picojson::value parsed;
+    REQUIRE(picojson::parse(parsed, write_reading(f, d)).empty());
+    CHECK(static_cast<float>(parsed.get("f").get<double>()) == f);
+    CHECK(parsed.get("d").get<double>() == d);
+  }
+
+  // With a decimal comma in the C locale, as printf and strtod would use
+  NumericLocale comma_locale({"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "de_DE"});
+  if (comma_locale.name == nullptr)
+  {
+    WARN_MESSAGE(false, "No locale with a decimal comma is installed, skipping");
+    return;
+  }
+
+  CAPTURE(comma_locale.name);
+  CHECK(write_reading(21.53f, -122.4194155) == R"({"f":21.53,"d":-122.4194155})");
+  CHECK(write_reading(3600, 2.0 / 3) == R"({"f":3600,"d":0.6666666666666666})");
+  CHECK(write_reading(1.5e-7f, 2.5e300) == R"({"f":1.5e-07,"d":2.5e+300})");
+  CHECK(write_reading(
+    std::numeric_limits<float>::max(), std::numeric_limits<double>::max()
+  ) == R"({"f":3.4028235e+38,"d":1.7976931348623157e+308})");
+}
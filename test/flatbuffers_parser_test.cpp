@@ -0,0 +1,44 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/oidc_generated.h"
+#include "../src/flatbuffers_parser.h"
+
+#include <string>
+
+TEST_CASE("Only untrusted buffers are always verified")
+{
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(OIDC::CreateTokenDirect(fbb, "abc", nullptr, nullptr, nullptr, 60));
+  std::experimental::string_view buf(
+    reinterpret_cast<const char*>(fbb.GetBufferPointer()),
+    fbb.GetSize()
+  );
+
+  CHECK(FlatbuffersParser::verify<OIDC::Token>(buf));
+
+  auto token = FlatbuffersParser::get_root<OIDC::Token>(buf);
+  auto trusted_token = FlatbuffersParser::get_trusted_root<OIDC::Token>(buf);
+  REQUIRE(token != nullptr);
+  CHECK(trusted_token == token);
+
+  auto obj = FlatbuffersParser::parse_trusted<OIDC::TokenT>(buf);
+  REQUIRE(obj);
+  CHECK(obj->access_token == "abc");
+  CHECK(obj->expires_in == 60);
+
+  // Received data is verified
+  std::string truncated(buf.data(), buf.size() - 8);
+  CHECK_FALSE(FlatbuffersParser::verify<OIDC::Token>(truncated));
+  CHECK(FlatbuffersParser::get_root<OIDC::Token>(truncated) == nullptr);
+  CHECK_FALSE(FlatbuffersParser::parse<OIDC::TokenT>("not a flatbuffer"));
+}
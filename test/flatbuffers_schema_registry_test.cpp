@@ -0,0 +1,121 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_streaming_json_parser.h"
+#include "../src/oidc_generated.h"
+
+#include "flatbuffers/idl.h"
+
+#include <string>
+
+TEST_CASE("Parsers share one registered copy of each schema")
+{
+  const auto oidc_fbs = get_oidc_fbs();
+
+  const FlatbuffersSchema* shared = nullptr;
+  {
+    // The registry keeps its own copy of the buffer
+    auto bfbs = generate_oidc_bfbs();
+    FlatbuffersStreamingJsonParser parser(bfbs);
+    REQUIRE(parser.is_ready());
+    shared = parser.get_shared_schema();
+  }
+
+  auto bfbs = generate_oidc_bfbs();
+  FlatbuffersStreamingJsonParser a(bfbs);
+  FlatbuffersStreamingJsonParser b(bfbs);
+  CHECK(a.get_shared_schema() == shared);
+  CHECK(b.get_shared_schema() == shared);
+  CHECK(a.get_flatbuffers_table_by_name("OIDC.Error") != nullptr);
+
+  // The field index is built once, with the shared schema
+  auto error_table = a.get_flatbuffers_table_by_name("OIDC.Error");
+  auto error_info = shared->table_index.get_table_info(error_table);
+  REQUIRE(error_info != nullptr);
+  auto code_id = shared->table_index.get_field_names().find("code");
+  REQUIRE(code_id != JsonKeyInterner::unknown);
+  CHECK(error_info->fields_by_key[code_id]->name()->str() == "code");
+
+  // Without a text schema, JSON text can't be parsed by flatbuffers::Parser
+  CHECK(a.get_flatbuffers_parser() == nullptr);
+
+  // With one, it is parsed only when first needed
+  FlatbuffersStreamingJsonParser c(oidc_fbs, bfbs);
+  CHECK(c.get_shared_schema() != shared);
+  auto token = c.parse<OIDC::TokenT>(R"({"access_token":"abc"})");
+  REQUIRE(token);
+  CHECK(token->access_token == "abc");
+
+  std::string invalid("not a schema", sizeof("not a schema"));
+  FlatbuffersStreamingJsonParser d(invalid);
+  CHECK_FALSE(d.is_ready());
+}
+
+TEST_CASE("Parser clones share the schema and parse independently")
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, bfbs);
+  REQUIRE(parser.is_ready());
+
+  // Strict JSON is built from the binary schema alone
+  auto clone = parser.clone();
+  REQUIRE(clone);
+  CHECK(clone->is_ready());
+  CHECK(clone->get_shared_schema() == parser.get_shared_schema());
+
+  auto token = clone->parse<OIDC::TokenT>(R"({"access_token":"a","expires_in":1})");
+  REQUIRE(token);
+  CHECK(token->expires_in == 1);
+
+  auto error = clone->parse<OIDC::ErrorT>(R"({"code":404,"unknown":[1]})");
+  REQUIRE(error);
+  CHECK(error->code == 404);
+
+  // Non-strict JSON falls back to the text schema parser
+  token = clone->parse<OIDC::TokenT>("{ access_token: \"b\", }");
+  REQUIRE(token);
+  CHECK(token->access_token == "b");
+
+  FlatbuffersStreamingJsonParser binary_only(bfbs);
+  CHECK_FALSE(binary_only.parse<OIDC::TokenT>("{ access_token: \"b\", }"));
+}
+
+TEST_CASE("Static schema buffers are registered without a copy")
+{
+  // Both outlive the registry, as embedded files would
+  static const char static_fbs[] = "table Static { x:int; } root_type Static;";
+  static const std::string static_bfbs = generate_bfbs(static_fbs);
+  REQUIRE(!static_bfbs.empty());
+
+  FlatbuffersStreamingJsonParser parser(
+    std::experimental::string_view(static_fbs, sizeof(static_fbs)),
+    static_bfbs,
+    FlatbuffersStreamingJsonParser::StaticSchema
+  );
+  REQUIRE(parser.is_ready());
+
+  auto shared = parser.get_shared_schema();
+  CHECK(shared->binary_schema.data() == static_bfbs.data());
+  CHECK(shared->text_schema.data() == static_fbs);
+  CHECK(shared->binary_schema_copy.empty());
+  CHECK(shared->text_schema_copy.empty());
+  CHECK(parser.get_flatbuffers_parser() != nullptr);
+
+  // The same contents from another buffer share the registered schema
+  const std::string fbs(static_fbs);
+  const std::string bfbs(static_bfbs);
+  FlatbuffersStreamingJsonParser copy(fbs, bfbs);
+  CHECK(copy.get_shared_schema() == shared);
+}
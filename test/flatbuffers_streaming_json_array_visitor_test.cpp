@@ -0,0 +1,138 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_streaming_json_array_visitor.h"
+#include "../src/oidc_generated.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+TEST_CASE("JSON array elements are delivered in order")
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonArrayVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser, 4);
+
+  // Brackets, commas and escaped quotes inside strings
+  std::string json(" [\n");
+  std::vector<int> expected;
+  for (int i = 0; i < 300; ++i)
+  {
+    if (i % 50 == 7)
+    {
+      json += R"(  {"code":)" + std::to_string(i) + R"(,"message":"],\"[{"})";
+      expected.push_back(-i);
+    }
+    else {
+      json += R"(  {"access_token":"a\\",)" "\n"
+        R"(   "ignored":[{},[1,"]"]],"expires_in":)" + std::to_string(i) + "}";
+      expected.push_back(i);
+    }
+    json += (i + 1 < 300)? ",\n" : "\n";
+  }
+  json += "] trailing";
+
+  // Callbacks run on the worker threads, so only record the items here
+  std::vector<int> items;
+  std::vector<std::string> access_tokens;
+  auto callback = [&](const OIDC::TokenT& t) -> bool
+  {
+    items.push_back(t.expires_in);
+    access_tokens.push_back(t.access_token);
+    return true;
+  };
+  auto errback = [&](const OIDC::ErrorT& e) -> bool
+  {
+    items.push_back(-e.code);
+    return true;
+  };
+
+  std::istringstream resp(json);
+  CHECK(visitor.parse_stream(resp, {}, callback, {"code"}, errback));
+  CHECK(items == expected);
+  CHECK(access_tokens == std::vector<std::string>(294, "a\\"));
+
+  // Elements split across buffers
+  for (size_t step : {1, 7, 37, 4096})
+  {
+    items.clear();
+    visitor.begin_stream({}, callback, {"code"}, errback);
+    for (size_t pos = 0; pos < json.size(); pos += step)
+    {
+      CHECK(visitor.feed(std::experimental::string_view(json).substr(pos, step)));
+    }
+    CHECK(visitor.finish());
+    CHECK(items == expected);
+  }
+
+  // With a single queued element, the reader waits for each delivery
+  FlatbuffersStreamingJsonArrayVisitor<OIDC::TokenT, OIDC::ErrorT> bounded(parser, 2, 1);
+  items.clear();
+  std::istringstream bounded_resp(json);
+  CHECK(bounded.parse_stream(bounded_resp, {}, callback, {"code"}, errback));
+  CHECK(items == expected);
+
+  // Paths are relative to each element
+  items.clear();
+  std::istringstream nested_resp(R"([{"t":{"expires_in":1}},{"t":{"expires_in":2}}])");
+  CHECK(visitor.parse_stream(nested_resp, {"t", "expires_in"}, callback));
+  CHECK(items == std::vector<int>({1, 2}));
+
+  std::istringstream empty_resp("[ ]");
+  CHECK(visitor.parse_stream(empty_resp, {}, callback));
+
+  // Nothing is delivered after a callback returns false
+  auto stop_at_10 = [&](const OIDC::TokenT& t) -> bool
+  {
+    items.push_back(t.expires_in);
+    return (t.expires_in != 10);
+  };
+  for (auto* stopped : {&visitor, &bounded})
+  {
+    items.clear();
+    std::istringstream stopped_resp(json);
+    CHECK_FALSE(stopped->parse_stream(stopped_resp, {}, stop_at_10, {"code"}, errback));
+    CHECK(items == std::vector<int>(expected.begin(), expected.begin() + 11));
+  }
+
+  items.clear();
+  std::istringstream all_resp(json);
+  CHECK(visitor.parse_stream(all_resp, {}, callback, {"code"}, errback));
+  CHECK(items == expected);
+
+  // An invalid element fails the stream, but not the other elements
+  items.clear();
+  std::istringstream invalid_resp(
+    R"([{"expires_in":1},{"expires_in":},{"expires_in":3}])"
+  );
+  CHECK_FALSE(visitor.parse_stream(invalid_resp, {}, callback));
+  CHECK(items == std::vector<int>({1, 3}));
+
+  for (const auto& invalid : {
+    R"({"expires_in":1})",
+    R"([{"expires_in":1},])",
+    R"([,{"expires_in":1}])",
+    R"([{"expires_in":1} {"expires_in":2}])",
+    R"([{"expires_in":1})",
+    R"([{"expires_in":1}})",
+  })
+  {
+    std::istringstream truncated_resp(invalid);
+    CHECK_FALSE(visitor.parse_stream(truncated_resp, {}, callback));
+  }
+}
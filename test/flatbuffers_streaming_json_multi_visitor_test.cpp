@@ -0,0 +1,157 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_streaming_json_multi_visitor.h"
+#include "../src/oidc_generated.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+TEST_CASE("Each bound path is routed to its own callback in one pass")
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonMultiVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  std::vector<std::string> items;
+  visitor.bind<OIDC::TokenT>({"access", "*", "access_token"},
+    [&](const OIDC::TokenT& t) -> bool
+    {
+      items.push_back("access:" + t.access_token);
+      return true;
+    }
+  );
+  visitor.bind_views<OIDC::TokenT>({"refresh", "*", "refresh_token"},
+    [&](const OIDC::Token& t) -> bool
+    {
+      items.push_back("refresh:" + t.refresh_token()->str());
+      return true;
+    }
+  );
+  visitor.bind<OIDC::ErrorT>({"errors", "*", "code"},
+    [&](const OIDC::ErrorT& e) -> bool
+    {
+      items.push_back("error:" + std::to_string(e.code));
+      return true;
+    }
+  );
+
+  // The first path bound wins
+  CHECK(visitor.bind<OIDC::ErrorT>({"access", "*", "access_token"}, nullptr));
+
+  const std::string json(R"({
+    "access":{"a":{"access_token":"a1"},"b":{"access_token":"a2","x":[]}},
+    "skipped":{"access_token":"s1"},
+    "errors":{"e":{"code":500,"message":"m"}},
+    "refresh":{"c":{"refresh_token":"r1"}},
+    "access_more":{"d":{"access_token":"a3"}}
+  })");
+
+  const std::vector<std::string> expected({
+    "access:a1", "access:a2", "error:500", "refresh:r1",
+  });
+
+  std::istringstream resp(json);
+  CHECK(visitor.parse_stream(resp));
+  CHECK(items == expected);
+
+  for (size_t split = 0; split <= json.size(); ++split)
+  {
+    items.clear();
+
+    visitor.begin_stream();
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(0, split)));
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(split)));
+    CHECK(visitor.finish());
+
+    CHECK(items == expected);
+  }
+
+  // Type mismatches fail the item
+  std::istringstream invalid_resp(R"({"errors":{"e":{"code":"x"}}})");
+  CHECK_FALSE(visitor.parse_stream(invalid_resp));
+
+  // The whole document, as a single type
+  visitor.clear_bindings();
+  items.clear();
+  visitor.bind<OIDC::ErrorT>({},
+    [&](const OIDC::ErrorT& e) -> bool
+    {
+      items.push_back(e.message);
+      return true;
+    }
+  );
+
+  std::istringstream root_resp(R"({"code":401,"message":"Invalid token"})");
+  CHECK(visitor.parse_stream(root_resp));
+  CHECK(items == std::vector<std::string>({"Invalid token"}));
+}
+
+TEST_CASE("Paths nested with a bound path are not bound")
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonMultiVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  std::vector<std::string> items;
+  CHECK(visitor.bind<OIDC::TokenT>({"tokens", "*", "access_token"},
+    [&](const OIDC::TokenT& t) -> bool
+    {
+      items.push_back("token:" + t.access_token);
+      return true;
+    }
+  ));
+
+  auto on_error = [&](const OIDC::ErrorT& e) -> bool
+  {
+    items.push_back("error:" + e.message);
+    return true;
+  };
+
+  // Inside of the bound values, directly or through a wildcard
+  CHECK_FALSE(visitor.bind<OIDC::ErrorT>({"tokens", "a", "access_token", "message"}, on_error));
+  CHECK_FALSE(visitor.bind<OIDC::ErrorT>({"*", "*", "*", "message"}, on_error));
+
+  // Containing the bound values, including the whole document
+  CHECK_FALSE(visitor.bind<OIDC::ErrorT>({"tokens", "*"}, on_error));
+  CHECK_FALSE(visitor.bind<OIDC::ErrorT>({}, on_error));
+
+  // Beside them
+  CHECK(visitor.bind<OIDC::ErrorT>({"errors", "*", "message"}, on_error));
+
+  const std::string json(R"({
+    "tokens":{"a":{"access_token":"a1"}},
+    "errors":{"e":{"message":"m"}}
+  })");
+
+  const std::vector<std::string> expected({"token:a1", "error:m"});
+
+  std::istringstream resp(json);
+  CHECK(visitor.parse_stream(resp));
+  CHECK(items == expected);
+
+  items.clear();
+  visitor.begin_stream();
+  CHECK(visitor.feed(json));
+  CHECK(visitor.finish());
+  CHECK(items == expected);
+}
@@ -0,0 +1,454 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_streaming_json_visitor.h"
+#include "../src/oidc_generated.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+TEST_CASE("Whole document is converted to a message or an error")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  SUBCASE("With the reflection schema") {}
+  SUBCASE("With table decoders")
+  {
+    // Type tables for other tables than the message/error are rejected
+    CHECK_FALSE(visitor.use_table_decoders(OIDC::ErrorTypeTable()));
+    CHECK_FALSE(visitor.use_table_decoders(OIDC::TokenTypeTable(), OIDC::TokenTypeTable()));
+
+    CHECK(visitor.use_table_decoders(OIDC::TokenTypeTable(), OIDC::ErrorTypeTable()));
+  }
+
+  OIDC::TokenT token;
+  OIDC::ErrorT error;
+  int tokens = 0;
+  int errors = 0;
+
+  auto parse = [&](const std::string& json) -> bool
+  {
+    std::istringstream resp(json);
+    return visitor.parse_stream(resp,
+      {},
+      [&](const OIDC::TokenT& t) -> bool
+      {
+        token = t;
+        tokens++;
+        return true;
+      },
+      {"code"},
+      [&](const OIDC::ErrorT& e) -> bool
+      {
+        error = e;
+        errors++;
+        return true;
+      }
+    );
+  };
+
+  CHECK(parse(R"({"access_token":"abc","unknown":{"a":[1,{}]},"expires_in":3600})"));
+  CHECK(tokens == 1);
+  CHECK(errors == 0);
+  CHECK(token.access_token == "abc");
+  CHECK(token.expires_in == 3600);
+
+  // The error path is recognized even after other keys
+  CHECK(parse(R"({"message":"Invalid token","status":"UNAUTHENTICATED","code":401})"));
+  CHECK(tokens == 1);
+  CHECK(errors == 1);
+  CHECK(error.code == 401);
+  CHECK(error.message == "Invalid token");
+  CHECK(error.status == "UNAUTHENTICATED");
+
+  // Type mismatches fail the item
+  CHECK_FALSE(parse(R"({"access_token":1})"));
+  CHECK(tokens == 1);
+}
+
+TEST_CASE("Each value matching the root path is a separate item")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  SUBCASE("With the reflection schema") {}
+  SUBCASE("With a table decoder")
+  {
+    CHECK(visitor.use_table_decoders(OIDC::TokenTypeTable()));
+  }
+
+  std::vector<int> items;
+  std::istringstream resp(R"({
+    "skipped":{"a":{"expires_in":1}},
+    "tokens":{"a":{"expires_in":2},"b":{"expires_in":3,"ignored":[]}}
+  })");
+
+  CHECK(visitor.parse_stream(resp,
+    {"tokens", "*", "expires_in"},
+    [&](const OIDC::TokenT& t) -> bool
+    {
+      items.push_back(t.expires_in);
+      return true;
+    }
+  ));
+
+  CHECK(items == std::vector<int>({2, 3}));
+}
+
+TEST_CASE("Table views are passed without unpacking")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  std::string id_token;
+  std::istringstream resp(R"({"id_token":"xyz","expires_in":60})");
+
+  CHECK(visitor.parse_stream_views(resp,
+    {},
+    [&](const OIDC::Token& t) -> bool
+    {
+      REQUIRE(t.id_token() != nullptr);
+      CHECK(t.access_token() == nullptr);
+      CHECK(t.expires_in() == 60);
+
+      id_token = t.id_token()->str();
+      return true;
+    }
+  ));
+
+  CHECK(id_token == "xyz");
+}
+
+TEST_CASE("Flatbuffers responses are verified, without parsing JSON")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  SUBCASE("With the reflection schema") {}
+  SUBCASE("With table decoders")
+  {
+    CHECK(visitor.use_table_decoders(OIDC::TokenTypeTable(), OIDC::ErrorTypeTable()));
+  }
+
+  OIDC::TokenT token;
+  token.id_token = std::string(3000, 'x');
+  token.expires_in = 60;
+
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(OIDC::Token::Pack(fbb, &token));
+  const std::string token_buf(
+    reinterpret_cast<const char*>(fbb.GetBufferPointer()), fbb.GetSize()
+  );
+
+  OIDC::ErrorT error;
+  error.code = 401;
+
+  flatbuffers::FlatBufferBuilder error_fbb;
+  error_fbb.Finish(OIDC::Error::Pack(error_fbb, &error));
+  const std::string error_buf(
+    reinterpret_cast<const char*>(error_fbb.GetBufferPointer()), error_fbb.GetSize()
+  );
+
+  int tokens = 0;
+  int errors = 0;
+  auto callback = [&](const OIDC::TokenT& t) -> bool
+  {
+    CHECK(t.id_token == token.id_token);
+    CHECK(t.expires_in == 60);
+    tokens++;
+    return true;
+  };
+  auto errback = [&](const OIDC::ErrorT& e) -> bool
+  {
+    CHECK(e.code == 401);
+    errors++;
+    return true;
+  };
+
+  std::istringstream resp(token_buf);
+  CHECK(visitor.parse_flatbuffer(resp, false, callback, errback));
+  CHECK(tokens == 1);
+
+  std::istringstream error_resp(error_buf);
+  CHECK(visitor.parse_flatbuffer(error_resp, true, callback, errback));
+  CHECK(errors == 1);
+
+  std::istringstream views_resp(token_buf);
+  CHECK(visitor.parse_flatbuffer_views(views_resp,
+    false,
+    [&](const OIDC::Token& t) -> bool
+    {
+      REQUIRE(t.id_token() != nullptr);
+      CHECK(t.id_token()->size() == 3000);
+      tokens++;
+      return true;
+    }
+  ));
+  CHECK(tokens == 2);
+
+  // Truncated, corrupted and JSON bodies all fail verification
+  std::string corrupted(token_buf);
+  corrupted[0] = '\xff';
+  for (const auto& invalid : {
+    token_buf.substr(0, token_buf.size() / 2),
+    corrupted,
+    std::string(R"({"id_token":"xyz"})"),
+    std::string(),
+  })
+  {
+    std::istringstream invalid_resp(invalid);
+    CHECK_FALSE(visitor.parse_flatbuffer(invalid_resp, false, callback, errback));
+  }
+  CHECK(tokens == 2);
+}
+
+TEST_CASE("Messages are delivered in batches, in order with errors")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  std::string json(R"({"tokens":{)");
+  for (int i = 0; i < 10; ++i)
+  {
+    json += "\"t" + std::to_string(i) + R"(":{"expires_in":)" + std::to_string(i) + "},";
+  }
+  json += R"("e":{"code":500},"t10":{"expires_in":10}}})";
+
+  std::vector<std::vector<int>> batches;
+  auto batch_callback = [&](const std::vector<OIDC::TokenT>& tokens) -> bool
+  {
+    batches.emplace_back();
+    for (const auto& t : tokens)
+    {
+      batches.back().push_back(t.expires_in);
+    }
+    return true;
+  };
+  auto errback = [&](const OIDC::ErrorT& e) -> bool
+  {
+    batches.push_back({-e.code});
+    return true;
+  };
+
+  const std::vector<std::vector<int>> expected({
+    {0, 1, 2, 3}, {4, 5, 6, 7}, {8, 9}, {-500}, {10},
+  });
+
+  std::istringstream resp(json);
+  CHECK(visitor.parse_stream_batches(resp,
+    {"tokens", "*", "expires_in"}, batch_callback, 4,
+    {"tokens", "*", "code"}, errback
+  ));
+  CHECK(batches == expected);
+
+  // The last batch is delivered by finish()
+  batches.clear();
+  visitor.begin_stream_batches(
+    {"tokens", "*", "expires_in"}, batch_callback, 4,
+    {"tokens", "*", "code"}, errback
+  );
+  CHECK(visitor.feed(json));
+  CHECK(batches.size() == 4);
+  CHECK(visitor.finish());
+  CHECK(batches == expected);
+
+  // A failing batch callback fails the parse
+  std::istringstream failing_resp(json);
+  CHECK_FALSE(visitor.parse_stream_batches(failing_resp,
+    {"tokens", "*", "expires_in"},
+    [](const std::vector<OIDC::TokenT>&) -> bool
+    {
+      return false;
+    }
+  ));
+}
+
+TEST_CASE("Several root paths are matched in one pass")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+  visitor.add_root_path({"refresh", "*", "refresh_token"});
+
+  std::vector<std::string> tokens;
+  int errors = 0;
+  std::istringstream resp(R"({
+    "access":{"a":{"access_token":"a1"},"b":{"access_token":"a2"}},
+    "refresh":{"c":{"refresh_token":"r1"}},
+    "error":{"code":500}
+  })");
+
+  CHECK(visitor.parse_stream(resp,
+    {"access", "*", "access_token"},
+    [&](const OIDC::TokenT& t) -> bool
+    {
+      tokens.push_back(t.access_token + t.refresh_token);
+      return true;
+    },
+    {"error", "code"},
+    [&](const OIDC::ErrorT& e) -> bool
+    {
+      CHECK(e.code == 500);
+      errors++;
+      return true;
+    }
+  ));
+
+  CHECK(tokens == std::vector<std::string>({"a1", "a2", "r1"}));
+  CHECK(errors == 1);
+}
+
+TEST_CASE("Push mode matches parse_stream for any split of the input")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  const std::string json(R"({
+    "skipped":[null,true,false,-1.5e3,{"a":"b"}],
+    "tokens":{
+      "a":{"access_token":"caf\u00e9 \ud83d\ude00","expires_in":3600},
+      "b":{"access_token":"\"\\\/\b\f\n\r\t","ignored":[[],{}]}
+    },
+    "error":{"code":401,"message":"Invalid token"}
+  } trailing)");
+
+  std::vector<std::string> items;
+  auto callback = [&](const OIDC::TokenT& t) -> bool
+  {
+    items.push_back(t.access_token);
+    return true;
+  };
+  auto errback = [&](const OIDC::ErrorT& e) -> bool
+  {
+    items.push_back(std::to_string(e.code));
+    return true;
+  };
+
+  std::istringstream resp(json);
+  CHECK(visitor.parse_stream(resp,
+    {"tokens", "*", "access_token"}, callback,
+    {"error", "code"}, errback
+  ));
+
+  auto expected = items;
+  CHECK(expected == std::vector<std::string>({
+    "caf\xc3\xa9 \xf0\x9f\x98\x80", "\"\\/\b\f\n\r\t", "401"
+  }));
+
+  for (size_t split = 0; split <= json.size(); ++split)
+  {
+    items.clear();
+
+    visitor.begin_stream(
+      {"tokens", "*", "access_token"}, callback,
+      {"error", "code"}, errback
+    );
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(0, split)));
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(split)));
+    CHECK(visitor.finish());
+
+    CHECK(items == expected);
+  }
+
+  // Byte by byte
+  items.clear();
+  visitor.begin_stream({}, callback);
+  for (auto c : std::string(R"({"access_token":"abc","expires_in":60})"))
+  {
+    CHECK(visitor.feed(std::experimental::string_view(&c, 1)));
+  }
+  CHECK(visitor.finish());
+  CHECK(items == std::vector<std::string>({"abc"}));
+
+  // A root number is only complete at the end of the input
+  visitor.begin_stream({"none"});
+  CHECK(visitor.feed("12"));
+  CHECK(visitor.feed("34"));
+  CHECK(visitor.finish());
+
+  // Truncated and malformed input
+  visitor.begin_stream();
+  CHECK(visitor.feed(R"({"a":)"));
+  CHECK_FALSE(visitor.finish());
+
+  visitor.begin_stream();
+  CHECK_FALSE(visitor.feed(R"({"a" 1})"));
+}
+
+TEST_CASE("Values outside of all paths are skipped without decoding")
+{
+  FlatbuffersStreamingJsonParser parser(get_oidc_fbs(), generate_oidc_bfbs());
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  // Brackets and escaped quotes inside skipped strings
+  const std::string json(R"({
+    "skipped":{"a":["]}\"{[",{"b":"\\"}],"c":-1e3,"d":"\u00e9"},
+    "s":"}{\"",
+    "tokens":{"a":{"access_token":"abc","ignored":{"x":[[]]}},"skipped":true},
+    "n":[1,2,3]
+  })");
+
+  std::vector<std::string> items;
+  auto callback = [&](const OIDC::TokenT& t) -> bool
+  {
+    items.push_back(t.access_token);
+    return true;
+  };
+
+  std::istringstream resp(json);
+  CHECK(visitor.parse_stream(resp, {"tokens", "*", "access_token"}, callback));
+  CHECK(items == std::vector<std::string>({"abc"}));
+
+  for (size_t split = 0; split <= json.size(); ++split)
+  {
+    items.clear();
+
+    visitor.begin_stream({"tokens", "*", "access_token"}, callback);
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(0, split)));
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(split)));
+    CHECK(visitor.finish());
+
+    CHECK(items == std::vector<std::string>({"abc"}));
+  }
+
+  // Skipped values must still be balanced
+  for (const auto& invalid : {
+    R"({"skipped":{"a":[}]})",
+    R"({"skipped":["a)",
+    "{\"skipped\":\"a\nb\"}",
+  })
+  {
+    std::istringstream invalid_resp(invalid);
+    CHECK_FALSE(visitor.parse_stream(invalid_resp, {"tokens", "*", "access_token"}, callback));
+
+    visitor.begin_stream({"tokens", "*", "access_token"}, callback);
+    CHECK_FALSE((visitor.feed(invalid) && visitor.finish()));
+  }
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_streaming_ndjson_visitor.h"
+#include "../src/oidc_generated.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+TEST_CASE("JSON lines are delivered in order")
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+  REQUIRE(parser.is_ready());
+
+  FlatbuffersStreamingNdjsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser, 4);
+
+  std::string ndjson;
+  std::vector<int> expected;
+  for (int i = 0; i < 500; ++i)
+  {
+    if (i % 50 == 7)
+    {
+      ndjson += R"({"code":)" + std::to_string(i) + "}\r\n";
+      expected.push_back(-i);
+    }
+    else {
+      ndjson += R"({"access_token":"a","expires_in":)" + std::to_string(i) + "}\n";
+      expected.push_back(i);
+    }
+
+    // Blank lines are skipped
+    if (i % 100 == 0)
+    {
+      ndjson += "\n";
+    }
+  }
+
+  // Callbacks run on the worker threads, so only record the items here
+  std::vector<int> items;
+  auto callback = [&](const OIDC::TokenT& t) -> bool
+  {
+    items.push_back(t.expires_in);
+    return true;
+  };
+  auto errback = [&](const OIDC::ErrorT& e) -> bool
+  {
+    items.push_back(-e.code);
+    return true;
+  };
+
+  // Records split across buffers, with no trailing newline
+  ndjson.pop_back();
+  visitor.begin_stream({}, callback, {"code"}, errback);
+  for (size_t pos = 0; pos < ndjson.size(); pos += 37)
+  {
+    CHECK(visitor.feed(std::experimental::string_view(ndjson).substr(pos, 37)));
+  }
+  CHECK(visitor.finish());
+  CHECK(items == expected);
+
+  // With a single queued record, the reader waits for each delivery
+  FlatbuffersStreamingNdjsonVisitor<OIDC::TokenT, OIDC::ErrorT> bounded(parser, 2, 1);
+  items.clear();
+  std::istringstream lines(ndjson);
+  CHECK(bounded.parse_stream(lines, {}, callback, {"code"}, errback));
+  CHECK(items == expected);
+
+  // An invalid record fails the stream, but not the other records
+  items.clear();
+  std::istringstream resp(
+    R"({"expires_in":1})" "\n"
+    R"({"expires_in":)" "\n"
+    R"({"expires_in":3})" "\n"
+  );
+  CHECK_FALSE(visitor.parse_stream(resp, {}, callback));
+  CHECK(items == std::vector<int>({1, 3}));
+
+  // Nothing is delivered after a callback returns false
+  auto stop_at_10 = [&](const OIDC::TokenT& t) -> bool
+  {
+    items.push_back(t.expires_in);
+    return (t.expires_in != 10);
+  };
+  for (auto* stopped : {&visitor, &bounded})
+  {
+    items.clear();
+    std::istringstream stopped_lines(ndjson);
+    CHECK_FALSE(stopped->parse_stream(stopped_lines, {}, stop_at_10, {"code"}, errback));
+    CHECK(items == std::vector<int>(expected.begin(), expected.begin() + 11));
+  }
+
+  // feed() stops taking records too, until the next stream
+  items.clear();
+  visitor.begin_stream({}, stop_at_10, {"code"}, errback);
+  bool is_fed = true;
+  for (size_t pos = 0; is_fed && (pos < ndjson.size()); pos += 37)
+  {
+    is_fed = visitor.feed(std::experimental::string_view(ndjson).substr(pos, 37));
+  }
+  CHECK_FALSE(visitor.finish());
+  CHECK(items == std::vector<int>(expected.begin(), expected.begin() + 11));
+
+  items.clear();
+  std::istringstream all_lines(ndjson);
+  CHECK(visitor.parse_stream(all_lines, {}, callback, {"code"}, errback));
+  CHECK(items == expected);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_json_builder.h"
+#include "../src/flatbuffers_table_decoder.h"
+#include "../src/json_push_parser.h"
+#include "../src/oidc_generated.h"
+
+#include <string>
+
+template<class BuilderT>
+bool
+decode_json(BuilderT& builder, const std::string& json)
+{
+  JsonPushParser<BuilderT> push_parser(builder);
+  return (push_parser.feed(json) && push_parser.finish() && builder.is_complete());
+}
+
+TEST_CASE("Field names are matched with a perfect hash")
+{
+  FlatbuffersTableDecoder decoder;
+  REQUIRE(decoder.set_type_table(OIDC::TokenTypeTable()));
+
+  auto token_table = OIDC::TokenTypeTable();
+  for (size_t i = 0; i < token_table->num_elems; ++i)
+  {
+    CHECK(decoder.find_field(token_table->names[i]) == static_cast<int>(i));
+  }
+
+  CHECK(decoder.find_field("") == -1);
+  CHECK(decoder.find_field("unknown") == -1);
+  CHECK(decoder.find_field("access_tokens") == -1);
+  CHECK(decoder.find_field("access_toke") == -1);
+
+  REQUIRE(decoder.set_type_table(OIDC::ErrorTypeTable()));
+  CHECK(decoder.find_field("code") == 0);
+  CHECK(decoder.find_field("access_token") == -1);
+
+  // Only flat tables are supported
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_LONG, 1, -1 },
+  };
+  static const char* names[] = { "ids" };
+  static flatbuffers::TypeTable vector_table = {
+    flatbuffers::ST_TABLE, 1, type_codes, nullptr, nullptr, names
+  };
+  CHECK_FALSE(decoder.set_type_table(&vector_table));
+  CHECK_FALSE(decoder.is_ready());
+  CHECK_FALSE(decoder.start());
+
+  CHECK_FALSE(decoder.set_type_table(nullptr));
+}
+
+TEST_CASE("Decoded tables match FlatbuffersJsonBuilder")
+{
+  const auto oidc_bfbs = generate_oidc_bfbs();
+  REQUIRE(!oidc_bfbs.empty());
+  auto schema = reflection::GetSchema(oidc_bfbs.data());
+  auto token_table = schema->objects()->LookupByKey("OIDC.Token");
+  REQUIRE(token_table != nullptr);
+
+  FlatbuffersJsonBuilder builder;
+  REQUIRE(builder.set_schema(schema));
+
+  FlatbuffersTableDecoder decoder;
+  REQUIRE(decoder.set_type_table(OIDC::TokenTypeTable()));
+
+  auto unpack = [](std::experimental::string_view buf)
+  {
+    OIDC::TokenT token;
+    flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t*>(buf.data()),
+      buf.size()
+    );
+    REQUIRE(OIDC::VerifyTokenBuffer(verifier));
+    OIDC::GetToken(buf.data())->UnPackTo(&token);
+    return token;
+  };
+
+  for (const auto& json : {
+    R"({"access_token":"abc","expires_in":3600})",
+    R"({"expires_in":3.0,"id_token":null,"token_type":"Bearer"})",
+    R"({"expires_in":"0x10","unknown":{"a":[1,{"b":"c"}],"d":null}})",
+    R"({"expires_in":0,"refresh_token":"","ignored":[[],{}],"grant_type":"x"})",
+    R"({})",
+  })
+  {
+    REQUIRE(builder.start(token_table));
+    REQUIRE(decode_json(builder, json));
+
+    REQUIRE(decoder.start());
+    REQUIRE(decode_json(decoder, json));
+
+    auto expected = unpack(builder.get_buffer());
+    auto token = unpack(decoder.get_buffer());
+
+    CHECK(token.access_token == expected.access_token);
+    CHECK(token.token_type == expected.token_type);
+    CHECK(token.grant_type == expected.grant_type);
+    CHECK(token.refresh_token == expected.refresh_token);
+    CHECK(token.expires_in == expected.expires_in);
+    CHECK(token.id_token == expected.id_token);
+  }
+
+  // Both fail on type mismatches
+  for (const auto& json : {
+    R"({"access_token":1})",
+    R"({"access_token":{}})",
+    R"({"expires_in":[1]})",
+    R"({"expires_in":"soon"})",
+    R"([{"expires_in":1}])",
+    R"("abc")",
+  })
+  {
+    REQUIRE(builder.start(token_table));
+    CHECK_FALSE(decode_json(builder, json));
+
+    REQUIRE(decoder.start());
+    CHECK_FALSE(decode_json(decoder, json));
+    CHECK(decoder.has_error());
+  }
+
+  // A single keyed value, as for an item under a "*" path
+  REQUIRE(decoder.start("expires_in"));
+  CHECK(decode_json(decoder, "60"));
+  CHECK(unpack(decoder.get_buffer()).expires_in == 60);
+
+  REQUIRE(decoder.start("unknown"));
+  CHECK(decode_json(decoder, R"({"expires_in":1})"));
+  CHECK(unpack(decoder.get_buffer()).expires_in == 0);
+}
+
+TEST_CASE("Decoded numbers must fit their field, and fields are only set once")
+{
+  FlatbuffersTableDecoder decoder;
+  REQUIRE(decoder.set_type_table(OIDC::TokenTypeTable()));
+
+  for (const auto& json : {
+    R"({"expires_in":2147483647})",
+    R"({"expires_in":-2147483648})",
+    R"({"expires_in":3.0})",
+    R"({"expires_in":1,"unknown":2,"unknowns":3})",
+  })
+  {
+    REQUIRE(decoder.start());
+    CHECK(decode_json(decoder, json));
+  }
+
+  for (const auto& json : {
+    R"({"expires_in":2147483648})",
+    R"({"expires_in":-2147483649})",
+    R"({"expires_in":3.5})",
+    R"({"expires_in":1e300})",
+    R"({"expires_in":"0x100000000"})",
+    R"({"expires_in":1,"expires_in":2})",
+    R"({"access_token":"a","expires_in":1,"access_token":"b"})",
+  })
+  {
+    REQUIRE(decoder.start());
+    CHECK_FALSE(decode_json(decoder, json));
+    CHECK(decoder.has_error());
+  }
+}
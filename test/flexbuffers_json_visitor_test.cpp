@@ -0,0 +1,104 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/flexbuffers_json_visitor.h"
+
+#include <sstream>
+#include <string>
+
+TEST_CASE("Any JSON document is converted to a FlexBuffer")
+{
+  FlexbuffersJsonVisitor visitor;
+
+  const std::string json(R"({
+    "keys":[{"kid":"a","n":1},{"kid":"b","n":2.5}],
+    "ok":true,
+    "none":null,
+    "name":"café"
+  })");
+
+  std::istringstream resp(json);
+  REQUIRE(visitor.parse_stream(resp));
+  REQUIRE(visitor.is_complete());
+
+  auto root = visitor.get_root().AsMap();
+  CHECK(root.size() == 4);
+  CHECK(root["ok"].AsBool());
+  CHECK(root["none"].IsNull());
+  CHECK(root["name"].AsString().str() == "caf\xc3\xa9");
+
+  auto keys = root["keys"].AsVector();
+  REQUIRE(keys.size() == 2);
+  CHECK(keys[0].AsMap()["kid"].AsString().str() == "a");
+  CHECK(keys[0].AsMap()["n"].AsInt64() == 1);
+  CHECK(keys[1].AsMap()["n"].AsDouble() == 2.5);
+
+  // Repeated keys are stored once
+  CHECK(keys[0].AsMap().Keys()[0].AsKey() == keys[1].AsMap().Keys()[0].AsKey());
+
+  // Push mode gives the same buffer, for any split of the input
+  auto expected = visitor.get_buffer().to_string();
+  for (size_t split = 0; split <= json.size(); ++split)
+  {
+    visitor.begin_stream();
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(0, split)));
+    CHECK(visitor.feed(std::experimental::string_view(json).substr(split)));
+    CHECK(visitor.finish());
+    CHECK(visitor.get_buffer() == expected);
+  }
+
+  // Scalar roots
+  visitor.begin_stream();
+  CHECK(visitor.feed("-12"));
+  CHECK(visitor.finish());
+  CHECK(visitor.get_root().AsInt64() == -12);
+
+  // Truncated input has no buffer
+  visitor.begin_stream();
+  CHECK(visitor.feed(R"({"a":[1,)"));
+  CHECK_FALSE(visitor.finish());
+  CHECK_FALSE(visitor.is_complete());
+  CHECK(visitor.get_buffer().empty());
+  CHECK(visitor.get_root().IsNull());
+}
+
+TEST_CASE("Objects with duplicate keys are rejected")
+{
+  FlexbuffersJsonVisitor visitor;
+
+  // The same key may appear in different objects
+  std::istringstream nested(R"({"a":{"a":1,"b":2},"b":[{"a":3},{"a":4}]})");
+  REQUIRE(visitor.parse_stream(nested));
+  CHECK(visitor.get_root().AsMap()["a"].AsMap()["a"].AsInt64() == 1);
+
+  for (const auto& json : {
+    R"({"a":1,"a":2})",
+    R"({"a":1,"b":{"c":[],"d":2,"c":3}})",
+    R"([{"x":1},{"y":1,"x":2,"y":3}])",
+    // FlexBuffer keys end at the first null character
+    R"({"a\u0000b":1,"a\u0000c":2})",
+  })
+  {
+    CAPTURE(json);
+    std::istringstream resp(json);
+    CHECK_FALSE(visitor.parse_stream(resp));
+    CHECK_FALSE(visitor.is_complete());
+
+    visitor.begin_stream();
+    CHECK_FALSE((visitor.feed(json) && visitor.finish()));
+    CHECK_FALSE(visitor.is_complete());
+  }
+
+  // The visitor is usable again afterwards
+  std::istringstream resp(R"({"a":1})");
+  CHECK(visitor.parse_stream(resp));
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/http_response_cache.h"
+
+#include <chrono>
+#include <string>
+
+TEST_CASE("Cache key includes method, host, path and query")
+{
+  auto key = HttpResponseCache::make_key("GET", "www.example.org", "/foo", "?x=1");
+  CHECK(key == "GET www.example.org/foo?x=1");
+  CHECK(key != HttpResponseCache::make_key("GET", "www.example.org", "/foo", ""));
+}
+
+TEST_CASE("Cache key includes the Authorization and Accept request headers")
+{
+  auto key = HttpResponseCache::make_key("GET", "www.example.org", "/foo", "");
+  auto alice = HttpResponseCache::make_key("GET", "www.example.org", "/foo", "", {{"authorization", "Bearer alice"}});
+  auto bob = HttpResponseCache::make_key("GET", "www.example.org", "/foo", "", {{"authorization", "Bearer bob"}});
+  auto json = HttpResponseCache::make_key("GET", "www.example.org", "/foo", "", {{"accept", "application/json"}});
+
+  CHECK(key != alice);
+  CHECK(alice != bob);
+  CHECK(key != json);
+
+  // Other request headers do not select a different response
+  CHECK(key == HttpResponseCache::make_key("GET", "www.example.org", "/foo", "", {{"user-agent", "esp32"}}));
+}
+
+TEST_CASE("Cacheable responses")
+{
+  CHECK(HttpResponseCache::is_cacheable(200, {{"cache-control", "max-age=60"}}));
+  CHECK(HttpResponseCache::is_cacheable(200, {{"etag", "\"v1\""}}));
+  CHECK(HttpResponseCache::is_cacheable(200, {{"last-modified", "Wed, 21 Oct 2015 07:28:00 GMT"}}));
+
+  CHECK_FALSE(HttpResponseCache::is_cacheable(200, {}));
+  CHECK_FALSE(HttpResponseCache::is_cacheable(404, {{"cache-control", "max-age=60"}}));
+  CHECK_FALSE(HttpResponseCache::is_cacheable(200, {{"cache-control", "no-store, max-age=60"}}));
+  CHECK_FALSE(HttpResponseCache::is_cacheable(200, {{"cache-control", "max-age=60"}, {"vary", "*"}}));
+}
+
+TEST_CASE("Fresh and stale entries")
+{
+  HttpResponseCache cache(1024);
+
+  cache.store("fresh", 200, "{}", {{"cache-control", "Public, Max-Age=60"}});
+  cache.store("stale", 200, "{}", {{"etag", "\"v1\""}, {"content-type", "application/json"}});
+  cache.store("no-cache", 200, "{}", {{"cache-control", "no-cache, max-age=60"}});
+
+  auto fresh = cache.find("fresh");
+  REQUIRE(fresh != nullptr);
+  CHECK(cache.is_fresh(*fresh));
+
+  auto stale = cache.find("stale");
+  REQUIRE(stale != nullptr);
+  CHECK_FALSE(cache.is_fresh(*stale));
+  CHECK(stale->etag == "\"v1\"");
+  CHECK(stale->content_type == "application/json");
+
+  auto no_cache = cache.find("no-cache");
+  REQUIRE(no_cache != nullptr);
+  CHECK_FALSE(cache.is_fresh(*no_cache));
+
+  // A 304 response can extend the lifetime and keeps the validators
+  cache.refresh("stale", {{"cache-control", "max-age=60"}});
+  CHECK(cache.is_fresh(*stale));
+  CHECK(stale->etag == "\"v1\"");
+  CHECK(stale->body == "{}");
+}
+
+TEST_CASE("A 304 without Cache-Control renews the stored lifetime")
+{
+  HttpResponseCache cache(1024);
+
+  cache.store("a", 200, "{}", {{"cache-control", "max-age=60"}, {"etag", "\"v1\""}});
+  auto entry = cache.find("a");
+  REQUIRE(entry != nullptr);
+  CHECK(entry->lifetime == std::chrono::seconds(60));
+
+  CHECK(cache.refresh("a", {{"etag", "\"v2\""}}));
+  CHECK(entry->lifetime == std::chrono::seconds(60));
+  CHECK(cache.is_fresh(*entry));
+  CHECK(entry->etag == "\"v2\"");
+
+  // An explicit directive replaces it
+  CHECK(cache.refresh("a", {{"cache-control", "no-cache"}}));
+  CHECK_FALSE(cache.is_fresh(*entry));
+}
+
+TEST_CASE("Entries are only found for requests matching their Vary headers")
+{
+  HttpResponseCache cache(1024);
+
+  cache.store(
+    "a", 200, "{}",
+    {{"cache-control", "max-age=60"}, {"vary", "Accept-Language, X-Client"}},
+    {{"accept-language", "en"}, {"user-agent", "esp32"}}
+  );
+
+  CHECK(cache.find("a", {{"accept-language", "en"}}) != nullptr);
+  CHECK(cache.find("a", {{"accept-language", "en"}, {"user-agent", "other"}}) != nullptr);
+  CHECK(cache.find("a", {{"accept-language", "fr"}}) == nullptr);
+  CHECK(cache.find("a", {{"accept-language", "en"}, {"x-client", "1"}}) == nullptr);
+  CHECK(cache.find("a") == nullptr);
+}
+
+TEST_CASE("Least recently used entries are evicted")
+{
+  HttpResponseCache cache(32);
+  std::string body(8, 'x');
+
+  cache.store("a", 200, body, {{"cache-control", "max-age=60"}});
+  cache.store("b", 200, body, {{"cache-control", "max-age=60"}});
+  cache.store("c", 200, body, {{"cache-control", "max-age=60"}});
+  CHECK(cache.size_bytes() == 27);
+
+  // Touch "a", so "b" is now the least recently used
+  CHECK(cache.find("a") != nullptr);
+
+  cache.store("d", 200, body, {{"cache-control", "max-age=60"}});
+  CHECK(cache.find("b") == nullptr);
+  CHECK(cache.find("a") != nullptr);
+  CHECK(cache.find("c") != nullptr);
+  CHECK(cache.find("d") != nullptr);
+  CHECK(cache.size_bytes() <= cache.max_size_bytes());
+
+  // Revalidating "c" makes it the most recently used, and may evict others
+  CHECK(cache.refresh("c", {{"etag", "\"abcdef\""}}));
+  CHECK(cache.find("a") == nullptr);
+  CHECK(cache.find("d") != nullptr);
+  CHECK(cache.find("c") != nullptr);
+  CHECK(cache.size_bytes() <= cache.max_size_bytes());
+
+  // Entries larger than the whole budget are not stored
+  CHECK_FALSE(cache.store("e", 200, std::string(64, 'x'), {}));
+  CHECK(cache.find("e") == nullptr);
+}
@@ -8,10 +8,15 @@
  * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
  */
 #include "test_runner.h"
+#include "test_compression.h"
 
 #include "../src/tls_connection.h"
 #include "../src/https_endpoint.h"
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+
 // This regex roughly worked to turn C++ class into MAKE_MOCKx() definitions
 // Removing the argument names and selecting the correct MACK_MOCKx is needed
 // :'<,'>s/virtual \([^ ]\+\) \([^(]\+\)(\([^(]*\)) = 0;/MAKE_MOCK0(\2, \1(\3));/
@@ -58,3 +63,275 @@ TEST_CASE("Does TLSConnection lifecycle")
 
   HttpsEndpointAutoConnect<TLSConnectionMock>(conn, "www.example.org", 443, "<pem>");
 }
+
+using trompeloeil::_;
+
+// A canned HTTP response, a few bytes per read() as TLS records may arrive
+struct CannedResponse
+{
+  std::string data;
+  size_t pos = 0;
+  size_t chunk = 5;
+
+  int read(std::experimental::string_view buf)
+  {
+    auto len = std::min({chunk, buf.size(), data.size() - pos});
+    std::memcpy(const_cast<char*>(buf.data()), data.data() + pos, len);
+    pos += len;
+    return len;
+  }
+};
+
+TEST_CASE("Compressed response bodies are inflated when accepted")
+{
+  TLSConnectionMock conn{};
+  ALLOW_CALL(conn, initialize(_, _, _)).RETURN(true);
+  ALLOW_CALL(conn, reconnect()).RETURN(true);
+  ALLOW_CALL(conn, disconnect()).RETURN(true);
+
+  std::string request;
+  ALLOW_CALL(conn, write(_))
+    .LR_SIDE_EFFECT(request = std::string(_1))
+    .RETURN(int(_1.size()));
+
+  CannedResponse response;
+  ALLOW_CALL(conn, read(_)).LR_RETURN(response.read(_1));
+
+  HttpsEndpointAutoConnect<TLSConnectionMock> endpoint(conn, "www.example.org", 443, "<pem>");
+
+  std::string body;
+  for (auto i=0; i<256; i++)
+  {
+    body += "{\"access_token\":\"abc\",\"expires_in\":3600}";
+  }
+
+  std::string received;
+  auto read_body = [&](int code, std::istream& resp) -> bool
+  {
+    received.assign(std::istreambuf_iterator<char>(resp), {});
+    return (code == 200);
+  };
+
+  // Content codings are case-insensitive
+  endpoint.set_accept_encoding();
+  for (const auto& coding : {
+    std::make_pair("gzip", MAX_WBITS + 16),
+    std::make_pair("GZIP", MAX_WBITS + 16),
+    std::make_pair("Deflate", MAX_WBITS),
+  })
+  {
+    response = CannedResponse();
+    response.data = std::string(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: application/json\r\n"
+      "Content-Encoding: ") + coding.first + "\r\n"
+      "\r\n" + compress_with_window_bits(body, coding.second);
+
+    received.clear();
+    CHECK(endpoint.make_request("/", read_body));
+    CHECK(request.find("\r\nAccept-Encoding: gzip, deflate\r\n") != std::string::npos);
+    CHECK(received == body);
+  }
+
+  // Otherwise the body is passed through as-is
+  endpoint.set_accept_encoding(false);
+  auto compressed = compress_with_window_bits(body, MAX_WBITS + 16);
+  response = CannedResponse();
+  response.data = "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\n\r\n" + compressed;
+
+  CHECK(endpoint.make_request("/", read_body));
+  CHECK(request.find("Accept-Encoding") == std::string::npos);
+  CHECK(received == compressed);
+}
+
+TEST_CASE("Accepting flatbuffers only replaces the caller's Accept header")
+{
+  TLSConnectionMock conn{};
+  ALLOW_CALL(conn, initialize(_, _, _)).RETURN(true);
+  ALLOW_CALL(conn, reconnect()).RETURN(true);
+  ALLOW_CALL(conn, disconnect()).RETURN(true);
+
+  std::string request;
+  ALLOW_CALL(conn, write(_))
+    .LR_SIDE_EFFECT(request += std::string(_1))
+    .RETURN(int(_1.size()));
+
+  CannedResponse response;
+  ALLOW_CALL(conn, read(_)).LR_RETURN(response.read(_1));
+
+  HttpsEndpointAutoConnect<TLSConnectionMock> endpoint(conn, "www.example.org", 443, "<pem>");
+
+  auto get = [&]() -> bool
+  {
+    request.clear();
+    response = CannedResponse();
+    response.data = "HTTP/1.1 200 OK\r\n\r\n";
+    return endpoint.make_request("/", [](int code, std::istream&) -> bool
+    {
+      return (code == 200);
+    });
+  };
+
+  const std::string accept_flatbuffers(
+    "\r\nAccept: application/x-flatbuffers, application/json\r\n"
+  );
+  const std::string accept_text("\r\nAccept: text/plain\r\n");
+
+  // Added, then removed
+  endpoint.set_accept_flatbuffers();
+  CHECK(get());
+  CHECK(request.find(accept_flatbuffers) != std::string::npos);
+
+  endpoint.set_accept_flatbuffers(false);
+  CHECK(get());
+  CHECK(request.find("\r\nAccept:") == std::string::npos);
+
+  // The caller's header is restored
+  endpoint.add_header("Accept", "text/plain");
+  endpoint.set_accept_flatbuffers();
+  CHECK(get());
+  CHECK(request.find(accept_flatbuffers) != std::string::npos);
+
+  endpoint.set_accept_flatbuffers(false);
+  CHECK(get());
+  CHECK(request.find(accept_text) != std::string::npos);
+
+  // Nor is it removed when already disabled
+  endpoint.set_accept_flatbuffers(false);
+  CHECK(get());
+  CHECK(request.find(accept_text) != std::string::npos);
+}
+
+TEST_CASE("Cached responses are replayed, and revalidated when stale")
+{
+  TLSConnectionMock conn{};
+  ALLOW_CALL(conn, initialize(_, _, _)).RETURN(true);
+  ALLOW_CALL(conn, reconnect()).RETURN(true);
+  ALLOW_CALL(conn, disconnect()).RETURN(true);
+
+  std::string request;
+  int requests = 0;
+  ALLOW_CALL(conn, write(_))
+    .LR_SIDE_EFFECT(request = std::string(_1))
+    .LR_SIDE_EFFECT(requests++)
+    .RETURN(int(_1.size()));
+
+  CannedResponse response;
+  ALLOW_CALL(conn, read(_)).LR_RETURN(response.read(_1));
+
+  HttpsEndpointAutoConnect<TLSConnectionMock> endpoint(conn, "www.example.org", 443, "<pem>");
+  HttpResponseCache cache(1024);
+  endpoint.set_response_cache(&cache);
+
+  std::string body("{\"access_token\":\"abc\"}");
+  int received_code = -1;
+  std::string received;
+  bool accept = true;
+  auto read_body = [&](int code, std::istream& resp) -> bool
+  {
+    received_code = code;
+    received.assign(std::istreambuf_iterator<char>(resp), {});
+    return accept;
+  };
+
+  auto respond = [&](const std::string& data)
+  {
+    response = CannedResponse();
+    response.data = data;
+    received_code = -1;
+    received.clear();
+  };
+
+  SUBCASE("Fresh responses are replayed without a request")
+  {
+    respond(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: application/json\r\n"
+      "Cache-Control: max-age=60\r\n"
+      "\r\n" + body
+    );
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(received == body);
+    CHECK(requests == 1);
+
+    respond("");
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(requests == 1);
+    CHECK(received_code == 200);
+    CHECK(received == body);
+    CHECK(endpoint.get_response_headers().size() == 1);
+    CHECK(endpoint.get_response_headers().at("content-type") == "application/json");
+
+    // A different Authorization is a different response
+    respond(
+      "HTTP/1.1 200 OK\r\n"
+      "\r\n{}"
+    );
+    CHECK(endpoint.make_request("GET", "/token", {{"Authorization", "Bearer x"}}, read_body));
+    CHECK(requests == 2);
+    CHECK(received == "{}");
+  }
+
+  SUBCASE("Stale responses are revalidated with a conditional request")
+  {
+    respond(
+      "HTTP/1.1 200 OK\r\n"
+      "ETag: \"v1\"\r\n"
+      "Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT\r\n"
+      "\r\n" + body
+    );
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(request.find("If-None-Match") == std::string::npos);
+    CHECK(received == body);
+
+    // Not modified, the cached body is used
+    respond(
+      "HTTP/1.1 304 Not Modified\r\n"
+      "\r\n"
+    );
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(requests == 2);
+    CHECK(request.find("\r\nIf-None-Match: \"v1\"\r\n") != std::string::npos);
+    CHECK(request.find("\r\nIf-Modified-Since: Wed, 21 Oct 2015 07:28:00 GMT\r\n") != std::string::npos);
+    CHECK(received_code == 200);
+    CHECK(received == body);
+
+    // Modified, the new body replaces the cached one
+    respond(
+      "HTTP/1.1 200 OK\r\n"
+      "ETag: \"v2\"\r\n"
+      "\r\n{}"
+    );
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(received == "{}");
+
+    respond(
+      "HTTP/1.1 304 Not Modified\r\n"
+      "\r\n"
+    );
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(request.find("\r\nIf-None-Match: \"v2\"\r\n") != std::string::npos);
+    CHECK(received == "{}");
+  }
+
+  SUBCASE("Rejected responses are not cached")
+  {
+    accept = false;
+    respond(
+      "HTTP/1.1 200 OK\r\n"
+      "Cache-Control: max-age=60\r\n"
+      "\r\n{\"bad\""
+    );
+    endpoint.make_request("/token", read_body);
+    CHECK(cache.size_bytes() == 0);
+
+    accept = true;
+    respond(
+      "HTTP/1.1 200 OK\r\n"
+      "\r\n" + body
+    );
+    CHECK(endpoint.make_request("/token", read_body));
+    CHECK(requests == 2);
+    CHECK(received == body);
+  }
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+#include "test_compression.h"
+
+#include "../src/inflating_streambuf.h"
+
+#include <algorithm>
+#include <istream>
+#include <sstream>
+#include <string>
+
+std::string
+make_json_body()
+{
+  std::string body;
+  for (auto i=0; i<256; i++)
+  {
+    body += "{\"access_token\":\"abc\",\"expires_in\":3600}";
+  }
+  return body;
+}
+
+TEST_CASE("Inflate gzip body")
+{
+  auto body = make_json_body();
+  std::stringbuf src(compress_with_window_bits(body, MAX_WBITS + 16));
+
+  InflatingStreambuf inflated_buf(src, 64);
+  std::istream inflated(&inflated_buf);
+
+  std::string out(std::istreambuf_iterator<char>(inflated), {});
+  CHECK(out == body);
+}
+
+TEST_CASE("Inflate deflate (zlib) body")
+{
+  auto body = make_json_body();
+  std::stringbuf src(compress_with_window_bits(body, MAX_WBITS));
+
+  InflatingStreambuf inflated_buf(src, 64);
+  std::istream inflated(&inflated_buf);
+
+  std::string out(std::istreambuf_iterator<char>(inflated), {});
+  CHECK(out == body);
+}
+
+TEST_CASE("Truncated compressed body")
+{
+  auto body = make_json_body();
+  auto compressed = compress_with_window_bits(body, MAX_WBITS + 16);
+  std::stringbuf src(compressed.substr(0, compressed.size() / 2));
+
+  InflatingStreambuf inflated_buf(src, 64);
+  std::istream inflated(&inflated_buf);
+
+  std::string out(std::istreambuf_iterator<char>(inflated), {});
+  CHECK(out.size() < body.size());
+  CHECK(body.compare(0, out.size(), out) == 0);
+}
+
+// Returns a single byte per read, as a slow connection might
+class OneByteStreambuf
+: public std::stringbuf
+{
+public:
+  using std::stringbuf::stringbuf;
+
+protected:
+  std::streamsize showmanyc() override
+  {
+    return 0;
+  }
+
+  std::streamsize xsgetn(char* s, std::streamsize n) override
+  {
+    return std::stringbuf::xsgetn(s, std::min(n, std::streamsize(1)));
+  }
+};
+
+TEST_CASE("Inflate a body arriving one byte at a time")
+{
+  // Fills shorter than the put-back area must not read before the buffer
+  auto body = make_json_body();
+  OneByteStreambuf src(compress_with_window_bits(body, MAX_WBITS + 16));
+
+  InflatingStreambuf inflated_buf(src, 64);
+  std::istream inflated(&inflated_buf);
+
+  std::string out(std::istreambuf_iterator<char>(inflated), {});
+  CHECK(out == body);
+}
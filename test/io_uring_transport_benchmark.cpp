@@ -0,0 +1,211 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "benchmark_runner.h"
+
+#include "../src/io_uring_transport.h"
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Connected loopback TCP sockets (client and server ends), closed on exit
+struct LoopbackConnections
+{
+  explicit LoopbackConnections(size_t count)
+  {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+      return;
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    if ((bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) &&
+        (listen(listen_fd, count) == 0) &&
+        (getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == 0))
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        if ((client < 0) ||
+            (connect(client, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+        {
+          close(client);
+          break;
+        }
+
+        int server = accept(listen_fd, nullptr, nullptr);
+        if (server < 0)
+        {
+          close(client);
+          break;
+        }
+
+        // Small request/response sized messages, as with TLS records
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        clients.push_back(client);
+        servers.push_back(server);
+      }
+    }
+
+    close(listen_fd);
+    ok = (servers.size() == count);
+  }
+
+  ~LoopbackConnections()
+  {
+    for (auto fd : clients)
+    {
+      close(fd);
+    }
+    for (auto fd : servers)
+    {
+      close(fd);
+    }
+  }
+
+  bool ok = false;
+  std::vector<int> clients;
+  std::vector<int> servers;
+};
+
+} // namespace
+
+// One message is sent on every connection, then received on every peer,
+// i.e. a round of requests on many sockets of a gateway
+BENCHMARK(io_uring_transport)
+{
+  const size_t message_len = 1024;
+  const std::string message(message_len, 'x');
+  const auto data = reinterpret_cast<const unsigned char*>(message.data());
+  std::vector<unsigned char> buf(message_len);
+
+  for (size_t socket_count : {1, 16, 64})
+  {
+    LoopbackConnections connections(socket_count);
+    if (!connections.ok)
+    {
+      printf("  Unable to open %zu loopback connections\n", socket_count);
+      return;
+    }
+
+    printf(" %zu sockets, %zu byte messages\n", socket_count, message_len);
+    const auto round_bytes = socket_count * message_len;
+
+    measure_throughput("send/recv", round_bytes, [&]
+    {
+      for (auto fd : connections.clients)
+      {
+        if (::send(fd, data, message_len, MSG_NOSIGNAL) != (ssize_t)message_len)
+        {
+          return false;
+        }
+      }
+
+      for (auto fd : connections.servers)
+      {
+        size_t received = 0;
+        while (received < message_len)
+        {
+          auto ret = ::recv(fd, buf.data(), message_len - received, 0);
+          if (ret <= 0)
+          {
+            return false;
+          }
+          received += ret;
+        }
+      }
+      return true;
+    });
+
+    IoUringTransport transport;
+    if (!transport.init(2 * socket_count, message_len))
+    {
+      printf("  io_uring is unavailable, skipping\n");
+      continue;
+    }
+
+    std::vector<IoUringTransport::Socket*> clients;
+    std::vector<IoUringTransport::Socket*> servers;
+    for (size_t i = 0; i < socket_count; i++)
+    {
+      clients.push_back(transport.attach(connections.clients[i]));
+      servers.push_back(transport.attach(connections.servers[i]));
+    }
+
+    // Each send is submitted on its own, as TLSConnection writes
+    auto send_all = [&]
+    {
+      for (auto sock : clients)
+      {
+        if (IoUringTransport::send(sock, data, message_len) != (int)message_len)
+        {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    auto recv_all = [&]
+    {
+      for (auto sock : servers)
+      {
+        size_t received = 0;
+        while (received < message_len)
+        {
+          auto ret = IoUringTransport::recv(sock, buf.data(), message_len - received);
+          if (ret <= 0)
+          {
+            return false;
+          }
+          received += ret;
+        }
+      }
+      return true;
+    };
+
+    measure_throughput("IoUringTransport", round_bytes, [&]
+    {
+      return (send_all() && recv_all());
+    });
+
+    // All sends are submitted together, e.g. a gateway writing to every
+    // connection before reading any response
+    measure_throughput("IoUringTransport, batched sends", round_bytes, [&]
+    {
+      transport.begin_batch();
+      return (send_all() && transport.flush() && recv_all());
+    });
+
+    for (size_t i = 0; i < socket_count; i++)
+    {
+      transport.detach(clients[i]);
+      transport.detach(servers[i]);
+    }
+  }
+}
+
+#endif // HTTPS_ENDPOINT_USE_IO_URING
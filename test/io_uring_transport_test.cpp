@@ -0,0 +1,173 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/io_uring_transport.h"
+
+#if defined(HTTPS_ENDPOINT_USE_IO_URING)
+
+#include <cerrno>
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Connected stream sockets, closed on scope exit
+struct SocketPair
+{
+  SocketPair()
+  {
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  }
+
+  ~SocketPair()
+  {
+    for (auto fd : fds)
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    }
+  }
+
+  int fds[2];
+};
+
+std::string
+recv_all(IoUringTransport::Socket* sock, size_t len)
+{
+  std::string received;
+  unsigned char buf[1000];
+  while (received.size() < len)
+  {
+    auto ret = IoUringTransport::recv(sock, buf, sizeof(buf));
+    if (ret <= 0)
+    {
+      break;
+    }
+    received.append(reinterpret_cast<char*>(buf), ret);
+  }
+  return received;
+}
+
+} // namespace
+
+TEST_CASE("io_uring transport sends and receives over a socketpair")
+{
+  IoUringTransport transport;
+  if (!transport.init(2, 4096))
+  {
+    // e.g. an older kernel, or io_uring disabled by seccomp
+    WARN_MESSAGE(false, "io_uring is unavailable, skipping");
+    return;
+  }
+
+  SocketPair pair;
+  auto a = transport.attach(pair.fds[0]);
+  auto b = transport.attach(pair.fds[1]);
+  REQUIRE(a != nullptr);
+  REQUIRE(b != nullptr);
+
+  // No free slots remain
+  CHECK(transport.attach(pair.fds[0]) == nullptr);
+
+  SUBCASE("Sends are received by the peer")
+  {
+    std::string ping("ping");
+    std::string pong("pong");
+    CHECK(IoUringTransport::send(a, (const unsigned char*)ping.data(), ping.size()) == 4);
+    CHECK(recv_all(b, 4) == ping);
+
+    CHECK(IoUringTransport::send(b, (const unsigned char*)pong.data(), pong.size()) == 4);
+    CHECK(recv_all(a, 4) == pong);
+  }
+
+  SUBCASE("Sends larger than the buffer are partial, and arrive in order")
+  {
+    std::string payload;
+    for (size_t i=0; i<(3 * 4096) + 17; i++)
+    {
+      payload.push_back('a' + (i % 26));
+    }
+
+    size_t sent = 0;
+    while (sent < payload.size())
+    {
+      auto ret = IoUringTransport::send(
+        a, (const unsigned char*)payload.data() + sent, payload.size() - sent
+      );
+      REQUIRE(ret > 0);
+      CHECK(ret <= 4096);
+      sent += ret;
+    }
+    CHECK(recv_all(b, payload.size()) == payload);
+  }
+
+  SUBCASE("A closed peer is reported as end of stream")
+  {
+    // Waits for the in-flight send before releasing the slot
+    std::string bye("bye");
+    CHECK(IoUringTransport::send(a, (const unsigned char*)bye.data(), bye.size()) == 3);
+    CHECK(transport.detach(a) == 0);
+    shutdown(pair.fds[0], SHUT_WR);
+
+    CHECK(recv_all(b, 3) == bye);
+    unsigned char buf[16];
+    CHECK(IoUringTransport::recv(b, buf, sizeof(buf)) == 0);
+  }
+
+  CHECK(transport.detach(b) == 0);
+}
+
+TEST_CASE("io_uring transport reports a failed send on the next call")
+{
+  IoUringTransport transport;
+  if (!transport.init(2, 4096))
+  {
+    WARN_MESSAGE(false, "io_uring is unavailable, skipping");
+    return;
+  }
+
+  SocketPair pair;
+  auto a = transport.attach(pair.fds[0]);
+  REQUIRE(a != nullptr);
+
+  // Fill the socket buffer, until a send has to wait for the peer
+  std::string payload(4096, 'x');
+  for (size_t i=0; (i < 1000) && !a->send_in_flight; i++)
+  {
+    REQUIRE(IoUringTransport::send(
+      a, (const unsigned char*)payload.data(), payload.size()) == 4096
+    );
+  }
+  REQUIRE(a->send_in_flight);
+
+  // The in-flight send fails once the peer is gone
+  close(pair.fds[1]);
+  pair.fds[1] = -1;
+
+  SUBCASE("By recv")
+  {
+    unsigned char buf[16];
+    CHECK(IoUringTransport::recv(a, buf, sizeof(buf)) == -EPIPE);
+    CHECK(transport.detach(a) == 0);
+  }
+
+  SUBCASE("By detach")
+  {
+    CHECK(transport.detach(a) == -EPIPE);
+  }
+}
+
+#endif // HTTPS_ENDPOINT_USE_IO_URING
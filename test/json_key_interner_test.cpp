@@ -0,0 +1,84 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/json_key_interner.h"
+
+#include <string>
+#include <vector>
+
+TEST_CASE("Interned keys have stable ids and storage")
+{
+  JsonKeyInterner interner;
+  CHECK(interner.find("a") == JsonKeyInterner::unknown);
+
+  // Enough keys to fill several arena blocks, plus an oversized one
+  std::vector<std::string> keys;
+  for (int i = 0; i < 500; ++i)
+  {
+    keys.push_back("key_" + std::to_string(i));
+  }
+  keys.push_back(std::string(3000, 'k'));
+  keys.push_back("");
+
+  std::vector<std::experimental::string_view> stored;
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    CHECK(interner.intern(keys[i]) == static_cast<JsonKeyInterner::Id>(i));
+    stored.push_back(interner.get_key(i));
+  }
+
+  CHECK(interner.size() == keys.size());
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    // Existing keys keep their id, and their storage is never moved
+    CHECK(interner.intern(keys[i]) == static_cast<JsonKeyInterner::Id>(i));
+    CHECK(interner.find(keys[i]) == static_cast<JsonKeyInterner::Id>(i));
+    CHECK(interner.get_key(i).data() == stored[i].data());
+    CHECK(interner.get_key(i) == keys[i]);
+  }
+
+  CHECK(interner.get_key(JsonKeyInterner::unknown).empty());
+
+  interner.clear();
+  CHECK(interner.size() == 0);
+  CHECK(interner.find("key_0") == JsonKeyInterner::unknown);
+}
+
+TEST_CASE("Layered interners keep the ids of their base")
+{
+  JsonKeyInterner base;
+  base.intern("a");
+  base.intern("b");
+
+  JsonKeyInterner interner;
+  interner.set_base(&base);
+  CHECK(interner.get_base() == &base);
+  CHECK(interner.find("b") == 1);
+  CHECK(interner.find("c") == JsonKeyInterner::unknown);
+
+  // New keys are numbered after the base, which is unchanged
+  CHECK(interner.intern("c") == 2);
+  CHECK(interner.intern("a") == 0);
+  CHECK(interner.find("c") == 2);
+  CHECK(interner.get_key(1) == "b");
+  CHECK(interner.get_key(2) == "c");
+  CHECK(interner.get_key(3).empty());
+  CHECK(interner.size() == 3);
+  CHECK(base.size() == 2);
+  CHECK(base.find("c") == JsonKeyInterner::unknown);
+
+  // Another base renumbers the keys interned here
+  interner.set_base(nullptr);
+  CHECK(interner.size() == 0);
+  CHECK(interner.find("a") == JsonKeyInterner::unknown);
+  CHECK(interner.intern("c") == 0);
+}
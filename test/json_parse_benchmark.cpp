@@ -0,0 +1,413 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "benchmark_runner.h"
+#include "test_schemas.h"
+
+#include "../src/flatbuffers_json_builder.h"
+#include "../src/flatbuffers_streaming_json_array_visitor.h"
+#include "../src/flatbuffers_streaming_json_visitor.h"
+#include "../src/flatbuffers_table_decoder.h"
+#include "../src/json_push_parser.h"
+#include "../src/json_scan.h"
+#include "../src/oidc_generated.h"
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+
+std::string
+generate_token_list_json(size_t count, bool pretty)
+{
+  std::string nl = pretty? "\n" : "";
+  std::string indent = pretty? "    " : "";
+
+  std::string json = "{" + nl + "  \"tokens\":{" + nl;
+  for (size_t i = 0; i < count; ++i)
+  {
+    json += indent + "\"t" + std::to_string(i) + "\":{" + nl;
+    json += indent + indent + "\"access_token\":\"ya29." + std::string(120, 'x') + "\"," + nl;
+    json += indent + indent + "\"token_type\":\"Bearer\"," + nl;
+    json += indent + indent + "\"expires_in\":" + std::to_string(3600 + i) + "," + nl;
+    json += indent + indent + "\"scopes\":[\"openid\",\"email\",\"profile\"]," + nl;
+    json += indent + indent + "\"id_token\":\"eyJhbGciOiJSUzI1NiJ9." + std::string(600, 'y') + "\"" + nl;
+    json += indent + ((i + 1 < count)? "}," : "}") + nl;
+  }
+  json += "  }" + nl + "}";
+
+  return json;
+}
+
+// Float-heavy sensor readings, with typical decimal precision
+constexpr char telemetry_fbs_text[] =
+  "table Reading { t:double; lat:double; lon:double;"
+  "  alt:float; temp:float; humidity:float; }"
+  "table Telemetry { readings:[Reading]; }"
+  "root_type Telemetry;";
+
+std::string
+generate_telemetry_json(size_t count)
+{
+  std::string json = "{\"readings\":[";
+  char reading[192];
+  for (size_t i = 0; i < count; ++i)
+  {
+    snprintf(reading, sizeof(reading),
+      "%s{\"t\":%.3f,\"lat\":%.7f,\"lon\":%.7f,"
+      "\"alt\":%.1f,\"temp\":%.2f,\"humidity\":%.1f}",
+      (i > 0)? "," : "",
+      1508371200.0 + (i * 0.125),
+      49.2827 + (i % 1000) * 1.3e-6,
+      -123.1207 - (i % 777) * 2.9e-6,
+      70.0 + (i % 50) * 0.1,
+      18.0 + (i % 400) * 0.01,
+      40.0 + (i % 300) * 0.1
+    );
+    json += reading;
+  }
+  json += "]}";
+
+  return json;
+}
+
+struct NullJsonHandler
+{
+  bool set_null() { return true; }
+  bool set_bool(bool) { return true; }
+  bool set_int64(int64_t) { return true; }
+  bool set_number(double) { return true; }
+  bool set_string(std::experimental::string_view) { return true; }
+  bool start_object() { return true; }
+  bool key(const std::string&) { return true; }
+  bool end_object() { return true; }
+  bool start_array() { return true; }
+  bool end_array() { return true; }
+};
+
+BENCHMARK(json_tokenizer)
+{
+  for (auto pretty : {false, true})
+  {
+    auto json = generate_token_list_json(4000, pretty);
+    printf(" %s, %zu bytes\n", pretty? "pretty" : "minified", json.size());
+
+    NullJsonHandler handler;
+    JsonPushParser<NullJsonHandler> push_parser(handler);
+    measure_throughput("JsonPushParser", json.size(), [&]
+    {
+      push_parser.clear();
+      return push_parser.feed(json) && push_parser.finish();
+    });
+  }
+}
+
+BENCHMARK(json_scan_string)
+{
+  std::string text(1 << 20, 'x');
+  text.push_back('"');
+  auto begin = text.data();
+  auto end = text.data() + text.size();
+
+  measure_throughput("scalar", text.size(), [&]
+  {
+    return json_scan::scalar::find_string_special(begin, end) == end - 1;
+  });
+
+  measure_throughput("word (64-bit)", text.size(), [&]
+  {
+    return json_scan::word::find_string_special(begin, end) == end - 1;
+  });
+
+#if defined(__SSE2__) && !defined(JSON_SCAN_NO_SIMD)
+  measure_throughput("SSE2", text.size(), [&]
+  {
+    return json_scan::sse2::find_string_special(begin, end) == end - 1;
+  });
+#endif // __SSE2__
+
+#if defined(__AVX2__) && !defined(JSON_SCAN_NO_SIMD)
+  measure_throughput("AVX2", text.size(), [&]
+  {
+    return json_scan::avx2::find_string_special(begin, end) == end - 1;
+  });
+#endif // __AVX2__
+}
+
+BENCHMARK(streaming_json_visitor)
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  size_t items = 0;
+  auto callback = [&](const OIDC::Token&) -> bool
+  {
+    items++;
+    return true;
+  };
+  auto message_callback = [&](const OIDC::TokenT&) -> bool
+  {
+    items++;
+    return true;
+  };
+  auto batch_callback = [&](const std::vector<OIDC::TokenT>& batch) -> bool
+  {
+    items += batch.size();
+    return true;
+  };
+  const std::vector<std::string> root_path({"tokens", "*", "access_token"});
+
+  // A single small projection, all other values are skipped
+  const std::vector<std::string> projection_path({"tokens", "t0", "expires_in"});
+
+  for (auto pretty : {false, true})
+  {
+    auto json = generate_token_list_json(4000, pretty);
+    printf(" %s, %zu bytes\n", pretty? "pretty" : "minified", json.size());
+
+    measure_throughput("memchr (baseline)", json.size(), [&]
+    {
+      return memchr(json.data(), '\0', json.size()) == nullptr;
+    });
+
+    measure_throughput("parse_stream (istream)", json.size(), [&]
+    {
+      std::istringstream resp(json);
+      return visitor.parse_stream_views(resp, root_path, callback);
+    });
+
+    measure_throughput("feed (4 KiB buffers)", json.size(), [&]
+    {
+      visitor.begin_stream_views(root_path, callback);
+
+      std::experimental::string_view remaining(json);
+      while (!remaining.empty())
+      {
+        if (!visitor.feed(remaining.substr(0, 4096)))
+        {
+          return false;
+        }
+        remaining.remove_prefix(std::min<size_t>(4096, remaining.size()));
+      }
+      return visitor.finish();
+    });
+
+    measure_throughput("feed, object API", json.size(), [&]
+    {
+      visitor.begin_stream(root_path, message_callback);
+      return visitor.feed(json) && visitor.finish();
+    });
+
+    measure_throughput("feed, object API batches of 256", json.size(), [&]
+    {
+      visitor.begin_stream_batches(root_path, batch_callback, 256);
+      return visitor.feed(json) && visitor.finish();
+    });
+
+    measure_throughput("projection, parse_stream (istream)", json.size(), [&]
+    {
+      std::istringstream resp(json);
+      return visitor.parse_stream_views(resp, projection_path, callback);
+    });
+
+    measure_throughput("projection, feed (4 KiB buffers)", json.size(), [&]
+    {
+      visitor.begin_stream_views(projection_path, callback);
+
+      std::experimental::string_view remaining(json);
+      while (!remaining.empty())
+      {
+        if (!visitor.feed(remaining.substr(0, 4096)))
+        {
+          return false;
+        }
+        remaining.remove_prefix(std::min<size_t>(4096, remaining.size()));
+      }
+      return visitor.finish();
+    });
+  }
+}
+
+BENCHMARK(json_array_visitor)
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+
+  // The same tokens, as a top-level array
+  std::string json("[");
+  for (size_t i = 0; i < 4000; ++i)
+  {
+    json += (i > 0)? "," : "";
+    json += "{\"access_token\":\"ya29." + std::string(120, 'x') + "\",";
+    json += "\"token_type\":\"Bearer\",\"expires_in\":" + std::to_string(3600 + i) + ",";
+    json += "\"scopes\":[\"openid\",\"email\",\"profile\"],";
+    json += "\"id_token\":\"eyJhbGciOiJSUzI1NiJ9." + std::string(600, 'y') + "\"}";
+  }
+  json += "]";
+  printf(" %zu bytes\n", json.size());
+
+  size_t items = 0;
+  auto callback = [&](const OIDC::TokenT&) -> bool
+  {
+    items++;
+    return true;
+  };
+
+  for (size_t workers : {1, 2, 4, 8})
+  {
+    if (workers > std::max(std::thread::hardware_concurrency(), 1u))
+    {
+      break;
+    }
+
+    FlatbuffersStreamingJsonArrayVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(
+      parser, workers
+    );
+
+    auto label = "feed (4 KiB buffers), " + std::to_string(workers) + " workers";
+    measure_throughput(label.c_str(), json.size(), [&]
+    {
+      visitor.begin_stream({}, callback);
+
+      std::experimental::string_view remaining(json);
+      while (!remaining.empty())
+      {
+        if (!visitor.feed(remaining.substr(0, 4096)))
+        {
+          return false;
+        }
+        remaining.remove_prefix(std::min<size_t>(4096, remaining.size()));
+      }
+      return visitor.finish();
+    });
+  }
+}
+
+BENCHMARK(token_decoder)
+{
+  const auto oidc_bfbs = generate_oidc_bfbs();
+  auto schema = reflection::GetSchema(oidc_bfbs.data());
+  auto token_table = schema->objects()->LookupByKey("OIDC.Token");
+
+  const std::string json(
+    "{\"access_token\":\"ya29.abc\",\"token_type\":\"Bearer\","
+    "\"expires_in\":3600,\"scope\":\"openid email\",\"id_token\":\"eyJ.def\"}"
+  );
+  printf(" %zu bytes\n", json.size());
+
+  FlatbuffersTableIndex table_index(schema);
+  FlatbuffersJsonBuilder builder;
+  builder.set_schema(schema, &table_index);
+  JsonPushParser<FlatbuffersJsonBuilder> builder_parser(builder);
+  measure_throughput("FlatbuffersJsonBuilder (reflection)", json.size(), [&]
+  {
+    builder_parser.clear();
+    return (
+      builder.start(token_table) &&
+      builder_parser.feed(json) && builder_parser.finish() &&
+      builder.is_complete()
+    );
+  });
+
+  FlatbuffersTableDecoder decoder;
+  decoder.set_type_table(OIDC::TokenTypeTable());
+  JsonPushParser<FlatbuffersTableDecoder> decoder_parser(decoder);
+  measure_throughput("FlatbuffersTableDecoder", json.size(), [&]
+  {
+    decoder_parser.clear();
+    return (
+      decoder.start() &&
+      decoder_parser.feed(json) && decoder_parser.finish() &&
+      decoder.is_complete()
+    );
+  });
+}
+
+BENCHMARK(flatbuffers_response)
+{
+  const auto oidc_fbs = get_oidc_fbs();
+  const auto oidc_bfbs = generate_oidc_bfbs();
+
+  FlatbuffersStreamingJsonParser parser(oidc_fbs, oidc_bfbs);
+  FlatbuffersStreamingJsonVisitor<OIDC::TokenT, OIDC::ErrorT> visitor(parser);
+
+  // The same token response, as JSON and as application/x-flatbuffers
+  OIDC::TokenT token;
+  token.access_token = "ya29.abc";
+  token.token_type = "Bearer";
+  token.expires_in = 3600;
+  token.id_token = "eyJ." + std::string(800, 'd');
+
+  const std::string json(
+    "{\"access_token\":\"" + token.access_token + "\","
+    "\"token_type\":\"" + token.token_type + "\","
+    "\"expires_in\":3600,\"id_token\":\"" + token.id_token + "\"}"
+  );
+
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(OIDC::Token::Pack(fbb, &token));
+  const std::string flatbuf(
+    reinterpret_cast<const char*>(fbb.GetBufferPointer()), fbb.GetSize()
+  );
+  printf(" JSON %zu bytes, flatbuffer %zu bytes\n", json.size(), flatbuf.size());
+
+  auto callback = [&](const OIDC::Token& t) -> bool
+  {
+    return (t.id_token() != nullptr);
+  };
+
+  measure_throughput("JSON, parse_stream_views", json.size(), [&]
+  {
+    std::istringstream resp(json);
+    return visitor.parse_stream_views(resp, {}, callback);
+  });
+
+  measure_throughput("flatbuffer, parse_flatbuffer_views", json.size(), [&]
+  {
+    std::istringstream resp(flatbuf);
+    return visitor.parse_flatbuffer_views(resp, false, callback);
+  });
+}
+
+BENCHMARK(telemetry_json)
+{
+  const auto telemetry_bfbs = generate_bfbs(telemetry_fbs_text);
+  auto schema = reflection::GetSchema(telemetry_bfbs.data());
+  auto telemetry_table = schema->objects()->LookupByKey("Telemetry");
+
+  auto json = generate_telemetry_json(20000);
+  printf(" %zu bytes\n", json.size());
+
+  NullJsonHandler handler;
+  JsonPushParser<NullJsonHandler> push_parser(handler);
+  measure_throughput("JsonPushParser (null handler)", json.size(), [&]
+  {
+    push_parser.clear();
+    return (push_parser.feed(json) && push_parser.finish());
+  });
+
+  FlatbuffersTableIndex table_index(schema);
+  FlatbuffersJsonBuilder builder;
+  builder.set_schema(schema, &table_index);
+  JsonPushParser<FlatbuffersJsonBuilder> builder_parser(builder);
+  measure_throughput("FlatbuffersJsonBuilder", json.size(), [&]
+  {
+    builder_parser.clear();
+    return (
+      builder.start(telemetry_table) &&
+      builder_parser.feed(json) && builder_parser.finish() &&
+      builder.is_complete()
+    );
+  });
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/json_path_matcher.h"
+
+#include <string>
+#include <vector>
+
+int
+match_path(const JsonPathMatcher& matcher, const std::vector<std::string>& path)
+{
+  auto state = matcher.get_root_state();
+  for (const auto& key : path)
+  {
+    state = matcher.next(state, key);
+  }
+
+  return matcher.get_value(state);
+}
+
+TEST_CASE("Literal and wildcard selectors")
+{
+  JsonPathMatcher matcher;
+  matcher.add_selector({"error"}, 1);
+  matcher.add_selector({"items", "*"}, 2);
+  matcher.add_selector({"*", "id"}, 3);
+  REQUIRE(matcher.compile());
+
+  CHECK(match_path(matcher, {}) == -1);
+  CHECK(match_path(matcher, {"error"}) == 1);
+  CHECK(match_path(matcher, {"items"}) == -1);
+  CHECK(match_path(matcher, {"items", "a"}) == 2);
+  CHECK(match_path(matcher, {"other", "id"}) == 3);
+  CHECK(match_path(matcher, {"items", "a", "b"}) == -1);
+
+  // Both selectors match, the first one added wins
+  CHECK(match_path(matcher, {"items", "id"}) == 2);
+
+  // No selector can match below a dead end
+  auto state = matcher.next(matcher.get_root_state(), "error");
+  state = matcher.next(state, "code");
+  CHECK(state == JsonPathMatcher::no_match);
+  CHECK(matcher.next(state, "id") == JsonPathMatcher::no_match);
+}
+
+TEST_CASE("Empty selector matches the root")
+{
+  JsonPathMatcher matcher;
+  matcher.add_selector({}, 0);
+  matcher.add_selector({"code"}, 1);
+  REQUIRE(matcher.compile());
+
+  CHECK(matcher.get_value(matcher.get_root_state()) == 0);
+  CHECK(match_path(matcher, {"code"}) == 1);
+  CHECK(match_path(matcher, {"message"}) == -1);
+}
+
+TEST_CASE("Interned key ids match the same as key strings")
+{
+  JsonKeyInterner interner;
+  auto other_id = interner.intern("other");
+
+  JsonPathMatcher matcher;
+  matcher.add_selector({"error"}, 1);
+  matcher.add_selector({"items", "*"}, 2);
+  matcher.add_selector({"*", "id"}, 3);
+  REQUIRE(matcher.compile(interner));
+
+  // Selector keys are interned, the wildcard is not
+  CHECK(interner.find("items") != JsonKeyInterner::unknown);
+  CHECK(interner.find("*") == JsonKeyInterner::unknown);
+
+  const std::vector<std::vector<std::string>> paths = {
+    {}, {"error"}, {"items"}, {"items", "a"}, {"other", "id"},
+    {"items", "a", "b"}, {"items", "id"}, {"unknown", "id"},
+  };
+  for (const auto& path : paths)
+  {
+    auto state = matcher.get_root_state();
+    for (const auto& key : path)
+    {
+      state = matcher.next(state, interner.find(key));
+    }
+
+    CHECK(matcher.get_value(state) == match_path(matcher, path));
+  }
+
+  CHECK(matcher.next(matcher.get_root_state(), other_id) ==
+        matcher.next(matcher.get_root_state(), "other"));
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "../src/json_scan.h"
+
+#include <string>
+
+TEST_CASE("Block scanners agree with the bytewise scanner")
+{
+  // Each special byte at every position, in runs longer than a block
+  const std::string specials("\"\\\x01\x1f\t\n\r !\x7f\x80\xff{}[]Y_", 19);
+  for (auto special : specials)
+  {
+    int mismatches = 0;
+
+    for (size_t len = 0; len < 80; ++len)
+    {
+      for (size_t pos = 0; pos <= len; ++pos)
+      {
+        std::string text(len, 'a');
+        std::string ws(len, ' ');
+        if (pos < len)
+        {
+          text[pos] = special;
+          ws[pos] = special;
+        }
+
+        auto text_end = text.data() + text.size();
+        auto ws_end = ws.data() + ws.size();
+
+        auto expected_special =
+          json_scan::scalar::find_string_special(text.data(), text_end);
+        auto expected_ws = json_scan::scalar::skip_whitespace(ws.data(), ws_end);
+        auto expected_structural =
+          json_scan::scalar::find_structural(text.data(), text_end);
+
+        mismatches += (
+          (json_scan::find_string_special(text.data(), text_end) != expected_special) +
+          (json_scan::word::find_string_special(text.data(), text_end) != expected_special) +
+          (json_scan::skip_whitespace(ws.data(), ws_end) != expected_ws) +
+          (json_scan::word::skip_whitespace(ws.data(), ws_end) != expected_ws) +
+          (json_scan::find_structural(text.data(), text_end) != expected_structural) +
+          (json_scan::word::find_structural(text.data(), text_end) != expected_structural)
+        );
+      }
+    }
+
+    CHECK(mismatches == 0);
+  }
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "benchmark_runner.h"
+
+#include "../src/flatbuffers_json_writer.h"
+#include "../src/oidc_generated.h"
+
+#include "flatbuffers/minireflect.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+BENCHMARK(json_writer)
+{
+  // A typical token request/response body
+  OIDC::TokenT token;
+  token.access_token = "ya29." + std::string(120, 'x');
+  token.token_type = "Bearer";
+  token.refresh_token = "1/" + std::string(40, 'r');
+  token.expires_in = 3600;
+  token.id_token = "eyJhbGciOiJSUzI1NiJ9." + std::string(600, 'y');
+
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(OIDC::Token::Pack(fbb, &token));
+  auto buffer = fbb.GetBufferPointer();
+
+  FlatbuffersJsonWriter writer;
+  std::string json;
+  writer.write(json, buffer, OIDC::TokenTypeTable());
+  printf(" Token, %zu bytes\n", json.size());
+
+  measure_throughput("FlatBufferToString", json.size(), [&]
+  {
+    return !flatbuffers::FlatBufferToString(buffer, OIDC::TokenTypeTable()).empty();
+  });
+
+  measure_throughput("FlatbuffersJsonWriter (new string)", json.size(), [&]
+  {
+    std::string out;
+    return writer.write(out, buffer, OIDC::TokenTypeTable());
+  });
+
+  measure_throughput("FlatbuffersJsonWriter (reused buffer)", json.size(), [&]
+  {
+    json.clear();
+    return writer.write(json, buffer, OIDC::TokenTypeTable());
+  });
+
+  measure_throughput("FlatbuffersJsonWriter (object API)", json.size(), [&]
+  {
+    json.clear();
+    return writer.write_object(json, token, OIDC::TokenTypeTable());
+  });
+}
+
+// As flatc --reflect-names would generate for:
+//   table Reading { t:double; lat:double; lon:double;
+//                   alt:float; temp:float; humidity:float; }
+//   table Telemetry { readings:[Reading]; }
+flatbuffers::TypeTable*
+ReadingTypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_DOUBLE, 0, -1 },
+    { flatbuffers::ET_DOUBLE, 0, -1 },
+    { flatbuffers::ET_DOUBLE, 0, -1 },
+    { flatbuffers::ET_FLOAT, 0, -1 },
+    { flatbuffers::ET_FLOAT, 0, -1 },
+    { flatbuffers::ET_FLOAT, 0, -1 },
+  };
+  static const char* names[] = { "t", "lat", "lon", "alt", "temp", "humidity" };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_TABLE, 6, type_codes, nullptr, nullptr, names
+  };
+  return &tt;
+}
+
+flatbuffers::TypeTable*
+TelemetryTypeTable()
+{
+  static flatbuffers::TypeCode type_codes[] = {
+    { flatbuffers::ET_SEQUENCE, 1, 0 },
+  };
+  static flatbuffers::TypeFunction type_refs[] = { ReadingTypeTable };
+  static const char* names[] = { "readings" };
+  static flatbuffers::TypeTable tt = {
+    flatbuffers::ST_TABLE, 1, type_codes, type_refs, nullptr, names
+  };
+  return &tt;
+}
+
+BENCHMARK(telemetry_writer)
+{
+  // Float-heavy sensor readings, with typical decimal precision
+  flatbuffers::FlatBufferBuilder fbb;
+  std::vector<double> values;
+  std::vector<flatbuffers::Offset<void>> readings;
+  for (int i = 0; i < 20000; ++i)
+  {
+    double t = 1508371200.0 + (i * 0.125);
+    double lat = 49.2827 + (i % 1000) * 1.3e-6;
+    double lon = -123.1207 - (i % 777) * 2.9e-6;
+    float alt = 70.0f + (i % 50) * 0.1f;
+    float temp = 18.0f + (i % 400) * 0.01f;
+    float humidity = 40.0f + (i % 300) * 0.1f;
+    values.insert(values.end(), {t, lat, lon, alt, temp, humidity});
+
+    auto start = fbb.StartTable();
+    fbb.AddElement<double>(flatbuffers::FieldIndexToOffset(0), t, 0);
+    fbb.AddElement<double>(flatbuffers::FieldIndexToOffset(1), lat, 0);
+    fbb.AddElement<double>(flatbuffers::FieldIndexToOffset(2), lon, 0);
+    fbb.AddElement<float>(flatbuffers::FieldIndexToOffset(3), alt, 0);
+    fbb.AddElement<float>(flatbuffers::FieldIndexToOffset(4), temp, 0);
+    fbb.AddElement<float>(flatbuffers::FieldIndexToOffset(5), humidity, 0);
+    readings.push_back(fbb.EndTable(start));
+  }
+  auto readings_vec = fbb.CreateVector(readings);
+  auto start = fbb.StartTable();
+  fbb.AddOffset(flatbuffers::FieldIndexToOffset(0), readings_vec);
+  fbb.Finish(flatbuffers::Offset<void>(fbb.EndTable(start)));
+  auto buffer = fbb.GetBufferPointer();
+
+  FlatbuffersJsonWriter writer;
+  std::string json;
+  writer.write(json, buffer, TelemetryTypeTable());
+  printf(" Telemetry, %zu bytes\n", json.size());
+
+  measure_throughput("FlatBufferToString", json.size(), [&]
+  {
+    return !flatbuffers::FlatBufferToString(buffer, TelemetryTypeTable()).empty();
+  });
+
+  // All 17 digits, for comparison (not the shortest form)
+  std::string digits;
+  measure_throughput("snprintf %.17g (numbers only)", json.size(), [&]
+  {
+    char number[32];
+    digits.clear();
+    for (auto val : values)
+    {
+      digits.append(number, snprintf(number, sizeof(number), "%.17g", val));
+    }
+    return !digits.empty();
+  });
+
+  measure_throughput("FlatbuffersJsonWriter (reused buffer)", json.size(), [&]
+  {
+    json.clear();
+    return writer.write(json, buffer, TelemetryTypeTable());
+  });
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "tls_test_server.h"
+
+#include "../src/openssl_tls_connection.h"
+
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+#include <chrono>
+#include <future>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace {
+
+// This process's socket bound to a local port, i.e. a client's socket
+int
+find_local_socket(unsigned short port)
+{
+  for (int fd = 0; fd < 1024; fd++)
+  {
+    struct sockaddr_in addr = {};
+    socklen_t addr_len = sizeof(addr);
+    if ((getsockname(fd, (struct sockaddr*)&addr, &addr_len) == 0) &&
+        (addr.sin_family == AF_INET) &&
+        (ntohs(addr.sin_port) == port))
+    {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+// Sends pong for each ping
+void
+ping_pong(SSL* ssl)
+{
+  while (tls_test_read(ssl, 4) == "ping")
+  {
+    SSL_write(ssl, "pong", 4);
+  }
+}
+
+bool
+ping(OpenSSLTLSConnection& conn)
+{
+  char buf[4];
+  return (
+    (conn.write("ping") == 4) &&
+    (conn.read(std::experimental::string_view(buf, sizeof(buf))) == 4) &&
+    (std::string(buf, 4) == "pong")
+  );
+}
+
+} // namespace
+
+TEST_CASE("OpenSSLTLSConnection requires a verified certificate for the host")
+{
+  TlsTestServer server;
+  REQUIRE(server.ready());
+
+  SUBCASE("Matching host name")
+  {
+    server.serve(ping_pong);
+
+    OpenSSLTLSConnection conn("localhost", server.port(), server.cacert_pem());
+    CHECK(conn.connect("localhost", server.port()));
+    CHECK(conn.connected());
+    CHECK(ping(conn));
+  }
+
+  SUBCASE("Certificate for another host name")
+  {
+    server.serve(ping_pong);
+
+    // The certificate is only valid for "localhost"
+    OpenSSLTLSConnection conn("127.0.0.1", server.port(), server.cacert_pem());
+    CHECK_FALSE(conn.connect("127.0.0.1", server.port()));
+    CHECK_FALSE(conn.connected());
+    CHECK_FALSE(conn.has_valid_session());
+
+    server.join();
+    CHECK(server.handshakes == 0);
+    CHECK(server.failed_handshakes == 1);
+  }
+
+  SUBCASE("Certificate from an unknown CA")
+  {
+    server.serve(ping_pong);
+
+    TlsTestServer other_server;
+    OpenSSLTLSConnection conn("localhost", server.port(), other_server.cacert_pem());
+    CHECK_FALSE(conn.connect("localhost", server.port()));
+    CHECK_FALSE(conn.connected());
+
+    server.join();
+    CHECK(server.failed_handshakes == 1);
+  }
+}
+
+TEST_CASE("OpenSSLTLSConnection resumes the stored session on reconnect()")
+{
+  for (bool tls12 : {false, true})
+  {
+    CAPTURE(tls12);
+
+    TlsTestServer server(tls12);
+    REQUIRE(server.ready());
+    server.serve(ping_pong, 2);
+
+    OpenSSLTLSConnection conn("localhost", server.port(), server.cacert_pem());
+    REQUIRE(conn.connect("localhost", server.port()));
+    CHECK(ping(conn));
+
+    // TLS 1.3 tickets arrive after the handshake, they are kept on disconnect
+    CHECK(conn.disconnect());
+    CHECK(conn.has_valid_session());
+
+    CHECK(conn.reconnect());
+    CHECK(conn.connected());
+    CHECK(ping(conn));
+    CHECK(conn.disconnect());
+
+    server.join();
+    CHECK(server.handshakes == 2);
+    CHECK(server.sessions_reused == 1);
+  }
+}
+
+TEST_CASE("OpenSSLTLSConnection reports read errors with the mbedtls codes")
+{
+  TlsTestServer server;
+  REQUIRE(server.ready());
+
+  char buf[16];
+  std::experimental::string_view read_buf(buf, sizeof(buf));
+
+  SUBCASE("close_notify")
+  {
+    server.serve([](SSL* ssl)
+    {
+      SSL_write(ssl, "bye", 3);
+    });
+
+    OpenSSLTLSConnection conn("localhost", server.port(), server.cacert_pem());
+    REQUIRE(conn.connect("localhost", server.port()));
+
+    CHECK(conn.read(read_buf) == 3);
+    CHECK(std::string(buf, 3) == "bye");
+    CHECK(conn.read(read_buf) == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY);
+  }
+
+  SUBCASE("Connection reset by the peer")
+  {
+    server.serve([](SSL* ssl)
+    {
+      // No close_notify, and close() sends a RST instead of a FIN
+      struct linger abort_on_close = { 1, 0 };
+      setsockopt(SSL_get_fd(ssl), SOL_SOCKET, SO_LINGER, &abort_on_close, sizeof(abort_on_close));
+      SSL_set_quiet_shutdown(ssl, 1);
+    });
+
+    OpenSSLTLSConnection conn("localhost", server.port(), server.cacert_pem());
+    REQUIRE(conn.connect("localhost", server.port()));
+    server.join();
+
+    CHECK(conn.read(read_buf) == MBEDTLS_ERR_NET_CONN_RESET);
+  }
+
+  SUBCASE("No data yet, on a socket with a receive timeout")
+  {
+    std::promise<void> timed_out;
+    auto timed_out_future = timed_out.get_future();
+    server.serve([&](SSL* ssl)
+    {
+      // Bounded, in case the client fails before signalling
+      timed_out_future.wait_for(std::chrono::seconds(5));
+      SSL_write(ssl, "late", 4);
+    });
+
+    OpenSSLTLSConnection conn("localhost", server.port(), server.cacert_pem());
+    auto connected = conn.connect("localhost", server.port());
+
+    auto fd = find_local_socket(server.last_peer_port);
+    struct timeval timeout = { 0, 50 * 1000 };
+    auto has_timeout = (
+      (fd >= 0) &&
+      (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0)
+    );
+
+    auto ret = conn.read(read_buf);
+    timed_out.set_value();
+
+    REQUIRE(connected);
+    REQUIRE(has_timeout);
+    CHECK(ret == MBEDTLS_ERR_SSL_WANT_READ);
+
+    // Retrying is all that is needed
+    do
+    {
+      ret = conn.read(read_buf);
+    }
+    while (ret == MBEDTLS_ERR_SSL_WANT_READ);
+
+    CHECK(ret == 4);
+    CHECK(std::string(buf, 4) == "late");
+  }
+}
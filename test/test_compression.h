@@ -0,0 +1,33 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <zlib.h>
+
+#include <string>
+
+// gzip (MAX_WBITS + 16) or zlib (MAX_WBITS) compressed copy of in
+inline std::string
+compress_with_window_bits(const std::string& in, int window_bits)
+{
+  z_stream zs = {};
+  deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+
+  std::string out(deflateBound(&zs, in.size()), '\0');
+  zs.next_in = (Bytef*)in.data();
+  zs.avail_in = in.size();
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  return out;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include "flatbuffers/idl.h"
+
+#include <string>
+
+// Same as src/oidc.fbs
+constexpr char oidc_fbs_text[] =
+  "namespace OIDC;"
+  "table Token { access_token:string; token_type:string; grant_type:string;"
+  "  refresh_token:string; expires_in:int; id_token:string; }"
+  "table Error { code:int; message:string; status:string; }"
+  "root_type Token;";
+
+// Schema buffers for FlatbuffersStreamingJsonParser, which must both
+// include the null terminator
+
+inline std::string
+get_oidc_fbs()
+{
+  return std::string(oidc_fbs_text, sizeof(oidc_fbs_text));
+}
+
+// Binary schema for a text schema, empty if it is invalid
+inline std::string
+generate_bfbs(const char* fbs_text)
+{
+  flatbuffers::Parser parser;
+  if (!parser.Parse(fbs_text))
+  {
+    return {};
+  }
+  parser.Serialize();
+
+  std::string bfbs(
+    reinterpret_cast<const char*>(parser.builder_.GetBufferPointer()),
+    parser.builder_.GetSize()
+  );
+  bfbs.push_back('\0');
+
+  return bfbs;
+}
+
+inline std::string
+generate_oidc_bfbs()
+{
+  return generate_bfbs(oidc_fbs_text);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "benchmark_runner.h"
+
+#include "tls_test_server.h"
+
+#include "../src/openssl_tls_connection.h"
+#include "../src/tls_connection.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t transfer_len = 1 << 20;
+
+// Bulk reads and writes through one connection of TLSConnectionImpl
+template<typename TLSConnectionImpl>
+void
+benchmark_tls_connection(const char* name, TlsTestServer& server)
+{
+  const std::string chunk(16384, 'x');
+  std::vector<char> buf(chunk.size());
+
+  // The server writes until the client disconnects
+  server.serve([&](SSL* ssl)
+  {
+    while (SSL_write(ssl, chunk.data(), chunk.size()) > 0)
+    {
+    }
+  });
+
+  {
+    TLSConnectionImpl conn("localhost", server.port(), server.cacert_pem());
+    if (!conn.connect("localhost", server.port()))
+    {
+      printf("  %s: unable to connect\n", name);
+      return;
+    }
+
+    auto label = std::string(name) + " read";
+    measure_throughput(label.c_str(), transfer_len, [&]
+    {
+      size_t received = 0;
+      while (received < transfer_len)
+      {
+        auto ret = conn.read(std::experimental::string_view(buf.data(), buf.size()));
+        if (ret <= 0)
+        {
+          return false;
+        }
+        received += ret;
+      }
+      return true;
+    });
+
+    conn.disconnect();
+  }
+  server.join();
+
+  // The server reads until the client disconnects
+  server.serve([](SSL* ssl)
+  {
+    tls_test_read_all(ssl);
+  });
+
+  {
+    TLSConnectionImpl conn("localhost", server.port(), server.cacert_pem());
+    if (!conn.connect("localhost", server.port()))
+    {
+      printf("  %s: unable to connect\n", name);
+      return;
+    }
+
+    auto label = std::string(name) + " write";
+    measure_throughput(label.c_str(), transfer_len, [&]
+    {
+      size_t sent = 0;
+      while (sent < transfer_len)
+      {
+        auto ret = conn.write(chunk);
+        if (ret <= 0)
+        {
+          return false;
+        }
+        sent += ret;
+      }
+      return true;
+    });
+
+    conn.disconnect();
+  }
+  server.join();
+}
+
+} // namespace
+
+// Both backends against the same loopback OpenSSL server, with the same
+// suite (TLS 1.2 ECDHE-ECDSA-AES128-GCM-SHA256), so only the client differs
+BENCHMARK(tls_connection)
+{
+  TlsTestServer server(true);
+  if (!server.ready())
+  {
+    printf("  Unable to start the TLS server\n");
+    return;
+  }
+
+  printf(" %zu KiB transfers\n", transfer_len / 1024);
+  benchmark_tls_connection<TLSConnection>("mbedtls", server);
+  benchmark_tls_connection<OpenSSLTLSConnection>("OpenSSL", server);
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#include "test_runner.h"
+#include "doctest.h"
+
+#include "tls_test_server.h"
+
+#include "../src/tls_connection.h"
+
+#if defined(HTTPS_ENDPOINT_KTLS_KEY_EXPORT)
+
+#include "mbedtls/ssl.h"
+
+#include <cstdio>
+#include <string>
+
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Whether TCP sockets accept the "tls" upper layer protocol (CONFIG_TLS)
+bool
+ktls_available()
+{
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+
+  // The ULP can only be attached to a connected socket
+  bool available = (
+    (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) &&
+    (listen(listen_fd, 1) == 0) &&
+    (getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == 0) &&
+    (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) &&
+    (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0)
+  );
+
+  close(fd);
+  close(listen_fd);
+  return available;
+}
+
+// File with some known contents, larger than the sendfile fallback chunks
+struct TestFile
+{
+  TestFile()
+  {
+    for (size_t i=0; i<5000; i++)
+    {
+      contents.push_back('a' + (i % 26));
+    }
+
+    file = tmpfile();
+    REQUIRE(file != nullptr);
+    REQUIRE(fwrite(contents.data(), 1, contents.size(), file) == contents.size());
+    fflush(file);
+  }
+
+  ~TestFile()
+  {
+    fclose(file);
+  }
+
+  int fd() const
+  {
+    return fileno(file);
+  }
+
+  std::string contents;
+  FILE* file = nullptr;
+};
+
+} // namespace
+
+TEST_CASE("sendfile without kTLS is encrypted by mbedtls")
+{
+  TlsTestServer server;
+  REQUIRE(server.ready());
+
+  std::string received;
+  server.serve([&](SSL* ssl)
+  {
+    received = tls_test_read_all(ssl);
+  });
+
+  TestFile file;
+
+  TLSConnection conn("localhost", server.port(), server.cacert_pem());
+  REQUIRE(conn.connect("localhost", server.port()));
+  CHECK_FALSE(conn.ktls_enabled());
+
+  SUBCASE("From an offset, which is advanced")
+  {
+    off_t offset = 10;
+    auto count = file.contents.size() - 10;
+    CHECK(conn.sendfile(file.fd(), &offset, count) == (ssize_t)count);
+    CHECK(offset == (off_t)file.contents.size());
+
+    conn.disconnect();
+    server.join();
+    CHECK(received == file.contents.substr(10));
+  }
+
+  SUBCASE("From the current file position")
+  {
+    REQUIRE(lseek(file.fd(), 0, SEEK_SET) == 0);
+    auto count = file.contents.size();
+    CHECK(conn.sendfile(file.fd(), nullptr, count) == (ssize_t)count);
+
+    conn.disconnect();
+    server.join();
+    CHECK(received == file.contents);
+  }
+}
+
+TEST_CASE("kTLS takes over record encryption after the handshake")
+{
+  if (!ktls_available())
+  {
+    // e.g. a kernel without CONFIG_TLS, or the tls module not loaded
+    WARN_MESSAGE(false, "The tls kernel module is unavailable, skipping");
+    return;
+  }
+
+  // The kernel supports the TLS 1.2 AES-GCM suites used by mbedtls
+  TlsTestServer server(true);
+  REQUIRE(server.ready());
+
+  TLSConnection conn("localhost", server.port(), server.cacert_pem());
+  REQUIRE(conn.set_ktls(true));
+
+  char buf[64];
+  std::experimental::string_view read_buf(buf, sizeof(buf));
+
+  SUBCASE("Application data is sent and received by the kernel")
+  {
+    std::string request;
+    server.serve([&](SSL* ssl)
+    {
+      request = tls_test_read(ssl, 4);
+      SSL_write(ssl, "pong", 4);
+    });
+
+    REQUIRE(conn.connect("localhost", server.port()));
+    CHECK(conn.ktls_enabled());
+
+    CHECK(conn.write("ping") == 4);
+    CHECK(conn.read(read_buf) == 4);
+    CHECK(std::string(buf, 4) == "pong");
+
+    server.join();
+    CHECK(request == "ping");
+  }
+
+  SUBCASE("A close_notify alert record ends the stream")
+  {
+    server.serve([&](SSL* ssl)
+    {
+      SSL_write(ssl, "bye", 3);
+    });
+
+    REQUIRE(conn.connect("localhost", server.port()));
+    CHECK(conn.ktls_enabled());
+
+    CHECK(conn.read(read_buf) == 3);
+    CHECK(std::string(buf, 3) == "bye");
+    CHECK(conn.read(read_buf) == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY);
+  }
+
+  SUBCASE("Other records than application data are rejected")
+  {
+    server.serve([&](SSL* ssl)
+    {
+      // Sends a HelloRequest, i.e. a handshake record
+      SSL_renegotiate(ssl);
+      SSL_do_handshake(ssl);
+    });
+
+    REQUIRE(conn.connect("localhost", server.port()));
+    CHECK(conn.ktls_enabled());
+
+    CHECK(conn.read(read_buf) == MBEDTLS_ERR_SSL_UNEXPECTED_MESSAGE);
+  }
+
+  SUBCASE("sendfile is encrypted by the kernel")
+  {
+    std::string received;
+    server.serve([&](SSL* ssl)
+    {
+      received = tls_test_read_all(ssl);
+    });
+
+    TestFile file;
+
+    REQUIRE(conn.connect("localhost", server.port()));
+    CHECK(conn.ktls_enabled());
+
+    off_t offset = 0;
+    auto count = file.contents.size();
+    CHECK(conn.sendfile(file.fd(), &offset, count) == (ssize_t)count);
+    CHECK(offset == (off_t)count);
+
+    // close_notify is sent by the kernel too
+    conn.disconnect();
+    server.join();
+    CHECK(received == file.contents);
+  }
+}
+
+#elif defined(HTTPS_ENDPOINT_USE_KTLS)
+
+TEST_CASE("kTLS is refused without the mbedtls 2.x key export")
+{
+  TLSConnection conn;
+  CHECK_FALSE(conn.set_ktls(true));
+  CHECK_FALSE(conn.ktls_enabled());
+}
+
+#endif // HTTPS_ENDPOINT_KTLS_KEY_EXPORT
@@ -0,0 +1,294 @@
+/*
+ * Copyright Paul Reimer, 2017
+ *
+ * This work is licensed under the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 Unported License.
+ * To view a copy of this license, visit
+ * https://creativecommons.org/licenses/by-nc-sa/4.0/
+ * or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California, 94041, USA.
+ */
+#pragma once
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <experimental/string_view>
+
+// OpenSSL TLS server on a loopback port, run on its own thread, for
+// testing the TLSConnection implementations against.
+// The certificate is self-signed, for "localhost", and generated on start.
+class TlsTestServer
+{
+public:
+  // Called with each accepted connection, after the handshake
+  // The connection is shut down (with close_notify) when it returns
+  typedef std::function<void(SSL*)> Handler;
+
+  // tls12: only TLS 1.2 with ECDHE-ECDSA-AES128-GCM-SHA256, as kTLS needs
+  explicit TlsTestServer(bool tls12=false)
+  {
+    // Clients may disconnect while the server is still writing
+    signal(SIGPIPE, SIG_IGN);
+
+    ctx = SSL_CTX_new(TLS_server_method());
+    pkey = generate_key();
+    cert = generate_cert(pkey);
+    if (!ctx || !pkey || !cert)
+    {
+      return;
+    }
+
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, pkey);
+
+    // Allow TLS 1.2 session ids to be resumed
+    static const unsigned char session_id_context[] = "TlsTestServer";
+    SSL_CTX_set_session_id_context(
+      ctx, session_id_context, sizeof(session_id_context) - 1
+    );
+
+    if (tls12)
+    {
+      SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+      SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+      SSL_CTX_set_cipher_list(ctx, "ECDHE-ECDSA-AES128-GCM-SHA256");
+    }
+
+    BIO* bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(bio, cert);
+    char* pem = nullptr;
+    auto pem_len = BIO_get_mem_data(bio, &pem);
+    cert_pem.assign(pem, pem_len);
+    BIO_free(bio);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    if ((listen_fd >= 0) &&
+        (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) &&
+        (listen(listen_fd, 8) == 0) &&
+        (getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) == 0))
+    {
+      listen_port = ntohs(addr.sin_port);
+    }
+  }
+
+  ~TlsTestServer()
+  {
+    // Wakes up accept(), if the client never connected
+    if (listen_fd >= 0)
+    {
+      shutdown(listen_fd, SHUT_RDWR);
+    }
+    join();
+
+    if (listen_fd >= 0)
+    {
+      close(listen_fd);
+    }
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    SSL_CTX_free(ctx);
+  }
+
+  bool ready() const
+  {
+    return (listen_port != 0);
+  }
+
+  unsigned short port() const
+  {
+    return listen_port;
+  }
+
+  // PEM including the null terminator, as mbedtls_x509_crt_parse expects
+  std::experimental::string_view cacert_pem() const
+  {
+    return std::experimental::string_view(cert_pem.c_str(), cert_pem.size() + 1);
+  }
+
+  // Accepts this many connections, with failed handshakes counted too
+  void serve(Handler handler, size_t connections=1)
+  {
+    join();
+
+    thread = std::thread([this, handler, connections]
+    {
+      for (size_t i = 0; i < connections; i++)
+      {
+        struct sockaddr_in peer = {};
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept(listen_fd, (struct sockaddr*)&peer, &peer_len);
+        if (fd < 0)
+        {
+          return;
+        }
+        last_peer_port = ntohs(peer.sin_port);
+
+        SSL* ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        if (SSL_accept(ssl) == 1)
+        {
+          handshakes++;
+          if (SSL_session_reused(ssl))
+          {
+            sessions_reused++;
+          }
+
+          handler(ssl);
+          SSL_shutdown(ssl);
+        }
+        else {
+          failed_handshakes++;
+          ERR_clear_error();
+        }
+
+        SSL_free(ssl);
+        close(fd);
+      }
+    });
+  }
+
+  // Waits for all connections passed to serve()
+  void join()
+  {
+    if (thread.joinable())
+    {
+      thread.join();
+    }
+  }
+
+  std::atomic<size_t> handshakes{0};
+  std::atomic<size_t> failed_handshakes{0};
+  std::atomic<size_t> sessions_reused{0};
+
+  // Client side port of the most recently accepted connection
+  std::atomic<unsigned short> last_peer_port{0};
+
+private:
+  static EVP_PKEY* generate_key()
+  {
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    if (key_ctx &&
+        (EVP_PKEY_keygen_init(key_ctx) == 1) &&
+        (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx, NID_X9_62_prime256v1) == 1))
+    {
+      EVP_PKEY_keygen(key_ctx, &key);
+    }
+    EVP_PKEY_CTX_free(key_ctx);
+    return key;
+  }
+
+  static X509* generate_cert(EVP_PKEY* key)
+  {
+    if (key == nullptr)
+    {
+      return nullptr;
+    }
+
+    X509* x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 3600);
+    X509_set_pubkey(x509, key);
+
+    X509_NAME* name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(
+      name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0
+    );
+    X509_set_issuer_name(x509, name);
+
+    X509V3_CTX ext_ctx;
+    X509V3_set_ctx_nodb(&ext_ctx);
+    X509V3_set_ctx(&ext_ctx, x509, x509, nullptr, nullptr, 0);
+
+    // Self-signed, so it is also the CA certificate
+    const struct {
+      int nid;
+      const char* value;
+    } extensions[] = {
+      { NID_basic_constraints, "critical,CA:TRUE" },
+      { NID_subject_alt_name, "DNS:localhost" },
+    };
+    for (const auto& extension : extensions)
+    {
+      X509_EXTENSION* ext = X509V3_EXT_conf_nid(
+        nullptr, &ext_ctx, extension.nid, const_cast<char*>(extension.value)
+      );
+      X509_add_ext(x509, ext, -1);
+      X509_EXTENSION_free(ext);
+    }
+
+    if (X509_sign(x509, key, EVP_sha256()) == 0)
+    {
+      X509_free(x509);
+      return nullptr;
+    }
+
+    return x509;
+  }
+
+  SSL_CTX* ctx = nullptr;
+  EVP_PKEY* pkey = nullptr;
+  X509* cert = nullptr;
+  std::string cert_pem;
+
+  int listen_fd = -1;
+  unsigned short listen_port = 0;
+
+  std::thread thread;
+};
+
+// Reads from ssl until close_notify or the end of the connection
+inline std::string
+tls_test_read_all(SSL* ssl)
+{
+  std::string received;
+  char buf[4096];
+  int ret;
+  while ((ret = SSL_read(ssl, buf, sizeof(buf))) > 0)
+  {
+    received.append(buf, ret);
+  }
+  return received;
+}
+
+// Reads exactly len bytes from ssl, or until the connection ends
+inline std::string
+tls_test_read(SSL* ssl, size_t len)
+{
+  std::string received(len, '\0');
+  size_t offset = 0;
+  while (offset < len)
+  {
+    auto ret = SSL_read(ssl, &received[offset], len - offset);
+    if (ret <= 0)
+    {
+      break;
+    }
+    offset += ret;
+  }
+  received.resize(offset);
+  return received;
+}